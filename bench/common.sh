@@ -0,0 +1,72 @@
+#
+# Routines shared by the benchmark scripts: a temporary instance and pgbench
+# log processing. The sourcing script sets BENCH_DIR and defines
+# bench_config() printing settings of a named configuration.
+#
+# Environment variables:
+#   PG_CONFIG  - pg_config of the PostgreSQL the extension is installed into
+#   BENCH_PORT - port of the temporary instance (54329)
+#   BENCH_TMP  - directory for the instance and logs (bench/tmp)
+#
+
+PG_CONFIG=${PG_CONFIG:-pg_config}
+BINDIR=$($PG_CONFIG --bindir)
+TMP=${BENCH_TMP:-$BENCH_DIR/tmp}
+PORT=${BENCH_PORT:-54329}
+
+DATA=$TMP/data
+DB=bench
+
+export PGPORT=$PORT
+export PGHOST=$TMP
+
+psql() {
+	"$BINDIR/psql" -X -q -v ON_ERROR_STOP=1 -d $DB "$@"
+}
+
+# Create a new instance and the database with the extension
+init_instance() {
+	rm -rf "$TMP"
+	mkdir -p "$TMP"
+
+	"$BINDIR/initdb" -D "$DATA" -A trust > "$TMP/initdb.log"
+	cat >> "$DATA/postgresql.conf" <<EOC
+port = $PORT
+listen_addresses = ''
+unix_socket_directories = '$TMP'
+include_if_exists = 'bench.conf'
+EOC
+
+	echo "shared_preload_libraries = 'pg_index_stats'" > "$DATA/bench.conf"
+	"$BINDIR/pg_ctl" -D "$DATA" -l "$TMP/postmaster.log" -w start > /dev/null
+	"$BINDIR/createdb" $DB
+	psql -c "CREATE EXTENSION pg_index_stats" "$@"
+	stop_instance
+}
+
+start_instance() {
+	bench_config $1 > "$DATA/bench.conf"
+	"$BINDIR/pg_ctl" -D "$DATA" -l "$TMP/postmaster.log" -w start > /dev/null
+}
+
+stop_instance() {
+	"$BINDIR/pg_ctl" -D "$DATA" -w stop -m fast > /dev/null
+}
+
+# Run pgbench, print TPS
+run_pgbench() {
+	"$BINDIR/pgbench" -n -l --log-prefix="$TMP/pgbench_log" "$@" $DB 2>/dev/null |
+		awk '/^tps/ { printf "%.0f", $3; exit }'
+}
+
+# Percentiles of transaction latency (ms) from pgbench logs
+latency_percentiles() {
+	cat "$TMP"/pgbench_log* | awk '{print $3 / 1000.}' | sort -n | awk '
+		{ v[NR] = $1 }
+		END {
+			if (NR == 0) { print "- -"; exit }
+			printf "%.3f %.3f", v[int(NR * 0.5) + (NR * 0.5 > int(NR * 0.5))],
+								v[int(NR * 0.99) + (NR * 0.99 > int(NR * 0.99))]
+		}'
+	rm -f "$TMP"/pgbench_log*
+}
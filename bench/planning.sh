@@ -0,0 +1,124 @@
+#!/bin/bash
+#
+# Planning overhead of pg_index_stats.
+#
+# Start a temporary instance, build synthetic schemas with a growing number of
+# indexed tables and indexes (hence, auto-generated statistics) per table and
+# drive a query mix in four configurations:
+#   off    - the library isn't loaded, generated statistics are still there;
+#   loaded - the library is loaded, QDS is off;
+#   qds    - the library is loaded, QDS is on;
+#   prune  - the library is loaded, QDS is off, useless statistics are pruned.
+# For each of them, report planning time percentiles of unprepared and
+# prepared (custom plan) queries, measured by EXPLAIN SUMMARY, and TPS with
+# latency percentiles of pgbench runs in the simple and prepared modes.
+#
+# The extension must be installed into the PostgreSQL pointed by PG_CONFIG.
+# Settings may be changed by the environment variables (see also common.sh):
+#   BENCH_TABLES     - numbers of tables ("10 100 500")
+#   BENCH_INDEXES    - numbers of indexes per table ("1 4 8")
+#   BENCH_ROWS       - rows per table (10000)
+#   BENCH_ITERATIONS - planned queries per percentile measurement (2000)
+#   BENCH_DURATION   - duration of a pgbench run, seconds (10)
+#   BENCH_CLIENTS    - pgbench clients (4)
+#
+
+set -e
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+. "$BENCH_DIR/common.sh"
+
+TABLES=${BENCH_TABLES:-"10 100 500"}
+INDEXES=${BENCH_INDEXES:-"1 4 8"}
+ROWS=${BENCH_ROWS:-10000}
+ITERATIONS=${BENCH_ITERATIONS:-2000}
+DURATION=${BENCH_DURATION:-10}
+CLIENTS=${BENCH_CLIENTS:-4}
+
+RESULTS=$TMP/planning.out
+
+bench_config() {
+	case $1 in
+		off)
+			echo "shared_preload_libraries = ''" ;;
+		loaded)
+			echo "shared_preload_libraries = 'pg_index_stats'"
+			echo "pg_index_stats.qds = off" ;;
+		qds)
+			echo "shared_preload_libraries = 'pg_index_stats'"
+			echo "pg_index_stats.qds = on" ;;
+		prune)
+			echo "shared_preload_libraries = 'pg_index_stats'"
+			echo "pg_index_stats.qds = off"
+			echo "pg_index_stats.prune_statistics = on" ;;
+	esac
+}
+
+# Generate a pgbench script over all the tables: table names can't be
+# parameters of a prepared statement, so choose a branch by a random number.
+make_mix() {
+	local ntables=$1
+	local file=$TMP/mix_$ntables.sql
+	local t
+
+	{
+		echo "\\set t random(1, $ntables)"
+		echo "\\set a random(0, 9)"
+		echo "\\set b random(0, 19)"
+		for t in $(seq 1 $ntables); do
+			if [ $t -eq 1 ]; then
+				echo "\\if :t = $t"
+			else
+				echo "\\elif :t = $t"
+			fi
+			echo "SELECT count(*) FROM bench.t$t WHERE c1 = :a AND c2 = :b;"
+			echo "SELECT count(*) FROM bench.t$t a JOIN bench.t$(( t % ntables + 1 )) b ON a.c1 = b.c1 AND a.c2 = b.c2 WHERE a.c3 < :b;"
+		done
+		echo "\\endif"
+	} > "$file"
+	echo "$file"
+}
+
+run_config() {
+	local ntables=$1 nindexes=$2 nstats=$3 config=$4 mix=$5
+	local mode prepared planning tps latency
+
+	start_instance $config
+
+	for mode in simple prepared; do
+		prepared=$([ $mode = prepared ] && echo true || echo false)
+		planning=$(psql -At -F ' ' -c "SELECT round(p50::numeric, 3), round(p90::numeric, 3), round(p99::numeric, 3), round(mean::numeric, 3) FROM bench_planning($ntables, $nindexes, $ITERATIONS, $prepared)")
+
+		tps=$(run_pgbench -T $DURATION -c $CLIENTS -j $CLIENTS -M $mode -f "$mix")
+		latency=$(latency_percentiles)
+
+		printf "%7s %7s %6s %-7s %-9s %9s %9s %9s %9s %8s %9s %9s\n" \
+			$ntables $nindexes $nstats $config $mode $planning $tps $latency |
+			tee -a "$RESULTS"
+	done
+
+	stop_instance
+}
+
+init_instance -f "$BENCH_DIR/planning.sql"
+
+printf "%7s %7s %6s %-7s %-9s %9s %9s %9s %9s %8s %9s %9s\n" \
+	tables indexes stats config mode plan_p50 plan_p90 plan_p99 plan_avg \
+	tps lat_p50 lat_p99 | tee "$RESULTS"
+
+for ntables in $TABLES; do
+	mix=$(make_mix $ntables)
+
+	for nindexes in $INDEXES; do
+		# Statistics are generated on index creation, so the library is needed
+		start_instance loaded
+		nstats=$(psql -At -c "SELECT bench_build($ntables, $nindexes, $ROWS)")
+		stop_instance
+
+		for config in off loaded qds prune; do
+			run_config $ntables $nindexes $nstats $config "$mix"
+		done
+	done
+done
+
+echo "Planning time and latency are in milliseconds. Results: $RESULTS"
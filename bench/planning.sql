@@ -0,0 +1,121 @@
+--
+-- Synthetic schema and planning time measurement for the planning benchmark.
+-- See planning.sh.
+--
+
+--
+-- Tables bench.t1 .. bench.t<ntables>, each with nindexes multi-column
+-- indexes. Columns are correlated, so extended statistics make sense.
+--
+CREATE OR REPLACE FUNCTION bench_build(ntables integer, nindexes integer,
+									   nrows integer)
+RETURNS integer AS $$
+DECLARE
+	ncols	integer := nindexes + 2;
+	cols	text;
+	vals	text;
+	t		integer;
+	j		integer;
+BEGIN
+	DROP SCHEMA IF EXISTS bench CASCADE;
+	CREATE SCHEMA bench;
+
+	SELECT string_agg(format('c%s integer', k), ', '),
+		   string_agg(format('g %% %s', k * 10), ', ')
+	INTO cols, vals FROM generate_series(1, ncols) AS k;
+
+	FOR t IN 1..ntables LOOP
+		EXECUTE format('CREATE TABLE bench.t%s (id integer, %s)', t, cols);
+		EXECUTE format('INSERT INTO bench.t%s SELECT g, %s
+						FROM generate_series(1, %s) AS g', t, vals, nrows);
+
+		-- Pairs and triples of neighbouring columns
+		FOR j IN 1..nindexes LOOP
+			IF j % 2 = 0 THEN
+				EXECUTE format('CREATE INDEX ON bench.t%s (c%s, c%s, c%s)',
+							   t, j, j + 1, j + 2);
+			ELSE
+				EXECUTE format('CREATE INDEX ON bench.t%s (c%s, c%s)',
+							   t, j, j + 1);
+			END IF;
+		END LOOP;
+		EXECUTE format('ANALYZE bench.t%s', t);
+	END LOOP;
+
+	RETURN (SELECT count(*) FROM pg_statistic_ext s
+			JOIN pg_class c ON c.oid = s.stxrelid
+			WHERE c.relnamespace = 'bench'::regnamespace);
+END;
+$$ LANGUAGE plpgsql;
+
+--
+-- Planning time percentiles of the query mix: a scan with clauses on an
+-- indexed set of columns and a join of two tables. Each query is replanned:
+-- prepared statements use custom plans.
+--
+CREATE OR REPLACE FUNCTION bench_planning(ntables integer, nindexes integer,
+										  iterations integer,
+										  prepared boolean)
+RETURNS TABLE (p50 float8, p90 float8, p99 float8, mean float8) AS $$
+DECLARE
+	times	float8[] := '{}';
+	plan	json;
+	stmt	text;
+	t		integer;
+	j		integer;
+	i		integer;
+BEGIN
+	SET LOCAL plan_cache_mode = force_custom_plan;
+
+	IF prepared THEN
+		EXECUTE 'DEALLOCATE ALL';
+		FOR t IN 1..ntables LOOP
+			EXECUTE format('PREPARE bench_scan%s(integer, integer) AS
+							SELECT count(*) FROM bench.t%s
+							WHERE c1 = $1 AND c2 = $2', t, t);
+			EXECUTE format('PREPARE bench_join%s(integer) AS
+							SELECT count(*) FROM bench.t%s a
+							JOIN bench.t%s b ON a.c1 = b.c1 AND a.c2 = b.c2
+							WHERE a.c3 < $1', t, t, t % ntables + 1);
+		END LOOP;
+	END IF;
+
+	FOR i IN 1..iterations LOOP
+		t := 1 + floor(random() * ntables)::integer;
+		j := 1 + floor(random() * nindexes)::integer;
+
+		IF prepared AND i % 2 = 0 THEN
+			stmt := format('EXECUTE bench_scan%s(%s, %s)', t,
+							floor(random() * 10)::integer,
+							floor(random() * 20)::integer);
+		ELSIF prepared THEN
+			stmt := format('EXECUTE bench_join%s(%s)', t,
+							floor(random() * 30)::integer);
+		ELSIF i % 2 = 0 THEN
+			stmt := format('SELECT count(*) FROM bench.t%s
+							 WHERE c%s = %s AND c%s = %s', t,
+							j, floor(random() * 10 * j)::integer,
+							j + 1, floor(random() * 10 * (j + 1))::integer);
+		ELSE
+			stmt := format('SELECT count(*) FROM bench.t%s a
+							 JOIN bench.t%s b ON a.c1 = b.c1 AND a.c2 = b.c2
+							 WHERE a.c3 < %s', t, t % ntables + 1,
+							floor(random() * 30)::integer);
+		END IF;
+
+		EXECUTE 'EXPLAIN (SUMMARY, FORMAT JSON) ' || stmt INTO plan;
+		times := times || (plan->0->>'Planning Time')::float8;
+	END LOOP;
+
+	IF prepared THEN
+		EXECUTE 'DEALLOCATE ALL';
+	END IF;
+
+	RETURN QUERY
+		SELECT pct[1], pct[2], pct[3], m
+		FROM (SELECT percentile_cont(ARRAY[0.5, 0.9, 0.99])
+						WITHIN GROUP (ORDER BY x) AS pct,
+					 avg(x) AS m
+			  FROM unnest(times) AS x) AS s;
+END;
+$$ LANGUAGE plpgsql;
@@ -0,0 +1,112 @@
+#!/bin/bash
+#
+# Per-query overhead of the QDS (query-driven statistics) on a point-select
+# OLTP workload.
+#
+# Start a temporary instance with a table indexed on (a, b), so that the
+# auto-generated statistics cover clauses of the query
+#   covered   - SELECT ... WHERE a = :a AND b = :b
+# and don't cover the clauses of
+#   uncovered - SELECT ... WHERE a = :a AND b = :b AND c = :c
+# Drive each query by pgbench in the simple (replanned) and prepared modes and
+# the configurations:
+#   off     - the library isn't loaded;
+#   loaded  - the library is loaded, QDS is off;
+#   qds     - QDS gathers candidate clauses, nothing consumes them;
+#   collect - candidates are collected in the shared repository;
+#   sampled - the same, one query of a hundred is analysed.
+# Report TPS, latency percentiles and the overhead per query in microseconds
+# against the 'off' configuration.
+#
+# The extension must be installed into the PostgreSQL pointed by PG_CONFIG.
+# Settings may be changed by the environment variables (see also common.sh):
+#   BENCH_ROWS     - rows in the table (1000000)
+#   BENCH_DURATION - duration of a pgbench run, seconds (10)
+#   BENCH_CLIENTS  - pgbench clients (8)
+#
+
+set -e
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+. "$BENCH_DIR/common.sh"
+
+ROWS=${BENCH_ROWS:-1000000}
+DURATION=${BENCH_DURATION:-10}
+CLIENTS=${BENCH_CLIENTS:-8}
+
+RESULTS=$TMP/qds.out
+
+bench_config() {
+	case $1 in
+		off)
+			echo "shared_preload_libraries = ''" ;;
+		loaded)
+			echo "shared_preload_libraries = 'pg_index_stats'"
+			echo "pg_index_stats.qds = off" ;;
+		qds)
+			echo "shared_preload_libraries = 'pg_index_stats'"
+			echo "pg_index_stats.qds = on" ;;
+		collect)
+			echo "shared_preload_libraries = 'pg_index_stats'"
+			echo "pg_index_stats.qds = on"
+			echo "pg_index_stats.qds_collect = on" ;;
+		sampled)
+			echo "shared_preload_libraries = 'pg_index_stats'"
+			echo "pg_index_stats.qds = on"
+			echo "pg_index_stats.qds_collect = on"
+			echo "pg_index_stats.qds_sample_rate = 0.01" ;;
+	esac
+}
+
+make_script() {
+	local query=$1
+	local file=$TMP/$query.sql
+
+	{
+		echo "\\set a random(0, 999)"
+		echo "\\set b random(0, $(( ROWS / 1000 )))"
+		echo "\\set c random(0, 99)"
+		case $query in
+			covered)
+				echo "SELECT id FROM bench_qds WHERE a = :a AND b = :b;" ;;
+			uncovered)
+				echo "SELECT id FROM bench_qds WHERE a = :a AND b = :b AND c = :c;" ;;
+		esac
+	} > "$file"
+	echo "$file"
+}
+
+init_instance -c "
+	CREATE TABLE bench_qds (id integer, a integer, b integer, c integer);
+	INSERT INTO bench_qds
+		SELECT g, g % 1000, g / 1000, g % 100 FROM generate_series(1, $ROWS) AS g;
+	CREATE INDEX ON bench_qds (a, b);
+	VACUUM ANALYZE bench_qds;"
+
+printf "%-9s %-9s %-8s %8s %9s %9s %9s\n" \
+	query mode config tps lat_p50 lat_p99 overhead | tee "$RESULTS"
+
+for query in covered uncovered; do
+	script=$(make_script $query)
+
+	for mode in simple prepared; do
+		base=
+
+		for config in off loaded qds collect sampled; do
+			start_instance $config
+			tps=$(run_pgbench -T $DURATION -c $CLIENTS -j $CLIENTS -M $mode -f "$script")
+			latency=$(latency_percentiles)
+			stop_instance
+
+			# Extra time of a query, spent by the library, in microseconds
+			base=${base:-$tps}
+			overhead=$(awk -v c=$CLIENTS -v t=$tps -v b=$base \
+				'BEGIN { if (t > 0 && b > 0) printf "%.2f", c * 1000000. * (1. / t - 1. / b); else print "-" }')
+
+			printf "%-9s %-9s %-8s %8s %9s %9s %9s\n" \
+				$query $mode $config $tps $latency $overhead | tee -a "$RESULTS"
+		done
+	done
+done
+
+echo "Latency is in milliseconds, overhead in microseconds. Results: $RESULTS"
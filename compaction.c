@@ -0,0 +1,698 @@
+/*-------------------------------------------------------------------------
+ *
+ * compaction.c
+ *		Choose a minimal-cost set of statistics, covering all the indexes of
+ *		a table.
+ *
+ * Pairwise reduction in duplicated_slots.c looks only at a new definition and
+ * each existing statistics separately, in order of creation. Here all the
+ * definitions, generated on indexes of a table, are considered at once as a
+ * weighted set cover problem:
+ *
+ * - ndistinct and dependencies of a set of columns may be served by the same
+ *   kind of statistics on any superset of the columns;
+ * - MCV is needed on exactly the same columns (as the pairwise reduction
+ *   does);
+ * - candidates are the definitions of indexes and unions of intersecting
+ *   ones, limited by columns_limit. The price of a candidate is an estimated
+ *   extra ANALYZE time and storage (see statcost.c).
+ *
+ * The greedy algorithm takes the cheapest statistics per covered definition
+ * until all of them are covered, then excessive choices are removed in the
+ * reverse order. The result is applied to the catalog as the incremental
+ * rebuild does. Statistics, not generated on indexes, are used as already
+ * covering but are never changed. Definitions, containing expressions, don't
+ * participate in the cover and are kept as is.
+ *
+ * Copyright (c) 2023-2025 Andrei Lepikhov
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ * IDENTIFICATION
+ *	  contrib/pg_index_stats/compaction.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <math.h>
+
+#include "access/genam.h"
+#include "access/htup_details.h"
+#include "access/table.h"
+#include "catalog/indexing.h"
+#include "catalog/pg_depend.h"
+#include "catalog/pg_index.h"
+#include "catalog/pg_statistic_ext.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "nodes/makefuncs.h"
+#include "statistics/statistics.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/syscache.h"
+
+#include "compaction.h"
+#include "pg_index_stats.h"
+#include "rebuild.h"
+
+PG_FUNCTION_INFO_V1(pg_index_stats_compact);
+
+static bool compact_after_ddl = false;
+
+typedef struct CoverCandidate
+{
+	Bitmapset  *columns;
+	int32		types;		/* kinds chosen so far */
+} CoverCandidate;
+
+/* Kind of statistics, needed on the columns of an index */
+typedef struct CoverElement
+{
+	Bitmapset  *columns;
+	int32		kind;
+	bool		covered;
+} CoverElement;
+
+typedef struct CoverChoice
+{
+	int			candidate;
+	int32		kind;
+} CoverChoice;
+
+static const int32 cover_kinds[] = {STAT_NDISTINCT, STAT_DEPENDENCIES};
+
+static int
+add_candidate(CoverCandidate *cands, int ncands, Bitmapset *columns)
+{
+	int		i;
+
+	for (i = 0; i < ncands; i++)
+	{
+		if (bms_equal(cands[i].columns, columns))
+			return ncands;
+	}
+
+	cands[ncands].columns = columns;
+	cands[ncands].types = 0;
+	return ncands + 1;
+}
+
+static int
+find_candidate(CoverCandidate *cands, int ncands, Bitmapset *columns)
+{
+	int		i;
+
+	for (i = 0; i < ncands; i++)
+	{
+		if (bms_equal(cands[i].columns, columns))
+			return i;
+	}
+	elog(ERROR, "cover candidate not found");
+	return -1;					/* keep compiler quiet */
+}
+
+/*
+ * Is the kind of statistics on the columns served by any statistics?
+ */
+static bool
+is_covered(List *fixed, CoverCandidate *cands, int ncands, Bitmapset *columns,
+		   int32 kind, bool exact)
+{
+	ListCell   *lc;
+	int			i;
+
+	foreach(lc, fixed)
+	{
+		StatExtEntry   *entry = (StatExtEntry *) lfirst(lc);
+
+		if ((entry->types & kind) &&
+			(exact ? bms_equal(entry->columns, columns) && entry->exprs == NIL :
+					 bms_is_subset(columns, entry->columns)))
+			return true;
+	}
+
+	for (i = 0; i < ncands; i++)
+	{
+		if ((cands[i].types & kind) &&
+			(exact ? bms_equal(cands[i].columns, columns) :
+					 bms_is_subset(columns, cands[i].columns)))
+			return true;
+	}
+	return false;
+}
+
+static double
+marginal_cost(Relation hrel, CoverCandidate *cand, int32 kind)
+{
+	StatCost	before;
+	StatCost	after;
+
+	estimate_statistics_cost(hrel, cand->columns, NIL, cand->types, &before);
+	estimate_statistics_cost(hrel, cand->columns, NIL, cand->types | kind,
+							 &after);
+	return statistics_cost_value(&after) - statistics_cost_value(&before);
+}
+
+static void
+add_cost(Relation hrel, StatExtEntry *entry, StatCost *total, double sign)
+{
+	StatCost	cost;
+
+	estimate_statistics_cost(hrel, entry->columns, entry->exprs, entry->types,
+							 &cost);
+	total->analyze_ms += sign * cost.analyze_ms;
+	total->bytes += sign * cost.bytes;
+}
+
+/*
+ * Collect definitions of statistics on the indexes of the relation. Plain ones
+ * are returned, ones with expressions are added to the desired list as is.
+ */
+static List *
+collect_requirements(Relation hrel, int32 stat_types, List **desired)
+{
+	List	   *indexes = RelationGetIndexList(hrel);
+	List	   *result = NIL;
+	ListCell   *lc;
+
+	/* Definitions of older indexes take precedence */
+	list_sort(indexes, list_oid_cmp);
+
+	foreach(lc, indexes)
+	{
+		Relation		irel;
+		DesiredStat	   *stat;
+		List		   *target;
+		ListCell	   *lc1;
+
+		irel = try_relation_open(lfirst_oid(lc), AccessShareLock);
+		if (irel == NULL)
+			continue;
+
+		stat = palloc0(sizeof(DesiredStat));
+		if (!index_statistics_definition(irel, hrel, &stat->exprlst,
+										 &stat->atts_used))
+		{
+			relation_close(irel, AccessShareLock);
+			pfree(stat);
+			continue;
+		}
+		stat->indexId = RelationGetRelid(irel);
+		relation_close(irel, AccessShareLock);
+
+		stat->entry.columns = stat->atts_used;
+		stat->entry.types = stat_types;
+		foreach(lc1, stat->exprlst)
+		{
+			StatsElem  *selem = (StatsElem *) lfirst(lc1);
+
+			if (selem->expr != NULL)
+				stat->entry.exprs = lappend(stat->entry.exprs, selem->expr);
+		}
+
+		target = (stat->entry.exprs != NIL) ? *desired : result;
+		foreach(lc1, target)
+		{
+			DesiredStat	   *prev = (DesiredStat *) lfirst(lc1);
+
+			if (bms_equal(prev->entry.columns, stat->entry.columns) &&
+				equal(prev->entry.exprs, stat->entry.exprs))
+				break;
+		}
+		if (lc1 != NULL)
+			/* Duplicated index */
+			continue;
+
+		if (stat->entry.exprs != NIL)
+			*desired = lappend(*desired, stat);
+		else
+			result = lappend(result, stat);
+	}
+
+	return result;
+}
+
+/*
+ * Compute the cover and apply it, if not dry_run. Return false, if nothing
+ * can be done on the relation.
+ */
+bool
+compact_relation(Relation hrel, bool dry_run, CompactionResult *result)
+{
+	int32			stat_types = get_statistic_types();
+	int				limit = Min(statistics_columns_limit(), STATS_MAX_DIMENSIONS);
+	List		   *autostats;
+	List		   *fixed = NIL;
+	List		   *requirements;
+	List		   *desired = NIL;
+	List		   *choices = NIL;
+	CoverCandidate *cands;
+	CoverElement   *elems;
+	int				nreqs;
+	int				ncands = 0;
+	int				nelems = 0;
+	ListCell	   *lc;
+	ListCell	   *lc1;
+	int				i;
+	int				j;
+
+	memset(result, 0, sizeof(CompactionResult));
+
+	if (stat_types == 0 || limit < 2 ||
+		hrel->rd_rel->relkind != RELKIND_RELATION)
+		return false;
+
+	autostats = fetch_index_based_statistics(RelationGetRelid(hrel), &fixed);
+	requirements = collect_requirements(hrel, stat_types, &desired);
+	nreqs = list_length(requirements);
+
+	/* Definitions of the indexes and unions of intersecting ones */
+	cands = (CoverCandidate *)
+		palloc0(Max(nreqs + nreqs * (nreqs - 1) / 2, 1) * sizeof(CoverCandidate));
+	foreach(lc, requirements)
+		ncands = add_candidate(cands, ncands,
+							   ((DesiredStat *) lfirst(lc))->entry.columns);
+	foreach(lc, requirements)
+	{
+		Bitmapset  *columns = ((DesiredStat *) lfirst(lc))->entry.columns;
+
+		for_each_cell(lc1, requirements, lnext(requirements, lc))
+		{
+			Bitmapset  *other = ((DesiredStat *) lfirst(lc1))->entry.columns;
+			Bitmapset  *uni;
+
+			if (!bms_overlap(columns, other))
+				continue;
+
+			uni = bms_union(columns, other);
+			if (bms_num_members(uni) <= limit)
+				ncands = add_candidate(cands, ncands, uni);
+		}
+	}
+
+	/* MCV is mandatory on the columns of each index */
+	elems = (CoverElement *) palloc0(Max(nreqs * lengthof(cover_kinds), 1) *
+									 sizeof(CoverElement));
+	foreach(lc, requirements)
+	{
+		Bitmapset  *columns = ((DesiredStat *) lfirst(lc))->entry.columns;
+
+		if ((stat_types & STAT_MCV) &&
+			!is_covered(fixed, NULL, 0, columns, STAT_MCV, true))
+			cands[find_candidate(cands, ncands, columns)].types |= STAT_MCV;
+
+		for (i = 0; i < lengthof(cover_kinds); i++)
+		{
+			if (!(stat_types & cover_kinds[i]))
+				continue;
+
+			elems[nelems].columns = columns;
+			elems[nelems].kind = cover_kinds[i];
+			elems[nelems].covered = is_covered(fixed, NULL, 0, columns,
+											   cover_kinds[i], false);
+			nelems++;
+		}
+	}
+
+	/* Greedy: take the cheapest kind per covered definition */
+	for (;;)
+	{
+		CoverChoice	   *choice;
+		int				best = -1;
+		int32			bestkind = 0;
+		double			bestratio = 0.;
+
+		CHECK_FOR_INTERRUPTS();
+
+		for (i = 0; i < ncands; i++)
+		{
+			for (j = 0; j < lengthof(cover_kinds); j++)
+			{
+				int32	kind = cover_kinds[j];
+				int		ncovered = 0;
+				double	ratio;
+				int		k;
+
+				if (!(stat_types & kind) || (cands[i].types & kind))
+					continue;
+
+				for (k = 0; k < nelems; k++)
+				{
+					if (!elems[k].covered && elems[k].kind == kind &&
+						bms_is_subset(elems[k].columns, cands[i].columns))
+						ncovered++;
+				}
+				if (ncovered == 0)
+					continue;
+
+				ratio = marginal_cost(hrel, &cands[i], kind) / ncovered;
+				if (best < 0 || ratio < bestratio)
+				{
+					best = i;
+					bestkind = kind;
+					bestratio = ratio;
+				}
+			}
+		}
+
+		if (best < 0)
+			break;
+
+		cands[best].types |= bestkind;
+		for (i = 0; i < nelems; i++)
+		{
+			if (elems[i].kind == bestkind &&
+				bms_is_subset(elems[i].columns, cands[best].columns))
+				elems[i].covered = true;
+		}
+
+		choice = palloc(sizeof(CoverChoice));
+		choice->candidate = best;
+		choice->kind = bestkind;
+		choices = lappend(choices, choice);
+	}
+
+	/* Remove choices, made excessive by the later ones */
+	for (i = list_length(choices) - 1; i >= 0; i--)
+	{
+		CoverChoice	   *choice = (CoverChoice *) list_nth(choices, i);
+		CoverCandidate *cand = &cands[choice->candidate];
+
+		cand->types &= ~choice->kind;
+		for (j = 0; j < nelems; j++)
+		{
+			if (elems[j].kind == choice->kind &&
+				bms_is_subset(elems[j].columns, cand->columns) &&
+				!is_covered(fixed, cands, ncands, elems[j].columns,
+							choice->kind, false))
+			{
+				/* Still needed */
+				cand->types |= choice->kind;
+				break;
+			}
+		}
+	}
+
+	/* Make definitions of the chosen statistics */
+	for (i = 0; i < ncands; i++)
+	{
+		DesiredStat	   *stat;
+		int				attnum = -1;
+
+		if (cands[i].types == 0)
+			continue;
+
+		stat = palloc0(sizeof(DesiredStat));
+		stat->entry.columns = cands[i].columns;
+		stat->entry.types = cands[i].types;
+		stat->atts_used = cands[i].columns;
+		while ((attnum = bms_next_member(cands[i].columns, attnum)) >= 0)
+		{
+			StatsElem  *selem = makeNode(StatsElem);
+
+			selem->name = get_attname(RelationGetRelid(hrel), attnum, false);
+			selem->expr = NULL;
+			stat->exprlst = lappend(stat->exprlst, selem);
+		}
+
+		/*
+		 * Depend on the index with the same definition. Statistics on a union
+		 * depend on the oldest index involved.
+		 */
+		foreach(lc, requirements)
+		{
+			DesiredStat	   *req = (DesiredStat *) lfirst(lc);
+
+			if (bms_equal(req->entry.columns, cands[i].columns))
+			{
+				stat->indexId = req->indexId;
+				break;
+			}
+			if (!OidIsValid(stat->indexId) &&
+				bms_is_subset(req->entry.columns, cands[i].columns))
+				stat->indexId = req->indexId;
+		}
+		Assert(OidIsValid(stat->indexId));
+
+		desired = lappend(desired, stat);
+	}
+
+	result->nbefore = list_length(autostats);
+	result->nafter = list_length(desired);
+	foreach(lc, autostats)
+		add_cost(hrel, (StatExtEntry *) lfirst(lc), &result->saved, 1.);
+	foreach(lc, desired)
+		add_cost(hrel, &((DesiredStat *) lfirst(lc))->entry, &result->saved, -1.);
+
+	if (!dry_run)
+		result->nchanged = apply_desired_statistics(hrel, autostats, desired);
+
+	return true;
+}
+
+/*
+ * Compact statistics of the table after creation of an index, if allowed.
+ */
+void
+compaction_after_ddl(Relation hrel)
+{
+	CompactionResult	result;
+
+	if (!compact_after_ddl || !compact_relation(hrel, false, &result))
+		return;
+
+	ereport(DEBUG1,
+			(errmsg("statistics on \"%s\" have been compacted: %d changed, %d left of %d",
+					RelationGetRelationName(hrel), result.nchanged,
+					result.nafter, result.nbefore),
+			 errdetail("Saved %.0f bytes and %.3f ms of ANALYZE.",
+					   result.saved.bytes, result.saved.analyze_ms)));
+}
+
+/*
+ * Has the statistics a column, not included into the index?
+ */
+static bool
+statistics_exceeds_index(Oid statoid, Form_pg_index index)
+{
+	HeapTuple				htup;
+	Form_pg_statistic_ext	stat;
+	bool					result = false;
+	int						i;
+	int						j;
+
+	htup = SearchSysCache1(STATEXTOID, ObjectIdGetDatum(statoid));
+	if (!HeapTupleIsValid(htup))
+		return false;
+
+	stat = (Form_pg_statistic_ext) GETSTRUCT(htup);
+	for (i = 0; i < stat->stxkeys.dim1 && !result; i++)
+	{
+		for (j = 0; j < index->indnatts; j++)
+		{
+			if (index->indkey.values[j] == stat->stxkeys.values[i])
+				break;
+		}
+		result = (j == index->indnatts);
+	}
+	ReleaseSysCache(htup);
+
+	return result;
+}
+
+/*
+ * Does the index hold statistics on a union of indexes? Such statistics
+ * depend on the oldest index involved only, so they are dropped with it,
+ * while other indexes still need them.
+ */
+bool
+compaction_union_depends_on(Oid indexoid)
+{
+	HeapTuple	indtup;
+	Relation	depRel;
+	ScanKeyData	key[2];
+	SysScanDesc	scan;
+	HeapTuple	tup;
+	bool		result = false;
+
+	indtup = SearchSysCache1(INDEXRELID, ObjectIdGetDatum(indexoid));
+	if (!HeapTupleIsValid(indtup))
+		return false;
+
+	depRel = table_open(DependRelationId, AccessShareLock);
+	ScanKeyInit(&key[0],
+				Anum_pg_depend_refclassid,
+				BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(RelationRelationId));
+	ScanKeyInit(&key[1],
+				Anum_pg_depend_refobjid,
+				BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(indexoid));
+
+	scan = systable_beginscan(depRel, DependReferenceIndexId, true,
+							  NULL, 2, key);
+	while (!result && HeapTupleIsValid(tup = systable_getnext(scan)))
+	{
+		Form_pg_depend	deprec = (Form_pg_depend) GETSTRUCT(tup);
+
+		if (deprec->classid != StatisticExtRelationId ||
+			deprec->deptype != DEPENDENCY_AUTO)
+			continue;
+
+		result = is_index_based_statistics(deprec->objid) &&
+			statistics_exceeds_index(deprec->objid,
+									 (Form_pg_index) GETSTRUCT(indtup));
+	}
+	systable_endscan(scan);
+	table_close(depRel, AccessShareLock);
+	ReleaseSysCache(indtup);
+
+	return result;
+}
+
+/*
+ * Restore the cover of the indexes of the table, after statistics on a union
+ * have been dropped together with an index.
+ */
+void
+compaction_after_drop(Oid relid)
+{
+	Relation			hrel;
+	CompactionResult	result;
+	Oid					save_userid;
+	int					save_sec_context;
+	int					save_nestlevel;
+	bool				done;
+
+	if (!rebuild_permitted(relid, false))
+		return;
+
+	hrel = try_relation_open(relid, AccessShareLock);
+	if (hrel == NULL)
+		return;
+
+	GetUserIdAndSecContext(&save_userid, &save_sec_context);
+	SetUserIdAndSecContext(hrel->rd_rel->relowner,
+						   save_sec_context | SECURITY_RESTRICTED_OPERATION);
+	save_nestlevel = NewGUCNestLevel();
+
+	done = compact_relation(hrel, false, &result);
+
+	AtEOXact_GUC(false, save_nestlevel);
+	SetUserIdAndSecContext(save_userid, save_sec_context);
+
+	if (done)
+		ereport(DEBUG1,
+				(errmsg("statistics on \"%s\" have been compacted after an index drop: %d changed, %d left",
+						RelationGetRelationName(hrel), result.nchanged,
+						result.nafter)));
+
+	relation_close(hrel, AccessShareLock);
+}
+
+/*
+ * Compact statistics of the relation or of all the tables, if relation is
+ * NULL. Return a row per table.
+ */
+Datum
+pg_index_stats_compact(PG_FUNCTION_ARGS)
+{
+	Oid				relid = PG_ARGISNULL(0) ? InvalidOid : PG_GETARG_OID(0);
+	bool			dry_run = !PG_ARGISNULL(1) && PG_GETARG_BOOL(1);
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext	compact_ctx;
+	MemoryContext	oldctx;
+	List		   *relids = NIL;
+	ListCell	   *lc;
+
+	prepare_materialized_srf(fcinfo);
+
+	if (OidIsValid(relid))
+		relids = list_make1_oid(relid);
+	else
+	{
+		foreach(lc, collect_rebuild_targets(InvalidOid, InvalidOid))
+			relids = lappend_oid(relids, ((RebuildTarget *) lfirst(lc))->relid);
+	}
+
+	compact_ctx = AllocSetContextCreate(CurrentMemoryContext,
+										MODULE_NAME" compaction context",
+										ALLOCSET_DEFAULT_SIZES);
+
+	foreach(lc, relids)
+	{
+		Relation			hrel;
+		CompactionResult	result;
+		Oid					save_userid;
+		int					save_sec_context;
+		int					save_nestlevel;
+		Datum				values[7];
+		bool				nulls[7];
+		bool				done;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (!rebuild_permitted(lfirst_oid(lc), OidIsValid(relid)))
+			continue;
+
+		hrel = try_relation_open(lfirst_oid(lc), AccessShareLock);
+		if (hrel == NULL)
+			continue;
+
+		GetUserIdAndSecContext(&save_userid, &save_sec_context);
+		SetUserIdAndSecContext(hrel->rd_rel->relowner,
+							   save_sec_context | SECURITY_RESTRICTED_OPERATION);
+		save_nestlevel = NewGUCNestLevel();
+
+		oldctx = MemoryContextSwitchTo(compact_ctx);
+		done = compact_relation(hrel, dry_run, &result);
+		MemoryContextSwitchTo(oldctx);
+		MemoryContextReset(compact_ctx);
+
+		AtEOXact_GUC(false, save_nestlevel);
+		SetUserIdAndSecContext(save_userid, save_sec_context);
+
+		if (done)
+		{
+			memset(nulls, false, sizeof(nulls));
+			values[0] = ObjectIdGetDatum(RelationGetRelid(hrel));
+			values[1] = CStringGetTextDatum(quote_qualified_identifier(
+							get_namespace_name(RelationGetNamespace(hrel)),
+							RelationGetRelationName(hrel)));
+			values[2] = Int32GetDatum(result.nbefore);
+			values[3] = Int32GetDatum(result.nafter);
+			values[4] = Int32GetDatum(result.nchanged);
+			values[5] = Int64GetDatum((int64) rint(result.saved.bytes));
+			values[6] = Float8GetDatum(result.saved.analyze_ms);
+			tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc,
+								 values, nulls);
+		}
+
+		relation_close(hrel, AccessShareLock);
+	}
+
+	MemoryContextDelete(compact_ctx);
+	return (Datum) 0;
+}
+
+void
+compaction_init(void)
+{
+	DefineCustomBoolVariable(MODULE_NAME".compact_after_ddl",
+							 "Compact statistics of a table after creation of an index",
+							 "Choose a minimal-cost set of statistics, covering all the indexes of the table",
+							 &compact_after_ddl,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+}
@@ -0,0 +1,25 @@
+#ifndef _COMPACTION_H_
+#define _COMPACTION_H_
+
+#include "postgres.h"
+
+#include "utils/relcache.h"
+
+#include "statcost.h"
+
+typedef struct CompactionResult
+{
+	int			nbefore;	/* index-based statistics before */
+	int			nafter;		/* ... and after the compaction */
+	int			nchanged;	/* created and altered statistics */
+	StatCost	saved;
+} CompactionResult;
+
+extern void compaction_init(void);
+extern bool compact_relation(Relation hrel, bool dry_run,
+							 CompactionResult *result);
+extern void compaction_after_ddl(Relation hrel);
+extern bool compaction_union_depends_on(Oid indexoid);
+extern void compaction_after_drop(Oid relid);
+
+#endif /* _COMPACTION_H_ */
@@ -31,6 +31,9 @@
 #include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/fmgroids.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
 #include "utils/rel.h"
 #include "utils/syscache.h"
 
@@ -38,16 +41,24 @@
 #include "pg_index_stats.h"
 
 /*
- * XXX: think about owners and acess rules ...
-*/
-typedef struct StatExtEntry
+ * Backend cache of parsed definitions of extended statistics, keyed by relid.
+ * Bulk DDL against a table with many statistics would re-parse the same
+ * catalog rows on each index build otherwise.
+ *
+ * Invalidation callback just marks an entry as invalid: the list may be in use
+ * at the moment, because we change pg_statistic_ext when walking through it.
+ * Invalid entries are removed at the next lookup.
+ */
+typedef struct StatExtCacheEntry
 {
-	Oid			oid;
-	char	   *name;
-	Bitmapset  *columns;
-	int			types;
-	List	   *exprs;
-} StatExtEntry;
+	Oid				relid;		/* hash key */
+	bool			valid;
+	MemoryContext	mcxt;		/* holds the statslist */
+	List		   *statslist;
+} StatExtCacheEntry;
+
+static HTAB *statext_cache = NULL;
+static bool statext_cache_has_invalid = false;
 
 /*
  * It is based on the code of the static fetch_statentries_for_relation, the
@@ -87,6 +98,8 @@ fetch_statentries_for_relation(Relation pg_statext, Oid relid)
 		entry = palloc0(sizeof(StatExtEntry));
 		staForm = (Form_pg_statistic_ext) GETSTRUCT(htup);
 		entry->oid = staForm->oid; /* Need to delete/update it further */
+		entry->hashvalue = GetSysCacheHashValue1(STATEXTOID,
+												 ObjectIdGetDatum(entry->oid));
 		entry->name = pstrdup(NameStr(staForm->stxname));
 		for (i = 0; i < staForm->stxkeys.dim1; i++)
 		{
@@ -144,6 +157,147 @@ fetch_statentries_for_relation(Relation pg_statext, Oid relid)
 	return result;
 }
 
+static void
+statext_cache_invalidate_all(void)
+{
+	HASH_SEQ_STATUS		status;
+	StatExtCacheEntry  *entry;
+
+	hash_seq_init(&status, statext_cache);
+	while ((entry = (StatExtCacheEntry *) hash_seq_search(&status)) != NULL)
+		entry->valid = false;
+	statext_cache_has_invalid = true;
+}
+
+static void
+statext_relcache_callback(Datum arg, Oid relid)
+{
+	StatExtCacheEntry *entry;
+
+	if (!OidIsValid(relid))
+	{
+		statext_cache_invalidate_all();
+		return;
+	}
+
+	entry = (StatExtCacheEntry *) hash_search(statext_cache, &relid,
+											  HASH_FIND, NULL);
+	if (entry != NULL)
+	{
+		entry->valid = false;
+		statext_cache_has_invalid = true;
+	}
+}
+
+/*
+ * pg_statistic_ext has been changed. CREATE and DROP STATISTICS invalidate the
+ * relcache entry of the table, but ALTER doesn't. Find the owner of the tuple.
+ */
+static void
+statext_syscache_callback(Datum arg, int cacheid, uint32 hashvalue)
+{
+	HASH_SEQ_STATUS		status;
+	StatExtCacheEntry  *entry;
+
+	if (hashvalue == 0)
+	{
+		statext_cache_invalidate_all();
+		return;
+	}
+
+	hash_seq_init(&status, statext_cache);
+	while ((entry = (StatExtCacheEntry *) hash_seq_search(&status)) != NULL)
+	{
+		ListCell   *lc;
+
+		if (!entry->valid)
+			continue;
+
+		foreach(lc, entry->statslist)
+		{
+			if (((StatExtEntry *) lfirst(lc))->hashvalue == hashvalue)
+			{
+				entry->valid = false;
+				statext_cache_has_invalid = true;
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * Get the list of extended statistics on the relation from the cache.
+ *
+ * The list is valid until the next call. Don't change it.
+ */
+static List *
+get_statentries_for_relation(Relation pg_statext, Oid relid)
+{
+	StatExtCacheEntry  *entry;
+	MemoryContext		mcxt;
+	MemoryContext		oldctx;
+	List			   *statslist;
+	bool				found;
+
+	if (statext_cache == NULL)
+	{
+		HASHCTL		ctl;
+
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(StatExtCacheEntry);
+		ctl.hcxt = CacheMemoryContext;
+		statext_cache = hash_create(MODULE_NAME" statistics cache", 64, &ctl,
+									HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+		CacheRegisterRelcacheCallback(statext_relcache_callback, (Datum) 0);
+		CacheRegisterSyscacheCallback(STATEXTOID, statext_syscache_callback,
+									  (Datum) 0);
+	}
+
+	/* Nobody uses lists at the moment. Get rid of the invalid ones. */
+	if (statext_cache_has_invalid)
+	{
+		HASH_SEQ_STATUS	status;
+
+		hash_seq_init(&status, statext_cache);
+		while ((entry = (StatExtCacheEntry *) hash_seq_search(&status)) != NULL)
+		{
+			if (entry->valid)
+				continue;
+
+			MemoryContextDelete(entry->mcxt);
+			(void) hash_search(statext_cache, &entry->relid, HASH_REMOVE, NULL);
+		}
+		statext_cache_has_invalid = false;
+	}
+
+	entry = (StatExtCacheEntry *) hash_search(statext_cache, &relid,
+											  HASH_FIND, NULL);
+	if (entry != NULL)
+		return entry->statslist;
+
+	/*
+	 * Build the list in a temporary context and move it under the cache
+	 * context only if no error happened.
+	 */
+	mcxt = AllocSetContextCreate(CurrentMemoryContext,
+								 MODULE_NAME" statistics cache entry",
+								 ALLOCSET_SMALL_SIZES);
+	oldctx = MemoryContextSwitchTo(mcxt);
+	statslist = fetch_statentries_for_relation(pg_statext, relid);
+	MemoryContextSwitchTo(oldctx);
+	MemoryContextSetParent(mcxt, CacheMemoryContext);
+
+	entry = (StatExtCacheEntry *) hash_search(statext_cache, &relid,
+											  HASH_ENTER, &found);
+	Assert(!found);
+	entry->valid = true;
+	entry->mcxt = mcxt;
+	entry->statslist = statslist;
+
+	return statslist;
+}
+
 typedef struct
 {
 	StatExtEntry *entry;
@@ -264,40 +418,87 @@ _probe_statistics(const List *statslist, const List *exprs,
 	return result;
 }
 
+/*
+ * Change set of statistic kinds of the existing statistics. There are only set
+ * of stat types may be altered for now.
+ */
+static void
+alter_statistics_types(Relation pg_stext, Oid stxoid, int32 types)
+{
+	HeapTuple	oldtup;
+	HeapTuple	newtup;
+	Datum		repl_val[Natts_pg_statistic_ext];
+	bool		repl_null[Natts_pg_statistic_ext];
+	bool		repl_repl[Natts_pg_statistic_ext];
+	Datum		stxtypes[4];	/* one for each possible type of statistic */
+	int			ntypes;
+	ArrayType  *stxkind;
+
+	oldtup = SearchSysCache1(STATEXTOID, ObjectIdGetDatum(stxoid));
+	if (!HeapTupleIsValid(oldtup))
+		elog(ERROR, "cache lookup failed for extended statistics object %u", stxoid);
+
+	ntypes = 0;
+
+	if (types & STAT_NDISTINCT)
+		stxtypes[ntypes++] = CharGetDatum(STATS_EXT_NDISTINCT);
+	if (types & STAT_DEPENDENCIES)
+		stxtypes[ntypes++] = CharGetDatum(STATS_EXT_DEPENDENCIES);
+	if (types & STAT_MCV)
+		stxtypes[ntypes++] = CharGetDatum(STATS_EXT_MCV);
+
+	Assert(ntypes > 0 && ntypes <= lengthof(stxtypes));
+	stxkind = construct_array(stxtypes, ntypes, CHAROID, 1, true, TYPALIGN_CHAR);
+
+	memset(repl_val, 0, sizeof(repl_val));
+	memset(repl_null, false, sizeof(repl_null));
+	memset(repl_repl, false, sizeof(repl_repl));
+	repl_repl[Anum_pg_statistic_ext_stxkind - 1] = true;
+	repl_val[Anum_pg_statistic_ext_stxkind - 1] = PointerGetDatum(stxkind);
+
+	newtup = heap_modify_tuple(oldtup, RelationGetDescr(pg_stext),
+									repl_val, repl_null, repl_repl);
+
+	CatalogTupleUpdate(pg_stext, &newtup->t_self, newtup);
+	InvokeObjectPostAlterHook(StatisticExtRelationId, stxoid, 0);
+
+	/*
+	 * NOTE: because we only support altering the statistics target, not the
+	 * other fields, there is no need to update dependencies.
+	 */
+
+	heap_freetuple(newtup);
+	ReleaseSysCache(oldtup);
+
+	CommandCounterIncrement();
+}
+
 /*
  * Decide on types of extended statistics that should stay in the definition.
+ * Nothing is changed in the catalog here: newtypes receives the set of types,
+ * that stays useful, for each entry of the statslist. Zero means the entry
+ * isn't needed anymore.
  *
  * XXX: what about stxstattarget? We don't think about it now, but it may
  * make sense in the future ...
  */
-int
-reduce_duplicated_stat(const List *exprs, Bitmapset *atts_used,
-					   Relation hrel, int32 stat_types)
+int32
+compactify_definition(List *statslist, const List *exprs,
+					  Bitmapset *atts_used, int32 stat_types, int32 *newtypes)
 {
-	Relation		pg_stext;
-	List		   *statslist;
-	MemoryContext	oldctx;
-	List		   *cmpsList;
-	ListCell	   *lc;
-
-	oldctx = MemoryContextSwitchTo(pg_index_stats_mem_ctx);
+	List	   *cmpsList;
+	ListCell   *lc;
+	int			i = 0;
 
 	Assert(stat_types > 0);
 
-	pg_stext = table_open(StatisticExtRelationId, RowExclusiveLock);
-	statslist = fetch_statentries_for_relation(pg_stext, RelationGetRelid(hrel));
-	if (statslist == NIL)
-	{
-		table_close(pg_stext, RowExclusiveLock);
-		MemoryContextSwitchTo(oldctx);
-		return stat_types;
-	}
-
 	cmpsList = _probe_statistics(statslist, exprs, atts_used);
 	foreach(lc, cmpsList)
 	{
 		StatListCmp	   *cmps = (StatListCmp *) lfirst(lc);
 
+		newtypes[i] = cmps->entry->types;
+
 		if (DUPDEF_STAT(cmps))
 		{
 			/*
@@ -327,98 +528,117 @@ reduce_duplicated_stat(const List *exprs, Bitmapset *atts_used,
 
 		if (COVERINGDEF_STAT(cmps))
 		{
-			int useful_stattypes = cmps->entry->types;
-
 			/*
 			 * New definition covers one of existing statistics. Probe,
 			 * if something useful still exists there.
 			 */
-
 			if (stat_types & STAT_NDISTINCT)
-				useful_stattypes &= ~STAT_NDISTINCT;
+				newtypes[i] &= ~STAT_NDISTINCT;
 			if (stat_types & STAT_DEPENDENCIES)
-				useful_stattypes &= ~STAT_DEPENDENCIES;
-
-			if (useful_stattypes == 0)
-			{
-				ObjectAddress object;
-
-				/*
-				 * Quite rare case because of MCV is highly probably has been
-				 * created. But it simply to implement.
-				 */
-				 object.classId = StatisticExtRelationId;
-				 object.objectId = cmps->entry->oid;
-				 object.objectSubId = 0;
+				newtypes[i] &= ~STAT_DEPENDENCIES;
+		}
 
-				 performDeletion(&object, DROP_CASCADE, PERFORM_DELETION_INTERNAL);
-				CommandCounterIncrement();
-			}
-			else if (useful_stattypes != cmps->entry->types)
-			{
-				HeapTuple	oldtup;
-				HeapTuple	newtup;
-				Datum		repl_val[Natts_pg_statistic_ext];
-				bool		repl_null[Natts_pg_statistic_ext];
-				bool		repl_repl[Natts_pg_statistic_ext];
-				Oid			stxoid = cmps->entry->oid;
-				Datum		types[4];		/* one for each possible type of statistic */
-				int			ntypes;
-				ArrayType  *stxkind;
+		/* TODO: change old statistic if a new one covers this old one */
+		// AlterStatistics AlterStatsStmt EventTriggerCollectSimpleCommand
 
-				/*
-				 * Some types must be removed from the existing statistic.
-				 * Alter this statistic. There are only set of stat types may
-				 * be altered for now.
-				 */
+		/* XXX: What if we have intersecting statistics ? */
+		i++;
+	}
 
-				oldtup = SearchSysCache1(STATEXTOID, ObjectIdGetDatum(stxoid));
-				if (!HeapTupleIsValid(oldtup))
-					elog(ERROR, "cache lookup failed for extended statistics object %u", stxoid);
+	return stat_types;
+}
 
-				ntypes = 0;
+/*
+ * Reduce the definition against statistics existing on the relation. Remove
+ * or alter existing statistics which become excessive.
+ */
+int
+reduce_duplicated_stat(const List *exprs, Bitmapset *atts_used,
+					   Relation hrel, int32 stat_types)
+{
+	Relation		pg_stext;
+	List		   *statslist;
+	MemoryContext	oldctx;
+	ListCell	   *lc;
+	int32		   *newtypes;
+	int				i = 0;
 
-				if (useful_stattypes & STAT_NDISTINCT)
-					types[ntypes++] = CharGetDatum(STATS_EXT_NDISTINCT);
-				if (useful_stattypes & STAT_DEPENDENCIES)
-					types[ntypes++] = CharGetDatum(STATS_EXT_DEPENDENCIES);
-				if (useful_stattypes & STAT_MCV)
-					types[ntypes++] = CharGetDatum(STATS_EXT_MCV);
+	oldctx = MemoryContextSwitchTo(pg_index_stats_mem_ctx);
 
-				Assert(ntypes > 0 && ntypes <= lengthof(types));
-				stxkind = construct_array(types, ntypes, CHAROID, 1, true, TYPALIGN_CHAR);
+	Assert(stat_types > 0);
 
-				memset(repl_val, 0, sizeof(repl_val));
-				memset(repl_null, false, sizeof(repl_null));
-				memset(repl_repl, false, sizeof(repl_repl));
-				repl_repl[Anum_pg_statistic_ext_stxkind - 1] = true;
-				repl_val[Anum_pg_statistic_ext_stxkind - 1] = PointerGetDatum(stxkind);
+	pg_stext = table_open(StatisticExtRelationId, RowExclusiveLock);
+	statslist = get_statentries_for_relation(pg_stext, RelationGetRelid(hrel));
+	if (statslist == NIL)
+	{
+		table_close(pg_stext, RowExclusiveLock);
+		MemoryContextSwitchTo(oldctx);
+		MemoryContextReset(pg_index_stats_mem_ctx);
+		return stat_types;
+	}
 
-				newtup = heap_modify_tuple(oldtup, RelationGetDescr(pg_stext),
-												repl_val, repl_null, repl_repl);
+	newtypes = (int32 *) palloc(list_length(statslist) * sizeof(int32));
+	stat_types = compactify_definition(statslist, exprs, atts_used, stat_types,
+									   newtypes);
 
-				CatalogTupleUpdate(pg_stext, &newtup->t_self, newtup);
-				InvokeObjectPostAlterHook(StatisticExtRelationId, stxoid, 0);
+	foreach(lc, statslist)
+	{
+		StatExtEntry   *entry = (StatExtEntry *) lfirst(lc);
 
-				/*
-				 * NOTE: because we only support altering the statistics target, not the
-				 * other fields, there is no need to update dependencies.
-				 */
+		if (newtypes[i] == 0)
+		{
+			ObjectAddress object;
 
-				heap_freetuple(newtup);
-				ReleaseSysCache(oldtup);
+			/*
+			 * Quite rare case because of MCV is highly probably has been
+			 * created. But it simply to implement.
+			 */
+			object.classId = StatisticExtRelationId;
+			object.objectId = entry->oid;
+			object.objectSubId = 0;
 
-				CommandCounterIncrement();
-			}
+			performDeletion(&object, DROP_CASCADE, PERFORM_DELETION_INTERNAL);
+			CommandCounterIncrement();
 		}
+		else if (newtypes[i] != entry->types)
+			/* Some types must be removed from the existing statistic */
+			alter_statistics_types(pg_stext, entry->oid, newtypes[i]);
 
-		/* TODO: change old statistic if a new one covers this old one */
-		// AlterStatistics AlterStatsStmt EventTriggerCollectSimpleCommand
-
-		/* XXX: What if we have intersecting statistics ? */
+		i++;
 	}
 
 	table_close(pg_stext, RowExclusiveLock);
 	MemoryContextSwitchTo(oldctx);
+	MemoryContextReset(pg_index_stats_mem_ctx);
 	return stat_types;
 }
+
+/*
+ * Get the list of extended statistics on the relation. The list belongs to
+ * the cache: don't change it and don't keep it across catalog changes.
+ */
+List *
+fetch_relation_statentries(Oid relid)
+{
+	Relation	pg_stext;
+	List	   *statslist;
+
+	pg_stext = table_open(StatisticExtRelationId, AccessShareLock);
+	statslist = get_statentries_for_relation(pg_stext, relid);
+	table_close(pg_stext, AccessShareLock);
+
+	return statslist;
+}
+
+/*
+ * Set new kinds of the statistics.
+ */
+void
+set_statistics_types(Oid stxoid, int32 types)
+{
+	Relation	pg_stext;
+
+	pg_stext = table_open(StatisticExtRelationId, RowExclusiveLock);
+	alter_statistics_types(pg_stext, stxoid, types);
+	table_close(pg_stext, RowExclusiveLock);
+}
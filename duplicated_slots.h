@@ -3,10 +3,30 @@
 
 #include "postgres.h"
 
+#include "nodes/bitmapset.h"
 #include "nodes/pg_list.h"
 #include "utils/relcache.h"
 
+/*
+ * XXX: think about owners and acess rules ...
+ */
+typedef struct StatExtEntry
+{
+	Oid			oid;
+	char	   *name;
+	Bitmapset  *columns;
+	int			types;
+	List	   *exprs;
+
+	uint32		hashvalue;	/* STATEXTOID syscache hash value of the oid */
+} StatExtEntry;
+
 extern int reduce_duplicated_stat(const List *exprs, Bitmapset *atts_used,
 								  Relation hrel, int32 stat_types);
+extern int32 compactify_definition(List *statslist, const List *exprs,
+								   Bitmapset *atts_used, int32 stat_types,
+								   int32 *newtypes);
+extern List *fetch_relation_statentries(Oid relid);
+extern void set_statistics_types(Oid stxoid, int32 types);
 
 #endif /* _DUPLICATED_SLOTS_H_ */
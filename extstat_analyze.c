@@ -0,0 +1,535 @@
+/*-------------------------------------------------------------------------
+ *
+ * extstat_analyze.c
+ *		Build pg_statistic_ext_data of a relation without the full ANALYZE.
+ *
+ * Statistics created automatically stay empty until the next ANALYZE of the
+ * table. On a huge table it may take days. Here we sample only the columns,
+ * involved in extended statistics, and build the extended statistics data,
+ * not touching pg_statistic at all. The sample is fetched in small batches
+ * with a pause in-between to not compete with the user workload.
+ *
+ * Copyright (c) 2023-2025 Andrei Lepikhov
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ * IDENTIFICATION
+ *	  contrib/pg_index_stats/extstat_analyze.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/htup_details.h"
+#include "access/table.h"
+#include "access/sysattr.h"
+#include "catalog/pg_statistic_ext.h"
+#include "catalog/pg_statistic_ext_data.h"
+#include "catalog/pg_type.h"
+#include "commands/vacuum.h"
+#if PG_VERSION_NUM >= 150000
+#include "common/pg_prng.h"
+#endif
+#include "executor/spi.h"
+#include "miscadmin.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/optimizer.h"
+#include "pgstat.h"
+#include "statistics/statistics.h"
+#include "storage/latch.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/syscache.h"
+
+#include "extstat_analyze.h"
+#include "pg_index_stats.h"
+#include "rebuild.h"
+#include "statretire.h"
+
+PG_FUNCTION_INFO_V1(pg_index_stats_analyze);
+
+/* Number of sample rows fetched between two pauses */
+#define SAMPLE_BATCH_SIZE	(1000)
+
+#if PG_VERSION_NUM >= 150000
+#define sample_random()	pg_prng_double(&pg_global_prng_state)
+#else
+#define sample_random()	((double) random() / ((double) MAX_RANDOM_VALUE + 1))
+#endif
+
+/*
+ * Has the statistics data for each of its kinds? A kind may be added to the
+ * existing statistics by the incremental rebuild.
+ */
+static bool
+statistics_data_complete(Oid statoid)
+{
+	HeapTuple	htup;
+	HeapTuple	dtup;
+	Datum		datum;
+	bool		isnull;
+	ArrayType  *arr;
+	char	   *enabled;
+	int			i;
+	bool		result = true;
+
+#if PG_VERSION_NUM >= 150000
+	dtup = SearchSysCache2(STATEXTDATASTXOID, ObjectIdGetDatum(statoid),
+						   BoolGetDatum(false));
+#else
+	dtup = SearchSysCache1(STATEXTDATASTXOID, ObjectIdGetDatum(statoid));
+#endif
+	if (!HeapTupleIsValid(dtup))
+		return false;
+
+	htup = SearchSysCache1(STATEXTOID, ObjectIdGetDatum(statoid));
+	if (!HeapTupleIsValid(htup))
+		elog(ERROR, "cache lookup failed for statistics object %u", statoid);
+
+	datum = SysCacheGetAttr(STATEXTOID, htup,
+							Anum_pg_statistic_ext_stxkind, &isnull);
+	Assert(!isnull);
+	arr = DatumGetArrayTypeP(datum);
+	enabled = (char *) ARR_DATA_PTR(arr);
+	for (i = 0; i < ARR_DIMS(arr)[0] && result; i++)
+	{
+		AttrNumber	attnum;
+
+		if (enabled[i] == STATS_EXT_NDISTINCT)
+			attnum = Anum_pg_statistic_ext_data_stxdndistinct;
+		else if (enabled[i] == STATS_EXT_DEPENDENCIES)
+			attnum = Anum_pg_statistic_ext_data_stxddependencies;
+		else if (enabled[i] == STATS_EXT_MCV)
+			attnum = Anum_pg_statistic_ext_data_stxdmcv;
+		else
+			continue;
+
+		(void) SysCacheGetAttr(STATEXTDATASTXOID, dtup, attnum, &isnull);
+		result = !isnull;
+	}
+
+	ReleaseSysCache(htup);
+	ReleaseSysCache(dtup);
+	return result;
+}
+
+/*
+ * Statistics of the relation, analysed by ANALYZE. A retired one is never
+ * built: without skipping it, the relation would be sampled again and again.
+ */
+static List *
+analysed_statistics(List *statoids)
+{
+	List	   *result = NIL;
+	ListCell   *lc;
+
+	foreach(lc, statoids)
+	{
+		if (!statistics_retired(lfirst_oid(lc)))
+			result = lappend_oid(result, lfirst_oid(lc));
+	}
+	return result;
+}
+
+/*
+ * Does any statistics on the relation still have no data?
+ */
+static bool
+has_empty_statistics(List *statoids)
+{
+	ListCell   *lc;
+
+	foreach(lc, statoids)
+	{
+		if (!statistics_data_complete(lfirst_oid(lc)))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Collect attribute numbers of columns, involved in any statistics on the
+ * relation, including columns referenced by expressions.
+ */
+static Bitmapset *
+statistics_attnums(List *statoids)
+{
+	Bitmapset  *attnums = NULL;
+	ListCell   *lc;
+
+	foreach(lc, statoids)
+	{
+		Oid					statoid = lfirst_oid(lc);
+		HeapTuple			htup;
+		Form_pg_statistic_ext staForm;
+		Datum				datum;
+		bool				isnull;
+		int					i;
+
+		htup = SearchSysCache1(STATEXTOID, ObjectIdGetDatum(statoid));
+		if (!HeapTupleIsValid(htup))
+			elog(ERROR, "cache lookup failed for statistics object %u", statoid);
+		staForm = (Form_pg_statistic_ext) GETSTRUCT(htup);
+
+		for (i = 0; i < staForm->stxkeys.dim1; i++)
+			attnums = bms_add_member(attnums, staForm->stxkeys.values[i]);
+
+		datum = SysCacheGetAttr(STATEXTOID, htup,
+								Anum_pg_statistic_ext_stxexprs, &isnull);
+		if (!isnull)
+		{
+			char	   *exprsString = TextDatumGetCString(datum);
+			Bitmapset  *varattnos = NULL;
+			int			attnum = -1;
+
+			pull_varattnos(stringToNode(exprsString), 1, &varattnos);
+			while ((attnum = bms_next_member(varattnos, attnum)) >= 0)
+				attnums = bms_add_member(attnums,
+									attnum + FirstLowInvalidHeapAttributeNumber);
+			pfree(exprsString);
+		}
+
+		ReleaseSysCache(htup);
+	}
+
+	return attnums;
+}
+
+/*
+ * Statistics target of the column, as examine_attribute() of analyze.c gets it
+ */
+static int
+column_statistics_target(Relation rel, AttrNumber attnum)
+{
+	int			target;
+#if PG_VERSION_NUM >= 170000
+	HeapTuple	atttuple;
+	Datum		datum;
+	bool		isnull;
+
+	atttuple = SearchSysCache2(ATTNUM,
+							   ObjectIdGetDatum(RelationGetRelid(rel)),
+							   Int16GetDatum(attnum));
+	if (!HeapTupleIsValid(atttuple))
+		elog(ERROR, "cache lookup failed for attribute %d of relation %u",
+			 attnum, RelationGetRelid(rel));
+	datum = SysCacheGetAttr(ATTNUM, atttuple,
+							Anum_pg_attribute_attstattarget, &isnull);
+	target = isnull ? -1 : DatumGetInt16(datum);
+	ReleaseSysCache(atttuple);
+#else
+	target = TupleDescAttr(RelationGetDescr(rel), attnum - 1)->attstattarget;
+#endif
+
+	return (target < 0) ? default_statistics_target : target;
+}
+
+/*
+ * Fill the part of VacAttrStats, needed to build extended statistics. The
+ * code is based on the static examine_attribute() of analyze.c.
+ */
+static VacAttrStats *
+make_attr_stats(Relation rel, AttrNumber attnum)
+{
+	Form_pg_attribute	attr = TupleDescAttr(RelationGetDescr(rel), attnum - 1);
+	VacAttrStats	   *stats;
+	HeapTuple			typtuple;
+
+	stats = (VacAttrStats *) palloc0(sizeof(VacAttrStats));
+#if PG_VERSION_NUM >= 170000
+	stats->attstattarget = column_statistics_target(rel, attnum);
+#else
+	stats->attr = attr;
+#endif
+	stats->attrtypid = attr->atttypid;
+	stats->attrtypmod = attr->atttypmod;
+	stats->attrcollid = attr->attcollation;
+
+	typtuple = SearchSysCacheCopy1(TYPEOID, ObjectIdGetDatum(stats->attrtypid));
+	if (!HeapTupleIsValid(typtuple))
+		elog(ERROR, "cache lookup failed for type %u", stats->attrtypid);
+	stats->attrtype = (Form_pg_type) GETSTRUCT(typtuple);
+	stats->anl_context = CurrentMemoryContext;
+	stats->tupattnum = attnum;
+	/* Sample rows are decomposed by the descriptor of the relation */
+	stats->tupDesc = RelationGetDescr(rel);
+
+	return stats;
+}
+
+/*
+ * Fetch a random sample of targrows rows of the relation. Only columns,
+ * mentioned in the attrs array, are filled in, others are set to NULL.
+ * Return the number of sampled rows and estimated number of rows in the table.
+ *
+ * As ANALYZE, the sample is taken by the table owner, not filtered by the row
+ * level security. The caller must check the user is the owner.
+ *
+ * A background worker reports the sample query as its activity.
+ */
+int
+extstat_acquire_sample(Relation rel, AttrNumber *attrs, int natts,
+					   HeapTuple *rows, int targrows, double *totalrows,
+					   int delay, bool report)
+{
+	MemoryContext	rowsctx = CurrentMemoryContext;
+	TupleDesc		tupdesc = RelationGetDescr(rel);
+	StringInfoData	query;
+	SPIPlanPtr		plan;
+	Portal			portal;
+	Datum		   *values;
+	bool		   *nulls;
+	double			reltuples = rel->rd_rel->reltuples;
+	double			seen = 0;
+	int				numrows = 0;
+	int				i;
+	Oid				save_userid;
+	int				save_sec_context;
+	int				save_nestlevel;
+
+	initStringInfo(&query);
+	appendStringInfoString(&query, "SELECT ");
+	for (i = 0; i < natts; i++)
+		appendStringInfo(&query, "%s%s", i > 0 ? ", " : "",
+						 quote_identifier(NameStr(TupleDescAttr(tupdesc,
+															attrs[i] - 1)->attname)));
+	appendStringInfo(&query, " FROM ONLY %s",
+					 quote_qualified_identifier(
+						get_namespace_name(RelationGetNamespace(rel)),
+						RelationGetRelationName(rel)));
+
+	/*
+	 * Read only a part of the table's pages if it is big enough. Take a bit
+	 * more, because of uneven distribution of tuples over pages. The reservoir
+	 * cuts the rest off.
+	 */
+	if (reltuples > targrows)
+		appendStringInfo(&query, " TABLESAMPLE SYSTEM (%g)",
+						 Min(100., 150. * targrows / reltuples));
+
+	values = (Datum *) palloc0(tupdesc->natts * sizeof(Datum));
+	nulls = (bool *) palloc(tupdesc->natts * sizeof(bool));
+	memset(nulls, true, tupdesc->natts * sizeof(bool));
+
+	GetUserIdAndSecContext(&save_userid, &save_sec_context);
+	SetUserIdAndSecContext(rel->rd_rel->relowner,
+						   save_sec_context | SECURITY_RESTRICTED_OPERATION);
+	save_nestlevel = NewGUCNestLevel();
+
+	/* Error out, rather than get a sample, filtered by a forced policy */
+	(void) set_config_option("row_security", "off",
+							 PGC_USERSET, PGC_S_SESSION,
+							 GUC_ACTION_SAVE, true, 0, false);
+
+	SPI_connect();
+	if (report)
+		pgstat_report_activity(STATE_RUNNING, query.data);
+
+	plan = SPI_prepare(query.data, 0, NULL);
+	if (plan == NULL)
+		elog(ERROR, "failed to prepare \"%s\": %s",
+			 query.data, SPI_result_code_string(SPI_result));
+	portal = SPI_cursor_open(NULL, plan, NULL, NULL, true);
+
+	for (;;)
+	{
+		uint64	j;
+
+		SPI_cursor_fetch(portal, true, SAMPLE_BATCH_SIZE);
+		if (SPI_processed == 0)
+			break;
+
+		for (j = 0; j < SPI_processed; j++)
+		{
+			MemoryContext	oldctx;
+			HeapTuple		tuple;
+			int				k;
+
+			for (i = 0; i < natts; i++)
+				values[attrs[i] - 1] = SPI_getbinval(SPI_tuptable->vals[j],
+													 SPI_tuptable->tupdesc,
+													 i + 1,
+													 &nulls[attrs[i] - 1]);
+
+			oldctx = MemoryContextSwitchTo(rowsctx);
+			tuple = heap_form_tuple(tupdesc, values, nulls);
+			MemoryContextSwitchTo(oldctx);
+
+			/* Reservoir sampling, Algorithm R */
+			if (numrows < targrows)
+				rows[numrows++] = tuple;
+			else if ((k = (int) ((seen + 1) * sample_random())) < targrows)
+			{
+				heap_freetuple(rows[k]);
+				rows[k] = tuple;
+			}
+			else
+				heap_freetuple(tuple);
+			seen++;
+		}
+		SPI_freetuptable(SPI_tuptable);
+
+		/* Throttling */
+		if (delay > 0)
+		{
+			(void) WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+							 delay, PG_WAIT_EXTENSION);
+			ResetLatch(MyLatch);
+		}
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	SPI_cursor_close(portal);
+	SPI_finish();
+	if (report)
+		pgstat_report_activity(STATE_IDLE, NULL);
+
+	AtEOXact_GUC(false, save_nestlevel);
+	SetUserIdAndSecContext(save_userid, save_sec_context);
+
+	*totalrows = (reltuples > targrows) ? reltuples : seen;
+	return numrows;
+}
+
+/*
+ * Build extended statistics data of the relation, if some of its statistics
+ * have no data yet. All the statistics are built on the same sample, so
+ * statistics created together are processed with a single pass.
+ *
+ * Caller should provide a transaction and an appropriate lock on the relation.
+ * Return false if nothing has been done.
+ */
+bool
+extstat_analyze_relation(Relation rel, int delay)
+{
+	List		   *statoids;
+	MemoryContext	anl_context;
+	MemoryContext	oldctx;
+	Bitmapset	   *attnums;
+	AttrNumber	   *attrs;
+	VacAttrStats  **vacattrstats;
+	HeapTuple	   *rows;
+	double			totalrows;
+	int				targrows;
+	int				numrows;
+	int				natts = 0;
+	int				attnum = -1;
+	int				i;
+	Oid				save_userid;
+	int				save_sec_context;
+	int				save_nestlevel;
+
+	statoids = analysed_statistics(RelationGetStatExtList(rel));
+	if (statoids == NIL || !has_empty_statistics(statoids))
+		return false;
+
+	anl_context = AllocSetContextCreate(CurrentMemoryContext,
+										MODULE_NAME" analyze",
+										ALLOCSET_DEFAULT_SIZES);
+	oldctx = MemoryContextSwitchTo(anl_context);
+
+	attnums = statistics_attnums(statoids);
+	attrs = (AttrNumber *) palloc(bms_num_members(attnums) * sizeof(AttrNumber));
+	vacattrstats = (VacAttrStats **)
+		palloc(bms_num_members(attnums) * sizeof(VacAttrStats *));
+
+	while ((attnum = bms_next_member(attnums, attnum)) >= 0)
+	{
+		if (!AttrNumberIsForUserDefinedAttr(attnum) ||
+			TupleDescAttr(RelationGetDescr(rel), attnum - 1)->attisdropped)
+			continue;
+
+		attrs[natts] = attnum;
+		vacattrstats[natts] = make_attr_stats(rel, attnum);
+		natts++;
+	}
+
+	if (natts == 0)
+	{
+		/* Statistics on expressions without any columns. Don't bother. */
+		MemoryContextSwitchTo(oldctx);
+		MemoryContextDelete(anl_context);
+		return false;
+	}
+
+	/*
+	 * The sample size, as ANALYZE takes it: enough for each of the columns, as
+	 * std_typanalyze() estimates it, and for each of the statistics, with
+	 * their own targets.
+	 */
+	targrows = ComputeExtStatisticsRows(rel, natts, vacattrstats);
+	for (i = 0; i < natts; i++)
+		targrows = Max(targrows, 300 * column_statistics_target(rel, attrs[i]));
+	if (targrows == 0)
+	{
+		/* Each of the columns has the statistics target 0 */
+		MemoryContextSwitchTo(oldctx);
+		MemoryContextDelete(anl_context);
+		return false;
+	}
+
+	rows = (HeapTuple *) palloc(targrows * sizeof(HeapTuple));
+	numrows = extstat_acquire_sample(rel, attrs, natts, rows, targrows,
+									 &totalrows, delay, true);
+
+	elog(DEBUG1, MODULE_NAME": sampled %d rows of %.0f of relation \"%s\"",
+		 numrows, totalrows, RelationGetRelationName(rel));
+
+	/*
+	 * Expressions are evaluated under the table owner's userid, as ANALYZE
+	 * does.
+	 */
+	GetUserIdAndSecContext(&save_userid, &save_sec_context);
+	SetUserIdAndSecContext(rel->rd_rel->relowner,
+						   save_sec_context | SECURITY_RESTRICTED_OPERATION);
+	save_nestlevel = NewGUCNestLevel();
+
+	if (numrows > 0)
+#if PG_VERSION_NUM >= 150000
+		BuildRelationExtStatistics(rel, false, totalrows, numrows, rows,
+								   natts, vacattrstats);
+#else
+		BuildRelationExtStatistics(rel, totalrows, numrows, rows,
+								   natts, vacattrstats);
+#endif
+
+	AtEOXact_GUC(false, save_nestlevel);
+	SetUserIdAndSecContext(save_userid, save_sec_context);
+
+	MemoryContextSwitchTo(oldctx);
+	MemoryContextDelete(anl_context);
+	return numrows > 0;
+}
+
+/*
+ * Build data of empty extended statistics of the relation right now, the same
+ * way the background worker does. Return false if nothing has been done.
+ */
+Datum
+pg_index_stats_analyze(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	Relation	rel;
+	bool		result;
+
+	(void) rebuild_permitted(relid, true);
+
+	/* The same lock as ANALYZE takes */
+	rel = table_open(relid, ShareUpdateExclusiveLock);
+	if (rel->rd_rel->relkind != RELKIND_RELATION)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not a table",
+						RelationGetRelationName(rel))));
+
+	result = extstat_analyze_relation(rel, 0);
+	table_close(rel, NoLock);
+
+	PG_RETURN_BOOL(result);
+}
@@ -0,0 +1,14 @@
+#ifndef _EXTSTAT_ANALYZE_H_
+#define _EXTSTAT_ANALYZE_H_
+
+#include "postgres.h"
+
+#include "access/htup.h"
+#include "utils/relcache.h"
+
+extern bool extstat_analyze_relation(Relation rel, int delay);
+extern int extstat_acquire_sample(Relation rel, AttrNumber *attrs, int natts,
+								  HeapTuple *rows, int targrows,
+								  double *totalrows, int delay, bool report);
+
+#endif /* _EXTSTAT_ANALYZE_H_ */
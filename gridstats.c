@@ -0,0 +1,595 @@
+/*-------------------------------------------------------------------------
+ *
+ * gridstats.c
+ *		Multi-dimensional histogram on the columns of an index.
+ *
+ * Extended statistics of the core describe correlated columns by MCV and
+ * dependencies, which work for equalities. Range clauses on correlated
+ * columns, like "created BETWEEN $1 AND $2 AND updated BETWEEN $3 AND $4",
+ * are still estimated as independent ones. Here an equi-depth grid is built
+ * on a sample of the key columns of an index: bounds of each dimension are
+ * quantiles of the column, so each row of buckets keeps the same number of
+ * sampled rows, and the frequency of each cell of the grid is stored. Rows
+ * having a NULL in any column are counted by the nullfrac only. The grid is
+ * stored in the extension table, see statstore.c.
+ *
+ * The planner estimates range clauses on two or more dimensions of the grid:
+ * each clause compares a column with a constant, so the fraction of each
+ * bucket of the dimension is found by the bounds of the bucket, satisfying
+ * the clauses, as for a single-column histogram. The selectivity is the sum
+ * of the cell frequencies, weighted by the fractions of their buckets in each
+ * dimension.
+ *
+ * Copyright (c) 2023-2025 Andrei Lepikhov
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ * IDENTIFICATION
+ *	  contrib/pg_index_stats/gridstats.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <math.h>
+
+#include "access/genam.h"
+#include "access/htup_details.h"
+#include "access/table.h"
+#include "commands/vacuum.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/paths.h"
+#include "utils/builtins.h"
+#include "utils/datum.h"
+#include "utils/fmgroids.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/selfuncs.h"
+#include "utils/sortsupport.h"
+#include "utils/typcache.h"
+
+#include "extstat_analyze.h"
+#include "gridstats.h"
+#include "pg_index_stats.h"
+#include "statstore.h"
+
+PG_FUNCTION_INFO_V1(pg_index_stats_grid);
+
+static bool use_grid = true;
+
+static int
+compare_datums(const void *a, const void *b, void *arg)
+{
+	return ApplySortComparator(*(const Datum *) a, false,
+							   *(const Datum *) b, false,
+							   (SortSupport) arg);
+}
+
+/*
+ * Number of buckets in each dimension. The total number of cells is limited
+ * by the size of the sample: on average, a cell gets 3 sampled rows.
+ */
+static int
+grid_buckets(int ndims, int nrows)
+{
+	int		ncells = 100 * default_statistics_target;
+	int		nbuckets = (int) floor(pow(ncells, 1.0 / ndims) + 1e-9);
+
+	return Min(nbuckets, nrows);
+}
+
+/*
+ * Number of the bucket containing the value. A value equal to a bound goes
+ * to the bucket above it, the last bucket includes its upper bound.
+ */
+static int
+grid_bucket_of(Datum value, Datum *bounds, int nbuckets, SortSupport ssup)
+{
+	int		lo = 1;
+	int		hi = nbuckets;
+
+	/* Binary search of the first inner bound greater than the value */
+	while (lo < hi)
+	{
+		int		mid = (lo + hi) / 2;
+
+		if (ApplySortComparator(bounds[mid], false, value, false, ssup) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo - 1;
+}
+
+/*
+ * Sample the table and build the grid on the key columns of the index.
+ */
+static StoredStat *
+build_grid_statistics(Relation hrel, Relation irel)
+{
+	TupleDesc		tupdesc = RelationGetDescr(hrel);
+	TupleDesc		itupdesc = RelationGetDescr(irel);
+	int				ndims = IndexRelationGetNumberOfKeyAttributes(irel);
+	MemoryContext	build_ctx;
+	MemoryContext	oldctx;
+	AttrNumber	   *attnums;
+	SortSupport		ssup;
+	HeapTuple	   *rows;
+	Datum		   *values;
+	Datum		   *sorted;
+	Datum		   *bounds;
+	int			   *counts;
+	StoredStat	   *stat;
+	double			totalrows;
+	int				targrows;
+	int				numrows;
+	int				nonnull = 0;
+	int				nbuckets = 0;
+	int				ncells = 0;
+	int				i;
+	int				j;
+	int				k;
+
+	build_ctx = AllocSetContextCreate(CurrentMemoryContext,
+									  MODULE_NAME" grid statistics build context",
+									  ALLOCSET_DEFAULT_SIZES);
+	oldctx = MemoryContextSwitchTo(build_ctx);
+
+	attnums = (AttrNumber *) palloc(ndims * sizeof(AttrNumber));
+	for (j = 0; j < ndims; j++)
+		attnums[j] = irel->rd_index->indkey.values[j];
+
+	/* The same estimation as std_typanalyze() does */
+	targrows = 300 * default_statistics_target;
+	rows = (HeapTuple *) palloc(targrows * sizeof(HeapTuple));
+	numrows = extstat_acquire_sample(hrel, attnums, ndims, rows, targrows,
+									 &totalrows, 0, false);
+
+	elog(DEBUG1, MODULE_NAME": sampled %d rows of %.0f of relation \"%s\"",
+		 numrows, totalrows, RelationGetRelationName(hrel));
+
+	/* Clauses compare values by the default btree opclass of the type */
+	ssup = (SortSupport) palloc0(ndims * sizeof(SortSupportData));
+	for (j = 0; j < ndims; j++)
+	{
+		Form_pg_attribute	attr = TupleDescAttr(tupdesc, attnums[j] - 1);
+		TypeCacheEntry	   *typentry;
+
+		typentry = lookup_type_cache(attr->atttypid, TYPECACHE_LT_OPR);
+		if (!OidIsValid(typentry->lt_opr))
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_FUNCTION),
+					 errmsg("could not identify an ordering operator for type %s",
+							format_type_be(attr->atttypid))));
+
+		ssup[j].ssup_cxt = build_ctx;
+		ssup[j].ssup_collation = attr->attcollation;
+		ssup[j].ssup_nulls_first = false;
+		PrepareSortSupportFromOrderingOp(typentry->lt_opr, &ssup[j]);
+	}
+
+	/* Rows with a NULL are counted by the nullfrac only */
+	values = (Datum *) palloc(Max(numrows, 1) * ndims * sizeof(Datum));
+	for (i = 0; i < numrows; i++)
+	{
+		bool	hasnull = false;
+
+		for (j = 0; j < ndims; j++)
+		{
+			bool	isnull;
+
+			values[nonnull * ndims + j] = heap_getattr(rows[i], attnums[j],
+													   tupdesc, &isnull);
+			hasnull |= isnull;
+		}
+		if (!hasnull)
+			nonnull++;
+	}
+
+	if (nonnull > 0)
+	{
+		nbuckets = grid_buckets(ndims, nonnull);
+		ncells = (int) pow(nbuckets, ndims);
+	}
+
+	/*
+	 * Bounds of each dimension are quantiles, picked as ANALYZE does. Bounds
+	 * of a dimension are kept together for the search.
+	 */
+	bounds = (Datum *) palloc(Max(nbuckets + 1, 1) * ndims * sizeof(Datum));
+	sorted = (Datum *) palloc(Max(nonnull, 1) * sizeof(Datum));
+	for (j = 0; j < ndims && nbuckets > 0; j++)
+	{
+		for (i = 0; i < nonnull; i++)
+			sorted[i] = values[i * ndims + j];
+		qsort_arg(sorted, nonnull, sizeof(Datum), compare_datums, &ssup[j]);
+
+		for (k = 0; k <= nbuckets; k++)
+			bounds[j * (nbuckets + 1) + k] =
+				sorted[(int) ((int64) k * (nonnull - 1) / nbuckets)];
+	}
+
+	/* Distribute the rows among the cells */
+	counts = (int *) palloc0(Max(ncells, 1) * sizeof(int));
+	for (i = 0; i < nonnull && nbuckets > 0; i++)
+	{
+		int		cell = 0;
+
+		for (j = 0; j < ndims; j++)
+			cell = cell * nbuckets +
+				grid_bucket_of(values[i * ndims + j],
+							   &bounds[j * (nbuckets + 1)], nbuckets,
+							   &ssup[j]);
+		counts[cell]++;
+	}
+
+	MemoryContextSwitchTo(oldctx);
+
+	stat = (StoredStat *) palloc0(sizeof(StoredStat));
+	stat->indexrelid = RelationGetRelid(irel);
+	stat->kind = STATSTORE_KIND_GRID;
+	stat->ndims = ndims;
+	stat->typids = (Oid *) palloc(ndims * sizeof(Oid));
+	stat->nullfrac = (numrows > 0) ? (float4) (numrows - nonnull) / numrows : 0.;
+	stat->ndistinct = 0.;
+	stat->nvalues = (nbuckets > 0) ? nbuckets + 1 : 0;
+	stat->values = (Datum *) palloc(Max(stat->nvalues, 1) * ndims *
+									sizeof(Datum));
+	stat->nnumbers = ncells;
+	stat->numbers = (double *) palloc(Max(ncells, 1) * sizeof(double));
+
+	for (j = 0; j < ndims; j++)
+		stat->typids[j] = TupleDescAttr(itupdesc, j)->atttypid;
+
+	for (k = 0; k < stat->nvalues; k++)
+	{
+		for (j = 0; j < ndims; j++)
+		{
+			Form_pg_attribute attr = TupleDescAttr(itupdesc, j);
+
+			stat->values[k * ndims + j] =
+				datumCopy(bounds[j * (nbuckets + 1) + k],
+						  attr->attbyval, attr->attlen);
+		}
+	}
+
+	/* Frequencies among rows without NULLs */
+	for (i = 0; i < ncells; i++)
+		stat->numbers[i] = (double) counts[i] / nonnull;
+
+	MemoryContextDelete(build_ctx);
+	return stat;
+}
+
+/*
+ * Build the grid on the key columns of the index and store it, replacing the
+ * previous one. Return the number of cells.
+ */
+Datum
+pg_index_stats_grid(PG_FUNCTION_ARGS)
+{
+	Relation	hrel;
+	Relation	irel;
+	StoredStat *stat;
+	int			ndims;
+
+	irel = statstore_open_index(PG_GETARG_OID(0), "grid", &hrel);
+
+	ndims = IndexRelationGetNumberOfKeyAttributes(irel);
+	if (ndims < 2 || grid_buckets(ndims, INT_MAX) < 2)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot build grid statistics on index \"%s\"",
+						RelationGetRelationName(irel)),
+				 errdetail("Only indexes with 2 to %d key columns are supported.",
+						   (int) floor(log(100. * default_statistics_target) / log(2.)))));
+
+	stat = build_grid_statistics(hrel, irel);
+	statstore_save(stat);
+
+	index_close(irel, AccessShareLock);
+	table_close(hrel, NoLock);
+
+	PG_RETURN_INT32(stat->nnumbers);
+}
+
+/*
+ * Is the clause a comparison of a key column of the index with a constant,
+ * estimated by a histogram? Return the number of the dimension or -1. If the
+ * bounds must be hidden from the user, only a leakproof operator is accepted.
+ */
+static int
+grid_clause_dimension(PlannerInfo *root, RestrictInfo *rinfo, Index varno,
+					  IndexOptInfo *index, bool leakproof)
+{
+	OpExpr	   *opexpr = (OpExpr *) rinfo->clause;
+	RegProcedure oprrest;
+	Node	   *left;
+	Node	   *right;
+	Var		   *var;
+	int			j;
+
+	if (!IsA(opexpr, OpExpr) || list_length(opexpr->args) != 2)
+		return -1;
+
+	oprrest = get_oprrest(opexpr->opno);
+	if (oprrest != F_SCALARLTSEL && oprrest != F_SCALARLESEL &&
+		oprrest != F_SCALARGTSEL && oprrest != F_SCALARGESEL)
+		return -1;
+
+	if (leakproof && !get_func_leakproof(get_opcode(opexpr->opno)))
+		return -1;
+
+	/* Binary-compatible relabeling doesn't change the value */
+	left = linitial(opexpr->args);
+	right = lsecond(opexpr->args);
+	if (IsA(left, RelabelType))
+		left = (Node *) ((RelabelType *) left)->arg;
+	if (IsA(right, RelabelType))
+		right = (Node *) ((RelabelType *) right)->arg;
+
+	if (IsA(left, Var) && IsA(estimate_expression_value(root, right), Const))
+		var = (Var *) left;
+	else if (IsA(right, Var) &&
+			 IsA(estimate_expression_value(root, left), Const))
+		var = (Var *) right;
+	else
+		return -1;
+
+	if (var->varno != varno || var->varlevelsup != 0)
+		return -1;
+
+	for (j = 0; j < index->nkeycolumns; j++)
+	{
+		if (index->indexkeys[j] == var->varattno)
+			return j;
+	}
+	return -1;
+}
+
+/*
+ * Fraction of each bucket of the dimension, satisfying the clauses. A bucket
+ * is taken by half if only one of its bounds satisfies them.
+ *
+ * A range strictly inside a bucket satisfies no bound at all, and the grid
+ * can't tell it from an empty one. Return false in this case: the estimation
+ * is unknown.
+ */
+static bool
+grid_dimension_fractions(PlannerInfo *root, StoredStat *stat, int dim,
+						 List *clauses, double *fractions)
+{
+	int			nbounds = stat->nvalues;
+	bool	   *passed = (bool *) palloc(nbounds * sizeof(bool));
+	ListCell   *lc;
+	bool		found = false;
+	int			k;
+
+	for (k = 0; k < nbounds; k++)
+		passed[k] = true;
+
+	foreach(lc, clauses)
+	{
+		OpExpr	   *opexpr = (OpExpr *) ((RestrictInfo *) lfirst(lc))->clause;
+		Node	   *left = linitial(opexpr->args);
+		Node	   *right = lsecond(opexpr->args);
+		bool		varonleft;
+		Const	   *cnst;
+		FmgrInfo	opproc;
+
+		if (IsA(left, RelabelType))
+			left = (Node *) ((RelabelType *) left)->arg;
+		varonleft = IsA(left, Var);
+		cnst = (Const *) estimate_expression_value(root,
+												   varonleft ? right : left);
+
+		if (cnst->constisnull)
+		{
+			/* Comparison with NULL is never true */
+			memset(passed, false, nbounds * sizeof(bool));
+			break;
+		}
+
+		fmgr_info(get_opcode(opexpr->opno), &opproc);
+		for (k = 0; k < nbounds; k++)
+		{
+			Datum	bound = stat->values[k * stat->ndims + dim];
+
+			if (!passed[k])
+				continue;
+
+			if (varonleft)
+				passed[k] = DatumGetBool(FunctionCall2Coll(&opproc,
+														   opexpr->inputcollid,
+														   bound,
+														   cnst->constvalue));
+			else
+				passed[k] = DatumGetBool(FunctionCall2Coll(&opproc,
+														   opexpr->inputcollid,
+														   cnst->constvalue,
+														   bound));
+		}
+	}
+
+	for (k = 0; k < nbounds - 1; k++)
+		fractions[k] = 0.5 * ((passed[k] ? 1 : 0) + (passed[k + 1] ? 1 : 0));
+	for (k = 0; k < nbounds; k++)
+		found |= passed[k];
+
+	pfree(passed);
+	return found;
+}
+
+/*
+ * Estimate selectivity of the range clauses by the grid. Return -1, if the
+ * grid can't estimate them.
+ */
+static Selectivity
+grid_clauses_selectivity(PlannerInfo *root, StoredStat *stat, List **dims)
+{
+	int				nbuckets = stat->nvalues - 1;
+	double		  **fractions;
+	Selectivity		sel = 0.;
+	int				cell;
+	int				j;
+
+	fractions = (double **) palloc0(stat->ndims * sizeof(double *));
+	for (j = 0; j < stat->ndims; j++)
+	{
+		if (dims[j] == NIL)
+			continue;
+
+		fractions[j] = (double *) palloc(nbuckets * sizeof(double));
+		if (!grid_dimension_fractions(root, stat, j, dims[j], fractions[j]))
+		{
+			sel = -1.;
+			break;
+		}
+	}
+
+	for (cell = 0; cell < stat->nnumbers && sel >= 0.; cell++)
+	{
+		Selectivity	cell_sel = stat->numbers[cell];
+		int			rest = cell;
+
+		if (cell_sel <= 0.)
+			continue;
+
+		/* The last dimension changes first */
+		for (j = stat->ndims - 1; j >= 0 && cell_sel > 0.; j--)
+		{
+			if (fractions[j] != NULL)
+				cell_sel *= fractions[j][rest % nbuckets];
+			rest /= nbuckets;
+		}
+		sel += cell_sel;
+	}
+
+	for (j = 0; j < stat->ndims; j++)
+	{
+		if (fractions[j] != NULL)
+			pfree(fractions[j]);
+	}
+	pfree(fractions);
+
+	if (sel < 0.)
+		return sel;
+
+	sel *= (1.0 - stat->nullfrac);
+	CLAMP_PROBABILITY(sel);
+	return sel;
+}
+
+/*
+ * Estimate a base relation by the grid of the index, covering range clauses on
+ * the most of its columns. Return false if no grid can tell anything.
+ */
+bool
+gridstats_estimate_baserel(PlannerInfo *root, RelOptInfo *rel, Index rti,
+						   RangeTblEntry *rte, BaserelEstimate *est)
+{
+	StoredStat	   *best_stat = NULL;
+	List		  **best_dims = NULL;
+	int				best_ndims = 0;
+	List		   *covered = NIL;
+	List		   *rest;
+	Selectivity		sel;
+	ListCell	   *lc;
+
+	if (!use_grid || rel->reloptkind != RELOPT_BASEREL ||
+		rte->rtekind != RTE_RELATION || rte->inh ||
+		list_length(rel->baserestrictinfo) < 2 || rel->tuples <= 0.)
+		return false;
+
+	foreach(lc, rel->indexlist)
+	{
+		IndexOptInfo   *index = (IndexOptInfo *) lfirst(lc);
+		List		  **dims;
+		StoredStat	   *stat;
+		List		   *clauses = NIL;
+		Bitmapset	   *keys = NULL;
+		bool			leakproof;
+		ListCell	   *lc1;
+		int				ndims = 0;
+		int				j;
+
+		if (index->nkeycolumns < 2)
+			continue;
+
+		for (j = 0; j < index->nkeycolumns; j++)
+		{
+			if (index->indexkeys[j] != 0)
+				keys = bms_add_member(keys, index->indexkeys[j]);
+		}
+		leakproof = statstore_need_leakproof(rel, rte, keys);
+
+		/* Range clauses of each dimension of the grid */
+		dims = (List **) palloc0(index->nkeycolumns * sizeof(List *));
+		foreach(lc1, rel->baserestrictinfo)
+		{
+			RestrictInfo   *rinfo = (RestrictInfo *) lfirst(lc1);
+			int				dim;
+
+			dim = grid_clause_dimension(root, rinfo, rti, index, leakproof);
+			if (dim < 0)
+				continue;
+
+			if (dims[dim] == NIL)
+				ndims++;
+			dims[dim] = lappend(dims[dim], rinfo);
+			clauses = lappend(clauses, rinfo);
+		}
+
+		/* Look into the storage only for a suitable index */
+		if (ndims < 2 || ndims <= best_ndims)
+		{
+			pfree(dims);
+			continue;
+		}
+
+		stat = statstore_fetch(index->indexoid, STATSTORE_KIND_GRID);
+		if (stat == NULL || stat->ndims != index->nkeycolumns ||
+			stat->nvalues < 2 ||
+			stat->nnumbers != (int) pow(stat->nvalues - 1, stat->ndims))
+			continue;
+
+		best_stat = stat;
+		best_dims = dims;
+		best_ndims = ndims;
+		covered = clauses;
+	}
+
+	if (best_stat == NULL)
+		return false;
+
+	sel = grid_clauses_selectivity(root, best_stat, best_dims);
+	if (sel < 0.)
+		return false;
+
+	rest = list_difference_ptr(rel->baserestrictinfo, covered);
+	sel *= clauselist_selectivity(root, rest, 0, JOIN_INNER, NULL);
+
+	est->nclauses = list_length(covered);
+	est->rows = clamp_row_est(rel->tuples * sel);
+	return true;
+}
+
+void
+gridstats_init(void)
+{
+	DefineCustomBoolVariable(MODULE_NAME".grid",
+							 "Use multi-dimensional histograms in estimations",
+							 NULL,
+							 &use_grid,
+							 true,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+}
@@ -0,0 +1,15 @@
+#ifndef _GRIDSTATS_H_
+#define _GRIDSTATS_H_
+
+#include "postgres.h"
+
+#include "nodes/pathnodes.h"
+
+#include "pg_index_stats.h"
+
+extern void gridstats_init(void);
+extern bool gridstats_estimate_baserel(PlannerInfo *root, RelOptInfo *rel,
+									  Index rti, RangeTblEntry *rte,
+									  BaserelEstimate *est);
+
+#endif /* _GRIDSTATS_H_ */
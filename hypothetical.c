@@ -0,0 +1,647 @@
+/*-------------------------------------------------------------------------
+ *
+ * hypothetical.c
+ *		Hypothetical ("what-if") extended statistics.
+ *
+ * Before creating real statistics on a hot table, a user may want to see how
+ * they would change the estimations and the plan. Here an MCV list on a set of
+ * columns is built in the backend memory from a sample of the table and used
+ * by the planner of this backend only. pg_statistic_ext is never touched.
+ *
+ * The core planner loads the data of extended statistics from the syscache by
+ * the OID of the statistics object, so a fake StatisticExtInfo in the
+ * rel->statlist can't be served. Instead, the selectivity of clauses, covered
+ * by the hypothetical MCV, is estimated here the same way as
+ * mcv_clauselist_selectivity() does, and the number of rows of the base
+ * relation is corrected before the cheapest paths are chosen. Other kinds of
+ * extended statistics are used by the core only from the catalog, so they are
+ * not supported.
+ *
+ * Copyright (c) 2023-2025 Andrei Lepikhov
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ * IDENTIFICATION
+ *	  contrib/pg_index_stats/hypothetical.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/htup_details.h"
+#include "access/table.h"
+#include "catalog/pg_type.h"
+#include "commands/vacuum.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/paths.h"
+#include "statistics/statistics.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/datum.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/selfuncs.h"
+#include "utils/sortsupport.h"
+#include "utils/typcache.h"
+#include "utils/varlena.h"
+
+#include "extstat_analyze.h"
+#include "hypothetical.h"
+#include "pg_index_stats.h"
+#include "rebuild.h"
+#include "statstore.h"
+
+PG_FUNCTION_INFO_V1(pg_index_stats_hypothetical);
+PG_FUNCTION_INFO_V1(pg_index_stats_hypothetical_reset);
+
+/*
+ * MCV list of a hypothetical statistics. Values and NULL flags of the items
+ * are stored as flat arrays of nitems x natts elements.
+ */
+typedef struct HypoStat
+{
+	MemoryContext	mcxt;		/* all the data of the statistics */
+	Oid				relid;
+	int				natts;
+	AttrNumber	   *attnums;	/* in ascending order */
+	Oid			   *atttypids;	/* to detect ALTER COLUMN TYPE */
+	int				nitems;
+	Datum		   *values;
+	bool		   *isnull;
+	double		   *freqs;
+	double		   *base_freqs;
+	double			totalfreq;
+} HypoStat;
+
+/* Sampled row, or a group of identical rows */
+typedef struct SampleItem
+{
+	int			index;		/* number of the (first) row in the sample */
+	int			count;
+	int			order;		/* position of the group in the sorted sample */
+} SampleItem;
+
+typedef struct SampleSortContext
+{
+	SortSupport	ssup;
+	int			natts;
+	int			dim;		/* the only column to compare, or -1 for all */
+	Datum	   *values;
+	bool	   *isnull;
+} SampleSortContext;
+
+static List *hypo_stats = NIL;
+static MemoryContext hypo_memctx = NULL;
+
+static int
+compare_sample_items(const void *a, const void *b, void *arg)
+{
+	SampleSortContext  *cxt = (SampleSortContext *) arg;
+	int					ia = ((const SampleItem *) a)->index * cxt->natts;
+	int					ib = ((const SampleItem *) b)->index * cxt->natts;
+	int					j;
+
+	for (j = 0; j < cxt->natts; j++)
+	{
+		int		cmp;
+
+		if (cxt->dim >= 0 && j != cxt->dim)
+			continue;
+
+		cmp = ApplySortComparator(cxt->values[ia + j], cxt->isnull[ia + j],
+								  cxt->values[ib + j], cxt->isnull[ib + j],
+								  &cxt->ssup[j]);
+		if (cmp != 0)
+			return cmp;
+	}
+	return 0;
+}
+
+/* The most common groups first. Keep the order of values for equal counts */
+static int
+compare_sample_groups(const void *a, const void *b)
+{
+	const SampleItem   *ga = (const SampleItem *) a;
+	const SampleItem   *gb = (const SampleItem *) b;
+
+	if (ga->count != gb->count)
+		return (ga->count > gb->count) ? -1 : 1;
+	return (ga->order > gb->order) - (ga->order < gb->order);
+}
+
+/*
+ * Number of sample rows, having the same value in the column dim as the row
+ * index has. The items must be sorted by this column.
+ */
+static int
+column_value_count(SampleSortContext *cxt, SampleItem *items, int numrows,
+				   int index)
+{
+	SampleItem	key = {index, 0, 0};
+	int			lo = 0;
+	int			hi = numrows;
+	int			first;
+
+	/* The first item, not less than the key */
+	while (lo < hi)
+	{
+		int		mid = lo + (hi - lo) / 2;
+
+		if (compare_sample_items(&items[mid], &key, cxt) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	first = lo;
+
+	/* The first item, greater than the key */
+	hi = numrows;
+	while (lo < hi)
+	{
+		int		mid = lo + (hi - lo) / 2;
+
+		if (compare_sample_items(&items[mid], &key, cxt) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo - first;
+}
+
+/*
+ * Build an MCV list on the columns of the relation the same way as ANALYZE
+ * does: group identical rows of the sample and keep the most common groups.
+ * Return NULL if the sample is empty.
+ */
+static HypoStat *
+build_hypothetical_mcv(Relation rel, AttrNumber *attnums, int natts)
+{
+	TupleDesc			tupdesc = RelationGetDescr(rel);
+	MemoryContext		build_ctx;
+	MemoryContext		oldctx;
+	SampleSortContext	cxt;
+	HeapTuple		   *rows;
+	SampleItem		   *items;
+	SampleItem		   *groups;
+	HypoStat		   *stat = NULL;
+	double				totalrows;
+	int					targrows;
+	int					numrows;
+	int					ngroups;
+	int					nitems;
+	int					i;
+	int					j;
+
+	build_ctx = AllocSetContextCreate(CurrentMemoryContext,
+									  MODULE_NAME" hypothetical build context",
+									  ALLOCSET_DEFAULT_SIZES);
+	oldctx = MemoryContextSwitchTo(build_ctx);
+
+	/* The same estimation as std_typanalyze() does */
+	targrows = 300 * default_statistics_target;
+	rows = (HeapTuple *) palloc(targrows * sizeof(HeapTuple));
+	numrows = extstat_acquire_sample(rel, attnums, natts, rows, targrows,
+									 &totalrows, 0, false);
+
+	elog(DEBUG1, MODULE_NAME": sampled %d rows of %.0f of relation \"%s\"",
+		 numrows, totalrows, RelationGetRelationName(rel));
+
+	if (numrows == 0)
+	{
+		MemoryContextSwitchTo(oldctx);
+		MemoryContextDelete(build_ctx);
+		return NULL;
+	}
+
+	cxt.ssup = (SortSupport) palloc0(natts * sizeof(SortSupportData));
+	cxt.natts = natts;
+	cxt.dim = -1;
+	cxt.values = (Datum *) palloc(numrows * natts * sizeof(Datum));
+	cxt.isnull = (bool *) palloc(numrows * natts * sizeof(bool));
+
+	for (j = 0; j < natts; j++)
+	{
+		Form_pg_attribute	attr = TupleDescAttr(tupdesc, attnums[j] - 1);
+		TypeCacheEntry	   *typentry;
+
+		typentry = lookup_type_cache(attr->atttypid, TYPECACHE_LT_OPR);
+		cxt.ssup[j].ssup_cxt = build_ctx;
+		cxt.ssup[j].ssup_collation = attr->attcollation;
+		cxt.ssup[j].ssup_nulls_first = false;
+		PrepareSortSupportFromOrderingOp(typentry->lt_opr, &cxt.ssup[j]);
+	}
+
+	items = (SampleItem *) palloc(numrows * sizeof(SampleItem));
+	for (i = 0; i < numrows; i++)
+	{
+		for (j = 0; j < natts; j++)
+			cxt.values[i * natts + j] = heap_getattr(rows[i], attnums[j],
+													 tupdesc,
+													 &cxt.isnull[i * natts + j]);
+		items[i].index = i;
+	}
+
+	/* Group identical rows */
+	qsort_arg(items, numrows, sizeof(SampleItem), compare_sample_items, &cxt);
+
+	groups = (SampleItem *) palloc(numrows * sizeof(SampleItem));
+	ngroups = 0;
+	for (i = 0; i < numrows; i++)
+	{
+		if (i == 0 ||
+			compare_sample_items(&items[i - 1], &items[i], &cxt) != 0)
+		{
+			groups[ngroups].index = items[i].index;
+			groups[ngroups].count = 0;
+			groups[ngroups].order = ngroups;
+			ngroups++;
+		}
+		groups[ngroups - 1].count++;
+	}
+
+	qsort(groups, ngroups, sizeof(SampleItem), compare_sample_groups);
+
+	/*
+	 * Keep no more items, than ANALYZE would do. A single occurrence in a
+	 * sample says nothing about a frequency, unless the whole table was read.
+	 */
+	nitems = Min(ngroups, default_statistics_target);
+	if (numrows < totalrows)
+	{
+		while (nitems > 0 && groups[nitems - 1].count < 2)
+			nitems--;
+	}
+
+	stat = (HypoStat *) MemoryContextAllocZero(hypo_memctx, sizeof(HypoStat));
+	stat->mcxt = AllocSetContextCreate(hypo_memctx,
+									   MODULE_NAME" hypothetical statistics",
+									   ALLOCSET_SMALL_SIZES);
+	MemoryContextSwitchTo(stat->mcxt);
+
+	stat->relid = RelationGetRelid(rel);
+	stat->natts = natts;
+	stat->attnums = (AttrNumber *) palloc(natts * sizeof(AttrNumber));
+	stat->atttypids = (Oid *) palloc(natts * sizeof(Oid));
+	stat->nitems = nitems;
+	stat->values = (Datum *) palloc0(Max(nitems, 1) * natts * sizeof(Datum));
+	stat->isnull = (bool *) palloc(Max(nitems, 1) * natts * sizeof(bool));
+	stat->freqs = (double *) palloc(Max(nitems, 1) * sizeof(double));
+	stat->base_freqs = (double *) palloc(Max(nitems, 1) * sizeof(double));
+
+	for (i = 0; i < nitems; i++)
+	{
+		stat->freqs[i] = (double) groups[i].count / numrows;
+		stat->base_freqs[i] = 1.0;
+		stat->totalfreq += stat->freqs[i];
+	}
+
+	for (j = 0; j < natts; j++)
+	{
+		Form_pg_attribute	attr = TupleDescAttr(tupdesc, attnums[j] - 1);
+
+		stat->attnums[j] = attnums[j];
+		stat->atttypids[j] = attr->atttypid;
+
+		for (i = 0; i < nitems; i++)
+		{
+			int		src = groups[i].index * natts + j;
+			int		dst = i * natts + j;
+
+			stat->isnull[dst] = cxt.isnull[src];
+			if (!cxt.isnull[src])
+				stat->values[dst] = datumCopy(cxt.values[src], attr->attbyval,
+											  attr->attlen);
+		}
+
+		/* Frequencies of the values of the column alone */
+		MemoryContextSwitchTo(build_ctx);
+		cxt.dim = j;
+		qsort_arg(items, numrows, sizeof(SampleItem), compare_sample_items,
+				  &cxt);
+		for (i = 0; i < nitems; i++)
+			stat->base_freqs[i] *= (double) column_value_count(&cxt, items,
+															   numrows,
+															   groups[i].index) /
+								   numrows;
+		MemoryContextSwitchTo(stat->mcxt);
+	}
+
+	MemoryContextSwitchTo(oldctx);
+	MemoryContextDelete(build_ctx);
+	return stat;
+}
+
+static void
+check_hypothetical_kinds(const char *kinds)
+{
+	List	   *elemlist = NIL;
+	ListCell   *lc;
+	char	   *tmp_str = pstrdup(kinds);
+
+	if (!SplitDirectoriesString(tmp_str, ',', &elemlist) || elemlist == NIL)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid list of statistics kinds: \"%s\"", kinds)));
+
+	foreach(lc, elemlist)
+	{
+		char   *stattype = (char *) lfirst(lc);
+
+		if (strcmp(stattype, STAT_MCV_NAME) == 0)
+			continue;
+		else if (strcmp(stattype, STAT_NDISTINCT_NAME) == 0 ||
+				 strcmp(stattype, STAT_DEPENDENCIES_NAME) == 0 ||
+				 strcmp(stattype, "all") == 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("hypothetical statistics of kind \"%s\" are not supported",
+							stattype),
+					 errhint("Only \"%s\" statistics may be hypothetical.",
+							 STAT_MCV_NAME)));
+		else
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("unrecognized statistics kind \"%s\"", stattype)));
+	}
+
+	list_free_deep(elemlist);
+	pfree(tmp_str);
+}
+
+/*
+ * Build hypothetical statistics on the columns of the relation. The
+ * statistics replace ones, built earlier on the same columns, and live until
+ * the end of the session or the reset.
+ * Return the number of MCV items.
+ */
+Datum
+pg_index_stats_hypothetical(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	ArrayType  *columns = PG_GETARG_ARRAYTYPE_P(1);
+	char	   *kinds = text_to_cstring(PG_GETARG_TEXT_PP(2));
+	Relation	rel;
+	Datum	   *elems;
+	bool	   *elemnulls;
+	int			nelems;
+	Bitmapset  *attset = NULL;
+	AttrNumber *attnums;
+	int			natts = 0;
+	int			attnum = -1;
+	HypoStat   *stat;
+	ListCell   *lc;
+	int			i;
+
+	check_hypothetical_kinds(kinds);
+
+	/* The table is sampled by its owner, as CREATE STATISTICS requires */
+	(void) rebuild_permitted(relid, true);
+
+	rel = relation_open(relid, AccessShareLock);
+
+	if (rel->rd_rel->relkind != RELKIND_RELATION &&
+		rel->rd_rel->relkind != RELKIND_MATVIEW)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("cannot build hypothetical statistics on relation \"%s\"",
+						RelationGetRelationName(rel)),
+				 errdetail("Only tables and materialized views are supported.")));
+
+	deconstruct_array(columns, NAMEOID, NAMEDATALEN, false, TYPALIGN_CHAR,
+					  &elems, &elemnulls, &nelems);
+
+	for (i = 0; i < nelems; i++)
+	{
+		char			   *attname;
+		AttrNumber			att;
+		Form_pg_attribute	attr;
+
+		if (elemnulls[i])
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("column name must not be null")));
+
+		attname = NameStr(*DatumGetName(elems[i]));
+		att = get_attnum(relid, attname);
+		if (att == InvalidAttrNumber)
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_COLUMN),
+					 errmsg("column \"%s\" does not exist", attname)));
+		if (!AttrNumberIsForUserDefinedAttr(att))
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("statistics creation on system columns is not supported")));
+		if (bms_is_member(att, attset))
+			ereport(ERROR,
+					(errcode(ERRCODE_DUPLICATE_COLUMN),
+					 errmsg("duplicate column name in statistics definition")));
+
+		attr = TupleDescAttr(RelationGetDescr(rel), att - 1);
+		if (!OidIsValid(lookup_type_cache(attr->atttypid,
+										  TYPECACHE_LT_OPR)->lt_opr))
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("column \"%s\" cannot be used in statistics because its type %s has no default btree operator class",
+							attname, format_type_be(attr->atttypid))));
+
+		attset = bms_add_member(attset, att);
+	}
+
+	if (bms_num_members(attset) < 2 ||
+		bms_num_members(attset) > STATS_MAX_DIMENSIONS)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("hypothetical statistics require from 2 to %d columns",
+						STATS_MAX_DIMENSIONS)));
+
+	attnums = (AttrNumber *) palloc(bms_num_members(attset) * sizeof(AttrNumber));
+	while ((attnum = bms_next_member(attset, attnum)) >= 0)
+		attnums[natts++] = (AttrNumber) attnum;
+
+	if (hypo_memctx == NULL)
+		hypo_memctx = AllocSetContextCreate(TopMemoryContext,
+											MODULE_NAME" - hypothetical statistics",
+											ALLOCSET_DEFAULT_SIZES);
+
+	stat = build_hypothetical_mcv(rel, attnums, natts);
+	relation_close(rel, AccessShareLock);
+
+	/* Forget previous statistics on the same columns */
+	foreach(lc, hypo_stats)
+	{
+		HypoStat   *old = (HypoStat *) lfirst(lc);
+
+		if (old->relid != relid || old->natts != natts ||
+			memcmp(old->attnums, attnums, natts * sizeof(AttrNumber)) != 0)
+			continue;
+
+		hypo_stats = foreach_delete_current(hypo_stats, lc);
+		MemoryContextDelete(old->mcxt);
+		pfree(old);
+	}
+
+	if (stat == NULL)
+		PG_RETURN_INT32(0);
+
+	{
+		MemoryContext oldctx = MemoryContextSwitchTo(hypo_memctx);
+
+		hypo_stats = lappend(hypo_stats, stat);
+		MemoryContextSwitchTo(oldctx);
+	}
+
+	PG_RETURN_INT32(stat->nitems);
+}
+
+/*
+ * Forget all the hypothetical statistics of the backend
+ */
+Datum
+pg_index_stats_hypothetical_reset(PG_FUNCTION_ARGS)
+{
+	hypo_stats = NIL;
+	if (hypo_memctx != NULL)
+		MemoryContextReset(hypo_memctx);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Estimate selectivity of the clauses as mcv_clauselist_selectivity() does:
+ * the clauses are evaluated on each MCV item, and the part of the data, not
+ * covered by the MCV list, is estimated by per-column statistics.
+ *
+ * An error, raised by a clause on some MCV item, is reported by the planning.
+ * It is a diagnostic tool, so we don't hide it.
+ */
+static Selectivity
+mcv_clauses_selectivity(PlannerInfo *root, HypoStat *stat, List *clauses,
+						TupleDesc tupdesc)
+{
+	bool		   *passed;
+	Selectivity		mcv_sel = 0.;
+	Selectivity		mcv_basesel = 0.;
+	Selectivity		simple_sel;
+	Selectivity		other_sel;
+	Selectivity		sel;
+	int				i;
+
+	passed = statstore_eval_clauses(clauses, tupdesc, stat->nitems,
+									stat->natts, stat->attnums, stat->values,
+									stat->isnull);
+	for (i = 0; i < stat->nitems; i++)
+	{
+		if (passed[i])
+		{
+			mcv_sel += stat->freqs[i];
+			mcv_basesel += stat->base_freqs[i];
+		}
+	}
+	pfree(passed);
+
+	/* Estimation of the clauses as independent ones */
+	simple_sel = clauselist_selectivity_ext(root, clauses, 0, JOIN_INNER, NULL,
+											false);
+
+	other_sel = simple_sel - mcv_basesel;
+	CLAMP_PROBABILITY(other_sel);
+	if (other_sel > 1.0 - stat->totalfreq)
+		other_sel = 1.0 - stat->totalfreq;
+
+	sel = mcv_sel + other_sel;
+	CLAMP_PROBABILITY(sel);
+	return sel;
+}
+
+/*
+ * Estimate a base relation by the hypothetical statistics, covering the most of
+ * its clauses. Return false if there are no such statistics.
+ */
+bool
+hypothetical_estimate_baserel(PlannerInfo *root, RelOptInfo *rel, Index rti,
+							  RangeTblEntry *rte, BaserelEstimate *est)
+{
+	HypoStat   *best = NULL;
+	List	   *covered = NIL;
+	List	   *rest;
+	Relation	hrel;
+	TupleDesc	tupdesc;
+	Selectivity	sel;
+	ListCell   *lc;
+	int			j;
+
+	if (hypo_stats == NIL || rel->reloptkind != RELOPT_BASEREL ||
+		rte->rtekind != RTE_RELATION || rte->inh ||
+		list_length(rel->baserestrictinfo) < 2 || rel->tuples <= 0.)
+		return false;
+
+	foreach(lc, hypo_stats)
+	{
+		HypoStat   *stat = (HypoStat *) lfirst(lc);
+		Bitmapset  *columns = NULL;
+		Bitmapset  *attnums = NULL;
+		List	   *clauses = NIL;
+		bool		leakproof;
+		ListCell   *lc1;
+
+		if (stat->relid != rte->relid)
+			continue;
+
+		for (j = 0; j < stat->natts; j++)
+			columns = bms_add_member(columns, stat->attnums[j]);
+
+		leakproof = statstore_need_leakproof(rel, rte, columns);
+		foreach(lc1, rel->baserestrictinfo)
+		{
+			RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc1);
+
+			if (statstore_clause_is_compatible((Node *) rinfo->clause, rti,
+											   columns, leakproof, &attnums))
+				clauses = lappend(clauses, rinfo);
+		}
+
+		if (bms_num_members(attnums) >= 2 &&
+			list_length(clauses) > list_length(covered))
+		{
+			best = stat;
+			covered = clauses;
+		}
+	}
+
+	if (best == NULL)
+		return false;
+
+	/* The relation is already locked by the planner */
+	hrel = table_open(rte->relid, NoLock);
+	tupdesc = RelationGetDescr(hrel);
+
+	for (j = 0; j < best->natts; j++)
+	{
+		Form_pg_attribute attr;
+
+		attr = (best->attnums[j] <= tupdesc->natts) ?
+						TupleDescAttr(tupdesc, best->attnums[j] - 1) : NULL;
+		if (attr == NULL || attr->attisdropped ||
+			attr->atttypid != best->atttypids[j])
+		{
+			/* The table has been altered since the statistics were built */
+			table_close(hrel, NoLock);
+			return false;
+		}
+	}
+
+	sel = mcv_clauses_selectivity(root, best, covered, tupdesc);
+	table_close(hrel, NoLock);
+
+	rest = list_difference_ptr(rel->baserestrictinfo, covered);
+	sel *= clauselist_selectivity(root, rest, 0, JOIN_INNER, NULL);
+
+	est->nclauses = list_length(covered);
+	est->rows = clamp_row_est(rel->tuples * sel);
+	return true;
+}
@@ -0,0 +1,14 @@
+#ifndef _HYPOTHETICAL_H_
+#define _HYPOTHETICAL_H_
+
+#include "postgres.h"
+
+#include "nodes/pathnodes.h"
+
+#include "pg_index_stats.h"
+
+extern bool hypothetical_estimate_baserel(PlannerInfo *root, RelOptInfo *rel,
+										 Index rti, RangeTblEntry *rte,
+										 BaserelEstimate *est);
+
+#endif /* _HYPOTHETICAL_H_ */
@@ -0,0 +1,634 @@
+/*-------------------------------------------------------------------------
+ *
+ * keystats.c
+ *		Statistics on the whole key of a multi-column index.
+ *
+ * Univariate statistics on the ROW() of the index key columns is cheap and
+ * describes the data the way queries, utilising the index, see them: keyset
+ * pagination walks the key in the index order, and a composite lookup
+ * compares all the key columns at once. Here a sample of the table is sorted
+ * in the index order, and the most common keys and an equi-depth histogram of
+ * the rest of the keys are built, as ANALYZE does for a single column. Keys
+ * having a NULL in any column are not included and counted by the nullfrac.
+ * The statistics are stored in the extension table, see statstore.c.
+ *
+ * The core can't estimate a group of columns by a univariate statistics: the
+ * get_index_stats_hook is asked only about a single expression of an index.
+ * So, the restriction clauses of a base relation, referencing two or more key
+ * columns, are evaluated on the stored keys, and the number of rows of the
+ * relation is corrected before the cheapest paths are chosen. The fraction of
+ * the histogram is taken by the number of buckets, which bounds satisfy the
+ * clauses. An equality on the whole key, not found among the most common keys,
+ * is estimated by the number of distinct keys.
+ *
+ * Copyright (c) 2023-2025 Andrei Lepikhov
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ * IDENTIFICATION
+ *	  contrib/pg_index_stats/keystats.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/genam.h"
+#include "access/htup_details.h"
+#include "access/nbtree.h"
+#include "access/table.h"
+#include "catalog/pg_am.h"
+#include "catalog/pg_index.h"
+#include "commands/vacuum.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/paths.h"
+#include "utils/datum.h"
+#include "utils/fmgroids.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/selfuncs.h"
+#include "utils/sortsupport.h"
+
+#include "extstat_analyze.h"
+#include "keystats.h"
+#include "pg_index_stats.h"
+#include "statstore.h"
+
+PG_FUNCTION_INFO_V1(pg_index_stats_keystats);
+
+/* Sampled row, or a group of identical keys */
+typedef struct KeyItem
+{
+	int			index;		/* number of the (first) row in the sample */
+	int			count;
+	int			order;		/* position of the group in the sorted sample */
+} KeyItem;
+
+typedef struct KeySortContext
+{
+	SortSupport	ssup;
+	int			nkeys;
+	Datum	   *values;
+} KeySortContext;
+
+static bool use_keystats = true;
+
+static int
+compare_key_items(const void *a, const void *b, void *arg)
+{
+	KeySortContext *cxt = (KeySortContext *) arg;
+	int				ia = ((const KeyItem *) a)->index * cxt->nkeys;
+	int				ib = ((const KeyItem *) b)->index * cxt->nkeys;
+	int				j;
+
+	for (j = 0; j < cxt->nkeys; j++)
+	{
+		int		cmp;
+
+		cmp = ApplySortComparator(cxt->values[ia + j], false,
+								  cxt->values[ib + j], false,
+								  &cxt->ssup[j]);
+		if (cmp != 0)
+			return cmp;
+	}
+	return 0;
+}
+
+/* The most common keys first. Keep the index order for equal counts */
+static int
+compare_key_groups(const void *a, const void *b)
+{
+	const KeyItem  *ga = (const KeyItem *) a;
+	const KeyItem  *gb = (const KeyItem *) b;
+
+	if (ga->count != gb->count)
+		return (ga->count > gb->count) ? -1 : 1;
+	return (ga->order > gb->order) - (ga->order < gb->order);
+}
+
+/*
+ * Number of distinct keys in the table, estimated by the Haas-Stokes
+ * estimator, as ANALYZE does.
+ */
+static double
+estimate_key_ndistinct(int nonnull, int ngroups, int f1, double totalrows)
+{
+	double	numer;
+	double	denom;
+	double	result;
+
+	if (nonnull == 0)
+		return 0.;
+	if (nonnull >= totalrows)
+		/* The whole table was read */
+		return ngroups;
+	if (f1 == nonnull)
+		/* All the keys are unique */
+		return totalrows;
+
+	numer = (double) nonnull * ngroups;
+	denom = (nonnull - f1) + (double) f1 * nonnull / totalrows;
+	result = numer / denom;
+
+	if (result < ngroups)
+		result = ngroups;
+	if (result > totalrows)
+		result = totalrows;
+	return floor(result + 0.5);
+}
+
+/*
+ * Sample the table, sort the sample in the index order and build the list of
+ * the most common keys and the histogram of the rest of them.
+ */
+static StoredStat *
+build_key_statistics(Relation hrel, Relation irel)
+{
+	TupleDesc		tupdesc = RelationGetDescr(hrel);
+	TupleDesc		itupdesc = RelationGetDescr(irel);
+	int				nkeys = IndexRelationGetNumberOfKeyAttributes(irel);
+	MemoryContext	build_ctx;
+	MemoryContext	oldctx;
+	KeySortContext	cxt;
+	AttrNumber	   *attnums;
+	HeapTuple	   *rows;
+	KeyItem		   *items;
+	KeyItem		   *groups;
+	int			   *group_of;
+	bool		   *is_mcv;
+	int			   *rest;
+	StoredStat	   *stat;
+	double			totalrows;
+	int				targrows;
+	int				numrows;
+	int				nonnull = 0;
+	int				ngroups = 0;
+	int				f1 = 0;
+	int				nmcv;
+	int				nrest = 0;
+	int				nrestgroups = 0;
+	int				nhist = 0;
+	int				i;
+	int				j;
+
+	build_ctx = AllocSetContextCreate(CurrentMemoryContext,
+									  MODULE_NAME" key statistics build context",
+									  ALLOCSET_DEFAULT_SIZES);
+	oldctx = MemoryContextSwitchTo(build_ctx);
+
+	attnums = (AttrNumber *) palloc(nkeys * sizeof(AttrNumber));
+	for (j = 0; j < nkeys; j++)
+		attnums[j] = irel->rd_index->indkey.values[j];
+
+	/* The same estimation as std_typanalyze() does */
+	targrows = 300 * default_statistics_target;
+	rows = (HeapTuple *) palloc(targrows * sizeof(HeapTuple));
+	numrows = extstat_acquire_sample(hrel, attnums, nkeys, rows, targrows,
+									 &totalrows, 0, false);
+
+	elog(DEBUG1, MODULE_NAME": sampled %d rows of %.0f of relation \"%s\"",
+		 numrows, totalrows, RelationGetRelationName(hrel));
+
+	/* Compare keys as the index does */
+	cxt.ssup = (SortSupport) palloc0(nkeys * sizeof(SortSupportData));
+	cxt.nkeys = nkeys;
+	cxt.values = (Datum *) palloc(Max(numrows, 1) * nkeys * sizeof(Datum));
+	for (j = 0; j < nkeys; j++)
+	{
+		Oid		ltopr;
+
+		ltopr = get_opfamily_member(irel->rd_opfamily[j],
+									irel->rd_opcintype[j],
+									irel->rd_opcintype[j],
+									BTLessStrategyNumber);
+		if (!OidIsValid(ltopr))
+			elog(ERROR, "missing operator %d(%u,%u) in opfamily %u",
+				 BTLessStrategyNumber, irel->rd_opcintype[j],
+				 irel->rd_opcintype[j], irel->rd_opfamily[j]);
+
+		cxt.ssup[j].ssup_cxt = build_ctx;
+		cxt.ssup[j].ssup_collation = irel->rd_indcollation[j];
+		cxt.ssup[j].ssup_nulls_first = false;
+		PrepareSortSupportFromOrderingOp(ltopr, &cxt.ssup[j]);
+		if ((irel->rd_indoption[j] & INDOPTION_DESC) != 0)
+			cxt.ssup[j].ssup_reverse = !cxt.ssup[j].ssup_reverse;
+	}
+
+	/* Keys with a NULL are counted by the nullfrac only */
+	items = (KeyItem *) palloc(Max(numrows, 1) * sizeof(KeyItem));
+	for (i = 0; i < numrows; i++)
+	{
+		bool	hasnull = false;
+
+		for (j = 0; j < nkeys; j++)
+		{
+			bool	isnull;
+
+			cxt.values[nonnull * nkeys + j] = heap_getattr(rows[i], attnums[j],
+														   tupdesc, &isnull);
+			hasnull |= isnull;
+		}
+		if (hasnull)
+			continue;
+
+		items[nonnull].index = nonnull;
+		nonnull++;
+	}
+
+	qsort_arg(items, nonnull, sizeof(KeyItem), compare_key_items, &cxt);
+
+	/* Group identical keys, remembering the group of each sorted row */
+	groups = (KeyItem *) palloc(Max(nonnull, 1) * sizeof(KeyItem));
+	group_of = (int *) palloc(Max(nonnull, 1) * sizeof(int));
+	for (i = 0; i < nonnull; i++)
+	{
+		if (i == 0 ||
+			compare_key_items(&items[i - 1], &items[i], &cxt) != 0)
+		{
+			groups[ngroups].index = items[i].index;
+			groups[ngroups].count = 0;
+			groups[ngroups].order = ngroups;
+			ngroups++;
+		}
+		groups[ngroups - 1].count++;
+		group_of[i] = ngroups - 1;
+	}
+	for (i = 0; i < ngroups; i++)
+	{
+		if (groups[i].count == 1)
+			f1++;
+	}
+
+	/*
+	 * The whole distribution fits into the list of the most common keys.
+	 * Otherwise, a key should be noticeably more common than the average, as
+	 * ANALYZE requires.
+	 */
+	qsort(groups, ngroups, sizeof(KeyItem), compare_key_groups);
+	if (ngroups <= default_statistics_target)
+		nmcv = ngroups;
+	else
+	{
+		double	mincount = 1.25 * nonnull / ngroups;
+
+		if (mincount < 2)
+			mincount = 2;
+
+		nmcv = 0;
+		while (nmcv < default_statistics_target &&
+			   groups[nmcv].count >= mincount)
+			nmcv++;
+	}
+
+	is_mcv = (bool *) palloc0(Max(ngroups, 1) * sizeof(bool));
+	for (i = 0; i < nmcv; i++)
+		is_mcv[groups[i].order] = true;
+
+	/* The rest of the keys in the index order */
+	rest = (int *) palloc(Max(nonnull, 1) * sizeof(int));
+	for (i = 0; i < nonnull; i++)
+	{
+		if (is_mcv[group_of[i]])
+			continue;
+		if (nrest == 0 || group_of[rest[nrest - 1]] != group_of[i])
+			nrestgroups++;
+		rest[nrest++] = i;
+	}
+	if (nrestgroups >= 2)
+		nhist = Min(nrestgroups, default_statistics_target + 1);
+
+	MemoryContextSwitchTo(oldctx);
+
+	stat = (StoredStat *) palloc0(sizeof(StoredStat));
+	stat->indexrelid = RelationGetRelid(irel);
+	stat->kind = STATSTORE_KIND_KEY;
+	stat->ndims = nkeys;
+	stat->typids = (Oid *) palloc(nkeys * sizeof(Oid));
+	stat->nullfrac = (numrows > 0) ? (float4) (numrows - nonnull) / numrows : 0.;
+	stat->ndistinct = estimate_key_ndistinct(nonnull, ngroups, f1,
+											 totalrows * nonnull /
+											 Max(numrows, 1));
+	stat->nvalues = nmcv + nhist;
+	stat->values = (Datum *) palloc(Max(stat->nvalues, 1) * nkeys *
+									sizeof(Datum));
+	stat->nnumbers = nmcv;
+	stat->numbers = (double *) palloc(Max(nmcv, 1) * sizeof(double));
+
+	for (j = 0; j < nkeys; j++)
+		stat->typids[j] = TupleDescAttr(itupdesc, j)->atttypid;
+
+	for (i = 0; i < nmcv; i++)
+	{
+		stat->numbers[i] = (double) groups[i].count / numrows;
+		for (j = 0; j < nkeys; j++)
+		{
+			Form_pg_attribute attr = TupleDescAttr(itupdesc, j);
+
+			stat->values[i * nkeys + j] =
+				datumCopy(cxt.values[groups[i].index * nkeys + j],
+						  attr->attbyval, attr->attlen);
+		}
+	}
+
+	/* Bounds of the equi-depth histogram, as compute_scalar_stats() picks */
+	if (nhist > 0)
+	{
+		int		delta = (nrest - 1) / (nhist - 1);
+		int		deltafrac = (nrest - 1) % (nhist - 1);
+		int		pos = 0;
+		int		posfrac = 0;
+
+		for (i = 0; i < nhist; i++)
+		{
+			int		src = items[rest[pos]].index;
+
+			for (j = 0; j < nkeys; j++)
+			{
+				Form_pg_attribute attr = TupleDescAttr(itupdesc, j);
+
+				stat->values[(nmcv + i) * nkeys + j] =
+					datumCopy(cxt.values[src * nkeys + j],
+							  attr->attbyval, attr->attlen);
+			}
+
+			pos += delta;
+			posfrac += deltafrac;
+			if (posfrac >= (nhist - 1))
+			{
+				pos++;
+				posfrac -= (nhist - 1);
+			}
+		}
+	}
+
+	MemoryContextDelete(build_ctx);
+	return stat;
+}
+
+/*
+ * Build statistics on the key of the index and store them, replacing the
+ * previous ones. Return the number of stored keys: the most common ones and
+ * bounds of the histogram.
+ */
+Datum
+pg_index_stats_keystats(PG_FUNCTION_ARGS)
+{
+	Relation	hrel;
+	Relation	irel;
+	StoredStat *stat;
+	int			nkeys;
+
+	irel = statstore_open_index(PG_GETARG_OID(0), "key", &hrel);
+
+	nkeys = IndexRelationGetNumberOfKeyAttributes(irel);
+	if (irel->rd_rel->relam != BTREE_AM_OID || nkeys < 2 ||
+		RelationGetIndexPredicate(irel) != NIL)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot build key statistics on index \"%s\"",
+						RelationGetRelationName(irel)),
+				 errdetail("Only not partial btree indexes with two or more key columns are supported.")));
+
+	stat = build_key_statistics(hrel, irel);
+	statstore_save(stat);
+
+	index_close(irel, AccessShareLock);
+	table_close(hrel, NoLock);
+
+	PG_RETURN_INT32(stat->nvalues);
+}
+
+/*
+ * Do the clauses include an equality on each column of the key?
+ */
+static bool
+clauses_match_whole_key(List *clauses, IndexOptInfo *index)
+{
+	Bitmapset  *attnums = NULL;
+	ListCell   *lc;
+	int			j;
+
+	foreach(lc, clauses)
+	{
+		Node	   *clause = (Node *) ((RestrictInfo *) lfirst(lc))->clause;
+		OpExpr	   *opexpr;
+		Node	   *left;
+		Node	   *right;
+
+		if (!IsA(clause, OpExpr))
+			continue;
+		opexpr = (OpExpr *) clause;
+		if (list_length(opexpr->args) != 2 ||
+			get_oprrest(opexpr->opno) != F_EQSEL)
+			continue;
+
+		left = strip_implicit_coercions(linitial(opexpr->args));
+		right = strip_implicit_coercions(lsecond(opexpr->args));
+		if (IsA(left, Var) && !contain_var_clause(right))
+			attnums = bms_add_member(attnums, ((Var *) left)->varattno);
+		else if (IsA(right, Var) && !contain_var_clause(left))
+			attnums = bms_add_member(attnums, ((Var *) right)->varattno);
+	}
+
+	for (j = 0; j < index->nkeycolumns; j++)
+	{
+		if (!bms_is_member(index->indexkeys[j], attnums))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Estimate selectivity of the clauses by the key statistics. Return -1, if
+ * the statistics can't tell anything: neither a common key nor a bound of the
+ * histogram satisfies the clauses.
+ */
+static Selectivity
+key_clauses_selectivity(StoredStat *stat, IndexOptInfo *index, List *clauses,
+						TupleDesc tupdesc)
+{
+	int				nmcv = stat->nnumbers;
+	int				nhist = stat->nvalues - nmcv;
+	AttrNumber	   *attnums;
+	bool		   *passed;
+	int				npassed = 0;
+	Selectivity		mcv_sel = 0.;
+	Selectivity		mcv_total = 0.;
+	Selectivity		other_frac;
+	Selectivity		sel;
+	int				i;
+	int				j;
+
+	attnums = (AttrNumber *) palloc(stat->ndims * sizeof(AttrNumber));
+	for (j = 0; j < stat->ndims; j++)
+		attnums[j] = index->indexkeys[j];
+
+	passed = statstore_eval_clauses(clauses, tupdesc, stat->nvalues,
+									stat->ndims, attnums, stat->values, NULL);
+	for (i = 0; i < stat->nvalues; i++)
+	{
+		if (passed[i])
+			npassed++;
+	}
+	pfree(attnums);
+
+	for (i = 0; i < nmcv; i++)
+	{
+		mcv_total += stat->numbers[i];
+		if (passed[i])
+			mcv_sel += stat->numbers[i];
+	}
+
+	other_frac = 1.0 - stat->nullfrac - mcv_total;
+	CLAMP_PROBABILITY(other_frac);
+
+	if (clauses_match_whole_key(clauses, index))
+	{
+		/* A single key. If it isn't common, it is an average one. */
+		if (mcv_sel > 0.)
+			sel = mcv_sel;
+		else
+			sel = other_frac / Max(stat->ndistinct - nmcv, 1.);
+	}
+	else
+	{
+		Selectivity	hist_sel = 0.;
+
+		if (npassed == 0)
+		{
+			pfree(passed);
+			return -1.;
+		}
+
+		/* A bucket with a single satisfying bound is taken by half */
+		if (nhist == 1)
+			hist_sel = passed[nmcv] ? 1. : 0.;
+		else if (nhist > 1)
+		{
+			for (i = nmcv; i < stat->nvalues - 1; i++)
+				hist_sel += 0.5 * ((passed[i] ? 1 : 0) + (passed[i + 1] ? 1 : 0));
+			hist_sel /= (nhist - 1);
+		}
+
+		sel = mcv_sel + hist_sel * other_frac;
+	}
+
+	pfree(passed);
+	CLAMP_PROBABILITY(sel);
+	return sel;
+}
+
+/*
+ * Estimate a base relation by the key statistics of the index, covering the
+ * most of its clauses. Return false if no statistics can tell anything.
+ */
+bool
+keystats_estimate_baserel(PlannerInfo *root, RelOptInfo *rel, Index rti,
+						  RangeTblEntry *rte, BaserelEstimate *est)
+{
+	IndexOptInfo   *best = NULL;
+	StoredStat	   *best_stat = NULL;
+	List		   *covered = NIL;
+	int				ncovered_atts = 0;
+	List		   *rest;
+	Relation		hrel;
+	Selectivity		sel;
+	ListCell	   *lc;
+
+	if (!use_keystats || rel->reloptkind != RELOPT_BASEREL ||
+		rte->rtekind != RTE_RELATION || rte->inh ||
+		rel->baserestrictinfo == NIL || rel->tuples <= 0.)
+		return false;
+
+	foreach(lc, rel->indexlist)
+	{
+		IndexOptInfo   *index = (IndexOptInfo *) lfirst(lc);
+		StoredStat	   *stat;
+		Bitmapset	   *keys = NULL;
+		Bitmapset	   *attnums = NULL;
+		List		   *clauses = NIL;
+		bool			leakproof;
+		ListCell	   *lc1;
+		int				j;
+
+		if (index->relam != BTREE_AM_OID || index->nkeycolumns < 2 ||
+			index->indpred != NIL)
+			continue;
+		for (j = 0; j < index->nkeycolumns; j++)
+		{
+			if (index->indexkeys[j] == 0)
+				break;
+			keys = bms_add_member(keys, index->indexkeys[j]);
+		}
+		if (j < index->nkeycolumns)
+			continue;
+
+		/*
+		 * Only comparisons are accepted: a NULL never satisfies them, so keys
+		 * with NULLs may be left out.
+		 */
+		leakproof = statstore_need_leakproof(rel, rte, keys);
+		foreach(lc1, rel->baserestrictinfo)
+		{
+			RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc1);
+
+			if (statstore_clause_is_compatible((Node *) rinfo->clause, rti,
+											   keys, leakproof, &attnums))
+				clauses = lappend(clauses, rinfo);
+		}
+
+		if (bms_num_members(attnums) < 2 ||
+			list_length(clauses) < list_length(covered) ||
+			(list_length(clauses) == list_length(covered) &&
+			 bms_num_members(attnums) <= ncovered_atts))
+			continue;
+
+		/* Look into the storage only for a suitable index */
+		stat = statstore_fetch(index->indexoid, STATSTORE_KIND_KEY);
+		if (stat == NULL || stat->ndims != index->nkeycolumns)
+			continue;
+
+		best = index;
+		best_stat = stat;
+		covered = clauses;
+		ncovered_atts = bms_num_members(attnums);
+	}
+
+	if (best == NULL)
+		return false;
+
+	/* The relation is already locked by the planner */
+	hrel = table_open(rte->relid, NoLock);
+	sel = key_clauses_selectivity(best_stat, best, covered,
+								  RelationGetDescr(hrel));
+	table_close(hrel, NoLock);
+
+	if (sel < 0.)
+		return false;
+
+	rest = list_difference_ptr(rel->baserestrictinfo, covered);
+	sel *= clauselist_selectivity(root, rest, 0, JOIN_INNER, NULL);
+
+	est->nclauses = list_length(covered);
+	est->rows = clamp_row_est(rel->tuples * sel);
+	return true;
+}
+
+void
+keystats_init(void)
+{
+	DefineCustomBoolVariable(MODULE_NAME".keystats",
+							 "Use statistics on index keys in estimations",
+							 NULL,
+							 &use_keystats,
+							 true,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+}
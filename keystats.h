@@ -0,0 +1,15 @@
+#ifndef _KEYSTATS_H_
+#define _KEYSTATS_H_
+
+#include "postgres.h"
+
+#include "nodes/pathnodes.h"
+
+#include "pg_index_stats.h"
+
+extern void keystats_init(void);
+extern bool keystats_estimate_baserel(PlannerInfo *root, RelOptInfo *rel,
+									 Index rti, RangeTblEntry *rte,
+									 BaserelEstimate *est);
+
+#endif /* _KEYSTATS_H_ */
@@ -0,0 +1,213 @@
+/* contrib/pg_index_stats/pg_index_stats--0.2--0.3.sql */
+
+-- complain if script is sourced in psql, rather than via ALTER EXTENSION
+\echo Use "ALTER EXTENSION pg_index_stats UPDATE TO '0.3'" to load this file. \quit
+
+--
+-- Cluster-wide repository of extended statistics candidates, gathered by the
+-- QDS machinery. Needs the library to be loaded on startup.
+--
+CREATE FUNCTION pg_index_stats_candidates(
+	OUT dbid		oid,
+	OUT relid		oid,
+	OUT attnums		int2[],
+	OUT exprs		text,
+	OUT calls		int8,
+	OUT max_qerror	float8,
+	OUT mean_qerror	float8,
+	OUT rows		float8,
+	OUT score		float8,
+	OUT last_seen	timestamptz,
+	OUT processed	boolean
+)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_index_stats_candidates'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+
+CREATE VIEW pg_index_stats_candidates AS
+  SELECT * FROM pg_index_stats_candidates();
+
+CREATE FUNCTION pg_index_stats_candidates_reset()
+RETURNS void
+AS 'MODULE_PATHNAME', 'pg_index_stats_candidates_reset'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+
+REVOKE ALL ON FUNCTION pg_index_stats_candidates_reset() FROM PUBLIC;
+
+--
+-- Cardinality corrections, learned by the QDS from actual numbers of rows.
+-- Needs the library to be loaded on startup.
+--
+CREATE FUNCTION pg_index_stats_corrections(
+	OUT dbid		oid,
+	OUT relid		oid,
+	OUT signature	int8,
+	OUT class		int4,
+	OUT samples		int8,
+	OUT factor		float8,
+	OUT spread		float8,
+	OUT analyzed	timestamptz,
+	OUT last_seen	timestamptz
+)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_index_stats_corrections'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+
+CREATE VIEW pg_index_stats_corrections AS
+  SELECT * FROM pg_index_stats_corrections();
+
+CREATE FUNCTION pg_index_stats_corrections_reset()
+RETURNS void
+AS 'MODULE_PATHNAME', 'pg_index_stats_corrections_reset'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+
+REVOKE ALL ON FUNCTION pg_index_stats_corrections_reset() FROM PUBLIC;
+
+--
+-- Usage of statistics by the planner: accesses to statistics of columns
+-- (attnum isn't NULL) and usable extended statistics objects (statid isn't
+-- NULL). Needs the library to be loaded on startup.
+--
+CREATE FUNCTION pg_index_stats_usage(
+	OUT dbid		oid,
+	OUT relid		oid,
+	OUT attnum		int2,
+	OUT statid		oid,
+	OUT accesses	int8,
+	OUT queries		int8,
+	OUT last_used	timestamptz
+)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_index_stats_usage'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+
+CREATE VIEW pg_index_stats_usage AS
+  SELECT * FROM pg_index_stats_usage();
+
+CREATE FUNCTION pg_index_stats_usage_reset()
+RETURNS void
+AS 'MODULE_PATHNAME', 'pg_index_stats_usage_reset'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+
+REVOKE ALL ON FUNCTION pg_index_stats_usage_reset() FROM PUBLIC;
+
+--
+-- Native implementation of the rebuild. Tables can be filtered by schema and
+-- name. The incremental mode changes only statistics which differ from the
+-- result of the full rebuild.
+--
+DROP FUNCTION pg_index_stats_rebuild();
+CREATE FUNCTION pg_index_stats_rebuild(nspname name DEFAULT NULL,
+									   relname name DEFAULT NULL,
+									   incremental boolean DEFAULT false)
+RETURNS integer
+AS 'MODULE_PATHNAME', 'pg_index_stats_rebuild'
+LANGUAGE C VOLATILE;
+
+--
+-- Parallel rebuild. Each table is processed by a background worker in a
+-- separate transaction, so a failure is reported and doesn't affect others.
+--
+CREATE FUNCTION pg_index_stats_rebuild(parallel integer,
+									   nspname name DEFAULT NULL,
+									   relname name DEFAULT NULL,
+									   incremental boolean DEFAULT false)
+RETURNS TABLE (relid oid, relation text, nstats integer, error text)
+AS 'MODULE_PATHNAME', 'pg_index_stats_rebuild_parallel'
+LANGUAGE C VOLATILE;
+
+REVOKE ALL ON FUNCTION pg_index_stats_rebuild(integer, name, name, boolean)
+FROM PUBLIC;
+
+--
+-- Parallel rebuild in all the databases, where the extension is installed
+--
+CREATE FUNCTION pg_index_stats_rebuild_all(parallel integer DEFAULT 1,
+										   incremental boolean DEFAULT false)
+RETURNS TABLE (datname name, relid oid, relation text, nstats integer,
+			   error text)
+AS 'MODULE_PATHNAME', 'pg_index_stats_rebuild_all'
+LANGUAGE C VOLATILE;
+
+REVOKE ALL ON FUNCTION pg_index_stats_rebuild_all(integer, boolean) FROM PUBLIC;
+
+--
+-- Build data of empty extended statistics of the table right now, as the
+-- background worker does.
+--
+CREATE FUNCTION pg_index_stats_analyze(relation regclass)
+RETURNS boolean
+AS 'MODULE_PATHNAME', 'pg_index_stats_analyze'
+LANGUAGE C STRICT VOLATILE;
+
+--
+-- Choose a minimal-cost set of statistics, covering all the indexes of a table
+-- (or of each table, if relation is NULL).
+--
+CREATE FUNCTION pg_index_stats_compact(relation regclass DEFAULT NULL,
+									   dry_run boolean DEFAULT false)
+RETURNS TABLE (relid oid, relation text, nstats_before integer,
+			   nstats_after integer, nchanged integer, saved_bytes bigint,
+			   saved_analyze_ms float8)
+AS 'MODULE_PATHNAME', 'pg_index_stats_compact'
+LANGUAGE C VOLATILE;
+
+--
+-- Hypothetical ("what-if") MCV statistics. Built in the memory of the backend
+-- and used by its planner only, not touching pg_statistic_ext.
+--
+CREATE FUNCTION pg_index_stats_hypothetical(relation regclass,
+											columns name[],
+											kinds text DEFAULT 'mcv')
+RETURNS integer
+AS 'MODULE_PATHNAME', 'pg_index_stats_hypothetical'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE FUNCTION pg_index_stats_hypothetical_reset()
+RETURNS void
+AS 'MODULE_PATHNAME', 'pg_index_stats_hypothetical_reset'
+LANGUAGE C VOLATILE;
+
+--
+-- Statistics, built and managed by the extension itself: the planner of the
+-- core doesn't know about them. Values are stored in the binary form. Rows are
+-- keyed by OIDs of indexes, which don't survive a dump and restore, so the
+-- table isn't dumped: build the statistics again after a restore.
+--
+CREATE TABLE pg_index_stats_data (
+	indexrelid	oid NOT NULL,
+	kind		"char" NOT NULL,
+	keytypes	oid[] NOT NULL,
+	nullfrac	float4 NOT NULL,
+	ndistinct	float8 NOT NULL,
+	stavalues	bytea[],
+	stanumbers	float8[],
+	PRIMARY KEY (indexrelid, kind)
+);
+
+--
+-- Statistics on the whole key of a multi-column btree index: the most common
+-- keys and a histogram, built in the index order.
+--
+CREATE FUNCTION pg_index_stats_keystats(index regclass)
+RETURNS integer
+AS 'MODULE_PATHNAME', 'pg_index_stats_keystats'
+LANGUAGE C STRICT VOLATILE;
+
+--
+-- Multi-dimensional histogram on the key columns of an index: an equi-depth
+-- grid, estimating range clauses on correlated columns.
+--
+CREATE FUNCTION pg_index_stats_grid(index regclass)
+RETURNS integer
+AS 'MODULE_PATHNAME', 'pg_index_stats_grid'
+LANGUAGE C STRICT VOLATILE;
+
+--
+-- Remove statistics of the index, or of all the indexes which don't exist
+-- anymore, if index is NULL.
+--
+CREATE FUNCTION pg_index_stats_data_remove(index regclass DEFAULT NULL)
+RETURNS integer
+AS 'MODULE_PATHNAME', 'pg_index_stats_data_remove'
+LANGUAGE C VOLATILE;
@@ -30,17 +30,32 @@
 #include "commands/explain_state.h"
 #endif
 #include "commands/extension.h"
+#include "funcapi.h"
 #include "miscadmin.h"
 #include "nodes/makefuncs.h"
+#include "nodes/pathnodes.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/paths.h"
 #include "tcop/utility.h"
 #include "utils/builtins.h"
+#include "utils/guc.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
 #include "utils/varlena.h"
 
+#include "compaction.h"
 #include "pg_index_stats.h"
 #include "duplicated_slots.h"
+#include "gridstats.h"
+#include "hypothetical.h"
+#include "keystats.h"
+#include "statcost.h"
+#include "statprune.h"
+#include "statretire.h"
+#include "statstore.h"
+#include "statusage.h"
+#include "statworker.h"
 
 #if PG_VERSION_NUM >= 180000
 PG_MODULE_MAGIC_EXT(
@@ -56,6 +71,7 @@ PG_FUNCTION_INFO_V1(pg_index_stats_build);
 #define DEFAULT_STATTYPES STAT_MCV_NAME", "STAT_NDISTINCT_NAME
 
 static char *stattypes = DEFAULT_STATTYPES;
+static int32 stattypes_mask = 0; /* parsed value of the stattypes */
 static int extstat_columns_limit = 5; /* Don't allow to be too expensive */
 static bool combine_stats = true;
 
@@ -128,11 +144,19 @@ static int explain_level = 0;
 
 static bool sc_enable = false;
 
+/* Extended statistics, pruned during the planning (see statprune.c) */
+static int sc_nextstats = 0;
+static int sc_npruned = 0;
+static double sc_prune_time = 0.;
+
 static bool
 index_stats_hook(PlannerInfo *root, Oid indexOid, AttrNumber indexattnum,
 				 VariableStatData *vardata)
 {
-	/* TODO: at first we need to identify the use case */
+	/*
+	 * The core asks only about expressions of an index. Statistics on the
+	 * whole index key can't be passed this way and are applied by keystats.c.
+	 */
 
 	if (prev_get_index_stats_hook)
 		return (*prev_get_index_stats_hook) (root, indexOid, indexattnum, vardata);
@@ -285,6 +309,20 @@ relation_stats_hook(PlannerInfo *root, RangeTblEntry *rte, AttrNumber attnum,
 	return false;
 }
 
+/*
+ * Register pruning of extended statistics of a relation
+ */
+void
+explain_stat_register_pruning(int nstats, int npruned, double elapsed_ms)
+{
+	if (!sc_enable || explain_level != 1)
+		return;
+
+	sc_nextstats += nstats;
+	sc_npruned += npruned;
+	sc_prune_time += elapsed_ms;
+}
+
 static void
 sc_ExplainOneQuery_hook(Query *query, int cursorOptions, IntoClause *into,
 						struct ExplainState *es, const char *queryString,
@@ -335,6 +373,9 @@ sc_ExplainOneQuery_hook(Query *query, int cursorOptions, IntoClause *into,
 			}
 
 			sc_enable = false;
+			sc_nextstats = 0;
+			sc_npruned = 0;
+			sc_prune_time = 0.;
 		}
 	}
 	PG_END_TRY();
@@ -350,18 +391,27 @@ void _PG_init(void);
 
 static object_access_hook_type next_object_access_hook = NULL;
 static ProcessUtility_hook_type next_ProcessUtility_hook = NULL;
+static set_rel_pathlist_hook_type next_set_rel_pathlist_hook = NULL;
 
 static List *index_candidates = NIL;
 
+/* Tables, which lost statistics on a union of indexes with a dropped index */
+static List *dropped_union_tables = NIL;
+
+/* Dropped indexes, which stored statistics should be removed */
+static List *dropped_indexes = NIL;
+
 static bool pg_index_stats_build_int(Relation rel);
 
 static bool
-_check_stattypes_string(const char *str)
+_check_stattypes_string(const char *str, int32 *stat_types)
 {
 	List	   *elemlist = NIL;
 	ListCell   *lc;
 	char	   *tmp_str;
 
+	*stat_types = 0;
+
 	if (strlen(str) == 0)
 	{
 		GUC_check_errdetail("must not be empty");
@@ -377,25 +427,29 @@ _check_stattypes_string(const char *str)
 		return false;
 	}
 
-	pfree(tmp_str);
-
 	foreach(lc, elemlist)
 	{
 		char   *stattype = (char *) lfirst(lc);
 
 		if (strcmp(stattype, STAT_NDISTINCT_NAME) == 0)
-			continue;
+			*stat_types |= STAT_NDISTINCT;
 		else if (strcmp(stattype, STAT_MCV_NAME) == 0)
-			continue;
+			*stat_types |= STAT_MCV;
 		else if (strcmp(stattype, STAT_DEPENDENCIES_NAME) == 0)
-			continue;
+			*stat_types |= STAT_DEPENDENCIES;
 		else if (strcmp(stattype, "all") == 0)
-			continue;
-
-		GUC_check_errdetail("parameter %s is incorrect", stattype);
-		return false;
+			*stat_types = STAT_NDISTINCT | STAT_MCV | STAT_DEPENDENCIES;
+		else
+		{
+			GUC_check_errdetail("parameter %s is incorrect", stattype);
+			list_free_deep(elemlist);
+			pfree(tmp_str);
+			return false;
+		}
 	}
 
+	list_free_deep(elemlist);
+	pfree(tmp_str);
 	return true;
 }
 
@@ -406,61 +460,34 @@ _check_stattypes_string(const char *str)
  * final decision on which types of extended statistics we will see after the
  * index creation.
  *
- * It is expensive a little bit to use in each hook call. So, be careful or
- * invent a cache.
+ * The string is parsed once, by the GUC check hook.
  */
-static int32
-get_statistic_types()
+int32
+get_statistic_types(void)
 {
-	List	   *elemlist;
-	ListCell   *lc;
-	int			statistic_types = 0;
-	char	   *tmp_stattypes;
-	MemoryContext oldctx;
-
-	oldctx = MemoryContextSwitchTo(pg_index_stats_mem_ctx);
-	tmp_stattypes = pstrdup(stattypes);
-	if (!SplitDirectoriesString(tmp_stattypes, ',', &elemlist))
-	{
-		/* syntax error in list */
-		ereport(ERROR,
-				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				 errmsg("invalid list syntax in parameter \"%s\"",
-						"statistic_types")));
-	}
-
-	if (elemlist == NIL)
-	{
-		MemoryContextSwitchTo(oldctx);
-		return 0;
-	}
-
-	foreach(lc, elemlist)
-	{
-		char   *stattype = (char *) lfirst(lc);
+	return stattypes_mask;
+}
 
-		if (strcmp(stattype, STAT_NDISTINCT_NAME) == 0)
-			statistic_types |= STAT_NDISTINCT;
-		else if (strcmp(stattype, STAT_MCV_NAME) == 0)
-			statistic_types |= STAT_MCV;
-		else if (strcmp(stattype, STAT_DEPENDENCIES_NAME) == 0)
-			statistic_types |= STAT_DEPENDENCIES;
-		else if (strcmp(stattype, "all") == 0)
-			statistic_types = STAT_NDISTINCT | STAT_MCV | STAT_DEPENDENCIES;
-		else
-			ereport(ERROR,
-					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-					 errmsg("Invalid parameter \"%s\" in GUC \"%s\"",
-							stattype, "statistic_types")));
-	}
+/*
+ * May new statistics be reduced against the existing ones?
+ */
+bool
+statistics_compactify_enabled(void)
+{
+	return combine_stats;
+}
 
-	MemoryContextSwitchTo(oldctx);
-	MemoryContextReset(pg_index_stats_mem_ctx);
-	return statistic_types;
+/*
+ * Maximum number of columns involved in auto-generated statistics
+ */
+int
+statistics_columns_limit(void)
+{
+	return extstat_columns_limit;
 }
 
 static bool
-_create_statistics(CreateStatsStmt *stmt, Oid indexId)
+_create_statistics(CreateStatsStmt *stmt, Oid relid, Oid indexId)
 {
 	ObjectAddress	obj;
 	ObjectAddress	refobj;
@@ -482,17 +509,111 @@ _create_statistics(CreateStatsStmt *stmt, Oid indexId)
 
 	/*
 	 * If the extension wasn't created in the database, statistics will
-	 * depend on the index relation only.
+	 * depend on the index relation only. Statistics, not based on an index
+	 * (query-driven ones), depend on the table, as usual.
 	 */
-	ObjectAddressSet(refobj, RelationRelationId, indexId);
-	recordDependencyOn(&obj, &refobj, DEPENDENCY_AUTO);
+	if (OidIsValid(indexId))
+	{
+		ObjectAddressSet(refobj, RelationRelationId, indexId);
+		recordDependencyOn(&obj, &refobj, DEPENDENCY_AUTO);
+	}
 
 	/* Let next command to see newly created statistics */
 	CommandCounterIncrement();
 
+	/* Don't wait for the next ANALYZE to fill the statistics up */
+	statworker_schedule_analyze(relid);
+
 	return true;
 }
 
+/*
+ * Create extended statistics of stat_types kinds on the exprlst definition
+ * over the hrel relation. Before that, reduce the definition against
+ * statistics already existing on the relation, if allowed.
+ *
+ * If indexId is valid, the statistics will depend on this index. Otherwise,
+ * it is considered as a query-driven one.
+ *
+ * Return false if nothing was created.
+ */
+bool
+pg_index_stats_create(Relation hrel, List *exprlst, Bitmapset *atts_used,
+					  int32 stat_types, Oid indexId)
+{
+	/*
+	 * The reduction alters existing statistics, relying on the new one. So,
+	 * at first, only simulate it to know the kinds to pay for, and change the
+	 * catalog when the definition, fitting the budget, is known.
+	 */
+	if (combine_stats)
+	{
+		List   *statslist = fetch_relation_statentries(RelationGetRelid(hrel));
+
+		if (statslist != NIL)
+		{
+			int32  *newtypes;
+
+			newtypes = (int32 *) palloc(list_length(statslist) * sizeof(int32));
+			stat_types = compactify_definition(statslist, exprlst, atts_used,
+											   stat_types, newtypes);
+			pfree(newtypes);
+		}
+	}
+	if (stat_types == 0)
+		/* Reduced to nothing */
+		return false;
+
+	/* Switch to cheaper kinds or narrow the definition, if too expensive */
+	stat_types = fit_statistics_budget(hrel, &exprlst, &atts_used, stat_types);
+	if (stat_types == 0)
+		return false;
+
+	if (combine_stats)
+		stat_types = reduce_duplicated_stat(exprlst, atts_used, hrel, stat_types);
+	if (stat_types == 0)
+		return false;
+
+	return pg_index_stats_create_exact(hrel, exprlst, stat_types, indexId);
+}
+
+/*
+ * Create extended statistics exactly as defined, without any reduction.
+ */
+bool
+pg_index_stats_create_exact(Relation hrel, List *exprlst, int32 stat_types,
+							Oid indexId)
+{
+	CreateStatsStmt	   *stmt;
+	RangeVar		   *from;
+
+	elog(DEBUG2, "Final Auto-generated statistics definition: %d", stat_types);
+
+	from = makeRangeVar(get_namespace_name(RelationGetNamespace(hrel)),
+						pstrdup(RelationGetRelationName(hrel)), -1);
+
+	stmt = makeNode(CreateStatsStmt);
+
+	/* Still only one relation allowed in the core */
+	stmt->relations = list_make1(from);
+	stmt->stxcomment = OidIsValid(indexId) ? STAT_COMMENT_INDEX :
+											 STAT_COMMENT_QUERY;
+	stmt->transformed = false;	/* true when transformStatsStmt is finished */
+	stmt->if_not_exists = true;
+	stmt->defnames = NULL;		/* qualified name (list of String) */
+	stmt->exprs = exprlst;
+
+	if (stat_types & STAT_NDISTINCT)
+		stmt->stat_types = lappend(stmt->stat_types, makeString(STAT_NDISTINCT_NAME));
+	if (stat_types & STAT_DEPENDENCIES)
+		stmt->stat_types = lappend(stmt->stat_types, makeString(STAT_DEPENDENCIES_NAME));
+	if (stat_types & STAT_MCV)
+		stmt->stat_types = lappend(stmt->stat_types, makeString(STAT_MCV_NAME));
+	Assert(stmt->stat_types != NIL);
+
+	return _create_statistics(stmt, RelationGetRelid(hrel), indexId);
+}
+
 /*
  * generateClonedExtStatsStmt
  */
@@ -514,9 +635,6 @@ pg_index_stats_build(PG_FUNCTION_ARGS)
 
 	tmp_stats_list = pstrdup(GetConfigOption(MODULE_NAME".stattypes", false, true));
 
-	/* Check correctness of the stats string */
-	(void) get_statistic_types();
-
 	SetConfigOption(MODULE_NAME".stattypes", stats_list, PGC_SUSET, PGC_S_SESSION);
 
 	/* Get descriptor of incoming index relation */
@@ -542,36 +660,54 @@ pg_index_stats_build(PG_FUNCTION_ARGS)
 /*
  * Use index and its description for creating definition of extended statistics
  * expression.
+ *
+ * The heap relation hrel is opened by the caller, who also switches to the
+ * table owner's userid. It allows to build statistics on a bunch of indexes
+ * of the same table without reopening it.
  */
-static bool
-pg_index_stats_build_int(Relation rel)
+bool
+pg_index_stats_build_index(Relation irel, Relation hrel, int32 stat_types)
 {
-	Relation		hrel = NULL;
-	TupleDesc		tupdesc = NULL;
-	Oid				indexId;
-	Oid				heapId;
-	IndexInfo	   *indexInfo = NULL;
-	Oid				save_userid;
-	int				save_sec_context;
-	int				save_nestlevel;
-	bool			result = false;
-	int32			stat_types = 0;
+	Bitmapset	   *atts_used = NULL;
+	List		   *exprlst = NIL;
 
-	if (extstat_columns_limit <= 0 || (stat_types = get_statistic_types()) == 0)
+	if (stat_types == 0 ||
+		!index_statistics_definition(irel, hrel, &exprlst, &atts_used))
 		return false;
 
 	/*
-	 * Switch to the table owner's userid, so that any index functions are
-	 * run as that user.  Also lock down security-restricted operations
-	 * and arrange to make GUC variable changes local to this command.
+	 * Now we have statistics definition. That's a good place to check other
+	 * statistics on the same relation and correct our definition to reduce
+	 * duplicated data as much as possible.
+	 *
+	 * Don't free here allocated structures because we do it in transaction
+	 * memory context. May we need to clean it locally in the case of
+	 * building statistics over huge database?
 	 */
-	GetUserIdAndSecContext(&save_userid, &save_sec_context);
-	SetUserIdAndSecContext(rel->rd_rel->relowner,
-						   save_sec_context | SECURITY_RESTRICTED_OPERATION);
-	save_nestlevel = NewGUCNestLevel();
+	return pg_index_stats_create(hrel, exprlst, atts_used, stat_types,
+								 RelationGetRelid(irel));
+}
+
+/*
+ * Build definition of extended statistics on the index: list of StatsElem
+ * and set of plain columns used. Return false, if the index isn't suitable.
+ */
+bool
+index_statistics_definition(Relation irel, Relation hrel, List **exprlstp,
+							Bitmapset **atts_usedp)
+{
+	IndexInfo	   *indexInfo;
+	TupleDesc		tupdesc;
+	ListCell	   *indexpr_item;
+	int				i;
+	Bitmapset	   *atts_used = NULL;
+	List		   *exprlst = NIL;
+	bool			result = false;
 
-	indexId = RelationGetRelid(rel);
-	indexInfo = BuildIndexInfo(rel);
+	if (extstat_columns_limit <= 0)
+		return false;
+
+	indexInfo = BuildIndexInfo(irel);
 
 	/*
 	 * Forbid any other indexes except btree just to be sure we have specific
@@ -583,129 +719,106 @@ pg_index_stats_build_int(Relation rel)
 	if (indexInfo->ii_Am != BTREE_AM_OID || indexInfo->ii_NumIndexKeyAttrs < 2)
 		goto cleanup;
 
+	/*
+	 * TODO: Create statistics could be applied to plain table, foreign
+	 * table or materialized VIEW.
+	 */
+	if (hrel->rd_rel->relkind != RELKIND_RELATION)
+		/*
+		 * Just for sure. TODO: may be better. At least for TOAST relations
+		 */
+		goto cleanup;
+
 	/*
 	 * Here is we form a statement to build statistics.
+	 * Next step is to build statistics expression list.
 	 */
+	tupdesc = RelationGetDescr(hrel);
+	indexpr_item = list_head(indexInfo->ii_Expressions);
+
+	for (i = 0; i < indexInfo->ii_NumIndexKeyAttrs; i++)
 	{
-		CreateStatsStmt	   *stmt = makeNode(CreateStatsStmt);
-		ListCell		   *indexpr_item = list_head(indexInfo->ii_Expressions);
-		RangeVar		   *from;
-		int					i;
-		Bitmapset		   *atts_used = NULL;
-		List			   *exprlst = NIL;
+		AttrNumber	attnum = indexInfo->ii_IndexAttrNumbers[i];
+		StatsElem  *selem;
 
-		heapId = IndexGetRelation(indexId, false);
-		hrel = relation_open(heapId, AccessShareLock);
+		Assert(extstat_columns_limit > 1);
 
-		/*
-		 * TODO: Create statistics could be applied to plain table, foreign
-		 * table or materialized VIEW.
-		 */
-		if (hrel->rd_rel->relkind != RELKIND_RELATION)
+		if (list_length(exprlst) >= extstat_columns_limit)
+		{
 			/*
-			 * Just for sure. TODO: may be better. At least for TOAST relations
+			 * To reduce risks of blind usage use only limited number of
+			 * index columns.
 			 */
-			goto cleanup;
-
-		/* Next step is to build statistics expression list */
-
-		tupdesc = RelationGetDescr(hrel);
-		from = makeRangeVar(get_namespace_name(RelationGetNamespace(hrel)),
-								pstrdup(RelationGetRelationName(hrel)), -1);
+			break;
+		}
 
-		for (i = 0; i < indexInfo->ii_NumIndexKeyAttrs; i++)
+		if (attnum != 0)
 		{
-			AttrNumber	attnum = indexInfo->ii_IndexAttrNumbers[i];
-			StatsElem  *selem;
-
-			Assert(extstat_columns_limit > 1);
-
-			if (list_length(exprlst) >= extstat_columns_limit)
-			{
-				/*
-				 * To reduce risks of blind usage use only limited number of
-				 * index columns.
-				 */
-				break;
-			}
-
-			if (attnum != 0)
-			{
-				if (bms_is_member(attnum, atts_used))
-					/* Can't build extended statistics with column duplicates */
-					continue;
-
-				selem = makeNode(StatsElem);
-				selem->name = pstrdup(TupleDescAttr(tupdesc, attnum - 1)->attname.data);
-				selem->expr = NULL;
-				atts_used = bms_add_member(atts_used, attnum);
-			}
-			else
-			{
-				Node	   *indexkey;
-
-				selem = makeNode(StatsElem);
-				indexkey = (Node *) lfirst(indexpr_item);
-				Assert(indexkey != NULL);
-				indexpr_item = lnext(indexInfo->ii_Expressions, indexpr_item);
-				selem->name = NULL;
-				selem->expr = indexkey;
-			}
+			if (bms_is_member(attnum, atts_used))
+				/* Can't build extended statistics with column duplicates */
+				continue;
 
-			exprlst = lappend(exprlst, selem);
+			selem = makeNode(StatsElem);
+			selem->name = pstrdup(TupleDescAttr(tupdesc, attnum - 1)->attname.data);
+			selem->expr = NULL;
+			atts_used = bms_add_member(atts_used, attnum);
+		}
+		else
+		{
+			Node	   *indexkey;
+
+			selem = makeNode(StatsElem);
+			indexkey = (Node *) lfirst(indexpr_item);
+			Assert(indexkey != NULL);
+			indexpr_item = lnext(indexInfo->ii_Expressions, indexpr_item);
+			selem->name = NULL;
+			selem->expr = indexkey;
 		}
 
-		if (list_length(exprlst) < 2)
-			/* Extended statistics can be made only for two or more expressions */
-			goto cleanup;
-
-		/*
-		 * Now we have statistics definition. That's a good place to check other
-		 * statistics on the same relation and correct our definition to reduce
-		 * duplicated data as much as possible.
-		 */
-		if (combine_stats)
-			stat_types = reduce_duplicated_stat(exprlst, atts_used, hrel, stat_types);
-		if (stat_types == 0)
-			/* Reduced to nothing */
-			goto cleanup;
-
-		elog(DEBUG2, "Final Auto-generated statistics definition: %d", stat_types);
-
-		/* Still only one relation allowed in the core */
-		stmt->relations = list_make1(from);
-		stmt->stxcomment = MODULE_NAME" - multivariate statistics";
-		stmt->transformed = false;	/* true when transformStatsStmt is finished */
-		stmt->if_not_exists = true;
-		stmt->defnames = NULL;		/* qualified name (list of String) */
-		stmt->exprs = exprlst;
-
-		if (stat_types & STAT_NDISTINCT)
-			stmt->stat_types = lappend(stmt->stat_types, makeString(STAT_NDISTINCT_NAME));
-		if (stat_types & STAT_DEPENDENCIES)
-			stmt->stat_types = lappend(stmt->stat_types, makeString(STAT_DEPENDENCIES_NAME));
-		if (stat_types & STAT_MCV)
-			stmt->stat_types = lappend(stmt->stat_types, makeString(STAT_MCV_NAME));
-		Assert(stmt->stat_types != NIL);
-
-		if (!_create_statistics(stmt, indexId))
-			goto cleanup;
-
-		/*
-		 * Don't free here allocated structures because we do it in transaction
-		 * memory context. May we need to clean it locally in the case of
-		 * building statistics over huge database?
-		 */
+		exprlst = lappend(exprlst, selem);
 	}
 
+	if (list_length(exprlst) < 2)
+		/* Extended statistics can be made only for two or more expressions */
+		goto cleanup;
+
+	*exprlstp = exprlst;
+	*atts_usedp = atts_used;
 	result = true;
 
 cleanup:
-	if (hrel)
-		relation_close(hrel, AccessShareLock);
-	if (indexInfo)
-		pfree(indexInfo);
+	pfree(indexInfo);
+	return result;
+}
+
+static bool
+pg_index_stats_build_int(Relation rel)
+{
+	Relation		hrel;
+	Oid				save_userid;
+	int				save_sec_context;
+	int				save_nestlevel;
+	bool			result;
+	int32			stat_types = 0;
+
+	if (extstat_columns_limit <= 0 || (stat_types = get_statistic_types()) == 0)
+		return false;
+
+	/*
+	 * Switch to the table owner's userid, so that any index functions are
+	 * run as that user.  Also lock down security-restricted operations
+	 * and arrange to make GUC variable changes local to this command.
+	 */
+	GetUserIdAndSecContext(&save_userid, &save_sec_context);
+	SetUserIdAndSecContext(rel->rd_rel->relowner,
+						   save_sec_context | SECURITY_RESTRICTED_OPERATION);
+	save_nestlevel = NewGUCNestLevel();
 
+	hrel = relation_open(IndexGetRelation(RelationGetRelid(rel), false),
+						 AccessShareLock);
+	result = pg_index_stats_build_index(rel, hrel, stat_types);
+	compaction_after_ddl(hrel);
+	relation_close(hrel, AccessShareLock);
 
 	AtEOXact_GUC(false, save_nestlevel);
 	SetUserIdAndSecContext(save_userid, save_sec_context);
@@ -727,6 +840,25 @@ extstat_remember_index_hook(ObjectAccessType access, Oid classId,
 	if (next_object_access_hook)
 		(*next_object_access_hook) (access, classId, objectId, subId, arg);
 
+	if (access == OAT_DROP && classId == RelationRelationId && subId == 0 &&
+		IsNormalProcessingMode())
+	{
+		char	relkind = get_rel_relkind(objectId);
+		bool	union_depends;
+
+		if (relkind != RELKIND_INDEX && relkind != RELKIND_PARTITIONED_INDEX)
+			return;
+
+		union_depends = compaction_union_depends_on(objectId);
+		memctx = MemoryContextSwitchTo(TopMemoryContext);
+		dropped_indexes = lappend_oid(dropped_indexes, objectId);
+		if (union_depends)
+			dropped_union_tables = list_append_unique_oid(dropped_union_tables,
+											IndexGetRelation(objectId, false));
+		MemoryContextSwitchTo(memctx);
+		return;
+	}
+
 	/*
 	 * Disable the extension machinery in some cases.
 	 * Changing that place remember, that we have UI to manually generate
@@ -743,6 +875,114 @@ extstat_remember_index_hook(ObjectAccessType access, Oid classId,
 	MemoryContextSwitchTo(memctx);
 }
 
+/*
+ * Statistics on a union of indexes depend on one of them. Having it dropped,
+ * compact statistics of the table again to cover the rest of the indexes.
+ */
+static void
+restore_dropped_cover(void)
+{
+	List	   *relids = dropped_union_tables;
+	ListCell   *lc;
+
+	dropped_union_tables = NIL;
+	if (relids == NIL || !IsTransactionState())
+	{
+		list_free(relids);
+		return;
+	}
+
+	PG_TRY();
+	{
+		foreach(lc, relids)
+			compaction_after_drop(lfirst_oid(lc));
+	}
+	PG_FINALLY();
+	{
+		list_free(relids);
+	}
+	PG_END_TRY();
+}
+
+/*
+ * Stored statistics are keyed by the OID of the index, remove them along with
+ * the index, before the OID is reused.
+ */
+static void
+forget_dropped_indexes(void)
+{
+	List	   *indexes = dropped_indexes;
+
+	dropped_indexes = NIL;
+	if (indexes == NIL || !IsTransactionState())
+	{
+		list_free(indexes);
+		return;
+	}
+
+	PG_TRY();
+	{
+		statstore_forget(indexes);
+	}
+	PG_FINALLY();
+	{
+		list_free(indexes);
+	}
+	PG_END_TRY();
+}
+
+typedef bool (*estimate_baserel_function) (PlannerInfo *root,
+										   RelOptInfo *rel, Index rti,
+										   RangeTblEntry *rte,
+										   BaserelEstimate *est);
+
+/*
+ * Statistics, unknown to the core, in the order of preference: with the same
+ * number of covered clauses, the later one is chosen.
+ */
+static const estimate_baserel_function baserel_estimators[] =
+{
+	hypothetical_estimate_baserel,
+	keystats_estimate_baserel,
+	gridstats_estimate_baserel
+};
+
+/*
+ * Estimation of a base relation is adjusted by several modules. Statistics,
+ * unknown to the core, estimate the clauses from scratch, so only one of them
+ * is applied: the one, covering the most clauses. QDS goes after it: the
+ * learned correction applies to the final estimation, and the actual number of
+ * rows, injected while re-planning, is never overwritten.
+ */
+static void
+estimate_baserel_hook(PlannerInfo *root, RelOptInfo *rel, Index rti,
+					  RangeTblEntry *rte)
+{
+	BaserelEstimate	best = {0, 0.};
+	int				i;
+
+	if (next_set_rel_pathlist_hook)
+		(*next_set_rel_pathlist_hook) (root, rel, rti, rte);
+
+	/* Nothing to estimate for a relation, proven empty */
+	if (IS_DUMMY_REL(rel) || rel->rows <= 0.)
+		return;
+
+	for (i = 0; i < lengthof(baserel_estimators); i++)
+	{
+		BaserelEstimate	est;
+
+		if (baserel_estimators[i] (root, rel, rti, rte, &est) &&
+			est.nclauses >= best.nclauses)
+			best = est;
+	}
+
+	if (best.nclauses > 0)
+		set_baserel_rows(rel, best.rows);
+
+	qds_set_rel_pathlist(root, rel, rti, rte);
+}
+
 static void
 after_utility_extstat_creation(PlannedStmt *pstmt, const char *queryString,
 							   bool readOnlyTree,
@@ -761,6 +1001,9 @@ after_utility_extstat_creation(PlannedStmt *pstmt, const char *queryString,
 								context, params, queryEnv,
 								dest, qc);
 
+	restore_dropped_cover();
+	forget_dropped_indexes();
+
 	/* Now, we can create extended statistics */
 
 	/* Quick exit on ROLLBACK or nothing to do */
@@ -817,15 +1060,104 @@ after_utility_extstat_creation(PlannedStmt *pstmt, const char *queryString,
 	PG_END_TRY();
 }
 
+/*
+ * Prepare a tuplestore for a set-returning function working in the
+ * materialize mode. Since PG15 core has InitMaterializedSRF() for that, but we
+ * have to support older versions too.
+ */
+void
+prepare_materialized_srf(FunctionCallInfo fcinfo)
+{
+	ReturnSetInfo  *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc		tupdesc;
+	MemoryContext	oldctx;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	oldctx = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->setDesc = CreateTupleDescCopy(tupdesc);
+	MemoryContextSwitchTo(oldctx);
+}
+
+/*
+ * Change the number of rows of the base relation.
+ *
+ * The paths are already built. Their costs barely depend on the number of
+ * produced rows, but upper paths depend on them a lot. So just correct the
+ * rows of the relation and its non-parameterised paths before the cheapest
+ * ones are chosen.
+ */
+void
+set_baserel_rows(RelOptInfo *rel, double rows)
+{
+	double		factor;
+	ListCell   *lc;
+
+	if (IS_DUMMY_REL(rel) || rel->rows <= 0.)
+		return;
+
+	factor = rows / rel->rows;
+	rel->rows = rows;
+
+	foreach(lc, rel->pathlist)
+	{
+		Path *path = (Path *) lfirst(lc);
+
+		if (path->param_info == NULL)
+			path->rows = rel->rows;
+	}
+
+	/* Rows of a partial path are divided between the workers */
+	foreach(lc, rel->partial_pathlist)
+	{
+		Path *path = (Path *) lfirst(lc);
+
+		if (path->param_info == NULL)
+			path->rows = clamp_row_est(path->rows * factor);
+	}
+}
+
 static bool
 check_hook_stattypes(char **newval, void **extra, GucSource source)
 {
-	if (!_check_stattypes_string(*newval))
+	int32	stat_types;
+	int32  *myextra;
+
+	if (!_check_stattypes_string(*newval, &stat_types))
 		return false;
 
+	/* Pass parsed value to the assign hook */
+#if PG_VERSION_NUM >= 160000
+	myextra = (int32 *) guc_malloc(LOG, sizeof(int32));
+#else
+	myextra = (int32 *) malloc(sizeof(int32));
+#endif
+	if (myextra == NULL)
+		return false;
+	*myextra = stat_types;
+	*extra = myextra;
+
 	return true;
 }
 
+static void
+assign_hook_stattypes(const char *newval, void *extra)
+{
+	stattypes_mask = *((int32 *) extra);
+}
+
 
 void
 _PG_init(void)
@@ -837,7 +1169,8 @@ _PG_init(void)
 							   DEFAULT_STATTYPES,
 							   PGC_SUSET,
 							   0,
-							   check_hook_stattypes, NULL, NULL);
+							   check_hook_stattypes, assign_hook_stattypes,
+							   NULL);
 
 	DefineCustomIntVariable(MODULE_NAME".columns_limit",
 							"Sets the maximum number of columns involved in extended statistics",
@@ -869,6 +1202,9 @@ _PG_init(void)
 	next_ProcessUtility_hook = ProcessUtility_hook;
 	ProcessUtility_hook = after_utility_extstat_creation;
 
+	next_set_rel_pathlist_hook = set_rel_pathlist_hook;
+	set_rel_pathlist_hook = estimate_baserel_hook;
+
 	pg_index_stats_mem_ctx = AllocSetContextCreate(TopMemoryContext,
 											 MODULE_NAME" - local memory context",
 											 ALLOCSET_DEFAULT_SIZES);
@@ -896,6 +1232,15 @@ _PG_init(void)
 #endif
 
 	qds_init();
+	statworker_init();
+	statcost_init();
+	compaction_init();
+	statprune_init();
+	statusage_init();
+	statretire_init();
+	statstore_init();
+	keystats_init();
+	gridstats_init();
 }
 
 
@@ -1049,6 +1394,31 @@ StatMgrOptions *
 	}
 	relation_stats_show(es);
 
+	/* Like the planning time, the pruning time is a part of the summary */
+	if (sc_nextstats > 0)
+	{
+		if (es->format != EXPLAIN_FORMAT_TEXT)
+		{
+			ExplainPropertyInteger("Extended Statistics", NULL,
+								   sc_nextstats, es);
+			ExplainPropertyInteger("Pruned Extended Statistics", NULL,
+								   sc_npruned, es);
+			if (es->summary)
+				ExplainPropertyFloat("Pruning Time", "ms", sc_prune_time, 3,
+									 es);
+		}
+		else
+		{
+			ExplainIndentText(es);
+			appendStringInfo(es->str, "Pruned extended statistics: %d of %d",
+							 sc_npruned, sc_nextstats);
+			if (es->summary)
+				appendStringInfo(es->str, ", pruning time: %.3f ms",
+								 sc_prune_time);
+			appendStringInfoChar(es->str, '\n');
+		}
+	}
+
 	if (es->format == EXPLAIN_FORMAT_TEXT)
 	{
 		es->indent--;
@@ -3,17 +3,24 @@
 
 #include "postgres.h"
 
+#include "fmgr.h"
+
 #define MODULE_NAME "pg_index_stats"
 
 #define STAT_NDISTINCT_NAME		"ndistinct"
 #define STAT_MCV_NAME			"mcv"
 #define STAT_DEPENDENCIES_NAME	"dependencies"
 
+/* Comments to distinguish statistics, generated by the extension */
+#define STAT_COMMENT_INDEX	MODULE_NAME" - multivariate statistics"
+#define STAT_COMMENT_QUERY	MODULE_NAME" - query-driven statistics"
+
 #define STAT_NDISTINCT		(1<<0)
 #define STAT_MCV			(1<<1)
 #define STAT_DEPENDENCIES	(1<<2)
 
 #include "access/relation.h"
+#include "nodes/pathnodes.h"
 #if PG_VERSION_NUM >= 180000
 #include "commands/explain_state.h"
 /*
@@ -27,6 +34,8 @@ typedef struct StatMgrOptions
 } StatMgrOptions;
 
 StatMgrOptions *StatMgrOptions_ensure(ExplainState *es);
+extern void explain_stat_register_pruning(int nstats, int npruned,
+										  double elapsed_ms);
 #endif
 
 extern MemoryContext pg_index_stats_mem_ctx;
@@ -34,8 +43,39 @@ extern int current_execution_level;
 
 extern Bitmapset *check_duplicated(List *statList, int32 stat_types);
 
+extern void prepare_materialized_srf(FunctionCallInfo fcinfo);
+
+struct RelOptInfo;
+extern void set_baserel_rows(struct RelOptInfo *rel, double rows);
+
+/*
+ * Estimation of a base relation by statistics, unknown to the core
+ */
+typedef struct BaserelEstimate
+{
+	int			nclauses;	/* restriction clauses, covered by the statistics */
+	double		rows;
+} BaserelEstimate;
+
+extern int32 get_statistic_types(void);
+extern bool pg_index_stats_create(Relation hrel, List *exprlst,
+								  Bitmapset *atts_used, int32 stat_types,
+								  Oid indexId);
+extern bool pg_index_stats_create_exact(Relation hrel, List *exprlst,
+										int32 stat_types, Oid indexId);
+extern bool pg_index_stats_build_index(Relation irel, Relation hrel,
+									   int32 stat_types);
+extern bool index_statistics_definition(Relation irel, Relation hrel,
+										List **exprlstp, Bitmapset **atts_usedp);
+extern bool statistics_compactify_enabled(void);
+extern int statistics_columns_limit(void);
+extern bool is_index_based_statistics(Oid statoid);
+
 /* Query-based statistic generator routines */
 
 extern void qds_init(void);
+extern bool qds_replanning(void);
+extern void qds_set_rel_pathlist(PlannerInfo *root, RelOptInfo *rel, Index rti,
+								 RangeTblEntry *rte);
 
 #endif							/* PG_INDEX_STATS_H */
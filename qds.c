@@ -7,26 +7,77 @@
 
 #include "postgres.h"
 
+#include <math.h>
+
 #include "catalog/pg_statistic_ext_d.h"
 #include "commands/defrem.h"
 #include "commands/explain.h"
+#if PG_VERSION_NUM >= 150000
+#include "common/pg_prng.h"
+#endif
 #include "executor/executor.h"
+#include "executor/instrument.h"
 #include "nodes/nodeFuncs.h"
 #include "optimizer/optimizer.h"
+#include "optimizer/paths.h"
 #include "optimizer/planner.h"
+#include "optimizer/restrictinfo.h"
 #include "parser/parsetree.h"
+#include "rewrite/rewriteManip.h"
 #include "statistics/extended_stats_internal.h"
 #include "utils/fmgroids.h"
 #include "utils/guc.h"
+#include "utils/inval.h"
 #include "utils/lsyscache.h"
+#include "utils/ruleutils.h"
+#include "utils/snapmgr.h"
+#include "utils/syscache.h"
+#include "utils/varlena.h"
 
 #include "pg_index_stats.h"
+#include "qds_correction.h"
+#include "qds_memo.h"
+#include "qds_repository.h"
 
+#if PG_VERSION_NUM >= 150000
+#define sample_random()	pg_prng_double(&pg_global_prng_state)
+#else
+#define sample_random()	((double) random() / ((double) MAX_RANDOM_VALUE + 1))
+#endif
 
 static bool enable_qds = true;
 static bool qds_log = false;
 static double estimation_error_threshold = 2.0;
+static double qds_sample_rate = 1.0;
+static int qds_min_duration = 0;
+static char *qds_queryids = NULL;
+static bool qds_replan = false;
+static double qds_replan_cost_change = 0.1;
+
+/* Parsed value of the qds_queryids: sorted array of query identifiers */
+typedef struct QueryIdList
+{
+	int			nids;
+	int64		ids[FLEXIBLE_ARRAY_MEMBER];
+} QueryIdList;
+
+static QueryIdList *qds_queryid_list = NULL;
+
+/*
+ * Is the current top-level statement analysed? Nested statements follow the
+ * decision made for the top-level one, as auto_explain does.
+ */
+static bool current_query_sampled = false;
+static int plan_nesting_level = 0;
+
+/*
+ * EXPLAIN with EXTSTAT_CANDIDATES gathers candidate clauses even for
+ * statements, known by the memo.
+ */
+static bool explain_candidates_requested = false;
+static bool current_query_forced = false;
 
+static planner_hook_type prev_planner_hook = NULL;
 static ExecutorStart_hook_type prev_ExecutorStart = NULL;
 static create_upper_paths_hook_type prev_create_upper_paths_hook = NULL;
 static ExecutorFinish_hook_type prev_ExecutorFinish = NULL;
@@ -593,12 +644,18 @@ planstate_calculate(PlanState *ps,
 	return true;
 }
 
-static HTAB *candidate_quals = NULL;
-
+/*
+ * A relation of a candidate. The range table of a subquery is shifted when the
+ * planner flattens range tables into the one of the plan, so the relation is
+ * identified by the eref alias of its range table entry: the flattened entry
+ * is a flat copy and shares the alias. The range table index in the plan is
+ * found at the start of the execution, 0 before that.
+ */
 typedef struct CandidateQualEntryKey
 {
 	Oid		oid;
 	Index	relid;
+	Alias  *eref;
 } CandidateQualEntryKey;
 
 typedef struct
@@ -607,10 +664,227 @@ typedef struct
 
 	Bitmapset			   *attnums;
 	List				   *exprs_list;
+	Cardinality				rows;		/* estimated by the clauses */
+	Index					rti;		/* range table index at the planning */
+
+	/* Learning of the cardinality correction, if qds_corrections */
+	uint64					signature;
+	int						pclass;
+	Cardinality				raw_rows;	/* estimation before any correction */
+
+	/* Outcome of the re-planning with the actual number of rows */
+	bool					replanned;
+	bool					sensitive;
 } CandidateQualEntry;
 
+/*
+ * Columns of two base relations joined by two or more equality clauses. The
+ * planner multiplies selectivities of such clauses, and a multi-column
+ * statistics on each side is a candidate to fix a misestimated join.
+ * A side is empty if it is covered already or refers to a single column.
+ */
+typedef struct JoinCandidateKey
+{
+	Oid		oid1;
+	Index	relid1;
+	Alias  *eref1;
+	Oid		oid2;
+	Index	relid2;
+	Alias  *eref2;
+} JoinCandidateKey;
+
+typedef struct JoinCandidateEntry
+{
+	JoinCandidateKey	key;
+
+	Bitmapset		   *attnums1;
+	Bitmapset		   *attnums2;
+} JoinCandidateEntry;
+
+/*
+ * Candidates of a statement. A statement being planned collects candidates of
+ * all its subqueries in its own entry, a nested planning (of a function,
+ * called at constant folding, for example) has its own one. The planned
+ * statement waits for its execution in the list of statements and is bound to
+ * the query descriptor at the start. So statements, executed inside another
+ * one (by a PL/pgSQL function, for example), are analysed on their own and
+ * neither mix with nor destroy candidates of the outer statement.
+ *
+ * The plan cache copies the plan it gets from the planner, so the executor
+ * receives another pointer. The statement is identified by fields of the plan,
+ * surviving the copy, and the execution level it is planned at.
+ *
+ * All of this lives in the local memory context, which is only reset at the
+ * end of each top-level query, so the steady-state path doesn't allocate
+ * memory blocks per query.
+ */
+typedef struct QdsStatement
+{
+	bool			planned;	/* the key below is filled */
+	int64			queryId;
+	int				stmt_location;
+	int				stmt_len;
+	int				level;		/* execution level of the planning */
+	QueryDesc	   *queryDesc;	/* NULL until the execution starts */
+	bool			memo;		/* store the outcome in the memo */
+	List		   *quals;		/* list of CandidateQualEntry */
+	List		   *joins;		/* list of JoinCandidateEntry */
+
+	/* Untouched query tree to plan the statement again, if qds_replan */
+	Query		   *parse;
+	int				cursorOptions;
+	bool			has_params;
+
+	List		   *corrected;	/* list of CorrectedRel */
+} QdsStatement;
+
+/* Base relation, which estimation was corrected by the learned ratio */
+typedef struct CorrectedRel
+{
+	RelOptInfo	   *rel;
+	Cardinality		raw_rows;
+} CorrectedRel;
+
+static QdsStatement *planning_statement = NULL;
+static List *qds_statements = NIL;
+
+/*
+ * Cache of decisions whether a set of columns of a relation is covered by an
+ * existing statistics. It lets us skip choose_best_statistics() for the same
+ * queries executed again and again. Only sets of plain columns with attnums
+ * below 64 are cached. Entries are dropped on any change of the relation or
+ * any extended statistics in the database.
+ */
+#define COVERED_CACHE_SIZE	(1024)
+
+static HTAB *covered_cache = NULL;
+
+typedef struct CoveredCacheKey
+{
+	Oid		relid;
+	bool	inh;
+	uint64	attmask;
+} CoveredCacheKey;
+
+typedef struct CoveredCacheEntry
+{
+	CoveredCacheKey	key;
+	bool			covered;
+} CoveredCacheEntry;
+
+static void
+covered_cache_reset(Oid relid)
+{
+	HASH_SEQ_STATUS		status;
+	CoveredCacheEntry  *entry;
+
+	if (covered_cache == NULL || hash_get_num_entries(covered_cache) == 0)
+		return;
+
+	hash_seq_init(&status, covered_cache);
+	while ((entry = (CoveredCacheEntry *) hash_seq_search(&status)) != NULL)
+	{
+		if (OidIsValid(relid) && entry->key.relid != relid)
+			continue;
+
+		(void) hash_search(covered_cache, &entry->key, HASH_REMOVE, NULL);
+	}
+}
+
+static void
+covered_relcache_callback(Datum arg, Oid relid)
+{
+	covered_cache_reset(relid);
+}
+
+/*
+ * Statistics was altered or its data was built outside of ANALYZE, that
+ * doesn't invalidate the relcache entry of the table.
+ */
+static void
+covered_syscache_callback(Datum arg, int cacheid, uint32 hashvalue)
+{
+	covered_cache_reset(InvalidOid);
+}
+
+static bool
+candidate_is_covered(RelOptInfo *rel, RangeTblEntry *rte,
+					 Bitmapset *attnums, List *exprs)
+{
+	CoveredCacheKey		key;
+	CoveredCacheEntry  *entry;
+	StatisticExtInfo   *stat;
+	bool				cacheable = (exprs == NIL);
+	bool				covered;
+	int					attnum = -1;
+
+	if (rel->statlist == NIL)
+		return false;
+
+	memset(&key, 0, sizeof(CoveredCacheKey));
+	key.relid = rte->relid;
+	key.inh = rte->inh;
+	while (cacheable && (attnum = bms_next_member(attnums, attnum)) >= 0)
+	{
+		if (attnum >= 64)
+			cacheable = false;
+		else
+			key.attmask |= UINT64CONST(1) << attnum;
+	}
+
+	if (cacheable)
+	{
+		entry = (CoveredCacheEntry *) hash_search(covered_cache, &key,
+												  HASH_FIND, NULL);
+		if (entry != NULL)
+			return entry->covered;
+	}
+
+#if (PG_VERSION_NUM < 150000)
+	stat = choose_best_statistics(rel->statlist, STATS_EXT_MCV,
+								  &attnums, &exprs, 1);
+#else
+	stat = choose_best_statistics(rel->statlist, STATS_EXT_MCV, rte->inh,
+								  &attnums, &exprs, 1);
+#endif
+	covered = (stat && bms_is_subset(attnums, stat->keys) &&
+			   stat_covers_expressions(stat, exprs, NULL));
+
+	if (cacheable)
+	{
+		if (hash_get_num_entries(covered_cache) >= COVERED_CACHE_SIZE)
+			covered_cache_reset(InvalidOid);
+
+		entry = (CoveredCacheEntry *) hash_search(covered_cache, &key,
+												  HASH_ENTER, NULL);
+		entry->covered = covered;
+	}
+
+	return covered;
+}
+
+/*
+ * Gather columns and expressions of the relation restriction clauses,
+ * compatible with extended statistics.
+ */
+static void
+rel_compatible_clauses(PlannerInfo *root, RelOptInfo *rel,
+					   Bitmapset **attnums, List **exprs)
+{
+	ListCell   *lc;
+
+	foreach (lc, rel->baserestrictinfo)
+	{
+		RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+
+		/* Let's discover conditions */
+		(void) statext_is_compatible_clause(root, (Node *) rinfo, rel->relid,
+											attnums, exprs);
+	}
+}
+
 static bool
-gather_compatible_clauses(PlannerInfo *root)
+gather_compatible_clauses(PlannerInfo *root, QdsStatement *stmt)
 {
 	int					i;
 
@@ -619,76 +893,266 @@ gather_compatible_clauses(PlannerInfo *root)
 		CandidateQualEntry *entry;
 		Bitmapset		   *attnums = NULL;
 		List			   *exprs = NIL;
-		bool				found;
 		RelOptInfo		   *rel = root->simple_rel_array[i];
 		RangeTblEntry	   *rte = root->simple_rte_array[i];
-		ListCell		   *lc;
 
 		if (rel == NULL || rel->baserestrictinfo == NIL)
 			continue;
 
-		if (!(rte->rtekind == RTE_RELATION && rte->relkind == RELKIND_RELATION))
+		/* Extended statistics may be built on these kinds of relation */
+		if (!(rte->rtekind == RTE_RELATION &&
+			  (rte->relkind == RELKIND_RELATION ||
+			   rte->relkind == RELKIND_MATVIEW ||
+			   rte->relkind == RELKIND_FOREIGN_TABLE)))
 			continue;
 
-		/* Gather all compatible columns and expressions */
-		foreach (lc, rel->baserestrictinfo)
-		{
-			RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+		/*
+		 * A single clause may refer to two columns only being an OR or NOT
+		 * clause. Skip the rest before any allocation.
+		 */
+		if (list_length(rel->baserestrictinfo) < 2 &&
+			!IsA(linitial_node(RestrictInfo, rel->baserestrictinfo)->clause,
+				 BoolExpr))
+			continue;
 
-			/* Let's discover conditions */
-			if (!statext_is_compatible_clause(root, (Node *) rinfo, rel->relid,
-											  &attnums, &exprs))
-				continue;
-		}
+		/* Gather all compatible columns and expressions */
+		rel_compatible_clauses(root, rel, &attnums, &exprs);
 
 		if (bms_num_members(attnums) + list_length(exprs) > 1)
 		{
-			CandidateQualEntryKey	key;
-			int						member;
-			StatisticExtInfo	   *stat;
+			int		member PG_USED_FOR_ASSERTS_ONLY;
 
 			Assert(rel->relid > 0 &&
 				   bms_get_singleton_member(rel->relids, &member) &&
 				   member == rel->relid);
-#if (PG_VERSION_NUM < 150000)
-			stat = choose_best_statistics(rel->statlist, STATS_EXT_MCV,
-										  &attnums, &exprs, 1);
-#else
-			stat = choose_best_statistics(rel->statlist, STATS_EXT_MCV, rte->inh,
-										  &attnums, &exprs, 1);
-#endif
-			if (stat && bms_is_subset(attnums, stat->keys) &&
-				stat_covers_expressions(stat, exprs, NULL))
+
+			if (candidate_is_covered(rel, rte, attnums, exprs))
 				/*
 				 * This combination of columns and expressions already covered
 				 * by an existed statistic - ignore it.
 				 */
 				continue;
 
-			memset(&key, 0, sizeof(CandidateQualEntryKey));
-			key.oid = rte->relid;
-			key.relid = member;
-			entry = hash_search(candidate_quals, &key, HASH_ENTER, &found);
-			if (!found)
+			/*
+			 * Each subquery has its own range table entries, so the entry is
+			 * unique within the statement. All the data is allocated in the
+			 * QDS local memory context already.
+			 */
+			entry = palloc0(sizeof(CandidateQualEntry));
+			entry->key.oid = rte->relid;
+			entry->key.eref = rte->eref;
+			entry->attnums = attnums;
+			entry->exprs_list = exprs;
+			entry->rows = rel->rows;
+			entry->rti = i;
+
+			if (qds_corrections_enabled())
 			{
-				entry->attnums = NULL;
-				entry->exprs_list = NIL;
+				ListCell   *lc;
+
+				entry->raw_rows = rel->rows;
+				foreach(lc, stmt->corrected)
+				{
+					CorrectedRel *corrected = (CorrectedRel *) lfirst(lc);
+
+					if (corrected->rel == rel)
+						entry->raw_rows = corrected->raw_rows;
+				}
+				entry->signature =
+					qds_clauses_signature(rel->baserestrictinfo);
+				entry->pclass = qds_correction_class(entry->raw_rows);
 			}
+			stmt->quals = lappend(stmt->quals, entry);
+		}
+	}
+	return true;
+}
 
-			/*
-			 * In case of nested execution, subqueries, etc we may find an entry
-			 * Put the issue out of current scope and just cancatenate
-			 * candidate clauses and attnums.
-			 */
-			entry->attnums = bms_join(entry->attnums, attnums);
-			entry->exprs_list = list_concat(entry->exprs_list, exprs);
+/*
+ * Return the plain column of a base table, involved in a join clause, or NULL.
+ */
+static Var *
+join_clause_var(PlannerInfo *root, Node *node)
+{
+	Var			   *var;
+	RelOptInfo	   *rel;
+	RangeTblEntry  *rte;
+
+	if (IsA(node, RelabelType))
+		node = (Node *) ((RelabelType *) node)->arg;
+
+	if (!IsA(node, Var))
+		return NULL;
+
+	var = (Var *) node;
+	if (var->varlevelsup > 0 || !AttrNumberIsForUserDefinedAttr(var->varattno) ||
+		var->varno < 1 || var->varno >= root->simple_rel_array_size)
+		return NULL;
+
+	rel = root->simple_rel_array[var->varno];
+	rte = root->simple_rte_array[var->varno];
+	if (rel == NULL || rel->reloptkind != RELOPT_BASEREL ||
+		!(rte->rtekind == RTE_RELATION && rte->relkind == RELKIND_RELATION))
+		return NULL;
+
+	return var;
+}
+
+typedef struct JoinClausePair
+{
+	Index		relid1;
+	Index		relid2;
+	Bitmapset  *attnums1;
+	Bitmapset  *attnums2;
+} JoinClausePair;
+
+static List *
+add_join_clause(List *pairs, Var *var1, Var *var2)
+{
+	JoinClausePair *pair;
+	ListCell	   *lc;
+
+	if (var1->varno == var2->varno)
+		return pairs;
+
+	if (var1->varno > var2->varno)
+	{
+		Var *tmp = var1;
+
+		var1 = var2;
+		var2 = tmp;
+	}
+
+	foreach(lc, pairs)
+	{
+		pair = (JoinClausePair *) lfirst(lc);
 
-			/* Put gathered data into the safe memory context */
-			entry->attnums = bms_copy(entry->attnums);
-			entry->exprs_list = copyObject(entry->exprs_list);
+		if (pair->relid1 == var1->varno && pair->relid2 == var2->varno)
+		{
+			pair->attnums1 = bms_add_member(pair->attnums1, var1->varattno);
+			pair->attnums2 = bms_add_member(pair->attnums2, var2->varattno);
+			return pairs;
 		}
 	}
-	return true;
+
+	pair = palloc(sizeof(JoinClausePair));
+	pair->relid1 = var1->varno;
+	pair->relid2 = var2->varno;
+	pair->attnums1 = bms_make_singleton(var1->varattno);
+	pair->attnums2 = bms_make_singleton(var2->varattno);
+	return lappend(pairs, pair);
+}
+
+/*
+ * Keep the side of a join candidate only if it refers to a few columns not
+ * covered by an existing statistics.
+ */
+static Bitmapset *
+join_candidate_side(PlannerInfo *root, Index relid, Bitmapset *attnums)
+{
+	if (bms_num_members(attnums) < 2 ||
+		candidate_is_covered(root->simple_rel_array[relid],
+							 root->simple_rte_array[relid], attnums, NIL))
+		return NULL;
+
+	return attnums;
+}
+
+/*
+ * Find pairs of base relations joined by multiple equality clauses: derived
+ * from equivalence classes and the rest of join clauses.
+ */
+static void
+gather_join_clauses(PlannerInfo *root, QdsStatement *stmt)
+{
+	List	   *pairs = NIL;
+	ListCell   *lc;
+	int			i;
+
+	foreach(lc, root->eq_classes)
+	{
+		EquivalenceClass   *ec = (EquivalenceClass *) lfirst(lc);
+		ListCell		   *lc1;
+
+		if (ec->ec_has_const || ec->ec_has_volatile ||
+			bms_membership(ec->ec_relids) != BMS_MULTIPLE)
+			continue;
+
+		foreach(lc1, ec->ec_members)
+		{
+			EquivalenceMember  *em1 = (EquivalenceMember *) lfirst(lc1);
+			ListCell		   *lc2;
+			Var				   *var1;
+
+			if (em1->em_is_child || em1->em_is_const ||
+				(var1 = join_clause_var(root, (Node *) em1->em_expr)) == NULL)
+				continue;
+
+			for_each_cell(lc2, ec->ec_members, lnext(ec->ec_members, lc1))
+			{
+				EquivalenceMember  *em2 = (EquivalenceMember *) lfirst(lc2);
+				Var				   *var2;
+
+				if (em2->em_is_child || em2->em_is_const ||
+					(var2 = join_clause_var(root, (Node *) em2->em_expr)) == NULL)
+					continue;
+
+				pairs = add_join_clause(pairs, var1, var2);
+			}
+		}
+	}
+
+	for (i = 1; i < root->simple_rel_array_size; i++)
+	{
+		RelOptInfo *rel = root->simple_rel_array[i];
+
+		if (rel == NULL || rel->reloptkind != RELOPT_BASEREL)
+			continue;
+
+		foreach(lc, rel->joininfo)
+		{
+			RestrictInfo   *rinfo = lfirst_node(RestrictInfo, lc);
+			OpExpr		   *clause = (OpExpr *) rinfo->clause;
+			Var			   *var1;
+			Var			   *var2;
+
+			if (!is_opclause(clause) || list_length(clause->args) != 2 ||
+				get_oprrest(clause->opno) != F_EQSEL)
+				continue;
+
+			var1 = join_clause_var(root, linitial(clause->args));
+			var2 = join_clause_var(root, lsecond(clause->args));
+
+			/* Each clause is in joininfo of both sides, take it once */
+			if (var1 == NULL || var2 == NULL ||
+				Min(var1->varno, var2->varno) != i)
+				continue;
+
+			pairs = add_join_clause(pairs, var1, var2);
+		}
+	}
+
+	foreach(lc, pairs)
+	{
+		JoinClausePair	   *pair = (JoinClausePair *) lfirst(lc);
+		JoinCandidateEntry *entry;
+		Bitmapset		   *attnums1;
+		Bitmapset		   *attnums2;
+
+		attnums1 = join_candidate_side(root, pair->relid1, pair->attnums1);
+		attnums2 = join_candidate_side(root, pair->relid2, pair->attnums2);
+		if (attnums1 == NULL && attnums2 == NULL)
+			continue;
+
+		entry = palloc0(sizeof(JoinCandidateEntry));
+		entry->key.oid1 = root->simple_rte_array[pair->relid1]->relid;
+		entry->key.eref1 = root->simple_rte_array[pair->relid1]->eref;
+		entry->key.oid2 = root->simple_rte_array[pair->relid2]->relid;
+		entry->key.eref2 = root->simple_rte_array[pair->relid2]->eref;
+		entry->attnums1 = attnums1;
+		entry->attnums2 = attnums2;
+		stmt->joins = lappend(stmt->joins, entry);
+	}
 }
 
 static void
@@ -707,156 +1171,684 @@ upper_paths_hook(PlannerInfo *root, UpperRelationKind stage,
 	if (stage != UPPERREL_FINAL)
 		return;
 
-	if (!enable_qds)
+	/* Not sampled or known by the memo */
+	if (!enable_qds || planning_statement == NULL)
 		return;
 
-	if (candidate_quals == NULL)
+	if (covered_cache == NULL)
 	{
 		HASHCTL ctl;
 
-		ctl.keysize = sizeof(CandidateQualEntryKey);
-		ctl.entrysize = sizeof(CandidateQualEntry);
+		ctl.keysize = sizeof(CoveredCacheKey);
+		ctl.entrysize = sizeof(CoveredCacheEntry);
 		ctl.hcxt = CacheMemoryContext;
-
-		candidate_quals = hash_create("Candidate quals table", 64, &ctl,
-									  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+		covered_cache = hash_create("Covered candidates cache",
+									COVERED_CACHE_SIZE, &ctl,
+									HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+		CacheRegisterRelcacheCallback(covered_relcache_callback, (Datum) 0);
+		CacheRegisterSyscacheCallback(STATEXTOID, covered_syscache_callback,
+									  (Datum) 0);
+		CacheRegisterSyscacheCallback(STATEXTDATASTXOID,
+									  covered_syscache_callback, (Datum) 0);
 	}
 
 	/* Make any allocations outside current unsafe memory context */
 	oldctx = MemoryContextSwitchTo(qds_local_memctx);
 
-	gather_compatible_clauses(root);
+	gather_compatible_clauses(root, planning_statement);
+	if (bms_membership(root->all_baserels) == BMS_MULTIPLE)
+		gather_join_clauses(root, planning_statement);
 
 	MemoryContextSwitchTo(oldctx);
 }
 
 /*
- * Having an executor node check if it have misestimations and, at the same
- * time attnums and expressions, compatible with extended statistics.
- *
- * Return non-null entry if we have something for new statistics definition.
+ * Find range table indexes of the candidate relations in the plan.
  */
-static CandidateQualEntry *
-fetch_candidate_entry(PlanState *ps, List *rtable)
+static void
+bind_candidates(QdsStatement *stmt, List *rtable)
 {
-	Index					relid = 0;
-	CandidateQualEntry	   *entry;
-	CandidateQualEntryKey	key;
-	RangeTblEntry		   *rte;
-	bool					found;
-
-	if (candidate_quals == NULL || hash_get_num_entries(candidate_quals) == 0)
-		return NULL;
+	ListCell   *lc;
+	Index		rti = 0;
 
-	/* Now, find a relid */
-	switch (nodeTag(ps))
+	foreach(lc, rtable)
 	{
-		case T_SeqScanState:
-		{
-			Scan *scan = (Scan *) ps->plan;
+		RangeTblEntry  *rte = lfirst_node(RangeTblEntry, lc);
+		ListCell	   *lc1;
 
-			relid = scan->scanrelid;
-		}
-			break;
-		case T_IndexScanState:
-		case T_IndexOnlyScanState:
-		case T_BitmapIndexScanState:
-		case T_ForeignScanState:
-		case T_CustomScanState:
-		case T_BitmapHeapScanState:
-		case T_HashState:
-		case T_IncrementalSortState:
-		case T_AggState:
-		case T_MemoizeState:
-		case T_GroupState:
-			break;
-		default:
-			break;
-	}
+		rti++;
+		if (rte->rtekind != RTE_RELATION)
+			continue;
 
-	if (relid <= 0)
-		return NULL;
+		foreach(lc1, stmt->quals)
+		{
+			CandidateQualEntry *entry = (CandidateQualEntry *) lfirst(lc1);
 
-	/*
-	 * We have a candidate according to the rule. Need to extract it from
-	 * the hash table and add to the recommendation's list.
-	 *
-	 * XXX: we can't identify exact clause set because (reloid, relid) may
-	 * be the same in different subplans. Just assume it is a rare case and
-	 * nothing wrong may happen except non-precise statistics definition.
-	 */
-	rte = rt_fetch(relid, rtable);
-	memset(&key, 0, sizeof(CandidateQualEntryKey));
-	key.relid = relid;
-	key.oid = rte->relid;
-	entry = hash_search(candidate_quals, &key, HASH_FIND, &found);
+			if (entry->key.eref == rte->eref)
+				entry->key.relid = rti;
+		}
 
-	if (!found)
-		return NULL;
+		foreach(lc1, stmt->joins)
+		{
+			JoinCandidateEntry *entry = (JoinCandidateEntry *) lfirst(lc1);
 
-	Assert(entry != NULL &&
-		   (!bms_is_empty(entry->attnums) || entry->exprs_list != NIL));
-	return entry;
+			if (entry->key.eref1 == rte->eref)
+				entry->key.relid1 = rti;
+			if (entry->key.eref2 == rte->eref)
+				entry->key.relid2 = rti;
+		}
+	}
 }
 
 static bool
-probe_candidate_node(PlanState *ps)
+qds_statement_matches(QdsStatement *stmt, PlannedStmt *pstmt)
 {
-	Cardinality	plan_rows;
-	Cardinality	real_rows;
-	Cardinality filtered;
-	bool		ret;
-
-	if (ps == NULL)
-		return false;
-
-	ret = planstate_calculate(ps, &plan_rows, &real_rows, &filtered);
-	if (!ret || real_rows < 2. ||
-		Max(plan_rows / real_rows, real_rows / plan_rows) < estimation_error_threshold)
-		return false;
-
-	return true;
+	return stmt->planned && stmt->queryId == (int64) pstmt->queryId &&
+		stmt->stmt_location == pstmt->stmt_location &&
+		stmt->stmt_len == pstmt->stmt_len &&
+		stmt->level == current_execution_level;
 }
 
-#include "nodes/makefuncs.h"
-#include "utils/lsyscache.h"
-
 /*
- * Separate the logic in a single function just to reuse it in multiple places
+ * Bind the planned statement to the query descriptor at the start of its
+ * execution. Entries left by a failed execution may refer to the same query
+ * descriptor, and plans of the same level, which weren't executed (a generic
+ * plan, lost to a custom one, for example), will never be. Forget them.
  */
-static List *
-get_canidate_expressions(CandidateQualEntry *entry)
+static QdsStatement *
+qds_statement_start(QueryDesc *queryDesc)
 {
-	List				   *candidates = NIL;
-	int						i = -1;
+	QdsStatement   *result = NULL;
+	ListCell	   *lc;
 
-	if (entry == NULL)
-		return NIL;
-
-	while ((i = bms_next_member(entry->attnums, i)) > 0)
+	foreach(lc, qds_statements)
 	{
-		Var	   *var;
-		Oid		typid;
-		int32	typmod;
-		Oid		collid;
+		QdsStatement *stmt = (QdsStatement *) lfirst(lc);
 
-		get_atttypetypmodcoll(entry->key.oid, i, &typid, &typmod, &collid);
-		var= makeVar(entry->key.relid, i, typid, typmod, collid, 0);
-		candidates = lappend(candidates, var);
+		if (stmt->queryDesc == queryDesc)
+			qds_statements = foreach_delete_current(qds_statements, lc);
+		else if (stmt->queryDesc != NULL ||
+				 stmt->level != current_execution_level)
+			continue;
+		else if (result == NULL &&
+				 qds_statement_matches(stmt, queryDesc->plannedstmt))
+			result = stmt;
+		else
+			qds_statements = foreach_delete_current(qds_statements, lc);
 	}
 
-	candidates = list_concat(candidates, entry->exprs_list);
-	return candidates;
+	if (result != NULL)
+		result->queryDesc = queryDesc;
+	return result;
 }
 
-#if PG_VERSION_NUM >= 180000
+static QdsStatement *
+qds_statement_find(QueryDesc *queryDesc, PlannedStmt *pstmt)
+{
+	ListCell   *lc;
 
-/* *****************************************************************************
- *
+	foreach(lc, qds_statements)
+	{
+		QdsStatement *stmt = (QdsStatement *) lfirst(lc);
+
+		if (stmt->queryDesc != NULL &&
+			(stmt->queryDesc == queryDesc ||
+			 stmt->queryDesc->plannedstmt == pstmt))
+			return stmt;
+	}
+	return NULL;
+}
+
+/*
+ * Return range table index of the relation, scanned by the plan node, or 0.
+ *
+ * A bitmap index scan isn't counted: it produces an approximate number of TIDs
+ * and its heap scan is the node, filtering the relation.
+ */
+static Index
+plan_scanrelid(Plan *plan)
+{
+	switch (nodeTag(plan))
+	{
+		case T_SeqScan:
+		case T_SampleScan:
+		case T_IndexScan:
+		case T_IndexOnlyScan:
+		case T_BitmapHeapScan:
+		case T_TidScan:
+		case T_TidRangeScan:
+		case T_ForeignScan:
+		case T_CustomScan:
+			/* Zero for a foreign or custom join */
+			return ((Scan *) plan)->scanrelid;
+		default:
+			break;
+	}
+
+	return 0;
+}
+
+/*
+ * Having an executor node check if it have misestimations and, at the same
+ * time attnums and expressions, compatible with extended statistics.
+ *
+ * Index quals, heap filters and recheck conditions of a scan are all made of
+ * the restriction clauses of the relation, so the output of the node is
+ * compared with the estimation of the whole clause set, however the clauses
+ * are split between them. A parameterised scan also applies join clauses and
+ * its error can't be attributed to the restriction clauses: it is detected by
+ * the estimated number of rows, different from the relation estimation.
+ *
+ * Return non-null entry if we have something for new statistics definition.
+ */
+static CandidateQualEntry *
+fetch_candidate_entry(QdsStatement *stmt, PlanState *ps)
+{
+	Index					relid;
+	CandidateQualEntry	   *entry = NULL;
+	ListCell			   *lc;
+	Cardinality				plan_rows;
+	Cardinality				real_rows;
+	Cardinality				filtered;
+	double					tolerance;
+
+	if (stmt == NULL || stmt->quals == NIL)
+		return NULL;
+
+	/* Now, find a relid */
+	relid = plan_scanrelid(ps->plan);
+	if (relid <= 0)
+		return NULL;
+
+	/*
+	 * We have a candidate according to the rule. Need to extract it from
+	 * the statement candidates and add to the recommendation's list.
+	 */
+	foreach(lc, stmt->quals)
+	{
+		CandidateQualEntry *cand = (CandidateQualEntry *) lfirst(lc);
+
+		if (cand->key.relid == relid)
+		{
+			entry = cand;
+			break;
+		}
+	}
+
+	if (entry == NULL)
+		return NULL;
+
+	Assert(!bms_is_empty(entry->attnums) || entry->exprs_list != NIL);
+
+	/*
+	 * Skip a parameterised scan. Estimation of a parallel scan is divided
+	 * between the workers and rounded, allow for that.
+	 */
+	if (!planstate_calculate(ps, &plan_rows, &real_rows, &filtered))
+		return NULL;
+	tolerance = (ps->worker_instrument != NULL) ?
+		ps->worker_instrument->num_workers + 1. : 0.5;
+	if (Max(plan_rows, entry->rows) - Min(plan_rows, entry->rows) > tolerance)
+		return NULL;
+
+	return entry;
+}
+
+/*
+ * Plan-sensitivity analysis.
+ *
+ * Many misestimations are harmless: the planner would choose the same plan
+ * knowing the actual number of rows. In the qds_replan mode, the statement is
+ * planned once more with the actual number of rows injected into the scanned
+ * relation of the candidate. The candidate is reported only if it changes the
+ * plan or its cost noticeably.
+ *
+ * Join candidates aren't checked this way and are reported as usual.
+ */
+static CandidateQualEntry *replan_entry = NULL;
+static Cardinality replan_rows = 0.;
+
+/*
+ * Apply the learned correction to the estimation of the base relation.
+ */
+static void
+correct_baserel_rows(RelOptInfo *rel, RangeTblEntry *rte)
+{
+	double		factor;
+
+	if (!qds_correction_lookup(rte->relid,
+							   qds_clauses_signature(rel->baserestrictinfo),
+							   qds_correction_class(rel->rows), &factor))
+		return;
+
+	/* Learning needs the original estimation */
+	if (planning_statement != NULL)
+	{
+		MemoryContext	oldctx = MemoryContextSwitchTo(qds_local_memctx);
+		CorrectedRel   *corrected = palloc(sizeof(CorrectedRel));
+
+		corrected->rel = rel;
+		corrected->raw_rows = rel->rows;
+		planning_statement->corrected =
+			lappend(planning_statement->corrected, corrected);
+		MemoryContextSwitchTo(oldctx);
+	}
+
+	set_baserel_rows(rel, clamp_row_est(rel->rows * factor));
+}
+
+/*
+ * Correct estimations of base relations by the learned ratios and inject the
+ * actual number of rows into the relation of the candidate being re-planned.
+ * Each planning of the same query tree gives the same range table indexes and
+ * clauses, so they identify the relation.
+ */
+void
+qds_set_rel_pathlist(PlannerInfo *root, RelOptInfo *rel, Index rti,
+					 RangeTblEntry *rte)
+{
+	Bitmapset  *attnums = NULL;
+	List	   *exprs = NIL;
+
+	if (rel->reloptkind != RELOPT_BASEREL || rte->rtekind != RTE_RELATION ||
+		rel->baserestrictinfo == NIL || rel->rows <= 0.)
+		return;
+
+	if (qds_corrections_enabled())
+		correct_baserel_rows(rel, rte);
+
+	if (replan_entry == NULL || rti != replan_entry->rti ||
+		rte->relid != replan_entry->key.oid)
+		return;
+
+	rel_compatible_clauses(root, rel, &attnums, &exprs);
+	if (!bms_equal(attnums, replan_entry->attnums) ||
+		!equal(exprs, replan_entry->exprs_list))
+		return;
+
+	set_baserel_rows(rel, replan_rows);
+}
+
+/*
+ * Is the statement being re-planned with the actual number of rows?
+ */
+bool
+qds_replanning(void)
+{
+	return replan_entry != NULL;
+}
+
+/*
+ * Plan the statement again with the actual number of rows of the candidate
+ * relation and compare the outcome with the executed plan.
+ */
+static bool
+replan_changes_plan(QdsStatement *stmt, CandidateQualEntry *entry,
+					Cardinality rows)
+{
+	QueryDesc	   *queryDesc = stmt->queryDesc;
+	QdsStatement   *save_statement = planning_statement;
+	PlannedStmt	   *pstmt;
+	MemoryContext	mcxt;
+	MemoryContext	oldctx;
+	bool			snapshot_pushed = false;
+	Cost			old_cost;
+	Cost			new_cost;
+	bool			result;
+
+	Assert(queryDesc != NULL && stmt->parse != NULL);
+
+	mcxt = AllocSetContextCreate(CurrentMemoryContext,
+								 MODULE_NAME" - QDS re-planning",
+								 ALLOCSET_DEFAULT_SIZES);
+	oldctx = MemoryContextSwitchTo(mcxt);
+
+	/* At the end of a portal there may be no snapshot */
+	if (!ActiveSnapshotSet())
+	{
+		PushActiveSnapshot(GetTransactionSnapshot());
+		snapshot_pushed = true;
+	}
+
+	/*
+	 * Don't gather candidates of the re-planned statement. The re-planning
+	 * isn't a query of the user: bypass the planner hooks, so it isn't counted
+	 * by pg_stat_statements and others, and the usage of statistics either.
+	 */
+	planning_statement = NULL;
+	replan_entry = entry;
+	replan_rows = rows;
+	PG_TRY();
+	{
+		Query		   *parse = copyObject(stmt->parse);
+		ParamListInfo	params = stmt->has_params ? queryDesc->params : NULL;
+
+#if PG_VERSION_NUM >= 190000
+		pstmt = standard_planner(parse, queryDesc->sourceText,
+								 stmt->cursorOptions, params, NULL);
+#else
+		pstmt = standard_planner(parse, queryDesc->sourceText,
+								 stmt->cursorOptions, params);
+#endif
+	}
+	PG_FINALLY();
+	{
+		replan_entry = NULL;
+		planning_statement = save_statement;
+	}
+	PG_END_TRY();
+
+	if (snapshot_pushed)
+		PopActiveSnapshot();
+
+	old_cost = queryDesc->plannedstmt->planTree->total_cost;
+	new_cost = pstmt->planTree->total_cost;
+	result = (qds_plan_shape_hash(pstmt) !=
+			  qds_plan_shape_hash(queryDesc->plannedstmt) ||
+			  fabs(new_cost - old_cost) > qds_replan_cost_change * old_cost);
+
+	MemoryContextSwitchTo(oldctx);
+	MemoryContextDelete(mcxt);
+	return result;
+}
+
+/*
+ * Is the misestimation at the scan worth reporting? Without the qds_replan
+ * mode any one is. The statement is re-planned only once for the candidate:
+ * both EXPLAIN and the analysis at the end of the execution need it.
+ */
+static bool
+candidate_changes_plan(QdsStatement *stmt, CandidateQualEntry *entry,
+					   PlanState *ps)
+{
+	Cardinality	plan_rows;
+	Cardinality	real_rows;
+	Cardinality	filtered;
+
+	if (!qds_replan || stmt->parse == NULL || stmt->queryDesc == NULL)
+		return true;
+
+	if (!entry->replanned)
+	{
+		if (!planstate_calculate(ps, &plan_rows, &real_rows, &filtered))
+			return false;
+
+		entry->sensitive = replan_changes_plan(stmt, entry, real_rows);
+		entry->replanned = true;
+	}
+
+	return entry->sensitive;
+}
+
+static bool
+is_join_state(PlanState *ps)
+{
+	return IsA(ps, NestLoopState) || IsA(ps, MergeJoinState) ||
+		   IsA(ps, HashJoinState);
+}
+
+/*
+ * Collect range table indexes of relations scanned by the plan subtree.
+ */
+static void
+plan_scanrelids(Plan *plan, Bitmapset **relids)
+{
+	List	   *children = NIL;
+	ListCell   *lc;
+
+	if (plan == NULL)
+		return;
+
+	if (plan_scanrelid(plan) > 0)
+		*relids = bms_add_member(*relids, plan_scanrelid(plan));
+
+	switch (nodeTag(plan))
+	{
+		case T_CustomScan:
+			children = ((CustomScan *) plan)->custom_plans;
+			break;
+		case T_SubqueryScan:
+			plan_scanrelids(((SubqueryScan *) plan)->subplan, relids);
+			break;
+		case T_Append:
+			children = ((Append *) plan)->appendplans;
+			break;
+		case T_MergeAppend:
+			children = ((MergeAppend *) plan)->mergeplans;
+			break;
+		default:
+			break;
+	}
+
+	foreach(lc, children)
+		plan_scanrelids((Plan *) lfirst(lc), relids);
+
+	plan_scanrelids(plan->lefttree, relids);
+	plan_scanrelids(plan->righttree, relids);
+}
+
+/*
+ * Find join candidates for relations, joined by the node: one of the pair is
+ * scanned by the outer subtree and another one - by the inner subtree.
+ */
+static List *
+fetch_join_candidates(QdsStatement *stmt, PlanState *ps)
+{
+	Bitmapset		   *outer = NULL;
+	Bitmapset		   *inner = NULL;
+	List			   *result = NIL;
+	ListCell		   *lc;
+
+	if (stmt == NULL || stmt->joins == NIL)
+		return NIL;
+
+	plan_scanrelids(outerPlan(ps->plan), &outer);
+	plan_scanrelids(innerPlan(ps->plan), &inner);
+
+	foreach(lc, stmt->joins)
+	{
+		JoinCandidateEntry *entry = (JoinCandidateEntry *) lfirst(lc);
+
+		/* Unbound relations are never members */
+		if ((bms_is_member(entry->key.relid1, outer) &&
+			 bms_is_member(entry->key.relid2, inner)) ||
+			(bms_is_member(entry->key.relid1, inner) &&
+			 bms_is_member(entry->key.relid2, outer)))
+			result = lappend(result, entry);
+	}
+
+	bms_free(outer);
+	bms_free(inner);
+	return result;
+}
+
+/*
+ * Check the node for a significant estimation error.
+ *
+ * On success, optionally return the estimation error (q-error) and total
+ * number of rows produced by the node.
+ */
+static bool
+probe_candidate_node(PlanState *ps, double *qerror, double *nrows)
+{
+	Cardinality	plan_rows;
+	Cardinality	real_rows;
+	Cardinality filtered;
+	double		error;
+	bool		ret;
+
+	if (ps == NULL)
+		return false;
+
+	ret = planstate_calculate(ps, &plan_rows, &real_rows, &filtered);
+	if (!ret || real_rows < 2.)
+		return false;
+
+	error = Max(plan_rows / real_rows, real_rows / plan_rows);
+	if (error < estimation_error_threshold)
+		return false;
+
+	if (qerror != NULL)
+		*qerror = error;
+	if (nrows != NULL)
+		*nrows = real_rows * ps->instrument->nloops;
+	return true;
+}
+
+/*
+ * Check the join node for a significant error of the join clauses selectivity.
+ *
+ * Errors of the inputs are propagated to the join estimation. Exclude them, so
+ * the rest is the error, introduced by the join clauses. The join clauses,
+ * pushed down to a parameterised inner scan, are out of the scope here.
+ */
+static bool
+probe_join_node(PlanState *ps, double *qerror, double *nrows)
+{
+	Cardinality	plan_rows;
+	Cardinality	real_rows;
+	Cardinality	outer_plan;
+	Cardinality	outer_real;
+	Cardinality	inner_plan;
+	Cardinality	inner_real;
+	Cardinality filtered;
+	double		ratio;
+	double		error;
+
+	if (!planstate_calculate(ps, &plan_rows, &real_rows, &filtered) ||
+		real_rows < 2. ||
+		!planstate_calculate(outerPlanState(ps), &outer_plan, &outer_real,
+							 &filtered) ||
+		!planstate_calculate(innerPlanState(ps), &inner_plan, &inner_real,
+							 &filtered))
+		return false;
+
+	ratio = (real_rows / plan_rows) /
+		((outer_real / outer_plan) * (inner_real / inner_plan));
+	error = Max(ratio, 1. / ratio);
+	if (error < estimation_error_threshold)
+		return false;
+
+	if (qerror != NULL)
+		*qerror = error;
+	if (nrows != NULL)
+		*nrows = real_rows * ps->instrument->nloops;
+	return true;
+}
+
+/*
+ * Is the algorithm of the plan node chosen by the planner according to the
+ * number of input rows? A misestimated input of such a node is likely to make
+ * the plan worse than the planner thinks.
+ */
+static bool
+is_cardinality_sensitive(Plan *plan)
+{
+	switch (nodeTag(plan))
+	{
+		case T_NestLoop:
+		case T_HashJoin:
+		case T_MergeJoin:
+		case T_Hash:
+		case T_Sort:
+		case T_IncrementalSort:
+		case T_Memoize:
+		case T_Material:
+		case T_Agg:
+			return true;
+		default:
+			break;
+	}
+
+	return false;
+}
+
+/*
+ * Score the misestimation at the node by its likely impact on the query
+ * runtime, so a large error of a cheap node doesn't outrank a moderate error
+ * feeding an expensive one.
+ *
+ * The q-error is weighted by the work of the node - the number of rows it
+ * produced over all the loops. Rows are used even if the timing is tracked, so
+ * the scores of all the queries stay comparable. The result is scaled by the
+ * share of the plan cost, which depends on the node - cost of the consumer of
+ * its rows - and doubled if the consumer is sensitive to the input
+ * cardinality. Logarithms keep the factors comparable.
+ */
+static double
+candidate_score(PlanState *ps, Plan *consumer, Plan *top, double qerror,
+				double nrows)
+{
+	double	share;
+
+	if (consumer == NULL)
+		consumer = ps->plan;
+	share = (top != NULL && top->total_cost > 0.) ?
+		consumer->total_cost / top->total_cost : 1.0;
+	share = Min(Max(share, 0.001), 1.0);
+
+	return log2(qerror) * log2(2.0 + nrows) * share *
+		(is_cardinality_sensitive(consumer) ? 2.0 : 1.0);
+}
+
+#include "nodes/makefuncs.h"
+#include "utils/lsyscache.h"
+
+/*
+ * Separate the logic in a single function just to reuse it in multiple places
+ */
+static List *
+get_canidate_expressions(Oid relid, Index varno, Bitmapset *attnums,
+						 List *exprs)
+{
+	List				   *candidates = NIL;
+	int						i = -1;
+
+	while ((i = bms_next_member(attnums, i)) > 0)
+	{
+		Var	   *var;
+		Oid		typid;
+		int32	typmod;
+		Oid		collid;
+
+		get_atttypetypmodcoll(relid, i, &typid, &typmod, &collid);
+		var= makeVar(varno, i, typid, typmod, collid, 0);
+		candidates = lappend(candidates, var);
+	}
+
+	candidates = list_concat(candidates, exprs);
+	return candidates;
+}
+
+/*
+ * Candidate expressions as a text, like EXPLAIN shows them
+ */
+static char *
+deparse_candidate_expressions(Oid relid, Index varno, Bitmapset *attnums,
+							  List *exprs)
+{
+	List   *candidates;
+
+	candidates = get_canidate_expressions(relid, varno, attnums,
+										  copyObject(exprs));
+
+	/* The deparsing context knows the only relation */
+	if (varno != 1)
+		ChangeVarNodes((Node *) candidates, varno, 1, 0);
+
+	return deparse_expression((Node *) candidates,
+							  deparse_context_for(get_rel_name(relid), relid),
+							  false, false);
+}
+
+#if PG_VERSION_NUM >= 180000
+
+/* *****************************************************************************
+ *
  * COPY From explain.c
  *
  * ****************************************************************************/
-#include "utils/ruleutils.h"
 static void
 show_expression(Node *node, const char *qlabel,
 				PlanState *planstate, List *ancestors,
@@ -889,6 +1881,10 @@ qds_per_node_hook(PlanState *planstate, List *ancestors,
 				  struct ExplainState *es)
 {
 	StatMgrOptions *options;
+	QdsStatement   *stmt;
+	Plan		   *consumer = NULL;
+	double			qerror;
+	double			nrows;
 
 	if (prev_explain_per_node_hook)
 		(*prev_explain_per_node_hook) (planstate, ancestors, relationship,
@@ -898,33 +1894,74 @@ qds_per_node_hook(PlanState *planstate, List *ancestors,
 	if (options == NULL)
 		return;
 
-	if (options->show_extstat_candidates && probe_candidate_node(planstate))
+	if (!options->show_extstat_candidates)
+		return;
+
+	stmt = qds_statement_find(NULL, es->pstmt);
+	if (stmt == NULL)
+		return;
+
+	/* Consumer of the node rows, if it isn't a subplan */
+	if (ancestors != NIL && !IsA(linitial(ancestors), SubPlan))
+		consumer = (Plan *) linitial(ancestors);
+
+	if (is_join_state(planstate))
 	{
-		CandidateQualEntry	   *entry;
-		List				   *candidates = NIL;
-		int						i = -1;
+		List	   *candidates = NIL;
+		ListCell   *lc;
 
-		/* Show candidate clauses for extended statistics definition */
-		entry = fetch_candidate_entry(planstate, es->rtable);
-		if (entry == NULL)
+		if (!probe_join_node(planstate, &qerror, &nrows))
 			return;
 
-		while ((i = bms_next_member(entry->attnums, i)) > 0)
+		/* Show columns of both sides of the join */
+		foreach(lc, fetch_join_candidates(stmt, planstate))
 		{
-			Var	   *var;
-			Oid		typid;
-			int32	typmod;
-			Oid		collid;
-
-			get_atttypetypmodcoll(entry->key.oid, i, &typid, &typmod, &collid);
-			var= makeVar(entry->key.relid, i, typid, typmod, collid, 0);
-			candidates = lappend(candidates, var);
+			JoinCandidateEntry *entry = (JoinCandidateEntry *) lfirst(lc);
+
+			candidates = list_concat(candidates,
+									 get_canidate_expressions(entry->key.oid1,
+															  entry->key.relid1,
+															  entry->attnums1,
+															  NIL));
+			candidates = list_concat(candidates,
+									 get_canidate_expressions(entry->key.oid2,
+															  entry->key.relid2,
+															  entry->attnums2,
+															  NIL));
 		}
 
-		candidates = list_concat(candidates, entry->exprs_list);
+		if (candidates == NIL)
+			return;
+
+		show_expression((Node *) candidates, "Candidate extstat join quals",
+						planstate, ancestors, true, es);
+	}
+	else if (probe_candidate_node(planstate, &qerror, &nrows))
+	{
+		CandidateQualEntry	   *entry;
+		List				   *candidates;
+
+		/* Show candidate clauses for extended statistics definition */
+		entry = fetch_candidate_entry(stmt, planstate);
+		if (entry == NULL || !candidate_changes_plan(stmt, entry, planstate))
+			return;
+
+		candidates = get_canidate_expressions(entry->key.oid, entry->key.relid,
+											  entry->attnums,
+											  entry->exprs_list);
 		show_expression((Node *) candidates, "Candidate extstat quals",
 						planstate, ancestors, false, es);
 	}
+	else
+		return;
+
+	/* The score depends on the costs, show it along with them */
+	if (es->costs)
+		ExplainPropertyFloat("Candidate Score", NULL,
+							 candidate_score(planstate, consumer,
+											 es->pstmt->planTree,
+											 qerror, nrows),
+							 2, es);
 }
 
 static void
@@ -950,6 +1987,10 @@ qds_explain_validate_options_hook(struct ExplainState *es, List *options,
 		ereport(ERROR,
 				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 				 errmsg("EXPLAIN option %s requires ANALYZE", "EXTSTAT_CANDIDATES")));
+
+	/* Candidates should be shown even for a statement known by the memo */
+	if (opts && opts->show_extstat_candidates)
+		explain_candidates_requested = true;
 }
 #endif
 
@@ -959,10 +2000,180 @@ qds_explain_validate_options_hook(struct ExplainState *es, List *options,
 
 int current_execution_level = 0;
 
+static int
+queryid_cmp(const void *a, const void *b)
+{
+	int64		qa = *(const int64 *) a;
+	int64		qb = *(const int64 *) b;
+
+	return (qa > qb) - (qa < qb);
+}
+
+/*
+ * Decide whether the statement should be analysed. Queries out of the
+ * qds_queryids list are never sampled, the rest are sampled with the
+ * probability qds_sample_rate.
+ */
+static bool
+qds_sample_query(int64 queryId)
+{
+	if (!enable_qds || qds_sample_rate <= 0.0)
+		return false;
+
+	if (qds_queryid_list != NULL &&
+		bsearch(&queryId, qds_queryid_list->ids, qds_queryid_list->nids,
+				sizeof(int64), queryid_cmp) == NULL)
+		return false;
+
+	return qds_sample_rate >= 1.0 || sample_random() < qds_sample_rate;
+}
+
+/*
+ * Make the sampling decision before the planning of a top-level statement:
+ * non-sampled queries don't gather candidate clauses at all. The same is for
+ * statements already analysed, according to the memo.
+ */
+#if PG_VERSION_NUM >= 190000
+static PlannedStmt *
+qds_planner(Query *parse, const char *query_string, int cursorOptions,
+			ParamListInfo boundParams, ExplainState *es)
+#else
+static PlannedStmt *
+qds_planner(Query *parse, const char *query_string, int cursorOptions,
+			ParamListInfo boundParams)
+#endif
+{
+	PlannedStmt	   *result;
+	int64			queryId = (int64) parse->queryId;
+	QdsStatement   *save_statement = planning_statement;
+	QdsStatement   *stmt = NULL;
+
+	/* Re-planning of an analysed statement isn't a subject for the QDS */
+	if (replan_entry != NULL)
+	{
+#if PG_VERSION_NUM >= 190000
+		if (prev_planner_hook)
+			return prev_planner_hook(parse, query_string, cursorOptions,
+									 boundParams, es);
+		return standard_planner(parse, query_string, cursorOptions,
+								boundParams, es);
+#else
+		if (prev_planner_hook)
+			return prev_planner_hook(parse, query_string, cursorOptions,
+									 boundParams);
+		return standard_planner(parse, query_string, cursorOptions,
+								boundParams);
+#endif
+	}
+
+	if (plan_nesting_level == 0 && current_execution_level == 0)
+	{
+		current_query_sampled = qds_sample_query(queryId);
+		current_query_forced = explain_candidates_requested;
+		explain_candidates_requested = false;
+	}
+
+	/* Learning of corrections needs each sampled execution to be analysed */
+	if (current_query_sampled &&
+		(current_query_forced || qds_corrections_enabled() ||
+		 !qds_memo_lookup(queryId, estimation_error_threshold)))
+	{
+		stmt = MemoryContextAllocZero(qds_local_memctx, sizeof(QdsStatement));
+		stmt->memo = qds_memo_enabled(queryId);
+
+		/* The planner scribbles on the query tree, keep a copy */
+		if (qds_replan)
+		{
+			MemoryContext oldctx = MemoryContextSwitchTo(qds_local_memctx);
+
+			stmt->parse = copyObject(parse);
+			stmt->cursorOptions = cursorOptions;
+			stmt->has_params = (boundParams != NULL);
+			MemoryContextSwitchTo(oldctx);
+		}
+	}
+
+	planning_statement = stmt;
+	plan_nesting_level++;
+	PG_TRY();
+	{
+#if PG_VERSION_NUM >= 190000
+		if (prev_planner_hook)
+			result = prev_planner_hook(parse, query_string, cursorOptions,
+									   boundParams, es);
+		else
+			result = standard_planner(parse, query_string, cursorOptions,
+									  boundParams, es);
+#else
+		if (prev_planner_hook)
+			result = prev_planner_hook(parse, query_string, cursorOptions,
+									   boundParams);
+		else
+			result = standard_planner(parse, query_string, cursorOptions,
+									  boundParams);
+#endif
+	}
+	PG_FINALLY();
+	{
+		plan_nesting_level--;
+		planning_statement = save_statement;
+	}
+	PG_END_TRY();
+
+	if (stmt != NULL)
+	{
+		MemoryContext	oldctx;
+		ListCell	   *lc;
+
+		/* Forget an unexecuted statement, planned with the same key */
+		foreach(lc, qds_statements)
+		{
+			QdsStatement *other = (QdsStatement *) lfirst(lc);
+
+			if (other->queryDesc == NULL && qds_statement_matches(other, result))
+				qds_statements = foreach_delete_current(qds_statements, lc);
+		}
+
+		stmt->planned = true;
+		stmt->queryId = (int64) result->queryId;
+		stmt->stmt_location = result->stmt_location;
+		stmt->stmt_len = result->stmt_len;
+		stmt->level = current_execution_level;
+
+		/* Pointers of the range table don't survive a copy of the plan */
+		bind_candidates(stmt, result->rtable);
+
+		oldctx = MemoryContextSwitchTo(qds_local_memctx);
+		qds_statements = lcons(stmt, qds_statements);
+		MemoryContextSwitchTo(oldctx);
+	}
+
+	return result;
+}
+
+/*
+ * Does the query need to be analysed at the end of execution? Without any
+ * candidate clauses gathered during the planning there is nothing to look for.
+ */
+static bool
+qds_query_analysed(QdsStatement *stmt)
+{
+	if (stmt == NULL || !current_query_sampled)
+		return false;
+
+	if (!qds_log && !(qds_collect && qds_repository_enabled()) &&
+		!qds_corrections_enabled())
+		return false;
+
+	return stmt->quals != NIL || stmt->joins != NIL;
+}
+
 static void
 qds_ExecutorStart(QueryDesc *queryDesc, int eflags)
 {
-	if (qds_log)
+	bool	analysed = qds_query_analysed(qds_statement_start(queryDesc));
+
+	if (analysed)
 	{
 		/* Force minimal instrumentation needed for the extension */
 		queryDesc->instrument_options |= INSTRUMENT_ROWS;
@@ -972,6 +2183,35 @@ qds_ExecutorStart(QueryDesc *queryDesc, int eflags)
 		prev_ExecutorStart(queryDesc, eflags);
 	else
 		standard_ExecutorStart(queryDesc, eflags);
+
+	if (analysed && qds_min_duration > 0 && queryDesc->totaltime == NULL)
+	{
+		MemoryContext oldctx;
+
+		/* Track the total execution time to skip fast queries */
+		oldctx = MemoryContextSwitchTo(queryDesc->estate->es_query_cxt);
+		queryDesc->totaltime = InstrAlloc(1, INSTRUMENT_TIMER, false);
+		MemoryContextSwitchTo(oldctx);
+	}
+}
+
+/*
+ * Has the query been executed long enough to be analysed?
+ */
+static bool
+qds_duration_exceeded(QueryDesc *queryDesc)
+{
+	double		msec;
+
+	if (qds_min_duration <= 0)
+		return true;
+
+	if (queryDesc->totaltime == NULL)
+		return false;
+
+	InstrEndLoop(queryDesc->totaltime);
+	msec = queryDesc->totaltime->total * 1000.0;
+	return msec >= qds_min_duration;
 }
 
 #if PG_VERSION_NUM >= 180000
@@ -1040,43 +2280,195 @@ qds_ExecutorFinish(QueryDesc *queryDesc)
 
 typedef struct CandidatesContext
 {
-	List		   *rtable;
-	StringInfoData	out;
-	bool			haveCandidates;
+	QdsStatement   *stmt;
+	Plan		   *top;		/* top node of the plan */
+	PlanState	   *parent;		/* parent of the node being walked */
+	bool			learn;		/* learn cardinality corrections */
+	List		   *found;		/* list of QdsMemoCandidate */
 } CandidatesContext;
 
+/*
+ * Record the actual number of rows of a scan having candidate clauses, whether
+ * it was misestimated or not, to learn the cardinality correction.
+ */
+static void
+learn_correction(QdsStatement *stmt, PlanState *ps)
+{
+	CandidateQualEntry *entry;
+	Cardinality			plan_rows;
+	Cardinality			real_rows;
+	Cardinality			filtered;
+
+	entry = fetch_candidate_entry(stmt, ps);
+	if (entry == NULL || entry->signature == 0 ||
+		!planstate_calculate(ps, &plan_rows, &real_rows, &filtered))
+		return;
+
+	qds_correction_record(entry->key.oid, entry->signature, entry->pclass,
+						  entry->raw_rows, real_rows);
+}
+
+static void
+add_candidate(CandidatesContext *ctx, Oid relid, Index varno,
+			  Bitmapset *attnums, List *exprs, double qerror, double nrows,
+			  double score)
+{
+	QdsMemoCandidate *candidate = palloc(sizeof(QdsMemoCandidate));
+
+	candidate->relid = relid;
+	candidate->varno = varno;
+	candidate->attnums = attnums;
+	candidate->exprs = exprs;
+	candidate->qerror = qerror;
+	candidate->nrows = nrows;
+	candidate->score = score;
+	ctx->found = lappend(ctx->found, candidate);
+}
+
 static bool
 show_candidates_walker(PlanState *ps, void *context)
 {
-	CandidatesContext *ctx = (CandidatesContext *) context;
+	CandidatesContext  *ctx = (CandidatesContext *) context;
+	PlanState		   *save_parent = ctx->parent;
+	Plan			   *consumer;
+	double				qerror;
+	double				nrows;
+	bool				result;
 
 	if (ps == NULL)
 		return false;
 
-	if (probe_candidate_node(ps))
+	consumer = (ctx->parent != NULL) ? ctx->parent->plan : NULL;
+
+	if (ctx->learn && !is_join_state(ps))
+		learn_correction(ctx->stmt, ps);
+
+	if (is_join_state(ps))
+	{
+		if (probe_join_node(ps, &qerror, &nrows))
 		{
-			CandidateQualEntry *entry;
-			List			   *candidates;
+			ListCell   *lc;
+			double		score;
 
-			/*
-			 * TODO: print to elog. But remember, we may be not in the top level
-			 * query.
-			 */
-			entry = fetch_candidate_entry(ps, ctx->rtable);
-			if (entry != NULL)
+			score = candidate_score(ps, consumer, ctx->top, qerror, nrows);
+
+			/* Each side of the join is a separate candidate */
+			foreach(lc, fetch_join_candidates(ctx->stmt, ps))
 			{
-				candidates = get_canidate_expressions(entry);
-				appendStringInfo(&ctx->out,
-								 "Relation: %s\n", get_rel_name(entry->key.oid));
+				JoinCandidateEntry *entry = (JoinCandidateEntry *) lfirst(lc);
+
+				if (entry->attnums1 != NULL)
+					add_candidate(ctx, entry->key.oid1, entry->key.relid1,
+								  entry->attnums1, NIL, qerror, nrows, score);
+				if (entry->attnums2 != NULL)
+					add_candidate(ctx, entry->key.oid2, entry->key.relid2,
+								  entry->attnums2, NIL, qerror, nrows, score);
+			}
+		}
+	}
+	else if (probe_candidate_node(ps, &qerror, &nrows))
+	{
+		CandidateQualEntry *entry;
 
-				appendStringInfo(&ctx->out,
-								 "Expressions: %s\n", nodeToString(candidates));
+		entry = fetch_candidate_entry(ctx->stmt, ps);
+		if (entry != NULL && candidate_changes_plan(ctx->stmt, entry, ps))
+			add_candidate(ctx, entry->key.oid, entry->key.relid,
+						  entry->attnums, entry->exprs_list, qerror, nrows,
+						  candidate_score(ps, consumer, ctx->top, qerror,
+										  nrows));
+	}
 
-				ctx->haveCandidates = true;
-			}
+	ctx->parent = ps;
+	result = planstate_tree_walker(ps, show_candidates_walker, context);
+	ctx->parent = save_parent;
+	return result;
+}
+
+static int
+candidate_score_cmp(const ListCell *a, const ListCell *b)
+{
+	QdsMemoCandidate   *ca = (QdsMemoCandidate *) lfirst(a);
+	QdsMemoCandidate   *cb = (QdsMemoCandidate *) lfirst(b);
+
+	if (ca->score > cb->score)
+		return -1;
+	if (ca->score < cb->score)
+		return 1;
+	return 0;
+}
+
+/*
+ * Walk the executed plan for misestimated nodes having candidate clauses of
+ * the statement. Log and collect them, the most impacting first, and remember
+ * the outcome in the memo.
+ */
+static void
+analyse_candidates(QueryDesc *queryDesc, QdsStatement *stmt, bool collect)
+{
+	CandidatesContext	ctx;
+	ListCell		   *lc;
+
+	ctx.stmt = stmt;
+	ctx.top = queryDesc->plannedstmt->planTree;
+	ctx.parent = NULL;
+	ctx.learn = qds_corrections_enabled();
+	ctx.found = NIL;
+	show_candidates_walker(queryDesc->planstate, (void *) &ctx);
+	list_sort(ctx.found, candidate_score_cmp);
+
+	/*
+	 * Logging is mostly for debugging. The shared repository is the way to see
+	 * candidates over the whole workload.
+	 */
+	if (qds_log && ctx.found != NIL)
+	{
+		StringInfoData	out;
+
+		initStringInfo(&out);
+		appendStringInfo(&out,
+						 "\nBEGIN -----------------------------------------\n");
+		appendStringInfo(&out,
+						 "Show extstat's candidate clauses for the query:\n%s\n",
+						 queryDesc->sourceText);
+		foreach(lc, ctx.found)
+		{
+			QdsMemoCandidate   *candidate = (QdsMemoCandidate *) lfirst(lc);
+
+			appendStringInfo(&out,
+							 "Relation: %s\n",
+							 get_rel_name(candidate->relid));
+
+			appendStringInfo(&out,
+							 "Expressions: %s\n",
+							 deparse_candidate_expressions(candidate->relid,
+														   candidate->varno,
+														   candidate->attnums,
+														   candidate->exprs));
+
+			appendStringInfo(&out, "Score: %.2f\n", candidate->score);
 		}
+		appendStringInfo(&out,
+						 "--------------------------------------------- END\n");
+		elog(LOG, "%s", out.data);
+		pfree(out.data);
+	}
+
+	foreach(lc, ctx.found)
+	{
+		QdsMemoCandidate *candidate = (QdsMemoCandidate *) lfirst(lc);
+
+		if (!collect)
+			break;
+
+		qds_repository_record(candidate->relid, candidate->varno,
+							  candidate->attnums, candidate->exprs,
+							  candidate->qerror, candidate->nrows,
+							  candidate->score);
+	}
 
-	return planstate_tree_walker(ps, show_candidates_walker, context);
+	if (stmt->memo)
+		qds_memo_store(queryDesc->plannedstmt, ctx.found,
+					   estimation_error_threshold);
 }
 
 /*
@@ -1090,41 +2482,62 @@ show_candidates_walker(PlanState *ps, void *context)
 static void
 qds_ExecutorEnd(QueryDesc *queryDesc)
 {
-	PlanState  *ps = queryDesc->planstate;
+	bool			collect = qds_collect && qds_repository_enabled();
+	QdsStatement   *stmt = qds_statement_find(queryDesc, NULL);
 
-	if (qds_log && queryDesc->instrument_options & INSTRUMENT_ROWS)
+	if ((qds_log || collect || qds_corrections_enabled()) &&
+		current_query_sampled)
 	{
-		CandidatesContext ctx;
-
-		/*
-		 * XXX:
-		 * For now, it makes no much sense because of bare expression string
-		 * full of internal info. We do it mostly for debugging.
-		 */
-		ctx.rtable = queryDesc->plannedstmt->rtable;
-		initStringInfo(&ctx.out);
-		ctx.haveCandidates = false;
-		appendStringInfo(&ctx.out,
-						 "\nBEGIN -----------------------------------------\n");
-		appendStringInfo(&ctx.out,
-						 "Show extstat's candidate clauses for the query:\n%s\n",
-						 queryDesc->sourceText);
-		show_candidates_walker(ps, (void *) &ctx);
-		appendStringInfo(&ctx.out,
-						 "--------------------------------------------- END\n");
+		List	   *candidates;
+		ListCell   *lc;
 
-		if (ctx.haveCandidates)
-			elog(LOG, "%s", ctx.out.data);
-		pfree(ctx.out.data);
+		if (stmt == NULL)
+		{
+			/*
+			 * The statement is known by the memo and wasn't analysed again.
+			 * Just count its candidates in the repository.
+			 */
+			if (qds_memo_fetch(queryDesc->plannedstmt,
+							   estimation_error_threshold, &candidates))
+			{
+				foreach(lc, candidates)
+				{
+					QdsMemoCandidate *candidate =
+						(QdsMemoCandidate *) lfirst(lc);
+
+					if (!collect)
+						break;
+
+					qds_repository_record(candidate->relid, candidate->varno,
+										  candidate->attnums, candidate->exprs,
+										  candidate->qerror, candidate->nrows,
+										  candidate->score);
+				}
+			}
+		}
+		else if (stmt->quals == NIL && stmt->joins == NIL)
+		{
+			/* No candidate clauses were gathered, so nothing can be found */
+			if (stmt->memo)
+				qds_memo_store(queryDesc->plannedstmt, NIL,
+							   estimation_error_threshold);
+		}
+		else if ((queryDesc->instrument_options & INSTRUMENT_ROWS) &&
+				 qds_duration_exceeded(queryDesc))
+			analyse_candidates(queryDesc, stmt, collect);
 	}
 
-	/* At the end, remove all the data */
-	if (current_execution_level == 0)
-	{
-		/* Instead of destroy may be just reset the memory context? */
-		hash_destroy(candidate_quals);
+	if (stmt != NULL)
+		qds_statements = list_delete_ptr(qds_statements, stmt);
 
-		candidate_quals = NULL;
+	/*
+	 * At the end of the top-level query, remove all the data. Keep the memory
+	 * context blocks for the next query. A statement, executed while the
+	 * planning of another one, isn't the top-level one.
+	 */
+	if (current_execution_level == 0 && plan_nesting_level == 0)
+	{
+		qds_statements = NIL;
 		MemoryContextReset(qds_local_memctx);
 	}
 
@@ -1134,6 +2547,75 @@ qds_ExecutorEnd(QueryDesc *queryDesc)
 		standard_ExecutorEnd(queryDesc);
 }
 
+static bool
+check_hook_queryids(char **newval, void **extra, GucSource source)
+{
+	char	   *rawstring;
+	List	   *elemlist;
+	ListCell   *lc;
+	int64	   *ids;
+	int			nids = 0;
+	QueryIdList *myextra;
+
+	rawstring = pstrdup(*newval);
+	if (!SplitIdentifierString(rawstring, ',', &elemlist))
+	{
+		GUC_check_errdetail("List syntax is invalid.");
+		pfree(rawstring);
+		list_free(elemlist);
+		return false;
+	}
+
+	ids = (int64 *) palloc(sizeof(int64) * (list_length(elemlist) + 1));
+	foreach(lc, elemlist)
+	{
+		char	   *str = (char *) lfirst(lc);
+		char	   *endptr;
+
+		errno = 0;
+		ids[nids] = strtoi64(str, &endptr, 10);
+		if (*str == '\0' || *endptr != '\0' || errno == ERANGE)
+		{
+			GUC_check_errdetail("Invalid query identifier: \"%s\".", str);
+			pfree(ids);
+			pfree(rawstring);
+			list_free(elemlist);
+			return false;
+		}
+		nids++;
+	}
+	qsort(ids, nids, sizeof(int64), queryid_cmp);
+
+	/* Pass parsed value to the assign hook */
+#if PG_VERSION_NUM >= 160000
+	myextra = (QueryIdList *) guc_malloc(LOG, offsetof(QueryIdList, ids) +
+										 sizeof(int64) * nids);
+#else
+	myextra = (QueryIdList *) malloc(offsetof(QueryIdList, ids) +
+									 sizeof(int64) * nids);
+#endif
+	if (myextra != NULL)
+	{
+		myextra->nids = nids;
+		memcpy(myextra->ids, ids, sizeof(int64) * nids);
+		*extra = myextra;
+	}
+
+	pfree(ids);
+	pfree(rawstring);
+	list_free(elemlist);
+	return myextra != NULL;
+}
+
+static void
+assign_hook_queryids(const char *newval, void *extra)
+{
+	QueryIdList *list = (QueryIdList *) extra;
+
+	/* Empty list means no restriction */
+	qds_queryid_list = (list->nids > 0) ? list : NULL;
+}
+
 void qds_init(void)
 {
 	DefineCustomBoolVariable(MODULE_NAME".qds",
@@ -1172,6 +2654,72 @@ void qds_init(void)
 							NULL,
 							NULL);
 
+	DefineCustomRealVariable(MODULE_NAME ".qds_sample_rate",
+							"Fraction of queries to analyse for extended statistics candidates",
+							"Queries out of the sample neither gather candidate clauses nor are instrumented",
+							&qds_sample_rate,
+							1.0,
+							0.0,
+							1.0,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable(MODULE_NAME ".qds_min_duration",
+							"Sets the minimum execution time above which queries are analysed for extended statistics candidates",
+							"Zero analyses all the sampled queries",
+							&qds_min_duration,
+							0,
+							0,
+							INT_MAX,
+							PGC_SUSET,
+							GUC_UNIT_MS,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomStringVariable(MODULE_NAME ".qds_queryids",
+							   "Comma-separated list of query identifiers to analyse for extended statistics candidates",
+							   "Empty list means any query. Needs query identifiers to be computed",
+							   &qds_queryids,
+							   "",
+							   PGC_SUSET,
+							   GUC_LIST_INPUT,
+							   check_hook_queryids, assign_hook_queryids,
+							   NULL);
+
+	DefineCustomBoolVariable(MODULE_NAME ".qds_replan",
+							"Report a candidate only if the actual number of rows changes the plan",
+							"The statement is planned again for each misestimated scan, having candidate clauses",
+							&qds_replan,
+							false,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomRealVariable(MODULE_NAME ".qds_replan_cost_change",
+							"Relative change of the plan cost, making a candidate worth reporting even if the plan is the same",
+							NULL,
+							&qds_replan_cost_change,
+							0.1,
+							0.0,
+							INT_MAX,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	qds_repository_init();
+	qds_memo_init();
+	qds_correction_init();
+
+	prev_planner_hook = planner_hook;
+	planner_hook = qds_planner;
 	prev_create_upper_paths_hook = create_upper_paths_hook;
 	create_upper_paths_hook = upper_paths_hook;
 
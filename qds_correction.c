@@ -0,0 +1,570 @@
+/*-------------------------------------------------------------------------
+ *
+ * qds_correction.c
+ *		Cluster-wide cache of cardinality corrections, learned by the QDS.
+ *
+ * Until a recommended statistics is created and analysed, the planner makes
+ * the same estimation error again and again. The QDS already sees the actual
+ * number of rows of each scan having candidate clauses, so it records the
+ * ratio of the actual and estimated numbers per relation, clause set and
+ * parameter class into a bounded shared hash table. The planner multiplies
+ * the estimation of a base relation by the learned ratio if it is confident:
+ * there are enough observations and they agree with each other.
+ *
+ * The clause set signature doesn't depend on values of constants and
+ * parameters, so the same clauses with different values share an entry. To
+ * not mix up values with quite different selectivities, the parameter class
+ * is the order of magnitude of the original estimation.
+ *
+ * An entry expires when the relation is analysed: new statistics can fix the
+ * estimation or change it.
+ *
+ * Copyright (c) 2023-2025 Andrei Lepikhov
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ * IDENTIFICATION
+ *	  contrib/pg_index_stats/qds_correction.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <math.h>
+
+#include "access/parallel.h"
+#include "common/hashfn.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/pathnodes.h"
+#include "pgstat.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/timestamp.h"
+
+#include "pg_index_stats.h"
+#include "qds_correction.h"
+
+PG_FUNCTION_INFO_V1(pg_index_stats_corrections);
+PG_FUNCTION_INFO_V1(pg_index_stats_corrections_reset);
+
+#define QDS_CORR_TRANCHE	MODULE_NAME" corrections"
+
+/*
+ * Observations of an entry should agree within this spread: standard
+ * deviation of log2 of the ratios. Otherwise, the correction isn't applied.
+ */
+#define QDS_CORRECTION_MAX_SPREAD	(1.0)
+
+typedef struct QdsCorrectionKey
+{
+	Oid			dbid;
+	Oid			relid;
+	uint64		signature;	/* signature of the restriction clauses */
+	int32		pclass;		/* parameter class */
+} QdsCorrectionKey;
+
+typedef struct QdsCorrectionEntry
+{
+	QdsCorrectionKey key;
+
+	slock_t		mutex;		/* protects the fields below */
+	int64		nsamples;
+	double		sum;		/* sum of log2(actual / estimated) */
+	double		sumsq;		/* sum of squares of the same */
+	TimestampTz	analyzed;	/* last analysis of the relation */
+	TimestampTz	last_seen;
+} QdsCorrectionEntry;
+
+typedef struct QdsCorrectionState
+{
+	LWLock	   *lock;		/* protects the hash table structure */
+	int64		dropped;	/* number of evicted entries */
+} QdsCorrectionState;
+
+static bool qds_corrections = false;
+static int qds_max_corrections = 1000;
+static int qds_correction_min_samples = 10;
+
+static QdsCorrectionState *qds_corr = NULL;
+static HTAB *qds_corr_htab = NULL;
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static Size
+qds_correction_memsize(void)
+{
+	Size		size;
+
+	size = MAXALIGN(sizeof(QdsCorrectionState));
+	size = add_size(size, hash_estimate_size(qds_max_corrections,
+											 sizeof(QdsCorrectionEntry)));
+	return size;
+}
+
+#if PG_VERSION_NUM >= 150000
+static void
+qds_correction_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(qds_correction_memsize());
+	RequestNamedLWLockTranche(QDS_CORR_TRANCHE, 1);
+}
+#endif
+
+static void
+qds_correction_shmem_startup(void)
+{
+	HASHCTL		info;
+	bool		found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	qds_corr = NULL;
+	qds_corr_htab = NULL;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	qds_corr = ShmemInitStruct(MODULE_NAME" corrections state",
+							   sizeof(QdsCorrectionState), &found);
+	if (!found)
+	{
+		qds_corr->lock = &(GetNamedLWLockTranche(QDS_CORR_TRANCHE))->lock;
+		qds_corr->dropped = 0;
+	}
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(QdsCorrectionKey);
+	info.entrysize = sizeof(QdsCorrectionEntry);
+	qds_corr_htab = ShmemInitHash(MODULE_NAME" corrections hash",
+								  qds_max_corrections, qds_max_corrections,
+								  &info, HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+bool
+qds_corrections_enabled(void)
+{
+	return qds_corrections && qds_corr != NULL;
+}
+
+/*
+ * Hash the clause tree, ignoring values of constants and parameters.
+ */
+static bool
+signature_walker(Node *node, void *context)
+{
+	uint64	   *hash = (uint64 *) context;
+
+	if (node == NULL)
+		return false;
+
+	*hash = hash_combine64(*hash, (uint64) nodeTag(node));
+
+	switch (nodeTag(node))
+	{
+		case T_Var:
+			*hash = hash_combine64(*hash, (uint64) ((Var *) node)->varattno);
+			*hash = hash_combine64(*hash, (uint64) ((Var *) node)->varlevelsup);
+			break;
+		case T_Const:
+			*hash = hash_combine64(*hash, (uint64) ((Const *) node)->consttype);
+			break;
+		case T_Param:
+			*hash = hash_combine64(*hash, (uint64) ((Param *) node)->paramtype);
+			break;
+		case T_OpExpr:
+		case T_DistinctExpr:
+		case T_NullIfExpr:
+			*hash = hash_combine64(*hash, (uint64) ((OpExpr *) node)->opno);
+			break;
+		case T_ScalarArrayOpExpr:
+			*hash = hash_combine64(*hash,
+								   (uint64) ((ScalarArrayOpExpr *) node)->opno);
+			*hash = hash_combine64(*hash,
+								   (uint64) ((ScalarArrayOpExpr *) node)->useOr);
+			break;
+		case T_FuncExpr:
+			*hash = hash_combine64(*hash, (uint64) ((FuncExpr *) node)->funcid);
+			break;
+		case T_BoolExpr:
+			*hash = hash_combine64(*hash, (uint64) ((BoolExpr *) node)->boolop);
+			break;
+		case T_NullTest:
+			*hash = hash_combine64(*hash,
+								   (uint64) ((NullTest *) node)->nulltesttype);
+			break;
+		case T_BooleanTest:
+			*hash = hash_combine64(*hash,
+								   (uint64) ((BooleanTest *) node)->booltesttype);
+			break;
+		default:
+			break;
+	}
+
+	return expression_tree_walker(node, signature_walker, context);
+}
+
+/*
+ * Signature of the relation restriction clauses. It doesn't depend on the
+ * order of clauses.
+ */
+uint64
+qds_clauses_signature(List *restrictinfo)
+{
+	uint64		signature = 0;
+	ListCell   *lc;
+
+	foreach(lc, restrictinfo)
+	{
+		RestrictInfo   *rinfo = lfirst_node(RestrictInfo, lc);
+		uint64			hash = 0;
+
+		(void) signature_walker((Node *) rinfo->clause, (void *) &hash);
+		signature += hash;
+	}
+
+	return hash_combine64(signature, (uint64) list_length(restrictinfo));
+}
+
+/*
+ * Parameter class: order of magnitude of the original estimation.
+ */
+int
+qds_correction_class(double rows)
+{
+	return (int) floor(log2(Max(rows, 1.0)));
+}
+
+/*
+ * Time of the last analysis of the relation, according to the cumulative
+ * statistics, or 0.
+ */
+static TimestampTz
+relation_analyze_time(Oid relid)
+{
+	PgStat_StatTabEntry *tabentry = pgstat_fetch_stat_tabentry(relid);
+
+	if (tabentry == NULL)
+		return 0;
+
+#if PG_VERSION_NUM >= 160000
+	return Max(tabentry->last_analyze_time, tabentry->last_autoanalyze_time);
+#else
+	return Max(tabentry->analyze_timestamp,
+			   tabentry->autovac_analyze_timestamp);
+#endif
+}
+
+/*
+ * Evict the least recently seen entry to free space for a new one.
+ * Caller must hold the lock exclusively.
+ */
+static void
+qds_correction_evict(void)
+{
+	HASH_SEQ_STATUS		hash_seq;
+	QdsCorrectionEntry *entry;
+	QdsCorrectionEntry *victim = NULL;
+
+	hash_seq_init(&hash_seq, qds_corr_htab);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+	{
+		if (victim == NULL || entry->last_seen < victim->last_seen)
+			victim = entry;
+	}
+
+	if (victim == NULL)
+		return;
+
+	(void) hash_search(qds_corr_htab, &victim->key, HASH_REMOVE, NULL);
+	qds_corr->dropped++;
+}
+
+/*
+ * Add an observation of the scan: estimated number of rows, as it was before
+ * any correction, and the actual one.
+ */
+void
+qds_correction_record(Oid relid, uint64 signature, int pclass,
+					  double estimated, double actual)
+{
+	QdsCorrectionKey	key;
+	QdsCorrectionEntry *entry;
+	TimestampTz			analyzed;
+	TimestampTz			now;
+	double				ratio;
+
+	if (!qds_corrections_enabled() || IsParallelWorker())
+		return;
+
+	ratio = log2(Max(actual, 1.0) / Max(estimated, 1.0));
+	analyzed = relation_analyze_time(relid);
+
+	memset(&key, 0, sizeof(QdsCorrectionKey));
+	key.dbid = MyDatabaseId;
+	key.relid = relid;
+	key.signature = signature;
+	key.pclass = pclass;
+
+	LWLockAcquire(qds_corr->lock, LW_SHARED);
+	entry = (QdsCorrectionEntry *) hash_search(qds_corr_htab, &key,
+											   HASH_FIND, NULL);
+	if (entry == NULL)
+	{
+		bool found;
+
+		/* Need exclusive lock to add the new entry */
+		LWLockRelease(qds_corr->lock);
+		LWLockAcquire(qds_corr->lock, LW_EXCLUSIVE);
+
+		if (hash_get_num_entries(qds_corr_htab) >= qds_max_corrections)
+			qds_correction_evict();
+
+		entry = (QdsCorrectionEntry *) hash_search(qds_corr_htab, &key,
+												   HASH_ENTER, &found);
+		if (!found)
+		{
+			SpinLockInit(&entry->mutex);
+			entry->nsamples = 0;
+			entry->sum = 0.;
+			entry->sumsq = 0.;
+			entry->analyzed = analyzed;
+		}
+	}
+
+	/* Don't make a system call under the spinlock */
+	now = GetCurrentTimestamp();
+	SpinLockAcquire(&entry->mutex);
+	if (entry->analyzed != analyzed)
+	{
+		/* Observations made before the analysis are outdated */
+		entry->nsamples = 0;
+		entry->sum = 0.;
+		entry->sumsq = 0.;
+		entry->analyzed = analyzed;
+	}
+	entry->nsamples++;
+	entry->sum += ratio;
+	entry->sumsq += ratio * ratio;
+	entry->last_seen = now;
+	SpinLockRelease(&entry->mutex);
+
+	LWLockRelease(qds_corr->lock);
+}
+
+/*
+ * Find a confident correction of the estimation. The factor is the learned
+ * ratio of the actual and estimated numbers of rows.
+ */
+bool
+qds_correction_lookup(Oid relid, uint64 signature, int pclass, double *factor)
+{
+	QdsCorrectionKey	key;
+	QdsCorrectionEntry *entry;
+	int64				nsamples = 0;
+	double				sum = 0.;
+	double				sumsq = 0.;
+	TimestampTz			analyzed = 0;
+	double				mean;
+
+	/* Quick check without the lock: the planner calls it for each relation */
+	if (!qds_corrections_enabled() ||
+		hash_get_num_entries(qds_corr_htab) == 0)
+		return false;
+
+	memset(&key, 0, sizeof(QdsCorrectionKey));
+	key.dbid = MyDatabaseId;
+	key.relid = relid;
+	key.signature = signature;
+	key.pclass = pclass;
+
+	LWLockAcquire(qds_corr->lock, LW_SHARED);
+	entry = (QdsCorrectionEntry *) hash_search(qds_corr_htab, &key,
+											   HASH_FIND, NULL);
+	if (entry != NULL)
+	{
+		SpinLockAcquire(&entry->mutex);
+		nsamples = entry->nsamples;
+		sum = entry->sum;
+		sumsq = entry->sumsq;
+		analyzed = entry->analyzed;
+		SpinLockRelease(&entry->mutex);
+	}
+	LWLockRelease(qds_corr->lock);
+
+	if (nsamples < qds_correction_min_samples)
+		return false;
+
+	mean = sum / nsamples;
+	if (sqrt(Max(sumsq / nsamples - mean * mean, 0.)) >
+		QDS_CORRECTION_MAX_SPREAD)
+		return false;
+
+	/* The relation has been analysed since the observations */
+	if (analyzed != relation_analyze_time(relid))
+		return false;
+
+	*factor = pow(2.0, mean);
+	return true;
+}
+
+#define PG_INDEX_STATS_CORRECTIONS_COLS	(9)
+
+/*
+ * Show content of the corrections cache.
+ */
+Datum
+pg_index_stats_corrections(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	HASH_SEQ_STATUS		hash_seq;
+	QdsCorrectionEntry *entry;
+
+	if (qds_corr == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg(MODULE_NAME" must be loaded via \"shared_preload_libraries\"")));
+
+	prepare_materialized_srf(fcinfo);
+
+	LWLockAcquire(qds_corr->lock, LW_SHARED);
+	hash_seq_init(&hash_seq, qds_corr_htab);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+	{
+		Datum		values[PG_INDEX_STATS_CORRECTIONS_COLS];
+		bool		nulls[PG_INDEX_STATS_CORRECTIONS_COLS];
+		int64		nsamples;
+		double		sum;
+		double		sumsq;
+		double		mean;
+		TimestampTz	analyzed;
+		TimestampTz	last_seen;
+
+		memset(nulls, false, sizeof(nulls));
+
+		SpinLockAcquire(&entry->mutex);
+		nsamples = entry->nsamples;
+		sum = entry->sum;
+		sumsq = entry->sumsq;
+		analyzed = entry->analyzed;
+		last_seen = entry->last_seen;
+		SpinLockRelease(&entry->mutex);
+
+		mean = (nsamples > 0) ? sum / nsamples : 0.;
+
+		values[0] = ObjectIdGetDatum(entry->key.dbid);
+		values[1] = ObjectIdGetDatum(entry->key.relid);
+		values[2] = Int64GetDatum((int64) entry->key.signature);
+		values[3] = Int32GetDatum(entry->key.pclass);
+		values[4] = Int64GetDatum(nsamples);
+		values[5] = Float8GetDatum(pow(2.0, mean));
+		values[6] = Float8GetDatum(nsamples > 0 ?
+								   pow(2.0, sqrt(Max(sumsq / nsamples -
+													 mean * mean, 0.))) :
+								   1.0);
+		if (analyzed != 0)
+			values[7] = TimestampTzGetDatum(analyzed);
+		else
+			nulls[7] = true;
+		values[8] = TimestampTzGetDatum(last_seen);
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+	}
+	LWLockRelease(qds_corr->lock);
+
+	return (Datum) 0;
+}
+
+/*
+ * Forget all the learned corrections
+ */
+Datum
+pg_index_stats_corrections_reset(PG_FUNCTION_ARGS)
+{
+	HASH_SEQ_STATUS		hash_seq;
+	QdsCorrectionEntry *entry;
+
+	if (qds_corr == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg(MODULE_NAME" must be loaded via \"shared_preload_libraries\"")));
+
+	LWLockAcquire(qds_corr->lock, LW_EXCLUSIVE);
+	hash_seq_init(&hash_seq, qds_corr_htab);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+		(void) hash_search(qds_corr_htab, &entry->key, HASH_REMOVE, NULL);
+	qds_corr->dropped = 0;
+	LWLockRelease(qds_corr->lock);
+
+	PG_RETURN_VOID();
+}
+
+void
+qds_correction_init(void)
+{
+	DefineCustomBoolVariable(MODULE_NAME".qds_corrections",
+							"Correct estimations of base relations by the ratios learned by the QDS",
+							"Works only if the library is loaded by the shared_preload_libraries",
+							&qds_corrections,
+							false,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable(MODULE_NAME".qds_max_corrections",
+							"Sets the maximum number of corrections kept in the shared cache",
+							NULL,
+							&qds_max_corrections,
+							1000,
+							100,
+							INT_MAX / 2,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable(MODULE_NAME".qds_correction_min_samples",
+							"Sets the minimum number of agreeing observations to apply a correction",
+							NULL,
+							&qds_correction_min_samples,
+							10,
+							1,
+							INT_MAX,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = qds_correction_shmem_request;
+#else
+	RequestAddinShmemSpace(qds_correction_memsize());
+	RequestNamedLWLockTranche(QDS_CORR_TRANCHE, 1);
+#endif
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = qds_correction_shmem_startup;
+}
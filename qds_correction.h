@@ -0,0 +1,17 @@
+#ifndef _QDS_CORRECTION_H_
+#define _QDS_CORRECTION_H_
+
+#include "postgres.h"
+
+#include "nodes/pg_list.h"
+
+extern void qds_correction_init(void);
+extern bool qds_corrections_enabled(void);
+extern uint64 qds_clauses_signature(List *restrictinfo);
+extern int qds_correction_class(double rows);
+extern void qds_correction_record(Oid relid, uint64 signature, int pclass,
+								  double estimated, double actual);
+extern bool qds_correction_lookup(Oid relid, uint64 signature, int pclass,
+								  double *factor);
+
+#endif /* _QDS_CORRECTION_H_ */
@@ -0,0 +1,413 @@
+/*-------------------------------------------------------------------------
+ *
+ * qds_memo.c
+ *		Per-backend memo of statements already analysed by the QDS.
+ *
+ * High-frequency statements are planned and executed again and again with the
+ * same outcome of the analysis. The memo is keyed by the query identifier and
+ * remembers the shape of the analysed plan and the candidates found (probably,
+ * none). While the entry is valid, planning of the statement doesn't gather
+ * candidate clauses, the execution isn't instrumented and the plan isn't
+ * traversed: remembered candidates are just counted in the repository again.
+ * If the statement gets another plan, the entry is dropped and the next
+ * planning analyses it from scratch.
+ *
+ * Entries are dropped on invalidation of any relation the plan depends on (it
+ * includes ANALYZE, updating pg_class) and on any change of extended
+ * statistics, including build of the data outside of ANALYZE.
+ *
+ * Copyright (c) 2023-2025 Andrei Lepikhov
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ * IDENTIFICATION
+ *	  contrib/pg_index_stats/qds_memo.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "common/hashfn.h"
+#include "nodes/nodes.h"
+#include "parser/parsetree.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
+#include "utils/syscache.h"
+
+#include "pg_index_stats.h"
+#include "qds_memo.h"
+
+/* Relations of a plan tracked for invalidation. If more, any drops the entry */
+#define QDS_MEMO_MAX_RELS	(8)
+
+typedef struct QdsMemoEntry
+{
+	int64		queryId;		/* hash key */
+
+	bool		valid;
+	uint32		planhash;
+	double		threshold;		/* estimation_error_threshold of the analysis */
+	int			nrels;			/* -1, if there are too many relations */
+	Oid			rels[QDS_MEMO_MAX_RELS];
+	MemoryContext mcxt;			/* NULL, if no candidates */
+	List	   *candidates;		/* list of QdsMemoCandidate */
+} QdsMemoEntry;
+
+static int qds_memo_size = 1000;
+
+static HTAB *qds_memo = NULL;
+
+/*
+ * Invalidation callbacks only mark entries as invalid: the list of candidates
+ * may be in use at the moment. Invalid entries are removed on the next access
+ * to the memo.
+ */
+static bool memo_has_invalid = false;
+
+static void
+memo_remove(QdsMemoEntry *entry)
+{
+	if (entry->mcxt != NULL)
+		MemoryContextDelete(entry->mcxt);
+	(void) hash_search(qds_memo, &entry->queryId, HASH_REMOVE, NULL);
+}
+
+static void
+memo_purge(bool all)
+{
+	HASH_SEQ_STATUS	status;
+	QdsMemoEntry   *entry;
+
+	if (!all && !memo_has_invalid)
+		return;
+
+	hash_seq_init(&status, qds_memo);
+	while ((entry = (QdsMemoEntry *) hash_seq_search(&status)) != NULL)
+	{
+		if (all || !entry->valid)
+			memo_remove(entry);
+	}
+	memo_has_invalid = false;
+}
+
+static void
+memo_invalidate_all(void)
+{
+	HASH_SEQ_STATUS	status;
+	QdsMemoEntry   *entry;
+
+	if (hash_get_num_entries(qds_memo) == 0)
+		return;
+
+	hash_seq_init(&status, qds_memo);
+	while ((entry = (QdsMemoEntry *) hash_seq_search(&status)) != NULL)
+		entry->valid = false;
+	memo_has_invalid = true;
+}
+
+static void
+memo_relcache_callback(Datum arg, Oid relid)
+{
+	HASH_SEQ_STATUS	status;
+	QdsMemoEntry   *entry;
+
+	if (!OidIsValid(relid))
+	{
+		memo_invalidate_all();
+		return;
+	}
+
+	if (hash_get_num_entries(qds_memo) == 0)
+		return;
+
+	hash_seq_init(&status, qds_memo);
+	while ((entry = (QdsMemoEntry *) hash_seq_search(&status)) != NULL)
+	{
+		int		i;
+
+		if (!entry->valid)
+			continue;
+
+		if (entry->nrels < 0)
+		{
+			entry->valid = false;
+			memo_has_invalid = true;
+			continue;
+		}
+
+		for (i = 0; i < entry->nrels; i++)
+		{
+			if (entry->rels[i] == relid)
+			{
+				entry->valid = false;
+				memo_has_invalid = true;
+				break;
+			}
+		}
+	}
+}
+
+static void
+memo_syscache_callback(Datum arg, int cacheid, uint32 hashvalue)
+{
+	memo_invalidate_all();
+}
+
+static void
+memo_create(void)
+{
+	HASHCTL		ctl;
+
+	ctl.keysize = sizeof(int64);
+	ctl.entrysize = sizeof(QdsMemoEntry);
+	ctl.hcxt = CacheMemoryContext;
+	qds_memo = hash_create(MODULE_NAME" QDS memo", 256, &ctl,
+						   HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	CacheRegisterRelcacheCallback(memo_relcache_callback, (Datum) 0);
+	CacheRegisterSyscacheCallback(STATEXTOID, memo_syscache_callback,
+								  (Datum) 0);
+	CacheRegisterSyscacheCallback(STATEXTDATASTXOID, memo_syscache_callback,
+								  (Datum) 0);
+}
+
+/*
+ * Hash of the plan shape: node types and scanned relations and indexes.
+ * Estimations and parameters don't matter.
+ */
+static uint32
+plan_shape_hash(Plan *plan, List *rtable, uint32 hash)
+{
+	List	   *children = NIL;
+	Index		scanrelid = 0;
+	Oid			indexid = InvalidOid;
+	ListCell   *lc;
+
+	if (plan == NULL)
+		return hash;
+
+	hash = hash_combine(hash, (uint32) nodeTag(plan));
+
+	switch (nodeTag(plan))
+	{
+		case T_SeqScan:
+		case T_SampleScan:
+		case T_BitmapHeapScan:
+		case T_TidScan:
+		case T_ForeignScan:
+			scanrelid = ((Scan *) plan)->scanrelid;
+			break;
+		case T_IndexScan:
+			scanrelid = ((Scan *) plan)->scanrelid;
+			indexid = ((IndexScan *) plan)->indexid;
+			break;
+		case T_IndexOnlyScan:
+			scanrelid = ((Scan *) plan)->scanrelid;
+			indexid = ((IndexOnlyScan *) plan)->indexid;
+			break;
+		case T_BitmapIndexScan:
+			indexid = ((BitmapIndexScan *) plan)->indexid;
+			break;
+		case T_CustomScan:
+			scanrelid = ((Scan *) plan)->scanrelid;
+			children = ((CustomScan *) plan)->custom_plans;
+			break;
+		case T_SubqueryScan:
+			hash = plan_shape_hash(((SubqueryScan *) plan)->subplan, rtable,
+								   hash);
+			break;
+		case T_Append:
+			children = ((Append *) plan)->appendplans;
+			break;
+		case T_MergeAppend:
+			children = ((MergeAppend *) plan)->mergeplans;
+			break;
+		case T_BitmapAnd:
+			children = ((BitmapAnd *) plan)->bitmapplans;
+			break;
+		case T_BitmapOr:
+			children = ((BitmapOr *) plan)->bitmapplans;
+			break;
+		default:
+			break;
+	}
+
+	if (scanrelid > 0)
+		hash = hash_combine(hash, (uint32) rt_fetch(scanrelid, rtable)->relid);
+	if (OidIsValid(indexid))
+		hash = hash_combine(hash, (uint32) indexid);
+
+	foreach(lc, children)
+		hash = plan_shape_hash((Plan *) lfirst(lc), rtable, hash);
+
+	hash = plan_shape_hash(plan->lefttree, rtable, hash);
+	return plan_shape_hash(plan->righttree, rtable, hash);
+}
+
+/*
+ * Shape of the whole planned statement, including its subplans.
+ */
+uint32
+qds_plan_shape_hash(PlannedStmt *pstmt)
+{
+	uint32		hash;
+	ListCell   *lc;
+
+	hash = plan_shape_hash(pstmt->planTree, pstmt->rtable, 0);
+	foreach(lc, pstmt->subplans)
+		hash = plan_shape_hash((Plan *) lfirst(lc), pstmt->rtable, hash);
+
+	return hash;
+}
+
+/*
+ * Is the statement a subject for the memo?
+ */
+bool
+qds_memo_enabled(int64 queryId)
+{
+	return qds_memo_size > 0 && queryId != 0;
+}
+
+/*
+ * Does the memo know the statement? Used by the planning, when the plan shape
+ * is unknown yet.
+ */
+bool
+qds_memo_lookup(int64 queryId, double threshold)
+{
+	QdsMemoEntry   *entry;
+
+	if (qds_memo == NULL || !qds_memo_enabled(queryId))
+		return false;
+
+	memo_purge(false);
+	entry = (QdsMemoEntry *) hash_search(qds_memo, &queryId, HASH_FIND, NULL);
+	return entry != NULL && entry->threshold == threshold;
+}
+
+/*
+ * Remember the outcome of the analysis of the statement execution.
+ */
+void
+qds_memo_store(PlannedStmt *pstmt, List *candidates, double threshold)
+{
+	int64			queryId = (int64) pstmt->queryId;
+	QdsMemoEntry   *entry;
+	MemoryContext	mcxt = NULL;
+	List		   *copy = NIL;
+	bool			found;
+	ListCell	   *lc;
+
+	if (!qds_memo_enabled(queryId))
+		return;
+
+	if (qds_memo == NULL)
+		memo_create();
+
+	if (candidates != NIL)
+	{
+		MemoryContext	oldctx;
+
+		/*
+		 * Copy the candidates in a temporary context and move it under the
+		 * cache context only if no error happened.
+		 */
+		mcxt = AllocSetContextCreate(CurrentMemoryContext,
+									 MODULE_NAME" QDS memo entry",
+									 ALLOCSET_SMALL_SIZES);
+		oldctx = MemoryContextSwitchTo(mcxt);
+		foreach(lc, candidates)
+		{
+			QdsMemoCandidate *src = (QdsMemoCandidate *) lfirst(lc);
+			QdsMemoCandidate *dst = palloc(sizeof(QdsMemoCandidate));
+
+			*dst = *src;
+			dst->attnums = bms_copy(src->attnums);
+			dst->exprs = copyObject(src->exprs);
+			copy = lappend(copy, dst);
+		}
+		MemoryContextSwitchTo(oldctx);
+		MemoryContextSetParent(mcxt, CacheMemoryContext);
+	}
+
+	memo_purge(false);
+	entry = (QdsMemoEntry *) hash_search(qds_memo, &queryId, HASH_FIND, NULL);
+	if (entry != NULL)
+		memo_remove(entry);
+	else if (hash_get_num_entries(qds_memo) >= qds_memo_size)
+		memo_purge(true);
+
+	entry = (QdsMemoEntry *) hash_search(qds_memo, &queryId, HASH_ENTER,
+										 &found);
+	Assert(!found);
+	entry->valid = true;
+	entry->planhash = qds_plan_shape_hash(pstmt);
+	entry->threshold = threshold;
+	entry->mcxt = mcxt;
+	entry->candidates = copy;
+
+	entry->nrels = 0;
+	foreach(lc, pstmt->relationOids)
+	{
+		if (entry->nrels >= QDS_MEMO_MAX_RELS)
+		{
+			entry->nrels = -1;
+			break;
+		}
+		entry->rels[entry->nrels++] = lfirst_oid(lc);
+	}
+}
+
+/*
+ * Fetch the candidates of the executed statement.
+ *
+ * Returns false if the statement is unknown. If the plan has another shape,
+ * the entry is dropped, so the next planning would analyse the statement.
+ * The list of candidates is valid until the next access to the memo.
+ */
+bool
+qds_memo_fetch(PlannedStmt *pstmt, double threshold, List **candidates)
+{
+	int64			queryId = (int64) pstmt->queryId;
+	QdsMemoEntry   *entry;
+
+	if (qds_memo == NULL || !qds_memo_enabled(queryId))
+		return false;
+
+	memo_purge(false);
+	entry = (QdsMemoEntry *) hash_search(qds_memo, &queryId, HASH_FIND, NULL);
+	if (entry == NULL)
+		return false;
+
+	if (entry->threshold != threshold ||
+		entry->planhash != qds_plan_shape_hash(pstmt))
+	{
+		memo_remove(entry);
+		return false;
+	}
+
+	*candidates = entry->candidates;
+	return true;
+}
+
+void
+qds_memo_init(void)
+{
+	DefineCustomIntVariable(MODULE_NAME".qds_memo_size",
+							"Sets the maximum number of statements remembered by the QDS memo of a backend",
+							"Zero disables the memo. Needs query identifiers to be computed",
+							&qds_memo_size,
+							1000,
+							0,
+							INT_MAX / 2,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+}
@@ -0,0 +1,34 @@
+#ifndef _QDS_MEMO_H_
+#define _QDS_MEMO_H_
+
+#include "postgres.h"
+
+#include "nodes/bitmapset.h"
+#include "nodes/pg_list.h"
+#include "nodes/plannodes.h"
+
+/*
+ * Candidate, found by the analysis of a statement execution, as it is
+ * replayed into the repository on the next executions.
+ */
+typedef struct QdsMemoCandidate
+{
+	Oid			relid;
+	Index		varno;
+	Bitmapset  *attnums;
+	List	   *exprs;
+	double		qerror;
+	double		nrows;
+	double		score;		/* estimated impact on the query runtime */
+} QdsMemoCandidate;
+
+extern void qds_memo_init(void);
+extern bool qds_memo_enabled(int64 queryId);
+extern bool qds_memo_lookup(int64 queryId, double threshold);
+extern void qds_memo_store(PlannedStmt *pstmt, List *candidates,
+						   double threshold);
+extern bool qds_memo_fetch(PlannedStmt *pstmt, double threshold,
+						   List **candidates);
+extern uint32 qds_plan_shape_hash(PlannedStmt *pstmt);
+
+#endif /* _QDS_MEMO_H_ */
@@ -0,0 +1,829 @@
+/*-------------------------------------------------------------------------
+ *
+ * qds_repository.c
+ *		Cluster-wide repository of extended statistics candidates detected
+ *		by the QDS machinery.
+ *
+ * Each backend finishing a query with misestimated scans contributes the
+ * candidate set of columns and expressions into a shared hash table. Entries
+ * are identified by database, relation and a canonical form of the candidate
+ * definition, so the same set of clauses found by different queries ends up
+ * in the same entry. The content survives restarts through a dump file.
+
+ * Copyright (c) 2023-2025 Andrei Lepikhov
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ * IDENTIFICATION
+ *	  contrib/pg_index_stats/qds_repository.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/parallel.h"
+#include "catalog/pg_authid.h"
+#include "catalog/pg_type.h"
+#include "common/hashfn.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "rewrite/rewriteManip.h"
+#include "statistics/statistics.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/acl.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/ruleutils.h"
+#include "utils/timestamp.h"
+
+#include "pg_index_stats.h"
+#include "qds_repository.h"
+
+PG_FUNCTION_INFO_V1(pg_index_stats_candidates);
+PG_FUNCTION_INFO_V1(pg_index_stats_candidates_reset);
+
+#define QDS_REPO_TRANCHE	MODULE_NAME" candidates"
+#define QDS_REPO_DUMP_FILE	PGSTAT_STAT_PERMANENT_DIRECTORY "/" MODULE_NAME "_candidates.stat"
+
+/* Magic number identifying the dump file format */
+static const uint32 QDS_REPO_FILE_HEADER = 0x51445302;
+
+/*
+ * Expressions are stored twice: deparsed, to show them to a user and to
+ * identify the definition, and serialized, to be able to build statistics
+ * without the query. Too long definitions are just skipped.
+ */
+#define QDS_EXPRS_TEXT_LEN	(256)
+#define QDS_EXPRS_NODE_LEN	(1024)
+
+typedef struct QdsRepoKey
+{
+	Oid			dbid;
+	Oid			relid;
+	uint64		defhash;	/* hash of the canonical definition */
+} QdsRepoKey;
+
+typedef struct QdsRepoEntry
+{
+	QdsRepoKey	key;
+
+	int			natts;
+	AttrNumber	attnums[STATS_MAX_DIMENSIONS];
+	char		exprs_text[QDS_EXPRS_TEXT_LEN];
+	char		exprs_node[QDS_EXPRS_NODE_LEN];
+
+	slock_t		mutex;		/* protects the counters below */
+	int64		calls;
+	double		max_qerror;
+	double		sum_qerror;
+	double		rows;
+	double		score;		/* summary impact of the misestimations */
+	TimestampTz	last_seen;
+	bool		processed;	/* the background worker has made a decision */
+} QdsRepoEntry;
+
+typedef struct QdsRepoState
+{
+	LWLock	   *lock;		/* protects the hash table structure */
+	int64		dropped;	/* number of evicted entries */
+	TimestampTz	stats_reset;
+} QdsRepoState;
+
+/* An element of the expressions list under canonicalization */
+typedef struct CanonicalExpr
+{
+	Node	   *expr;
+	char	   *text;
+} CanonicalExpr;
+
+bool qds_collect = false;
+static int qds_max_candidates = 1000;
+static bool qds_save = true;
+
+static QdsRepoState *qds_repo = NULL;
+static HTAB *qds_repo_htab = NULL;
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static Size
+qds_repository_memsize(void)
+{
+	Size		size;
+
+	size = MAXALIGN(sizeof(QdsRepoState));
+	size = add_size(size, hash_estimate_size(qds_max_candidates,
+											 sizeof(QdsRepoEntry)));
+	return size;
+}
+
+#if PG_VERSION_NUM >= 150000
+static void
+qds_repository_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(qds_repository_memsize());
+	RequestNamedLWLockTranche(QDS_REPO_TRANCHE, 1);
+}
+#endif
+
+/*
+ * Dump the repository content into the file on the postmaster shutdown.
+ */
+static void
+qds_repository_shmem_shutdown(int code, Datum arg)
+{
+	FILE			   *file;
+	HASH_SEQ_STATUS		hash_seq;
+	QdsRepoEntry	   *entry;
+	int32				num_entries;
+
+	/* Don't try to dump during a crash */
+	if (code)
+		return;
+
+	if (qds_repo == NULL)
+		return;
+
+	if (!qds_save)
+	{
+		/* Remove an outdated file, if any */
+		(void) unlink(QDS_REPO_DUMP_FILE);
+		return;
+	}
+
+	file = AllocateFile(QDS_REPO_DUMP_FILE ".tmp", PG_BINARY_W);
+	if (file == NULL)
+		goto error;
+
+	num_entries = hash_get_num_entries(qds_repo_htab);
+	if (fwrite(&QDS_REPO_FILE_HEADER, sizeof(uint32), 1, file) != 1 ||
+		fwrite(&num_entries, sizeof(int32), 1, file) != 1)
+		goto error;
+
+	hash_seq_init(&hash_seq, qds_repo_htab);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+	{
+		if (fwrite(entry, sizeof(QdsRepoEntry), 1, file) != 1)
+		{
+			hash_seq_term(&hash_seq);
+			goto error;
+		}
+	}
+
+	if (FreeFile(file))
+	{
+		file = NULL;
+		goto error;
+	}
+
+	(void) durable_rename(QDS_REPO_DUMP_FILE ".tmp", QDS_REPO_DUMP_FILE, LOG);
+	return;
+
+error:
+	ereport(LOG,
+			(errcode_for_file_access(),
+			 errmsg("could not write file \"%s\": %m",
+					QDS_REPO_DUMP_FILE ".tmp")));
+	if (file)
+		FreeFile(file);
+	(void) unlink(QDS_REPO_DUMP_FILE ".tmp");
+}
+
+/*
+ * Load content of the repository, saved at the previous shutdown.
+ * Errors aren't critical here: in the worst case we lose gathered candidates.
+ */
+static void
+qds_repository_load(void)
+{
+	FILE	   *file;
+	uint32		header;
+	int32		num_entries;
+	int			i;
+
+	file = AllocateFile(QDS_REPO_DUMP_FILE, PG_BINARY_R);
+	if (file == NULL)
+	{
+		if (errno != ENOENT)
+			ereport(LOG,
+					(errcode_for_file_access(),
+					 errmsg("could not read file \"%s\": %m",
+							QDS_REPO_DUMP_FILE)));
+		return;
+	}
+
+	if (fread(&header, sizeof(uint32), 1, file) != 1 ||
+		fread(&num_entries, sizeof(int32), 1, file) != 1)
+		goto read_error;
+
+	if (header != QDS_REPO_FILE_HEADER)
+	{
+		ereport(LOG,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("ignoring invalid data in file \"%s\"",
+						QDS_REPO_DUMP_FILE)));
+		goto cleanup;
+	}
+
+	for (i = 0; i < num_entries; i++)
+	{
+		QdsRepoEntry	temp;
+		QdsRepoEntry   *entry;
+		bool			found;
+
+		if (fread(&temp, sizeof(QdsRepoEntry), 1, file) != 1)
+			goto read_error;
+
+		/* The limit could be decreased since the previous start */
+		if (hash_get_num_entries(qds_repo_htab) >= qds_max_candidates)
+			break;
+
+		entry = (QdsRepoEntry *) hash_search(qds_repo_htab, &temp.key,
+											 HASH_ENTER, &found);
+		if (!found)
+		{
+			memcpy(entry, &temp, sizeof(QdsRepoEntry));
+			SpinLockInit(&entry->mutex);
+		}
+	}
+	goto cleanup;
+
+read_error:
+	ereport(LOG,
+			(errcode_for_file_access(),
+			 errmsg("could not read file \"%s\": %m", QDS_REPO_DUMP_FILE)));
+cleanup:
+	FreeFile(file);
+
+	/*
+	 * Remove the file to not load the same data once more after a crash.
+	 */
+	(void) unlink(QDS_REPO_DUMP_FILE);
+}
+
+static void
+qds_repository_shmem_startup(void)
+{
+	HASHCTL		info;
+	bool		found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	qds_repo = NULL;
+	qds_repo_htab = NULL;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	qds_repo = ShmemInitStruct(MODULE_NAME" candidates state",
+							   sizeof(QdsRepoState), &found);
+	if (!found)
+	{
+		qds_repo->lock = &(GetNamedLWLockTranche(QDS_REPO_TRANCHE))->lock;
+		qds_repo->dropped = 0;
+		qds_repo->stats_reset = GetCurrentTimestamp();
+	}
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(QdsRepoKey);
+	info.entrysize = sizeof(QdsRepoEntry);
+	qds_repo_htab = ShmemInitHash(MODULE_NAME" candidates hash",
+								  qds_max_candidates, qds_max_candidates,
+								  &info, HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	/*
+	 * Only the postmaster dumps and loads the data. Backends just attach to
+	 * the shared structures.
+	 */
+	if (!IsUnderPostmaster)
+		on_shmem_exit(qds_repository_shmem_shutdown, (Datum) 0);
+
+	if (found)
+		return;
+
+	qds_repository_load();
+}
+
+bool
+qds_repository_enabled(void)
+{
+	return qds_repo != NULL;
+}
+
+static int
+canonical_expr_cmp(const ListCell *a, const ListCell *b)
+{
+	CanonicalExpr  *ea = (CanonicalExpr *) lfirst(a);
+	CanonicalExpr  *eb = (CanonicalExpr *) lfirst(b);
+
+	return strcmp(ea->text, eb->text);
+}
+
+/*
+ * Build canonical representation of the expressions list: make them
+ * independent from the range table position, sort and remove duplicates.
+ *
+ * Return false if the representation doesn't fit the repository entry.
+ */
+static bool
+canonicalize_exprs(Oid relid, Index varno, List *exprs,
+				   char **exprs_text, char **exprs_node)
+{
+	List		   *context;
+	List		   *items = NIL;
+	List		   *nodes = NIL;
+	ListCell	   *lc;
+	StringInfoData	str;
+	char		   *relname;
+	char		   *prev = NULL;
+
+	relname = get_rel_name(relid);
+	if (relname == NULL)
+		return false;
+
+	context = deparse_context_for(relname, relid);
+	foreach(lc, exprs)
+	{
+		CanonicalExpr  *item = palloc(sizeof(CanonicalExpr));
+
+		item->expr = copyObject(lfirst(lc));
+		if (varno != 1)
+			ChangeVarNodes(item->expr, varno, 1, 0);
+		item->text = deparse_expression(item->expr, context, false, false);
+		items = lappend(items, item);
+	}
+	list_sort(items, canonical_expr_cmp);
+
+	initStringInfo(&str);
+	foreach(lc, items)
+	{
+		CanonicalExpr  *item = (CanonicalExpr *) lfirst(lc);
+
+		if (prev != NULL && strcmp(prev, item->text) == 0)
+			continue;
+
+		if (str.len > 0)
+			appendStringInfoString(&str, ", ");
+		appendStringInfoString(&str, item->text);
+		nodes = lappend(nodes, item->expr);
+		prev = item->text;
+	}
+
+	*exprs_text = str.data;
+	*exprs_node = nodeToString(nodes);
+
+	return (strlen(*exprs_text) < QDS_EXPRS_TEXT_LEN &&
+			strlen(*exprs_node) < QDS_EXPRS_NODE_LEN);
+}
+
+/* Share of the entries, evicted at once when the repository is full */
+#define QDS_EVICT_PERCENT	(5)
+
+/* The least frequently seen entries go first, the oldest of them first */
+static int
+qds_entry_cmp(const void *a, const void *b)
+{
+	QdsRepoEntry   *ea = *(QdsRepoEntry *const *) a;
+	QdsRepoEntry   *eb = *(QdsRepoEntry *const *) b;
+
+	if (ea->calls != eb->calls)
+		return (ea->calls > eb->calls) - (ea->calls < eb->calls);
+	return (ea->last_seen > eb->last_seen) - (ea->last_seen < eb->last_seen);
+}
+
+/*
+ * Evict the least valuable entries to free space for new ones. A batch is
+ * evicted at once, so the whole repository isn't scanned for each new
+ * candidate. Caller must hold the lock exclusively.
+ */
+static void
+qds_repository_evict(void)
+{
+	HASH_SEQ_STATUS		hash_seq;
+	QdsRepoEntry	   *entry;
+	QdsRepoEntry	  **entries;
+	long				nentries = hash_get_num_entries(qds_repo_htab);
+	long				nvictims;
+	long				i = 0;
+
+	if (nentries == 0)
+		return;
+
+	entries = (QdsRepoEntry **) palloc(nentries * sizeof(QdsRepoEntry *));
+	hash_seq_init(&hash_seq, qds_repo_htab);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+		entries[i++] = entry;
+
+	qsort(entries, i, sizeof(QdsRepoEntry *), qds_entry_cmp);
+
+	nvictims = Max(1, i * QDS_EVICT_PERCENT / 100);
+	nvictims = Min(nvictims, i);
+	for (i = 0; i < nvictims; i++)
+	{
+		(void) hash_search(qds_repo_htab, &entries[i]->key, HASH_REMOVE, NULL);
+		qds_repo->dropped++;
+	}
+
+	pfree(entries);
+}
+
+/*
+ * Add an observation of the candidate into the shared repository.
+ *
+ * attnums and exprs define the candidate statistic on the relation relid.
+ * Vars in the exprs refer to the range table entry varno. score estimates
+ * the impact of the misestimation on the query runtime.
+ */
+void
+qds_repository_record(Oid relid, Index varno, Bitmapset *attnums,
+					  List *exprs, double qerror, double rows, double score)
+{
+	QdsRepoKey		key;
+	QdsRepoEntry   *entry;
+	AttrNumber		atts[STATS_MAX_DIMENSIONS];
+	int				natts = 0;
+	int				attnum = -1;
+	int				nelems;
+	char		   *exprs_text = "";
+	char		   *exprs_node = "";
+	TimestampTz		now;
+
+	if (!qds_repository_enabled() || IsParallelWorker())
+		return;
+
+	nelems = bms_num_members(attnums) + list_length(exprs);
+	if (nelems < 2 || nelems > STATS_MAX_DIMENSIONS)
+		/* Extended statistics can't be built on such a definition */
+		return;
+
+	while ((attnum = bms_next_member(attnums, attnum)) >= 0)
+		atts[natts++] = (AttrNumber) attnum;
+
+	if (exprs != NIL &&
+		!canonicalize_exprs(relid, varno, exprs, &exprs_text, &exprs_node))
+	{
+		elog(DEBUG1, "skip too long candidate definition on relation %u",
+			 relid);
+		return;
+	}
+
+	memset(&key, 0, sizeof(QdsRepoKey));
+	key.dbid = MyDatabaseId;
+	key.relid = relid;
+	key.defhash = hash_bytes_extended((const unsigned char *) atts,
+									  natts * sizeof(AttrNumber), 0);
+	key.defhash = hash_combine64(key.defhash,
+								 hash_bytes_extended((const unsigned char *) exprs_text,
+													 strlen(exprs_text), 0));
+
+	LWLockAcquire(qds_repo->lock, LW_SHARED);
+	entry = (QdsRepoEntry *) hash_search(qds_repo_htab, &key, HASH_FIND, NULL);
+	if (entry == NULL)
+	{
+		bool found;
+
+		/* Need exclusive lock to add the new entry */
+		LWLockRelease(qds_repo->lock);
+		LWLockAcquire(qds_repo->lock, LW_EXCLUSIVE);
+
+		if (hash_get_num_entries(qds_repo_htab) >= qds_max_candidates)
+			qds_repository_evict();
+
+		entry = (QdsRepoEntry *) hash_search(qds_repo_htab, &key,
+											 HASH_ENTER, &found);
+		if (!found)
+		{
+			entry->natts = natts;
+			memcpy(entry->attnums, atts, natts * sizeof(AttrNumber));
+			strlcpy(entry->exprs_text, exprs_text, QDS_EXPRS_TEXT_LEN);
+			strlcpy(entry->exprs_node, exprs_node, QDS_EXPRS_NODE_LEN);
+			SpinLockInit(&entry->mutex);
+			entry->calls = 0;
+			entry->max_qerror = 0.;
+			entry->sum_qerror = 0.;
+			entry->rows = 0.;
+			entry->score = 0.;
+			entry->processed = false;
+		}
+	}
+
+	/* Don't make a system call under the spinlock */
+	now = GetCurrentTimestamp();
+	SpinLockAcquire(&entry->mutex);
+	entry->calls++;
+	entry->max_qerror = Max(entry->max_qerror, qerror);
+	entry->sum_qerror += qerror;
+	entry->rows += rows;
+	entry->score += score;
+	entry->last_seen = now;
+	SpinLockRelease(&entry->mutex);
+
+	LWLockRelease(qds_repo->lock);
+}
+
+/*
+ * Return list of databases (OIDs) having candidates, not processed yet by the
+ * background worker.
+ */
+List *
+qds_repository_pending_databases(int min_calls)
+{
+	HASH_SEQ_STATUS		hash_seq;
+	QdsRepoEntry	   *entry;
+	List			   *result = NIL;
+
+	if (!qds_repository_enabled())
+		return NIL;
+
+	LWLockAcquire(qds_repo->lock, LW_SHARED);
+	hash_seq_init(&hash_seq, qds_repo_htab);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+	{
+		bool	pending;
+
+		SpinLockAcquire(&entry->mutex);
+		pending = !entry->processed && entry->calls >= min_calls;
+		SpinLockRelease(&entry->mutex);
+
+		if (pending)
+			result = list_append_unique_oid(result, entry->key.dbid);
+	}
+	LWLockRelease(qds_repo->lock);
+
+	return result;
+}
+
+static int
+candidate_score_cmp(const ListCell *a, const ListCell *b)
+{
+	QdsCandidate   *ca = (QdsCandidate *) lfirst(a);
+	QdsCandidate   *cb = (QdsCandidate *) lfirst(b);
+
+	if (ca->score > cb->score)
+		return -1;
+	if (ca->score < cb->score)
+		return 1;
+	return 0;
+}
+
+/*
+ * Return up to limit the most valuable unprocessed candidates of the database.
+ * The value is estimated by the summary impact of the misestimations.
+ */
+List *
+qds_repository_fetch_pending(Oid dbid, int min_calls, int limit)
+{
+	HASH_SEQ_STATUS		hash_seq;
+	QdsRepoEntry	   *entry;
+	List			   *result = NIL;
+
+	if (!qds_repository_enabled())
+		return NIL;
+
+	LWLockAcquire(qds_repo->lock, LW_SHARED);
+	hash_seq_init(&hash_seq, qds_repo_htab);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+	{
+		QdsCandidate   *candidate;
+		bool			pending;
+		double			score;
+
+		if (entry->key.dbid != dbid)
+			continue;
+
+		SpinLockAcquire(&entry->mutex);
+		pending = !entry->processed && entry->calls >= min_calls;
+		score = entry->score;
+		SpinLockRelease(&entry->mutex);
+
+		if (!pending)
+			continue;
+
+		candidate = palloc(sizeof(QdsCandidate));
+		candidate->dbid = entry->key.dbid;
+		candidate->relid = entry->key.relid;
+		candidate->defhash = entry->key.defhash;
+		candidate->natts = entry->natts;
+		memcpy(candidate->attnums, entry->attnums,
+			   entry->natts * sizeof(AttrNumber));
+		candidate->exprs = (entry->exprs_node[0] != '\0') ?
+										pstrdup(entry->exprs_node) : NULL;
+		candidate->score = score;
+		result = lappend(result, candidate);
+	}
+	LWLockRelease(qds_repo->lock);
+
+	list_sort(result, candidate_score_cmp);
+	if (limit >= 0 && list_length(result) > limit)
+		result = list_truncate(result, limit);
+
+	return result;
+}
+
+/*
+ * The decision on the candidate has been made. Don't propose it anymore.
+ */
+void
+qds_repository_set_processed(QdsCandidate *candidate)
+{
+	QdsRepoKey		key;
+	QdsRepoEntry   *entry;
+
+	if (!qds_repository_enabled())
+		return;
+
+	memset(&key, 0, sizeof(QdsRepoKey));
+	key.dbid = candidate->dbid;
+	key.relid = candidate->relid;
+	key.defhash = candidate->defhash;
+
+	LWLockAcquire(qds_repo->lock, LW_SHARED);
+	entry = (QdsRepoEntry *) hash_search(qds_repo_htab, &key, HASH_FIND, NULL);
+	if (entry != NULL)
+	{
+		SpinLockAcquire(&entry->mutex);
+		entry->processed = true;
+		SpinLockRelease(&entry->mutex);
+	}
+	LWLockRelease(qds_repo->lock);
+}
+
+#define PG_INDEX_STATS_CANDIDATES_COLS	(11)
+
+/*
+ * Show content of the repository.
+ */
+Datum
+pg_index_stats_candidates(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	HASH_SEQ_STATUS		hash_seq;
+	QdsRepoEntry	   *entry;
+	bool				all_databases;
+
+	if (!qds_repository_enabled())
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg(MODULE_NAME" must be loaded via \"shared_preload_libraries\"")));
+
+	prepare_materialized_srf(fcinfo);
+
+	/*
+	 * Definitions of candidates reveal the schema of the tables. Candidates of
+	 * other databases are shown only to the roles, which may read all the
+	 * statistics, as pg_stat_statements does.
+	 */
+	all_databases = has_privs_of_role(GetUserId(), ROLE_PG_READ_ALL_STATS);
+
+	LWLockAcquire(qds_repo->lock, LW_SHARED);
+	hash_seq_init(&hash_seq, qds_repo_htab);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+	{
+		Datum		values[PG_INDEX_STATS_CANDIDATES_COLS];
+		bool		nulls[PG_INDEX_STATS_CANDIDATES_COLS];
+		Datum	   *atts;
+		int64		calls;
+		double		max_qerror;
+		double		sum_qerror;
+		double		rows;
+		double		score;
+		TimestampTz	last_seen;
+		bool		processed;
+		int			i;
+
+		if (!all_databases && entry->key.dbid != MyDatabaseId)
+			continue;
+
+		memset(nulls, false, sizeof(nulls));
+
+		SpinLockAcquire(&entry->mutex);
+		calls = entry->calls;
+		max_qerror = entry->max_qerror;
+		sum_qerror = entry->sum_qerror;
+		rows = entry->rows;
+		score = entry->score;
+		last_seen = entry->last_seen;
+		processed = entry->processed;
+		SpinLockRelease(&entry->mutex);
+
+		atts = palloc(sizeof(Datum) * Max(entry->natts, 1));
+		for (i = 0; i < entry->natts; i++)
+			atts[i] = Int16GetDatum(entry->attnums[i]);
+
+		values[0] = ObjectIdGetDatum(entry->key.dbid);
+		values[1] = ObjectIdGetDatum(entry->key.relid);
+		values[2] = PointerGetDatum(construct_array(atts, entry->natts,
+													INT2OID, sizeof(int16),
+													true, TYPALIGN_SHORT));
+		if (entry->exprs_text[0] != '\0')
+			values[3] = CStringGetTextDatum(entry->exprs_text);
+		else
+			nulls[3] = true;
+		values[4] = Int64GetDatum(calls);
+		values[5] = Float8GetDatum(max_qerror);
+		values[6] = Float8GetDatum(calls > 0 ? sum_qerror / calls : 0.);
+		values[7] = Float8GetDatum(rows);
+		values[8] = Float8GetDatum(score);
+		values[9] = TimestampTzGetDatum(last_seen);
+		values[10] = BoolGetDatum(processed);
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+	}
+	LWLockRelease(qds_repo->lock);
+
+	return (Datum) 0;
+}
+
+/*
+ * Remove all the candidates from the repository
+ */
+Datum
+pg_index_stats_candidates_reset(PG_FUNCTION_ARGS)
+{
+	HASH_SEQ_STATUS		hash_seq;
+	QdsRepoEntry	   *entry;
+
+	if (!qds_repository_enabled())
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg(MODULE_NAME" must be loaded via \"shared_preload_libraries\"")));
+
+	LWLockAcquire(qds_repo->lock, LW_EXCLUSIVE);
+	hash_seq_init(&hash_seq, qds_repo_htab);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+		(void) hash_search(qds_repo_htab, &entry->key, HASH_REMOVE, NULL);
+	qds_repo->dropped = 0;
+	qds_repo->stats_reset = GetCurrentTimestamp();
+	LWLockRelease(qds_repo->lock);
+
+	PG_RETURN_VOID();
+}
+
+void
+qds_repository_init(void)
+{
+	DefineCustomBoolVariable(MODULE_NAME".qds_collect",
+							"Aggregate extended statistics candidates in the shared repository",
+							"Works only if the library is loaded by the shared_preload_libraries",
+							&qds_collect,
+							false,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable(MODULE_NAME".qds_max_candidates",
+							"Sets the maximum number of candidates kept in the shared repository",
+							NULL,
+							&qds_max_candidates,
+							1000,
+							100,
+							INT_MAX / 2,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomBoolVariable(MODULE_NAME".qds_save",
+							"Save the candidates repository across server shutdowns",
+							NULL,
+							&qds_save,
+							true,
+							PGC_SIGHUP,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = qds_repository_shmem_request;
+#else
+	RequestAddinShmemSpace(qds_repository_memsize());
+	RequestNamedLWLockTranche(QDS_REPO_TRANCHE, 1);
+#endif
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = qds_repository_shmem_startup;
+}
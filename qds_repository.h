@@ -0,0 +1,38 @@
+#ifndef _QDS_REPOSITORY_H_
+#define _QDS_REPOSITORY_H_
+
+#include "postgres.h"
+
+#include "nodes/bitmapset.h"
+#include "nodes/pg_list.h"
+#include "statistics/statistics.h"
+
+/*
+ * A copy of the repository entry, detached from the shared memory, which is
+ * enough to build the statistics.
+ */
+typedef struct QdsCandidate
+{
+	Oid			dbid;
+	Oid			relid;
+	uint64		defhash;
+
+	int			natts;
+	AttrNumber	attnums[STATS_MAX_DIMENSIONS];
+	char	   *exprs;		/* serialized list of expressions or NULL */
+	double		score;
+} QdsCandidate;
+
+extern bool qds_collect;
+
+extern void qds_repository_init(void);
+extern bool qds_repository_enabled(void);
+extern void qds_repository_record(Oid relid, Index varno, Bitmapset *attnums,
+								  List *exprs, double qerror, double rows,
+								  double score);
+
+extern List *qds_repository_pending_databases(int min_calls);
+extern List *qds_repository_fetch_pending(Oid dbid, int min_calls, int limit);
+extern void qds_repository_set_processed(QdsCandidate *candidate);
+
+#endif /* _QDS_REPOSITORY_H_ */
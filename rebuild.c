@@ -0,0 +1,1153 @@
+/*-------------------------------------------------------------------------
+ *
+ * rebuild.c
+ *		Bulk regeneration of extended statistics over existing indexes.
+ *
+ * pg_index catalog is walked once and indexes are grouped by the heap
+ * relation. So, each table is opened once and its statistics are built in a
+ * row, with a memory context reset after each table. Progress is reported in
+ * the pg_stat_progress_analyze view.
+ *
+ * The parallel version splits tables across dynamic background workers. Each
+ * table is processed in a separate transaction, so a failure doesn't roll
+ * back the work done on other tables.
+ *
+ * Copyright (c) 2023-2025 Andrei Lepikhov
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ * IDENTIFICATION
+ *	  contrib/pg_index_stats/rebuild.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/genam.h"
+#include "access/htup_details.h"
+#include "access/table.h"
+#include "access/tableam.h"
+#include "access/xact.h"
+#include "catalog/catalog.h"
+#include "catalog/dependency.h"
+#include "catalog/indexing.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_database.h"
+#include "catalog/pg_depend.h"
+#include "catalog/pg_index.h"
+#include "catalog/pg_statistic_ext.h"
+#include "commands/extension.h"
+#include "commands/progress.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "nodes/makefuncs.h"
+#include "pgstat.h"
+#include "port/atomics.h"
+#include "postmaster/bgworker.h"
+#include "storage/dsm.h"
+#include "storage/proc.h"
+#include "storage/shm_mq.h"
+#include "tcop/tcopprot.h"
+#include "utils/acl.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/snapmgr.h"
+
+#include "duplicated_slots.h"
+#include "pg_index_stats.h"
+#include "rebuild.h"
+#include "statworker.h"
+
+PG_FUNCTION_INFO_V1(pg_index_stats_rebuild);
+PG_FUNCTION_INFO_V1(pg_index_stats_rebuild_parallel);
+PG_FUNCTION_INFO_V1(pg_index_stats_rebuild_all);
+
+/*
+ * Skip system schemas, as pg_index_stats_remove() does.
+ */
+static bool
+is_system_namespace(Oid nspid)
+{
+	char   *nspname;
+	bool	result;
+
+	if (IsCatalogNamespace(nspid) || IsToastNamespace(nspid))
+		return true;
+
+	nspname = get_namespace_name(nspid);
+	result = (nspname == NULL || strcmp(nspname, "information_schema") == 0);
+	if (nspname)
+		pfree(nspname);
+	return result;
+}
+
+static int
+target_cmp(const ListCell *a, const ListCell *b)
+{
+	RebuildTarget  *ta = (RebuildTarget *) lfirst(a);
+	RebuildTarget  *tb = (RebuildTarget *) lfirst(b);
+
+	if (ta->relid < tb->relid)
+		return -1;
+	return (ta->relid > tb->relid) ? 1 : 0;
+}
+
+/*
+ * Walk pg_index once and group indexes by heap relations.
+ * Indexes are listed in order of creation, which the rebuild follows to give
+ * the same result as consecutive CREATE INDEX commands.
+ */
+List *
+collect_rebuild_targets(Oid nspid, Oid relid)
+{
+	Relation		indrel;
+	TableScanDesc	scan;
+	HeapTuple		tuple;
+	HTAB		   *htab;
+	HASHCTL			ctl;
+	HASH_SEQ_STATUS	status;
+	RebuildTarget  *target;
+	List		   *result = NIL;
+
+	ctl.keysize = sizeof(Oid);
+	ctl.entrysize = sizeof(RebuildTarget);
+	ctl.hcxt = CurrentMemoryContext;
+	htab = hash_create(MODULE_NAME" rebuild targets", 1024, &ctl,
+					   HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	indrel = table_open(IndexRelationId, AccessShareLock);
+	scan = table_beginscan_catalog(indrel, 0, NULL);
+	while ((tuple = heap_getnext(scan, ForwardScanDirection)) != NULL)
+	{
+		Form_pg_index	index = (Form_pg_index) GETSTRUCT(tuple);
+		Oid				relnsp;
+		bool			found;
+
+		if (OidIsValid(relid) && index->indrelid != relid)
+			continue;
+
+		/*
+		 * Extended statistics are built on btree indexes with two or more
+		 * columns only. Don't waste time on the rest.
+		 */
+		if (index->indnkeyatts < 2)
+			continue;
+
+		relnsp = get_rel_namespace(index->indrelid);
+		if ((OidIsValid(nspid) && relnsp != nspid) ||
+			is_system_namespace(relnsp))
+			continue;
+
+		target = (RebuildTarget *) hash_search(htab, &index->indrelid,
+											   HASH_ENTER, &found);
+		if (!found)
+		{
+			target->indexes = NIL;
+			result = lappend(result, target);
+		}
+		target->indexes = lappend_oid(target->indexes, index->indexrelid);
+	}
+	table_endscan(scan);
+	table_close(indrel, AccessShareLock);
+
+	/* The hash table is needed only to group indexes */
+	hash_seq_init(&status, htab);
+	while ((target = (RebuildTarget *) hash_seq_search(&status)) != NULL)
+		list_sort(target->indexes, list_oid_cmp);
+	list_sort(result, target_cmp);
+
+	return result;
+}
+
+/*
+ * Get the index the statistics were generated on. Such statistics depend on
+ * the index. Return InvalidOid, if it isn't index-based statistics.
+ */
+static Oid
+get_statistics_index(Oid statoid)
+{
+	Relation	depRel;
+	ScanKeyData	key[2];
+	SysScanDesc	scan;
+	HeapTuple	tup;
+	Oid			result = InvalidOid;
+
+	depRel = table_open(DependRelationId, AccessShareLock);
+
+	ScanKeyInit(&key[0],
+				Anum_pg_depend_classid,
+				BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(StatisticExtRelationId));
+	ScanKeyInit(&key[1],
+				Anum_pg_depend_objid,
+				BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(statoid));
+
+	scan = systable_beginscan(depRel, DependDependerIndexId, true,
+							  NULL, 2, key);
+	while (HeapTupleIsValid(tup = systable_getnext(scan)))
+	{
+		Form_pg_depend	deprec = (Form_pg_depend) GETSTRUCT(tup);
+		char			relkind;
+
+		if (deprec->refclassid != RelationRelationId ||
+			deprec->refobjsubid != 0)
+			continue;
+
+		relkind = get_rel_relkind(deprec->refobjid);
+		if (relkind == RELKIND_INDEX || relkind == RELKIND_PARTITIONED_INDEX)
+		{
+			result = deprec->refobjid;
+			break;
+		}
+	}
+	systable_endscan(scan);
+	table_close(depRel, AccessShareLock);
+
+	return result;
+}
+
+/*
+ * Is the statistics generated on an index definition?
+ */
+bool
+is_index_based_statistics(Oid statoid)
+{
+	return OidIsValid(get_statistics_index(statoid));
+}
+
+/*
+ * Remove statistics, previously generated on indexes of the relation.
+ */
+static void
+remove_index_based_statistics(Relation hrel)
+{
+	List	   *statoids = RelationGetStatExtList(hrel);
+	ListCell   *lc;
+
+	foreach(lc, statoids)
+	{
+		Oid				statoid = lfirst_oid(lc);
+		ObjectAddress	object;
+
+		if (!is_index_based_statistics(statoid))
+			continue;
+
+		ObjectAddressSet(object, StatisticExtRelationId, statoid);
+		performDeletion(&object, DROP_RESTRICT, PERFORM_DELETION_INTERNAL);
+	}
+
+	if (statoids != NIL)
+		CommandCounterIncrement();
+	list_free(statoids);
+}
+
+/*
+ * Has the existing statistics the same columns and expressions?
+ */
+static bool
+same_definition(StatExtEntry *stat, DesiredStat *desired)
+{
+	ListCell   *lc;
+
+	if (!bms_equal(stat->columns, desired->entry.columns) ||
+		list_length(stat->exprs) != list_length(desired->entry.exprs))
+		return false;
+
+	foreach(lc, stat->exprs)
+	{
+		if (!list_member(desired->entry.exprs, lfirst(lc)))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Make statistics depend on the index instead of the oldindex.
+ */
+static void
+move_statistics_dependency(Oid statoid, Oid oldindex, Oid newindex)
+{
+	if (OidIsValid(oldindex))
+		changeDependencyFor(StatisticExtRelationId, statoid,
+							RelationRelationId, oldindex, newindex);
+	else
+	{
+		ObjectAddress	obj;
+		ObjectAddress	refobj;
+
+		ObjectAddressSet(obj, StatisticExtRelationId, statoid);
+		ObjectAddressSet(refobj, RelationRelationId, newindex);
+		recordDependencyOn(&obj, &refobj, DEPENDENCY_AUTO);
+	}
+	CommandCounterIncrement();
+}
+
+/*
+ * Bring index-based statistics of the table in line with the current indexes
+ * and settings, touching only the difference.
+ *
+ * At first, compute what the full rebuild would produce: walk the indexes in
+ * order of creation and reduce each definition against the statistics, not
+ * generated on indexes, and the previously computed ones. Then apply the
+ * difference with the existing index-based statistics. Statistics, not
+ * generated on indexes, are never changed here.
+ *
+ * Return number of created and altered statistics.
+ */
+static int
+rebuild_relation_incremental(Relation hrel, RebuildTarget *target,
+							 int32 stat_types)
+{
+	bool		compactify = statistics_compactify_enabled();
+	List	   *autostats;
+	List	   *fixed = NIL;
+	List	   *desired = NIL;
+	ListCell   *lc;
+	int			nprocessed = 0;
+	int			i;
+
+	autostats = fetch_index_based_statistics(RelationGetRelid(hrel), &fixed);
+
+	/* Simulate the full rebuild */
+	foreach(lc, target->indexes)
+	{
+		Relation		irel;
+		DesiredStat	   *stat;
+		ListCell	   *lc1;
+		int32			types = stat_types;
+
+		CHECK_FOR_INTERRUPTS();
+
+		pgstat_progress_update_param(PROGRESS_ANALYZE_EXT_STATS_COMPUTED,
+									 ++nprocessed);
+
+		irel = try_relation_open(lfirst_oid(lc), AccessShareLock);
+		if (irel == NULL)
+			continue;
+
+		stat = palloc0(sizeof(DesiredStat));
+		if ((irel->rd_rel->relkind != RELKIND_INDEX &&
+			 irel->rd_rel->relkind != RELKIND_PARTITIONED_INDEX) ||
+			!index_statistics_definition(irel, hrel, &stat->exprlst,
+										 &stat->atts_used))
+		{
+			relation_close(irel, AccessShareLock);
+			pfree(stat);
+			continue;
+		}
+		stat->indexId = RelationGetRelid(irel);
+		relation_close(irel, AccessShareLock);
+
+		if (compactify)
+		{
+			List	   *statslist = list_concat_copy(fixed, NIL);
+			int32	   *newtypes;
+			int			nfixed = list_length(fixed);
+
+			foreach(lc1, desired)
+				statslist = lappend(statslist, &((DesiredStat *) lfirst(lc1))->entry);
+
+			newtypes = (int32 *) palloc(Max(list_length(statslist), 1) *
+										sizeof(int32));
+			types = compactify_definition(statslist, stat->exprlst,
+										  stat->atts_used, types, newtypes);
+
+			/* Only statistics computed here may be reduced */
+			i = 0;
+			foreach(lc1, desired)
+			{
+				DesiredStat	   *prev = (DesiredStat *) lfirst(lc1);
+
+				prev->entry.types = newtypes[nfixed + i++];
+				if (prev->entry.types == 0)
+					desired = foreach_delete_current(desired, lc1);
+			}
+			pfree(newtypes);
+			list_free(statslist);
+		}
+
+		if (types == 0)
+			continue;
+
+		stat->entry.oid = InvalidOid;
+		stat->entry.columns = stat->atts_used;
+		stat->entry.types = types;
+		foreach(lc1, stat->exprlst)
+		{
+			StatsElem  *selem = (StatsElem *) lfirst(lc1);
+
+			if (selem->expr != NULL)
+				stat->entry.exprs = lappend(stat->entry.exprs, selem->expr);
+		}
+		desired = lappend(desired, stat);
+	}
+
+	return apply_desired_statistics(hrel, autostats, desired);
+}
+
+/*
+ * Get statistics on the relation, generated on indexes. Other statistics are
+ * returned in the others list. Entries are copied: the cached list becomes
+ * invalid after the first change in the catalog.
+ */
+List *
+fetch_index_based_statistics(Oid relid, List **others)
+{
+	List	   *result = NIL;
+	ListCell   *lc;
+
+	foreach(lc, fetch_relation_statentries(relid))
+	{
+		StatExtEntry   *entry = palloc(sizeof(StatExtEntry));
+
+		memcpy(entry, lfirst(lc), sizeof(StatExtEntry));
+		entry->columns = bms_copy(entry->columns);
+		entry->exprs = copyObject(entry->exprs);
+
+		if (is_index_based_statistics(entry->oid))
+			result = lappend(result, entry);
+		else if (others != NULL)
+			*others = lappend(*others, entry);
+	}
+	return result;
+}
+
+/*
+ * Match the existing index-based statistics with the desired ones. Statistics
+ * with the same definition stay with their data; only their kinds and the
+ * index they depend on are corrected. Excessive ones are removed, missing ones
+ * are created.
+ *
+ * Return number of created and altered statistics.
+ */
+int
+apply_desired_statistics(Relation hrel, List *autostats, List *desired)
+{
+	Oid		   *autoindex;
+	bool	   *matched;
+	ListCell   *lc;
+	int			nchanged = 0;
+	int			i;
+
+	autoindex = (Oid *) palloc0(Max(list_length(autostats), 1) * sizeof(Oid));
+	matched = (bool *) palloc0(Max(list_length(autostats), 1) * sizeof(bool));
+	i = 0;
+	foreach(lc, autostats)
+		autoindex[i++] = get_statistics_index(((StatExtEntry *) lfirst(lc))->oid);
+
+	foreach(lc, desired)
+	{
+		DesiredStat	   *stat = (DesiredStat *) lfirst(lc);
+		StatExtEntry   *existing = NULL;
+		ListCell	   *lc1;
+
+		i = 0;
+		foreach(lc1, autostats)
+		{
+			StatExtEntry   *entry = (StatExtEntry *) lfirst(lc1);
+
+			if (!matched[i] && same_definition(entry, stat))
+			{
+				matched[i] = true;
+				existing = entry;
+				break;
+			}
+			i++;
+		}
+
+		if (existing == NULL)
+			continue;
+
+		stat->entry.oid = existing->oid;
+		if (existing->types == stat->entry.types && autoindex[i] == stat->indexId)
+			/* Nothing to do */
+			continue;
+
+		if (autoindex[i] != stat->indexId)
+			move_statistics_dependency(existing->oid, autoindex[i],
+									   stat->indexId);
+
+		if (existing->types != stat->entry.types)
+		{
+			set_statistics_types(existing->oid, stat->entry.types);
+
+			/* Data of added kinds are absent so far */
+			if (stat->entry.types & ~existing->types)
+				statworker_schedule_analyze(RelationGetRelid(hrel));
+		}
+		nchanged++;
+	}
+
+	/* Remove excessive statistics before creating new ones */
+	i = 0;
+	foreach(lc, autostats)
+	{
+		ObjectAddress	object;
+
+		if (matched[i++])
+			continue;
+
+		ObjectAddressSet(object, StatisticExtRelationId,
+						 ((StatExtEntry *) lfirst(lc))->oid);
+		performDeletion(&object, DROP_RESTRICT, PERFORM_DELETION_INTERNAL);
+		CommandCounterIncrement();
+	}
+
+	foreach(lc, desired)
+	{
+		DesiredStat	   *stat = (DesiredStat *) lfirst(lc);
+
+		if (OidIsValid(stat->entry.oid))
+			continue;
+
+		if (pg_index_stats_create_exact(hrel, stat->exprlst, stat->entry.types,
+										stat->indexId))
+			nchanged++;
+	}
+
+	return nchanged;
+}
+
+/*
+ * Rebuild statistics of a table. Return number of created statistics.
+ * In the incremental mode, return number of created and altered ones.
+ */
+static int
+rebuild_relation(RebuildTarget *target, int32 stat_types, bool incremental)
+{
+	Relation	hrel;
+	ListCell   *lc;
+	Oid			save_userid;
+	int			save_sec_context;
+	int			save_nestlevel;
+	int			nbuilt = 0;
+	int			nprocessed = 0;
+
+	hrel = try_relation_open(target->relid, AccessShareLock);
+	if (hrel == NULL)
+		return 0;
+
+	/* Do the same as pg_index_stats_build() for each index */
+	GetUserIdAndSecContext(&save_userid, &save_sec_context);
+	SetUserIdAndSecContext(hrel->rd_rel->relowner,
+						   save_sec_context | SECURITY_RESTRICTED_OPERATION);
+	save_nestlevel = NewGUCNestLevel();
+
+	if (incremental)
+	{
+		nbuilt = rebuild_relation_incremental(hrel, target, stat_types);
+		goto done;
+	}
+
+	remove_index_based_statistics(hrel);
+
+	foreach(lc, target->indexes)
+	{
+		Relation	irel;
+
+		CHECK_FOR_INTERRUPTS();
+
+		irel = try_relation_open(lfirst_oid(lc), AccessShareLock);
+		if (irel == NULL)
+			continue;
+
+		if ((irel->rd_rel->relkind == RELKIND_INDEX ||
+			 irel->rd_rel->relkind == RELKIND_PARTITIONED_INDEX) &&
+			pg_index_stats_build_index(irel, hrel, stat_types))
+			nbuilt++;
+
+		relation_close(irel, AccessShareLock);
+		pgstat_progress_update_param(PROGRESS_ANALYZE_EXT_STATS_COMPUTED,
+									 ++nprocessed);
+	}
+
+done:
+	AtEOXact_GUC(false, save_nestlevel);
+	SetUserIdAndSecContext(save_userid, save_sec_context);
+
+	relation_close(hrel, AccessShareLock);
+	return nbuilt;
+}
+
+/*
+ * Report the table being processed as the command target. Number of tables is
+ * reported as child tables, number of its indexes - as extended statistics to
+ * compute.
+ */
+static void
+report_progress(RebuildTarget *target, int ntargets, int ndone)
+{
+	const int	index[] = {
+		PROGRESS_ANALYZE_PHASE,
+		PROGRESS_ANALYZE_EXT_STATS_TOTAL,
+		PROGRESS_ANALYZE_CHILD_TABLES_TOTAL,
+		PROGRESS_ANALYZE_CHILD_TABLES_DONE
+	};
+	int64		val[4];
+
+	pgstat_progress_start_command(PROGRESS_COMMAND_ANALYZE, target->relid);
+	val[0] = PROGRESS_ANALYZE_PHASE_COMPUTE_EXT_STATS;
+	val[1] = list_length(target->indexes);
+	val[2] = ntargets;
+	val[3] = ndone;
+	pgstat_progress_update_multi_param(4, index, val);
+}
+
+/*
+ * Only owner may rebuild statistics of a table. If the table was requested
+ * explicitly, complain. Otherwise, silently skip tables of others.
+ */
+bool
+rebuild_permitted(Oid relid, bool explicit)
+{
+#if PG_VERSION_NUM >= 160000
+	if (object_ownercheck(RelationRelationId, relid, GetUserId()))
+#else
+	if (pg_class_ownercheck(relid, GetUserId()))
+#endif
+		return true;
+
+	if (explicit)
+		aclcheck_error(ACLCHECK_NOT_OWNER, OBJECT_TABLE, get_rel_name(relid));
+	return false;
+}
+
+/*
+ * Get schema and table filters from the arguments argno and argno + 1.
+ */
+static void
+get_rebuild_filters(FunctionCallInfo fcinfo, int argno, Oid *nspid, Oid *relid)
+{
+	*nspid = InvalidOid;
+	*relid = InvalidOid;
+
+	if (!PG_ARGISNULL(argno))
+		*nspid = get_namespace_oid(NameStr(*PG_GETARG_NAME(argno)), false);
+
+	if (!PG_ARGISNULL(argno + 1))
+	{
+		RangeVar   *relvar;
+
+		relvar = makeRangeVar(OidIsValid(*nspid) ?
+									get_namespace_name(*nspid) : NULL,
+							  pstrdup(NameStr(*PG_GETARG_NAME(argno + 1))), -1);
+		*relid = RangeVarGetRelid(relvar, NoLock, false);
+	}
+}
+
+/*
+ * Remove statistics, generated on indexes, and build them again according to
+ * current settings. Tables can be filtered by schema and name.
+ * In the incremental mode, only the difference is applied.
+ * Return number of created (and altered) statistics.
+ */
+Datum
+pg_index_stats_rebuild(PG_FUNCTION_ARGS)
+{
+	Oid				nspid;
+	Oid				relid;
+	MemoryContext	rebuild_ctx;
+	MemoryContext	oldctx;
+	List		   *targets;
+	ListCell	   *lc;
+	int32			stat_types = get_statistic_types();
+	bool			incremental = !PG_ARGISNULL(2) && PG_GETARG_BOOL(2);
+	int				ntargets;
+	int				ndone = 0;
+	int				result = 0;
+
+	get_rebuild_filters(fcinfo, 0, &nspid, &relid);
+
+	targets = collect_rebuild_targets(nspid, relid);
+	ntargets = list_length(targets);
+
+	rebuild_ctx = AllocSetContextCreate(CurrentMemoryContext,
+										MODULE_NAME" rebuild context",
+										ALLOCSET_DEFAULT_SIZES);
+
+	foreach(lc, targets)
+	{
+		RebuildTarget  *target = (RebuildTarget *) lfirst(lc);
+
+		CHECK_FOR_INTERRUPTS();
+
+		report_progress(target, ntargets, ndone++);
+
+		if (!rebuild_permitted(target->relid, OidIsValid(relid)))
+			continue;
+
+		oldctx = MemoryContextSwitchTo(rebuild_ctx);
+		result += rebuild_relation(target, stat_types, incremental);
+		MemoryContextSwitchTo(oldctx);
+		MemoryContextReset(rebuild_ctx);
+	}
+
+	if (targets != NIL)
+		pgstat_progress_end_command();
+
+	MemoryContextDelete(rebuild_ctx);
+	PG_RETURN_INT32(result);
+}
+
+/* *****************************************************************************
+ *
+ * Parallel rebuild
+ *
+ * The leader launches a set of dynamic background workers connected to the
+ * database. Each worker builds the same list of tables and takes the next
+ * unprocessed one, using a shared counter. Each table is processed in its own
+ * transaction, so an error affects only this table. Results are sent to the
+ * leader through a message queue per worker.
+ *
+ **************************************************************************** */
+
+#define RESULT_QUEUE_SIZE	(16384)
+
+typedef struct RebuildShared
+{
+	Oid					dbid;
+	Oid					userid;
+	Oid					nspid;
+	Oid					relid;
+
+	/* Settings of the leader */
+	char				stattypes[256];
+	int					columns_limit;
+	bool				compactify;
+
+	bool				incremental;
+
+	pg_atomic_uint32	next_target;
+} RebuildShared;
+
+/*
+ * Message of a worker on a processed table. Name of the relation and text of
+ * the error (empty, if no error) follow the header.
+ */
+typedef struct RebuildResult
+{
+	Oid			relid;
+	int32		nstats;
+	bool		failed;
+	char		data[FLEXIBLE_ARRAY_MEMBER];
+} RebuildResult;
+
+#define REBUILD_QUEUE(shared, i) \
+	((shm_mq *) ((char *) (shared) + MAXALIGN(sizeof(RebuildShared)) + \
+				 (i) * RESULT_QUEUE_SIZE))
+
+static void
+send_result(shm_mq_handle *mqh, Oid relid, const char *relation,
+			int32 nstats, const char *error)
+{
+	StringInfoData	buf;
+	RebuildResult	hdr;
+
+	hdr.relid = relid;
+	hdr.nstats = nstats;
+	hdr.failed = (error != NULL);
+
+	initStringInfo(&buf);
+	appendBinaryStringInfo(&buf, (char *) &hdr, offsetof(RebuildResult, data));
+	appendBinaryStringInfo(&buf, relation, strlen(relation) + 1);
+	if (error != NULL)
+		appendBinaryStringInfo(&buf, error, strlen(error) + 1);
+	else
+		appendStringInfoChar(&buf, '\0');
+
+#if PG_VERSION_NUM >= 150000
+	if (shm_mq_send(mqh, buf.len, buf.data, false, true) != SHM_MQ_SUCCESS)
+#else
+	if (shm_mq_send(mqh, buf.len, buf.data, false) != SHM_MQ_SUCCESS)
+#endif
+		/* The leader has gone. Nobody needs our work anymore. */
+		proc_exit(0);
+
+	pfree(buf.data);
+}
+
+/*
+ * Rebuild statistics of a table in a separate transaction and report the
+ * result to the leader.
+ */
+static void
+rebuild_relation_isolated(RebuildTarget *target, shm_mq_handle *mqh,
+						  bool explicit, bool incremental, int ntargets,
+						  int ndone)
+{
+	MemoryContext	oldctx = CurrentMemoryContext;
+	char *volatile	relation = NULL;
+	char		   *error = NULL;
+	volatile int32	nstats = 0;
+	volatile bool	skip = false;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	PG_TRY();
+	{
+		char   *relname = get_rel_name(target->relid);
+
+		if (relname == NULL)
+			/* The table has been dropped in-between */
+			skip = true;
+		else
+		{
+			char   *nspname = get_namespace_name(get_rel_namespace(target->relid));
+
+			relation = MemoryContextStrdup(oldctx,
+										   quote_qualified_identifier(nspname,
+																	  relname));
+			report_progress(target, ntargets, ndone);
+
+			if (!rebuild_permitted(target->relid, explicit))
+				skip = true;
+			else
+				nstats = rebuild_relation(target, get_statistic_types(),
+										  incremental);
+		}
+
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+	}
+	PG_CATCH();
+	{
+		ErrorData  *edata;
+
+		MemoryContextSwitchTo(oldctx);
+		edata = CopyErrorData();
+		FlushErrorState();
+		AbortCurrentTransaction();
+
+		error = pstrdup(edata->message);
+		FreeErrorData(edata);
+		nstats = 0;
+	}
+	PG_END_TRY();
+
+	MemoryContextSwitchTo(oldctx);
+
+	if (!skip || error != NULL)
+		send_result(mqh, target->relid, relation ? relation : "", nstats, error);
+
+	if (relation)
+		pfree(relation);
+	if (error)
+		pfree(error);
+}
+
+void
+pg_index_stats_rebuild_worker_main(Datum main_arg)
+{
+	dsm_segment	   *seg;
+	RebuildShared  *shared;
+	shm_mq_handle  *mqh;
+	int				worker_num;
+	MemoryContext	worker_ctx;
+	List		   *targets = NIL;
+	int				ntargets;
+	int				ndone = 0;
+	char			columns_limit[32];
+
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	seg = dsm_attach(DatumGetUInt32(main_arg));
+	if (seg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("could not map dynamic shared memory segment")));
+	shared = (RebuildShared *) dsm_segment_address(seg);
+	memcpy(&worker_num, MyBgworkerEntry->bgw_extra, sizeof(int));
+
+	shm_mq_set_sender(REBUILD_QUEUE(shared, worker_num), MyProc);
+	mqh = shm_mq_attach(REBUILD_QUEUE(shared, worker_num), seg, NULL);
+
+	BackgroundWorkerInitializeConnectionByOid(shared->dbid, shared->userid, 0);
+	pgstat_report_appname(MODULE_NAME" rebuild worker");
+
+	worker_ctx = AllocSetContextCreate(TopMemoryContext,
+									   MODULE_NAME" rebuild worker context",
+									   ALLOCSET_DEFAULT_SIZES);
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+
+	/* Use settings of the leader */
+	SetConfigOption(MODULE_NAME".stattypes", shared->stattypes,
+					PGC_SUSET, PGC_S_SESSION);
+	snprintf(columns_limit, sizeof(columns_limit), "%d", shared->columns_limit);
+	SetConfigOption(MODULE_NAME".columns_limit", columns_limit,
+					PGC_SUSET, PGC_S_SESSION);
+	SetConfigOption(MODULE_NAME".compactify",
+					shared->compactify ? "on" : "off",
+					PGC_SUSET, PGC_S_SESSION);
+
+	/* The cluster-wide rebuild skips databases without the extension */
+	if (OidIsValid(get_extension_oid(MODULE_NAME, true)))
+	{
+		MemoryContext	oldctx = MemoryContextSwitchTo(worker_ctx);
+
+		targets = collect_rebuild_targets(shared->nspid, shared->relid);
+		MemoryContextSwitchTo(oldctx);
+	}
+	CommitTransactionCommand();
+
+	/*
+	 * Workers build their lists independently. A concurrent DDL may make them
+	 * slightly different, but it isn't worth the effort to synchronize them.
+	 */
+	ntargets = list_length(targets);
+	MemoryContextSwitchTo(worker_ctx);
+	for (;;)
+	{
+		uint32	k = pg_atomic_fetch_add_u32(&shared->next_target, 1);
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (k >= (uint32) ntargets)
+			break;
+
+		rebuild_relation_isolated((RebuildTarget *) list_nth(targets, k), mqh,
+								  OidIsValid(shared->relid), shared->incremental,
+								  ntargets, ndone++);
+	}
+
+	pgstat_progress_end_command();
+	dsm_detach(seg);
+	proc_exit(0);
+}
+
+/*
+ * Launch workers to rebuild statistics in the database and put their results
+ * into the tuplestore. If datname isn't NULL, it is added as the first column.
+ */
+static void
+run_rebuild_workers(Oid dbid, const char *datname, Oid nspid, Oid relid,
+					bool incremental, int nworkers, ReturnSetInfo *rsinfo)
+{
+	dsm_segment			   *seg;
+	RebuildShared		   *shared;
+	BackgroundWorkerHandle **handles;
+	shm_mq_handle		  **mqhs;
+	NameData				dbname;
+	int						nlaunched = 0;
+	int						i;
+
+	if (datname != NULL)
+		namestrcpy(&dbname, datname);
+
+	seg = dsm_create(MAXALIGN(sizeof(RebuildShared)) +
+					 (Size) nworkers * RESULT_QUEUE_SIZE, 0);
+	shared = (RebuildShared *) dsm_segment_address(seg);
+	shared->dbid = dbid;
+	shared->userid = GetUserId();
+	shared->nspid = nspid;
+	shared->relid = relid;
+	strlcpy(shared->stattypes,
+			GetConfigOption(MODULE_NAME".stattypes", false, true),
+			sizeof(shared->stattypes));
+	shared->columns_limit = atoi(GetConfigOption(MODULE_NAME".columns_limit",
+												 false, true));
+	shared->compactify = (strcmp(GetConfigOption(MODULE_NAME".compactify",
+												 false, true), "on") == 0);
+	shared->incremental = incremental;
+	pg_atomic_init_u32(&shared->next_target, 0);
+
+	handles = (BackgroundWorkerHandle **)
+		palloc0(nworkers * sizeof(BackgroundWorkerHandle *));
+	mqhs = (shm_mq_handle **) palloc0(nworkers * sizeof(shm_mq_handle *));
+
+	for (i = 0; i < nworkers; i++)
+	{
+		BackgroundWorker	worker;
+		shm_mq			   *mq;
+
+		mq = shm_mq_create(REBUILD_QUEUE(shared, i), RESULT_QUEUE_SIZE);
+		shm_mq_set_receiver(mq, MyProc);
+
+		memset(&worker, 0, sizeof(worker));
+		worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
+						   BGWORKER_BACKEND_DATABASE_CONNECTION;
+		worker.bgw_start_time = BgWorkerStart_ConsistentState;
+		worker.bgw_restart_time = BGW_NEVER_RESTART;
+		snprintf(worker.bgw_library_name, sizeof(worker.bgw_library_name),
+				 MODULE_NAME);
+		snprintf(worker.bgw_function_name, sizeof(worker.bgw_function_name),
+				 "pg_index_stats_rebuild_worker_main");
+		snprintf(worker.bgw_name, BGW_MAXLEN,
+				 MODULE_NAME" rebuild worker %d for database %u", i, dbid);
+		snprintf(worker.bgw_type, BGW_MAXLEN, MODULE_NAME" rebuild worker");
+		worker.bgw_main_arg = UInt32GetDatum(dsm_segment_handle(seg));
+		memcpy(worker.bgw_extra, &i, sizeof(int));
+		worker.bgw_notify_pid = MyProcPid;
+
+		if (!RegisterDynamicBackgroundWorker(&worker, &handles[i]))
+			break;
+
+		mqhs[i] = shm_mq_attach(mq, seg, handles[i]);
+		nlaunched++;
+	}
+
+	if (nlaunched == 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_RESOURCES),
+				 errmsg("could not register background process"),
+				 errhint("You may need to increase max_worker_processes.")));
+	else if (nlaunched < nworkers)
+		elog(NOTICE, "only %d of %d requested workers have been launched",
+			 nlaunched, nworkers);
+
+	/* Gather results until all the workers detach their queues */
+	for (;;)
+	{
+		bool	active = false;
+		bool	received = false;
+
+		for (i = 0; i < nlaunched; i++)
+		{
+			shm_mq_result	res;
+			Size			nbytes;
+			void		   *data;
+			RebuildResult  *msg;
+			Datum			values[5];
+			bool			nulls[5];
+			int				j = 0;
+
+			if (mqhs[i] == NULL)
+				continue;
+
+			res = shm_mq_receive(mqhs[i], &nbytes, &data, true);
+			if (res == SHM_MQ_WOULD_BLOCK)
+			{
+				active = true;
+				continue;
+			}
+			if (res == SHM_MQ_DETACHED)
+			{
+				shm_mq_detach(mqhs[i]);
+				mqhs[i] = NULL;
+				continue;
+			}
+
+			active = true;
+			received = true;
+			msg = (RebuildResult *) data;
+
+			memset(nulls, false, sizeof(nulls));
+			if (datname != NULL)
+				values[j++] = NameGetDatum(&dbname);
+			values[j++] = ObjectIdGetDatum(msg->relid);
+			values[j++] = CStringGetTextDatum(msg->data);
+			values[j++] = Int32GetDatum(msg->nstats);
+			if (msg->failed)
+				values[j] = CStringGetTextDatum(msg->data + strlen(msg->data) + 1);
+			else
+				nulls[j] = true;
+
+			tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc,
+								 values, nulls);
+		}
+
+		if (!active)
+			break;
+
+		if (!received)
+		{
+			(void) WaitLatch(MyLatch, WL_LATCH_SET | WL_EXIT_ON_PM_DEATH, 0,
+							 PG_WAIT_EXTENSION);
+			ResetLatch(MyLatch);
+			CHECK_FOR_INTERRUPTS();
+		}
+	}
+
+	dsm_detach(seg);
+}
+
+static int
+get_parallel(FunctionCallInfo fcinfo)
+{
+	int		nworkers;
+
+	if (PG_ARGISNULL(0) ||
+		(nworkers = PG_GETARG_INT32(0)) < 1 || nworkers > max_worker_processes)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("number of workers must be between 1 and %d",
+						max_worker_processes)));
+	return nworkers;
+}
+
+/*
+ * Parallel version of the rebuild. Return a row per processed table.
+ */
+Datum
+pg_index_stats_rebuild_parallel(PG_FUNCTION_ARGS)
+{
+	int		nworkers = get_parallel(fcinfo);
+	Oid		nspid;
+	Oid		relid;
+
+	get_rebuild_filters(fcinfo, 1, &nspid, &relid);
+
+	prepare_materialized_srf(fcinfo);
+	run_rebuild_workers(MyDatabaseId, NULL, nspid, relid,
+						!PG_ARGISNULL(3) && PG_GETARG_BOOL(3), nworkers,
+						(ReturnSetInfo *) fcinfo->resultinfo);
+
+	return (Datum) 0;
+}
+
+/*
+ * Rebuild statistics in each database where the extension is installed.
+ * Databases are processed one by one, tables of a database - in parallel.
+ */
+Datum
+pg_index_stats_rebuild_all(PG_FUNCTION_ARGS)
+{
+	int				nworkers = get_parallel(fcinfo);
+	bool			incremental = !PG_ARGISNULL(1) && PG_GETARG_BOOL(1);
+	Relation		rel;
+	TableScanDesc	scan;
+	HeapTuple		tuple;
+	List		   *dbids = NIL;
+	List		   *datnames = NIL;
+	ListCell	   *lc1;
+	ListCell	   *lc2;
+
+	prepare_materialized_srf(fcinfo);
+
+	rel = table_open(DatabaseRelationId, AccessShareLock);
+	scan = table_beginscan_catalog(rel, 0, NULL);
+	while ((tuple = heap_getnext(scan, ForwardScanDirection)) != NULL)
+	{
+		Form_pg_database	dbform = (Form_pg_database) GETSTRUCT(tuple);
+
+		if (!dbform->datallowconn)
+			continue;
+
+		dbids = lappend_oid(dbids, dbform->oid);
+		datnames = lappend(datnames, pstrdup(NameStr(dbform->datname)));
+	}
+	table_endscan(scan);
+	table_close(rel, AccessShareLock);
+
+	forboth(lc1, dbids, lc2, datnames)
+	{
+		CHECK_FOR_INTERRUPTS();
+		run_rebuild_workers(lfirst_oid(lc1), (char *) lfirst(lc2),
+							InvalidOid, InvalidOid, incremental, nworkers,
+							(ReturnSetInfo *) fcinfo->resultinfo);
+	}
+
+	return (Datum) 0;
+}
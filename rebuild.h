@@ -0,0 +1,37 @@
+#ifndef _REBUILD_H_
+#define _REBUILD_H_
+
+#include "postgres.h"
+
+#include "fmgr.h"
+#include "utils/relcache.h"
+
+#include "duplicated_slots.h"
+
+typedef struct RebuildTarget
+{
+	Oid			relid;		/* heap relation, hash key */
+	List	   *indexes;	/* OIDs of its indexes */
+} RebuildTarget;
+
+/*
+ * Statistics, which should exist on an index. StatExtEntry goes first to let
+ * compactify_definition() treat it as an existing one.
+ */
+typedef struct DesiredStat
+{
+	StatExtEntry	entry;
+	Oid				indexId;
+	List		   *exprlst;	/* list of StatsElem */
+	Bitmapset	   *atts_used;
+} DesiredStat;
+
+extern List *collect_rebuild_targets(Oid nspid, Oid relid);
+extern bool rebuild_permitted(Oid relid, bool explicit);
+extern List *fetch_index_based_statistics(Oid relid, List **others);
+extern int apply_desired_statistics(Relation hrel, List *autostats,
+									List *desired);
+
+extern PGDLLEXPORT void pg_index_stats_rebuild_worker_main(Datum main_arg);
+
+#endif /* _REBUILD_H_ */
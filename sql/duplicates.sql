@@ -64,6 +64,12 @@ SET pg_index_stats.compactify = 'off';
 SET pg_index_stats.columns_limit = 2; -- Just do it quickly
 SELECT pg_index_stats_rebuild(); -- must create duplicated stats
 \dX
+SELECT pg_index_stats_rebuild('pg_catalog'); -- system schemas are skipped
+SELECT pg_index_stats_rebuild('public', 'nonexistent'); -- ERROR
+SELECT relation, nstats, error
+  FROM pg_index_stats_rebuild(parallel => 2, relname => 'is_test');
+-- Nothing has been changed since the last rebuild
+SELECT pg_index_stats_rebuild('public', 'is_test', incremental => true);
 RESET pg_index_stats.compactify;
 
 DROP INDEX ist_idx3,ist_idx0,ist_idx1,ist_idx_1;
@@ -73,5 +79,29 @@ CREATE INDEX idx4 ON is_test(x1, x2);
 
 RESET pg_index_stats.columns_limit;
 DROP TABLE is_test CASCADE;
+
+-- Global compaction: ndistinct on (a,b) is served by the wider statistics
+CREATE TABLE cmp_test (a int, b int, c int);
+SET pg_index_stats.compactify = 'off';
+CREATE INDEX cmp_idx1 ON cmp_test (a, b);
+CREATE INDEX cmp_idx2 ON cmp_test (a, b, c);
+RESET pg_index_stats.compactify;
+SELECT nstats_before, nstats_after, nchanged, saved_bytes
+  FROM pg_index_stats_compact('cmp_test', dry_run => true);
+SELECT nstats_before, nstats_after, nchanged, saved_bytes
+  FROM pg_index_stats_compact('cmp_test');
+SELECT nstats_before, nstats_after, nchanged, saved_bytes
+  FROM pg_index_stats_compact('cmp_test'); -- nothing to do
+DROP TABLE cmp_test;
+
+-- Storage budget: MCV doesn't fit, ndistinct does
+CREATE TABLE bdg_test (a int, b int, c int);
+SET pg_index_stats.table_storage_budget = '1kB';
+CREATE INDEX bdg_idx1 ON bdg_test (a, b, c);
+CREATE INDEX bdg_idx2 ON bdg_test (b, c); -- skipped
+SELECT stxname, stxkind FROM pg_statistic_ext
+WHERE stxrelid = 'bdg_test'::regclass;
+RESET pg_index_stats.table_storage_budget;
+DROP TABLE bdg_test;
 DROP EXTENSION pg_index_stats;
 
@@ -0,0 +1,25 @@
+CREATE EXTENSION pg_index_stats;
+
+CREATE TABLE eat1 (x integer, y integer);
+INSERT INTO eat1 (x,y)
+  SELECT value % 10, value % 10 FROM generate_series(1, 1000) AS value;
+CREATE INDEX eat1_idx ON eat1 (x,y);
+
+-- Statistics are created empty
+SELECT count(*) FROM pg_stats_ext WHERE tablename = 'eat1';
+
+SELECT pg_index_stats_analyze('eat1');
+SELECT n_distinct IS NOT NULL AS ndistinct,
+       array_length(most_common_vals, 1) AS nmcv
+FROM pg_stats_ext WHERE tablename = 'eat1';
+
+-- Nothing to build anymore
+SELECT pg_index_stats_analyze('eat1');
+
+-- ANALYZE never builds a statistics with the target 0, as a retired one
+CREATE STATISTICS eat1_retired ON x, y FROM eat1;
+ALTER STATISTICS eat1_retired SET STATISTICS 0;
+SELECT pg_index_stats_analyze('eat1');
+
+DROP TABLE eat1;
+DROP EXTENSION pg_index_stats;
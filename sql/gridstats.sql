@@ -0,0 +1,53 @@
+CREATE EXTENSION pg_index_stats;
+
+-- Don't generate extended statistics on the indexes
+SET pg_index_stats.columns_limit = 0;
+
+CREATE TABLE grid1 (a integer, b integer);
+INSERT INTO grid1 (a,b)
+  SELECT x % 100, x % 100 FROM generate_series(1, 10000) AS x;
+CREATE INDEX grid1_idx ON grid1 (a,b);
+CREATE INDEX grid1_a_idx ON grid1 (a);
+VACUUM ANALYZE grid1;
+
+SELECT * FROM check_estimated_rows('
+  SELECT * FROM grid1 WHERE a < 10 AND b < 10;');
+SELECT * FROM check_estimated_rows('
+  SELECT * FROM grid1 WHERE a BETWEEN 20 AND 29 AND b BETWEEN 20 AND 29;');
+
+-- 100 buckets in each dimension
+SELECT pg_index_stats_grid('grid1_idx');
+SELECT * FROM check_estimated_rows('
+  SELECT * FROM grid1 WHERE a < 10 AND b < 10;');
+SELECT * FROM check_estimated_rows('
+  SELECT * FROM grid1 WHERE a BETWEEN 20 AND 29 AND b BETWEEN 20 AND 29;');
+SET pg_index_stats.grid = off;
+SELECT * FROM check_estimated_rows('
+  SELECT * FROM grid1 WHERE a < 10 AND b < 10;');
+RESET pg_index_stats.grid;
+
+SELECT pg_index_stats_grid('grid1_a_idx'); -- ERROR
+SELECT pg_index_stats_grid('grid1'); -- ERROR
+
+SELECT pg_index_stats_data_remove('grid1_idx');
+SELECT * FROM check_estimated_rows('
+  SELECT * FROM grid1 WHERE a < 10 AND b < 10;');
+
+-- A range inside a single bucket keeps the estimation of the core
+CREATE TABLE grid2 (a integer, b integer);
+INSERT INTO grid2 (a,b)
+  SELECT x, x % 10 FROM generate_series(0, 9999) AS x;
+CREATE INDEX grid2_idx ON grid2 (a,b);
+VACUUM ANALYZE grid2;
+SELECT pg_index_stats_grid('grid2_idx');
+CREATE TEMP TABLE grid2_est AS SELECT estimated FROM check_estimated_rows('
+  SELECT * FROM grid2 WHERE a BETWEEN 4920 AND 4950 AND b < 5;');
+SET pg_index_stats.grid = off;
+SELECT g.estimated = c.estimated AS same, g.estimated > 1 AS nonzero
+FROM grid2_est g, check_estimated_rows('
+  SELECT * FROM grid2 WHERE a BETWEEN 4920 AND 4950 AND b < 5;') c;
+RESET pg_index_stats.grid;
+
+RESET pg_index_stats.columns_limit;
+DROP TABLE grid1, grid2;
+DROP EXTENSION pg_index_stats;
@@ -0,0 +1,41 @@
+CREATE EXTENSION pg_index_stats;
+
+CREATE TABLE hypo1 (x integer, y integer);
+INSERT INTO hypo1 (x,y)
+  SELECT value % 72, value % 36 FROM generate_series(1, 10000) AS value;
+INSERT INTO hypo1 (x,y)
+  SELECT value % 250 + 100, value % 250 + 100
+  FROM generate_series(1, 1000) AS value;
+VACUUM ANALYZE hypo1;
+
+SELECT * FROM check_estimated_rows('
+  SELECT x,y FROM hypo1 WHERE x = 1 AND y = 1;');
+
+-- The whole table is sampled, so the estimation is exact
+SELECT pg_index_stats_hypothetical('hypo1', '{x,y}');
+SELECT * FROM check_estimated_rows('
+  SELECT x,y FROM hypo1 WHERE x = 1 AND y = 1;');
+
+-- No real statistics were created
+SELECT count(*) FROM pg_statistic_ext WHERE stxrelid = 'hypo1'::regclass;
+
+SELECT pg_index_stats_hypothetical('hypo1', '{x,y}', 'ndistinct'); -- ERROR
+SELECT pg_index_stats_hypothetical('hypo1', '{x,x}'); -- ERROR
+SELECT pg_index_stats_hypothetical('hypo1', '{x}'); -- ERROR
+SELECT pg_index_stats_hypothetical('hypo1', '{x,z}'); -- ERROR
+
+-- The table is sampled by the owner, so only the owner may do it
+CREATE ROLE regress_hypo_user;
+GRANT SELECT ON hypo1 TO regress_hypo_user;
+SET ROLE regress_hypo_user;
+SELECT pg_index_stats_hypothetical('hypo1', '{x,y}'); -- ERROR
+RESET ROLE;
+REVOKE SELECT ON hypo1 FROM regress_hypo_user;
+DROP ROLE regress_hypo_user;
+
+SELECT pg_index_stats_hypothetical_reset();
+SELECT * FROM check_estimated_rows('
+  SELECT x,y FROM hypo1 WHERE x = 1 AND y = 1;');
+
+DROP TABLE hypo1;
+DROP EXTENSION pg_index_stats;
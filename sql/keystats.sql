@@ -0,0 +1,78 @@
+CREATE EXTENSION pg_index_stats;
+
+-- Don't generate extended statistics on the indexes
+SET pg_index_stats.columns_limit = 0;
+
+CREATE TABLE kst1 (a integer, b integer);
+INSERT INTO kst1 (a,b)
+  SELECT x % 100, x % 100 FROM generate_series(1, 10000) AS x;
+CREATE INDEX kst1_idx ON kst1 (a,b);
+CREATE INDEX kst1_a_idx ON kst1 (a);
+
+CREATE TABLE kst2 (a integer, b integer);
+INSERT INTO kst2 (a,b)
+  SELECT x % 2, x FROM generate_series(1, 10000) AS x;
+CREATE INDEX kst2_idx ON kst2 (a,b);
+VACUUM ANALYZE kst1, kst2;
+
+SELECT * FROM check_estimated_rows('
+  SELECT * FROM kst1 WHERE a = 1 AND b = 1;');
+
+-- The whole table is sampled: each key is a common one
+SELECT pg_index_stats_keystats('kst1_idx');
+SELECT * FROM check_estimated_rows('
+  SELECT * FROM kst1 WHERE a = 1 AND b = 1;');
+SELECT * FROM check_estimated_rows('
+  SELECT * FROM kst1 WHERE a = 1 AND b = 2;');
+
+-- A leaky operator mustn't see the keys behind the row level security
+CREATE FUNCTION kst_leaky_eq(integer, integer) RETURNS bool
+  LANGUAGE plpgsql IMMUTABLE AS $$ BEGIN RETURN $1 = $2; END; $$;
+CREATE OPERATOR === (PROCEDURE = kst_leaky_eq,
+  LEFTARG = integer, RIGHTARG = integer, RESTRICT = eqsel);
+SELECT * FROM check_estimated_rows('
+  SELECT * FROM kst1 WHERE a === 1 AND b === 1;');
+CREATE ROLE regress_keystats_user;
+GRANT SELECT ON kst1 TO regress_keystats_user;
+ALTER TABLE kst1 ENABLE ROW LEVEL SECURITY;
+CREATE POLICY kst1_policy ON kst1 USING (a >= 0);
+SET ROLE regress_keystats_user;
+SELECT * FROM check_estimated_rows('
+  SELECT * FROM kst1 WHERE a === 1 AND b === 1;');
+SELECT * FROM check_estimated_rows('
+  SELECT * FROM kst1 WHERE a = 1 AND b = 1;');
+RESET ROLE;
+DROP POLICY kst1_policy ON kst1;
+ALTER TABLE kst1 DISABLE ROW LEVEL SECURITY;
+REVOKE SELECT ON kst1 FROM regress_keystats_user;
+DROP ROLE regress_keystats_user;
+DROP OPERATOR === (integer, integer);
+DROP FUNCTION kst_leaky_eq;
+
+-- Keyset pagination. The core estimates by the first column only.
+SELECT * FROM check_estimated_rows('
+  SELECT * FROM kst2 WHERE (a,b) > (0,5000);');
+SELECT pg_index_stats_keystats('kst2_idx');
+SELECT * FROM check_estimated_rows('
+  SELECT * FROM kst2 WHERE (a,b) > (0,5000);');
+SET pg_index_stats.keystats = off;
+SELECT * FROM check_estimated_rows('
+  SELECT * FROM kst2 WHERE (a,b) > (0,5000);');
+RESET pg_index_stats.keystats;
+
+SELECT pg_index_stats_keystats('kst1_a_idx'); -- ERROR
+SELECT pg_index_stats_keystats('kst1'); -- ERROR
+
+SELECT pg_index_stats_data_remove('kst1_idx');
+SELECT * FROM check_estimated_rows('
+  SELECT * FROM kst1 WHERE a = 1 AND b = 1;');
+
+-- Statistics of a dropped index are removed along with it
+SELECT count(*) FROM pg_index_stats_data;
+DROP INDEX kst2_idx;
+SELECT count(*) FROM pg_index_stats_data;
+SELECT pg_index_stats_data_remove();
+
+RESET pg_index_stats.columns_limit;
+DROP TABLE kst1, kst2;
+DROP EXTENSION pg_index_stats;
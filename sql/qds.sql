@@ -16,6 +16,43 @@ SELECT x,y FROM qds1 WHERE x = 1 AND y = 1; -- ERROR, needs ANALYZE
 EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF, BUFFERS OFF, EXTSTAT_CANDIDATES ON)
 SELECT x,y FROM qds1 WHERE x = 1 AND y = 1;
 
+-- The score doesn't depend on the timing of the node
+CREATE FUNCTION qds_candidate_score(timing boolean) RETURNS float8 AS $$
+DECLARE
+  plan json;
+BEGIN
+  EXECUTE format('EXPLAIN (ANALYZE, TIMING %s, SUMMARY OFF, BUFFERS OFF,
+                           EXTSTAT_CANDIDATES ON, FORMAT JSON)
+                  SELECT x,y FROM qds1 WHERE x = 1 AND y = 1', timing)
+  INTO plan;
+  RETURN (plan->0->'Plan'->>'Candidate Score')::float8;
+END;
+$$ LANGUAGE plpgsql;
+SELECT qds_candidate_score(false) AS timing_off,
+       qds_candidate_score(true) AS timing_on;
+DROP FUNCTION qds_candidate_score;
+
+-- Queries out of the sample don't gather candidates
+SET pg_index_stats.qds_sample_rate = 0;
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF, BUFFERS OFF, EXTSTAT_CANDIDATES ON)
+SELECT x,y FROM qds1 WHERE x = 1 AND y = 1;
+RESET pg_index_stats.qds_sample_rate;
+SET pg_index_stats.qds_queryids = '1, -2';
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF, BUFFERS OFF, EXTSTAT_CANDIDATES ON)
+SELECT x,y FROM qds1 WHERE x = 1 AND y = 1;
+SET pg_index_stats.qds_queryids = '1, abc'; -- ERROR
+RESET pg_index_stats.qds_queryids;
+
+-- The memo doesn't hide candidates from EXPLAIN
+SET compute_query_id = on;
+SET pg_index_stats.qds_log = on;
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF, BUFFERS OFF, EXTSTAT_CANDIDATES ON)
+SELECT x,y FROM qds1 WHERE x = 1 AND y = 1;
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF, BUFFERS OFF, EXTSTAT_CANDIDATES ON)
+SELECT x,y FROM qds1 WHERE x = 1 AND y = 1;
+RESET pg_index_stats.qds_log;
+RESET compute_query_id;
+
 SELECT * FROM check_estimated_rows('
   SELECT x,y FROM qds1 WHERE x = 1 AND y = 2;');
 EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF,
@@ -64,7 +101,7 @@ EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF,
 SELECT x,y FROM qds1 WHERE x > 70 AND x < 72 AND x = 71
 ; -- The same column only, couple inequalities, no extended statistics
 
--- TODO: Need to detect that we gather candidates recursively too
+-- Statements, executed by a function, are analysed on their own
 CREATE FUNCTION recursive_execution()
 RETURNS bool
 AS $func$
@@ -77,6 +114,49 @@ EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF,
 		 BUFFERS OFF, EXTSTAT_CANDIDATES ON)
 SELECT * FROM recursive_execution();
 
+CREATE FUNCTION nested_candidates()
+RETURNS bool
+AS $func$
+BEGIN
+  PERFORM x,y FROM qds1 WHERE x % 71 = 0 AND y % 35 = 0;
+  RETURN true;
+END;
+$func$ LANGUAGE PLPGSQL;
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF,
+		 BUFFERS OFF, EXTSTAT_CANDIDATES ON)
+SELECT x,y FROM qds1 WHERE x = 1 AND y = 1 AND nested_candidates()
+; -- Candidates of the nested statement don't mix with the outer ones
+DROP FUNCTION nested_candidates;
+-- Statements of the plan cache are copies of the planned ones
+CREATE TABLE qds_sink (x int, y int);
+CREATE FUNCTION nested_insert()
+RETURNS bool
+AS $func$
+BEGIN
+  INSERT INTO qds_sink SELECT x,y FROM qds1 WHERE x = 1 AND y = 1;
+  RETURN true;
+END;
+$func$ LANGUAGE PLPGSQL;
+SET pg_index_stats.qds_log = on;
+SET client_min_messages = log;
+SELECT nested_insert();
+RESET client_min_messages;
+RESET pg_index_stats.qds_log;
+PREPARE qds_prep(int) AS SELECT x,y FROM qds1 WHERE x = $1 AND y = 1;
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF,
+		 BUFFERS OFF, EXTSTAT_CANDIDATES ON)
+EXECUTE qds_prep(1);
+DEALLOCATE qds_prep;
+DROP FUNCTION nested_insert;
+DROP TABLE qds_sink;
+
+-- The misestimation doesn't change the plan, nothing to recommend
+SET pg_index_stats.qds_replan = on;
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF,
+		 BUFFERS OFF, EXTSTAT_CANDIDATES ON)
+SELECT x,y FROM qds1 WHERE x = 1 AND y = 1;
+RESET pg_index_stats.qds_replan;
+
 -- Before we had a recommendation to build statistics on the (x,y).
 -- Now we have a stat, so no recommendations should be provided.
  -- Unfortunately, it only works after an analyse. We may avoid it - see the
@@ -88,5 +168,39 @@ EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF,
 		 BUFFERS OFF, EXTSTAT_CANDIDATES ON)
 SELECT x,y FROM qds1 WHERE x IN (71) AND y > 33 AND y < 37;
 
+-- Cross-column correlation of join clauses
+CREATE TABLE qds_j1 (a integer, b integer);
+CREATE TABLE qds_j2 (a integer, b integer);
+INSERT INTO qds_j1 (a,b) SELECT i % 10, i % 10 FROM generate_series(1, 1000) AS i;
+INSERT INTO qds_j2 (a,b) SELECT i % 10, i % 10 FROM generate_series(1, 100) AS i;
+ANALYZE qds_j1, qds_j2;
+SET enable_hashjoin = off;
+SET enable_mergejoin = off;
+SET enable_material = off;
+SET max_parallel_workers_per_gather = 0;
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF,
+		 BUFFERS OFF, EXTSTAT_CANDIDATES ON)
+SELECT count(*) FROM qds_j1 j1 JOIN qds_j2 j2 ON j1.a = j2.a AND j1.b = j2.b;
+RESET enable_hashjoin;
+RESET enable_mergejoin;
+RESET enable_material;
+RESET max_parallel_workers_per_gather;
+DROP TABLE qds_j1, qds_j2;
+
+-- Index scan: clauses are split between the index condition and the filter
+CREATE TABLE qds_i (x integer, y integer);
+INSERT INTO qds_i (x,y)
+  SELECT value % 72, value % 36 FROM generate_series(1, 10000) AS value;
+CREATE INDEX qds_i_x_idx ON qds_i (x);
+VACUUM ANALYZE qds_i;
+SET enable_seqscan = off;
+SET enable_bitmapscan = off;
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF,
+		 BUFFERS OFF, EXTSTAT_CANDIDATES ON)
+SELECT x,y FROM qds_i WHERE x = 1 AND y = 1;
+RESET enable_seqscan;
+RESET enable_bitmapscan;
+DROP TABLE qds_i;
+
 DROP FUNCTION recursive_execution;
 DROP EXTENSION pg_index_stats;
@@ -24,6 +24,17 @@ EXPLAIN (COSTS OFF, STAT ON)
 SELECT * FROM sc_a s1 JOIN sc_a s2 ON true
 WHERE s1.x=1 AND s2.y LIKE 'a';
 
+-- Extended statistics, useless for the query, are pruned
+CREATE STATISTICS sc_a_stat ON x, y FROM sc_a;
+ANALYZE sc_a;
+SET pg_index_stats.prune_statistics = on;
+EXPLAIN (COSTS OFF, STAT ON)
+SELECT * FROM sc_a WHERE x=1;
+EXPLAIN (COSTS OFF, STAT ON)
+SELECT * FROM sc_a WHERE x=1 AND y LIKE 'a';
+RESET pg_index_stats.prune_statistics;
+DROP STATISTICS sc_a_stat;
+
 -- Check format
 EXPLAIN (COSTS OFF, STAT ON, FORMAT JSON)
 SELECT * FROM sc_a WHERE x=1 AND y LIKE 'a';
@@ -0,0 +1,502 @@
+/*-------------------------------------------------------------------------
+ *
+ * statcost.c
+ *		Estimation of the price of extended statistics.
+ *
+ * ANALYZE builds each kind of extended statistics over the same sample of
+ * rows. The number of sorts of the sample depends on the number of columns
+ * and the kind: ndistinct and functional dependencies are computed for each
+ * combination of columns, MCV - once. Size of the data depends on the same
+ * things plus widths of the columns. All the estimations here are rough and
+ * are intended to compare alternative sets of statistics only.
+ *
+ * Budgets limit the total price of extended statistics on a table and in the
+ * database. New statistics, which don't fit, are switched to cheaper kinds,
+ * narrowed or skipped.
+ *
+ * Copyright (c) 2023-2025 Andrei Lepikhov
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ * IDENTIFICATION
+ *	  contrib/pg_index_stats/statcost.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <math.h>
+
+#include "access/htup_details.h"
+#include "access/table.h"
+#include "access/tableam.h"
+#include "catalog/pg_statistic.h"
+#include "catalog/pg_statistic_ext.h"
+#include "commands/vacuum.h"
+#include "lib/stringinfo.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/parsenodes.h"
+#include "storage/lmgr.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+#include "utils/syscache.h"
+
+#include "duplicated_slots.h"
+#include "pg_index_stats.h"
+#include "statcost.h"
+#include "statretire.h"
+
+/* Time of comparison of two sample tuples on a single column, ms */
+#define COMPARISON_COST_MS		(0.00005)
+
+/* Catalog tuples of empty statistics */
+#define STATISTICS_OVERHEAD_BYTES	(256)
+
+/* Price of a kilobyte of statistics data in milliseconds of ANALYZE */
+static double storage_cost_weight = 1.0;
+
+/* Budgets of extended statistics. -1 means no limit */
+static int table_analyze_budget = -1;		/* ms */
+static int table_storage_budget = -1;		/* kB */
+static int database_analyze_budget = -1;	/* ms */
+static int database_storage_budget = -1;	/* kB */
+
+/*
+ * Average width of a column. Use statistics of the column, if any.
+ */
+static int32
+column_width(Relation rel, AttrNumber attnum)
+{
+	Form_pg_attribute	attr = TupleDescAttr(RelationGetDescr(rel), attnum - 1);
+	int32				width;
+
+	width = get_attavgwidth(RelationGetRelid(rel), attnum);
+	if (width > 0)
+		return width;
+	return get_typavgwidth(attr->atttypid, attr->atttypmod);
+}
+
+/*
+ * Number of distinct values of a column according to pg_statistic. Return
+ * a negative value, if unknown.
+ */
+static double
+column_ndistinct(Relation rel, AttrNumber attnum)
+{
+	HeapTuple	tuple;
+	double		ndistinct = -1.;
+
+	tuple = SearchSysCache3(STATRELATTINH,
+							ObjectIdGetDatum(RelationGetRelid(rel)),
+							Int16GetDatum(attnum),
+							BoolGetDatum(false));
+	if (!HeapTupleIsValid(tuple))
+		return ndistinct;
+
+	ndistinct = ((Form_pg_statistic) GETSTRUCT(tuple))->stadistinct;
+	if (ndistinct < 0.)
+		ndistinct = -ndistinct * Max(rel->rd_rel->reltuples, 0.);
+	else if (ndistinct == 0.)
+		ndistinct = -1.;
+
+	ReleaseSysCache(tuple);
+	return ndistinct;
+}
+
+static double
+binomial(int n, int k)
+{
+	double	result = 1.;
+	int		i;
+
+	for (i = 1; i <= k; i++)
+		result = result * (n - k + i) / i;
+	return result;
+}
+
+/*
+ * Estimate extra ANALYZE time and storage the statistics of types on the
+ * columns and the exprs would cost.
+ */
+void
+estimate_statistics_cost(Relation rel, Bitmapset *columns, List *exprs,
+						 int32 types, StatCost *cost)
+{
+	double		nrows = 300. * default_statistics_target;
+	double		sortcost = nrows * log2(nrows) * COMPARISON_COST_MS;
+	double		width = 0.;
+	double		ndistinct = 1.;
+	int			ncols = bms_num_members(columns) + list_length(exprs);
+	int			attnum = -1;
+	ListCell   *lc;
+
+	cost->analyze_ms = 0.;
+	cost->bytes = 0.;
+
+	if (types == 0 || ncols < 2)
+		return;
+
+	while ((attnum = bms_next_member(columns, attnum)) >= 0)
+	{
+		double	nd = column_ndistinct(rel, attnum);
+
+		width += column_width(rel, attnum);
+		ndistinct = (nd > 0.) ? ndistinct * nd : nrows;
+		ndistinct = Min(ndistinct, nrows);
+	}
+	foreach(lc, exprs)
+	{
+		Node   *expr = (Node *) lfirst(lc);
+
+		width += get_typavgwidth(exprType(expr), exprTypmod(expr));
+		ndistinct = nrows;
+	}
+
+	cost->bytes = STATISTICS_OVERHEAD_BYTES;
+
+	if (types & STAT_NDISTINCT)
+	{
+		/* Each combination of two or more columns */
+		double	ncombinations = pow(2., ncols) - ncols - 1;
+
+		cost->analyze_ms += ncombinations * sortcost * ncols / 2.;
+		cost->bytes += ncombinations *
+			(sizeof(double) + sizeof(int) + ncols * sizeof(AttrNumber));
+	}
+
+	if (types & STAT_DEPENDENCIES)
+	{
+		double	ndependencies = 0.;
+		int		k;
+
+		/* Each column of each combination is a potentially dependent one */
+		for (k = 2; k <= ncols; k++)
+			ndependencies += binomial(ncols, k) * k;
+
+		cost->analyze_ms += ndependencies * sortcost * ncols / 2.;
+		cost->bytes += ndependencies *
+			(sizeof(double) + sizeof(int) + ncols * sizeof(AttrNumber));
+	}
+
+	if (types & STAT_MCV)
+	{
+		double	nitems = Min(ndistinct, (double) default_statistics_target);
+
+		cost->analyze_ms += sortcost * ncols;
+		cost->bytes += nitems *
+			(width + ncols * (sizeof(bool) + sizeof(uint16)) + 2 * sizeof(double));
+	}
+}
+
+/*
+ * Combine time and storage into a single value to compare alternatives.
+ */
+double
+statistics_cost_value(const StatCost *cost)
+{
+	return cost->analyze_ms + storage_cost_weight * cost->bytes / 1024.;
+}
+
+/*
+ * Summary price of extended statistics on the relation. Retired statistics
+ * aren't analysed and don't count.
+ */
+static void
+relation_statistics_cost(Relation rel, StatCost *total)
+{
+	ListCell   *lc;
+
+	foreach(lc, fetch_relation_statentries(RelationGetRelid(rel)))
+	{
+		StatExtEntry   *entry = (StatExtEntry *) lfirst(lc);
+		StatCost		cost;
+
+		if (statistics_retired(entry->oid))
+			continue;
+
+		estimate_statistics_cost(rel, entry->columns, entry->exprs,
+								 entry->types, &cost);
+		total->analyze_ms += cost.analyze_ms;
+		total->bytes += cost.bytes;
+	}
+}
+
+/*
+ * Summary price of extended statistics in the database. Used only if the
+ * database budget is set: each table with statistics has to be opened. The
+ * creation of statistics doesn't wait for a table, locked by someone else:
+ * statistics of such a table are left out of the price.
+ */
+static void
+database_statistics_cost(StatCost *total)
+{
+	Relation		pg_stext;
+	TableScanDesc	scan;
+	HeapTuple		tuple;
+	List		   *relids = NIL;
+	ListCell	   *lc;
+
+	pg_stext = table_open(StatisticExtRelationId, AccessShareLock);
+	scan = table_beginscan_catalog(pg_stext, 0, NULL);
+	while ((tuple = heap_getnext(scan, ForwardScanDirection)) != NULL)
+		relids = list_append_unique_oid(relids,
+					((Form_pg_statistic_ext) GETSTRUCT(tuple))->stxrelid);
+	table_endscan(scan);
+	table_close(pg_stext, AccessShareLock);
+
+	foreach(lc, relids)
+	{
+		Oid			relid = lfirst_oid(lc);
+		Relation	rel;
+
+		if (!ConditionalLockRelationOid(relid, AccessShareLock))
+			continue;
+
+		rel = try_relation_open(relid, NoLock);
+		if (rel == NULL)
+		{
+			UnlockRelationOid(relid, AccessShareLock);
+			continue;
+		}
+		relation_statistics_cost(rel, total);
+		relation_close(rel, AccessShareLock);
+	}
+	list_free(relids);
+}
+
+static bool
+fits_budget(const StatCost *used, const StatCost *cost, int analyze_budget,
+			int storage_budget)
+{
+	if (analyze_budget >= 0 &&
+		used->analyze_ms + cost->analyze_ms > analyze_budget)
+		return false;
+	if (storage_budget >= 0 &&
+		used->bytes + cost->bytes > storage_budget * 1024.)
+		return false;
+	return true;
+}
+
+/*
+ * Price of the definition, limited by the first ncols elements.
+ */
+static void
+definition_cost(Relation rel, List *exprlst, int ncols, int32 types,
+				StatCost *cost)
+{
+	Bitmapset  *columns = NULL;
+	List	   *exprs = NIL;
+	ListCell   *lc;
+
+	foreach(lc, exprlst)
+	{
+		StatsElem  *selem = (StatsElem *) lfirst(lc);
+
+		if (foreach_current_index(lc) >= ncols)
+			break;
+
+		if (selem->expr != NULL)
+			exprs = lappend(exprs, selem->expr);
+		else
+			columns = bms_add_member(columns,
+									 get_attnum(RelationGetRelid(rel),
+												selem->name));
+	}
+
+	estimate_statistics_cost(rel, columns, exprs, types, cost);
+	bms_free(columns);
+	list_free(exprs);
+}
+
+static char *
+stattypes_string(int32 types)
+{
+	StringInfoData	str;
+
+	initStringInfo(&str);
+	if (types & STAT_MCV)
+		appendStringInfoString(&str, STAT_MCV_NAME);
+	if (types & STAT_NDISTINCT)
+		appendStringInfo(&str, "%s%s", str.len > 0 ? ", " : "",
+						 STAT_NDISTINCT_NAME);
+	if (types & STAT_DEPENDENCIES)
+		appendStringInfo(&str, "%s%s", str.len > 0 ? ", " : "",
+						 STAT_DEPENDENCIES_NAME);
+	return str.data;
+}
+
+/*
+ * Is the subset of kinds more preferable? More kinds are better. MCV is the
+ * most useful for estimations, dependencies - the least one.
+ */
+static bool
+better_kinds(int32 a, int32 b)
+{
+	int		na = ((a & STAT_MCV) != 0) + ((a & STAT_NDISTINCT) != 0) +
+				 ((a & STAT_DEPENDENCIES) != 0);
+	int		nb = ((b & STAT_MCV) != 0) + ((b & STAT_NDISTINCT) != 0) +
+				 ((b & STAT_DEPENDENCIES) != 0);
+	int		wa = ((a & STAT_MCV) ? 4 : 0) + ((a & STAT_NDISTINCT) ? 2 : 0) +
+				 ((a & STAT_DEPENDENCIES) ? 1 : 0);
+	int		wb = ((b & STAT_MCV) ? 4 : 0) + ((b & STAT_NDISTINCT) ? 2 : 0) +
+				 ((b & STAT_DEPENDENCIES) ? 1 : 0);
+
+	return (na != nb) ? na > nb : wa > wb;
+}
+
+/*
+ * Fit the new statistics into the table and database budgets. Try cheaper
+ * kinds of statistics on all the columns, then narrow the definition, cutting
+ * off the trailing columns. The exprlst may be truncated and atts_used
+ * corrected then. Return the set of kinds, zero if the statistics should be
+ * skipped.
+ */
+int32
+fit_statistics_budget(Relation hrel, List **exprlst, Bitmapset **atts_used,
+					  int32 types)
+{
+	StatCost	table_used = {0., 0.};
+	StatCost	database_used = {0., 0.};
+	int32		variants[7];
+	int			nvariants = 0;
+	int			ncols;
+	int			i;
+	int			j;
+
+	if (table_analyze_budget < 0 && table_storage_budget < 0 &&
+		database_analyze_budget < 0 && database_storage_budget < 0)
+		return types;
+
+	relation_statistics_cost(hrel, &table_used);
+	if (database_analyze_budget >= 0 || database_storage_budget >= 0)
+		database_statistics_cost(&database_used);
+
+	/* Non-empty subsets of the kinds, in order of preference */
+	for (i = 1; i <= (STAT_NDISTINCT | STAT_MCV | STAT_DEPENDENCIES); i++)
+	{
+		if ((i & ~types) != 0)
+			continue;
+
+		for (j = nvariants; j > 0 && better_kinds(i, variants[j - 1]); j--)
+			variants[j] = variants[j - 1];
+		variants[j] = i;
+		nvariants++;
+	}
+
+	for (ncols = list_length(*exprlst); ncols >= 2; ncols--)
+	{
+		for (i = 0; i < nvariants; i++)
+		{
+			StatCost	cost;
+			ListCell   *lc;
+
+			definition_cost(hrel, *exprlst, ncols, variants[i], &cost);
+			if (!fits_budget(&table_used, &cost, table_analyze_budget,
+							 table_storage_budget) ||
+				!fits_budget(&database_used, &cost, database_analyze_budget,
+							 database_storage_budget))
+				continue;
+
+			if (ncols == list_length(*exprlst) && variants[i] == types)
+				/* Fits as is */
+				return types;
+
+			/* Cut off the trailing columns */
+			for_each_from(lc, *exprlst, ncols)
+			{
+				StatsElem  *selem = (StatsElem *) lfirst(lc);
+
+				if (selem->expr == NULL)
+					*atts_used = bms_del_member(*atts_used,
+											get_attnum(RelationGetRelid(hrel),
+													   selem->name));
+			}
+			*exprlst = list_truncate(list_copy(*exprlst), ncols);
+
+			ereport(NOTICE,
+					(errmsg("extended statistics on \"%s\" don't fit the budget",
+							RelationGetRelationName(hrel)),
+					 errdetail("Created on %d columns of kinds \"%s\".",
+							   ncols, stattypes_string(variants[i]))));
+			return variants[i];
+		}
+	}
+
+	ereport(NOTICE,
+			(errmsg("extended statistics on \"%s\" don't fit the budget",
+					RelationGetRelationName(hrel)),
+			 errdetail("Skipped.")));
+	return 0;
+}
+
+void
+statcost_init(void)
+{
+	DefineCustomRealVariable(MODULE_NAME".storage_cost_weight",
+							 "Price of a kilobyte of statistics data in milliseconds of ANALYZE",
+							 NULL,
+							 &storage_cost_weight,
+							 1.0,
+							 0.0,
+							 1e10,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomIntVariable(MODULE_NAME".table_analyze_budget",
+							"Maximum estimated ANALYZE time of extended statistics on a table",
+							"Value -1 means no limit",
+							&table_analyze_budget,
+							-1,
+							-1,
+							INT_MAX,
+							PGC_SUSET,
+							GUC_UNIT_MS,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable(MODULE_NAME".table_storage_budget",
+							"Maximum estimated size of extended statistics data on a table",
+							"Value -1 means no limit",
+							&table_storage_budget,
+							-1,
+							-1,
+							INT_MAX,
+							PGC_SUSET,
+							GUC_UNIT_KB,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable(MODULE_NAME".database_analyze_budget",
+							"Maximum estimated ANALYZE time of extended statistics in the database",
+							"Value -1 means no limit",
+							&database_analyze_budget,
+							-1,
+							-1,
+							INT_MAX,
+							PGC_SUSET,
+							GUC_UNIT_MS,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable(MODULE_NAME".database_storage_budget",
+							"Maximum estimated size of extended statistics data in the database",
+							"Value -1 means no limit",
+							&database_storage_budget,
+							-1,
+							-1,
+							INT_MAX,
+							PGC_SUSET,
+							GUC_UNIT_KB,
+							NULL,
+							NULL,
+							NULL);
+}
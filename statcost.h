@@ -0,0 +1,27 @@
+#ifndef _STATCOST_H_
+#define _STATCOST_H_
+
+#include "postgres.h"
+
+#include "nodes/bitmapset.h"
+#include "nodes/pg_list.h"
+#include "utils/relcache.h"
+
+/*
+ * Estimated price of extended statistics: extra work of ANALYZE and size of
+ * the pg_statistic_ext_data entry.
+ */
+typedef struct StatCost
+{
+	double		analyze_ms;
+	double		bytes;
+} StatCost;
+
+extern void statcost_init(void);
+extern void estimate_statistics_cost(Relation rel, Bitmapset *columns,
+									 List *exprs, int32 types, StatCost *cost);
+extern double statistics_cost_value(const StatCost *cost);
+extern int32 fit_statistics_budget(Relation hrel, List **exprlst,
+								   Bitmapset **atts_used, int32 types);
+
+#endif /* _STATCOST_H_ */
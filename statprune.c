@@ -0,0 +1,286 @@
+/*-------------------------------------------------------------------------
+ *
+ * statprune.c
+ *		Per-query pruning of extended statistics of a relation.
+ *
+ * Automatic generation leaves dozens of extended statistics on a table with
+ * many indexes. The planner considers all of them each time it estimates a
+ * list of clauses or a number of groups, and deserialises the dependencies of
+ * each one covering two or more of the clause columns. Most of them can't be
+ * used by a particular query.
+ *
+ * Right after the planner has built the list of statistics of a base relation,
+ * we remove from it:
+ * - statistics on columns, with less than two of them referenced by clauses
+ *   or grouping (including DISTINCT, window partitions and sorting) of the
+ *   query: nothing may be estimated by them;
+ * - statistics, dominated by another one of the same kind: the columns, used
+ *   by the query, are a subset of the other's ones. The planner prefers the
+ *   statistics covering more columns anyway, and the data of the wider one
+ *   includes everything the narrower one has (dependencies and ndistinct are
+ *   built for all the combinations of columns). For the same used columns the
+ *   statistics with fewer columns wins, as choose_best_statistics() does.
+ * Statistics on expressions are always kept.
+ *
+ * Copyright (c) 2023-2025 Andrei Lepikhov
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ * IDENTIFICATION
+ *	  contrib/pg_index_stats/statprune.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "nodes/nodeFuncs.h"
+#include "nodes/pathnodes.h"
+#include "optimizer/plancat.h"
+#include "portability/instr_time.h"
+#include "utils/guc.h"
+
+#include "pg_index_stats.h"
+#include "statprune.h"
+
+static bool prune_statistics = false;
+
+static get_relation_info_hook_type prev_get_relation_info_hook = NULL;
+
+typedef struct QueryAttnumsContext
+{
+	Index		varno;
+	Bitmapset  *attnums;
+} QueryAttnumsContext;
+
+/*
+ * Collect columns of the relation, referenced by the expression on the current
+ * query level. Subqueries are planned separately, their references to the
+ * relation are parameters here.
+ */
+static bool
+query_attnums_walker(Node *node, void *context)
+{
+	QueryAttnumsContext *cxt = (QueryAttnumsContext *) context;
+
+	if (node == NULL)
+		return false;
+
+	if (IsA(node, Var))
+	{
+		Var	   *var = (Var *) node;
+
+		if (var->varno == cxt->varno && var->varlevelsup == 0 &&
+			AttrNumberIsForUserDefinedAttr(var->varattno))
+			cxt->attnums = bms_add_member(cxt->attnums, var->varattno);
+		return false;
+	}
+
+	if (IsA(node, Query))
+		return false;
+
+	return expression_tree_walker(node, query_attnums_walker, context);
+}
+
+/*
+ * Columns of the relation, referenced by clauses or grouping (including
+ * DISTINCT, window partitions and sorting) of the query. Plain outputs of the
+ * query are never estimated.
+ *
+ * A child of an append relation is referenced through its parent, so the
+ * columns of the parent are translated.
+ */
+Bitmapset *
+query_relation_attnums(PlannerInfo *root, Index varno)
+{
+	QueryAttnumsContext	cxt = {varno, NULL};
+	ListCell		   *lc;
+
+	if (root->append_rel_array != NULL &&
+		root->append_rel_array[varno] != NULL)
+	{
+		AppendRelInfo  *appinfo = root->append_rel_array[varno];
+		Bitmapset	   *parent_attnums;
+		int				attnum = -1;
+
+		parent_attnums = query_relation_attnums(root, appinfo->parent_relid);
+		while ((attnum = bms_next_member(parent_attnums, attnum)) >= 0)
+		{
+			Var	   *var;
+
+			if (attnum > list_length(appinfo->translated_vars))
+				continue;
+			var = (Var *) list_nth(appinfo->translated_vars, attnum - 1);
+			if (var != NULL && IsA(var, Var) &&
+				AttrNumberIsForUserDefinedAttr(var->varattno))
+				cxt.attnums = bms_add_member(cxt.attnums, var->varattno);
+		}
+		return cxt.attnums;
+	}
+
+	(void) query_attnums_walker((Node *) root->parse->jointree, (void *) &cxt);
+	(void) query_attnums_walker(root->parse->havingQual, (void *) &cxt);
+	foreach(lc, root->parse->targetList)
+	{
+		TargetEntry *tle = (TargetEntry *) lfirst(lc);
+
+		if (tle->ressortgroupref > 0)
+			(void) query_attnums_walker((Node *) tle->expr, (void *) &cxt);
+	}
+
+	return cxt.attnums;
+}
+
+/*
+ * Does statistics a make statistics b useless for the query?
+ * Both are of the same kind and have at least two used columns.
+ */
+static bool
+statistics_dominates(StatisticExtInfo *a, Bitmapset *used_a, int pos_a,
+					 StatisticExtInfo *b, Bitmapset *used_b, int pos_b)
+{
+	int		nkeys_a;
+	int		nkeys_b;
+
+	if (a->kind != b->kind)
+		return false;
+#if PG_VERSION_NUM >= 150000
+	if (a->inherit != b->inherit)
+		return false;
+#endif
+
+	if (!bms_is_subset(used_b, used_a))
+		return false;
+	if (!bms_equal(used_a, used_b))
+		return true;
+
+	nkeys_a = bms_num_members(a->keys);
+	nkeys_b = bms_num_members(b->keys);
+	return (nkeys_a < nkeys_b || (nkeys_a == nkeys_b && pos_a < pos_b));
+}
+
+/*
+ * Return the number of pruned statistics
+ */
+static int
+prune_relation_statistics(PlannerInfo *root, RelOptInfo *rel)
+{
+	Bitmapset		   *attnums;
+	int					nstats = list_length(rel->statlist);
+	Bitmapset		  **used;
+	bool			   *keep;
+	List			   *statlist = NIL;
+	ListCell		   *lc;
+	int					npruned = 0;
+	int					i;
+	int					j;
+
+	attnums = query_relation_attnums(root, rel->relid);
+
+	used = (Bitmapset **) palloc0(nstats * sizeof(Bitmapset *));
+	keep = (bool *) palloc(nstats * sizeof(bool));
+
+	i = 0;
+	foreach(lc, rel->statlist)
+	{
+		StatisticExtInfo *info = (StatisticExtInfo *) lfirst(lc);
+
+		used[i] = bms_intersect(info->keys, attnums);
+		keep[i] = (info->exprs != NIL || bms_num_members(used[i]) >= 2);
+		i++;
+	}
+
+	for (i = 0; i < nstats; i++)
+	{
+		StatisticExtInfo *info = list_nth(rel->statlist, i);
+
+		if (!keep[i] || info->exprs != NIL)
+			continue;
+
+		/* Dominance is transitive, so compare with all the usable ones */
+		for (j = 0; j < nstats; j++)
+		{
+			StatisticExtInfo *other = list_nth(rel->statlist, j);
+
+			if (j == i || other->exprs != NIL ||
+				bms_num_members(used[j]) < 2)
+				continue;
+
+			if (statistics_dominates(other, used[j], j, info, used[i], i))
+			{
+				keep[i] = false;
+				break;
+			}
+		}
+	}
+
+	i = 0;
+	foreach(lc, rel->statlist)
+	{
+		if (keep[i++])
+			statlist = lappend(statlist, lfirst(lc));
+		else
+			npruned++;
+	}
+
+	list_free(rel->statlist);
+	rel->statlist = statlist;
+	pfree(used);
+	pfree(keep);
+	return npruned;
+}
+
+static void
+statprune_get_relation_info(PlannerInfo *root, Oid relationObjectId,
+							bool inhparent, RelOptInfo *rel)
+{
+	instr_time	start;
+	instr_time	duration;
+	int			nstats;
+	int			npruned;
+
+	if (prev_get_relation_info_hook)
+		(*prev_get_relation_info_hook) (root, relationObjectId, inhparent, rel);
+
+	/*
+	 * Children of an append relation are referenced by the query through
+	 * the parent. Don't bother with them.
+	 */
+	if (!prune_statistics || rel->reloptkind != RELOPT_BASEREL ||
+		rel->statlist == NIL)
+		return;
+
+	nstats = list_length(rel->statlist);
+
+	INSTR_TIME_SET_CURRENT(start);
+	npruned = prune_relation_statistics(root, rel);
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+
+	elog(DEBUG1, MODULE_NAME": pruned %d of %d extended statistics of relation %u in %.3f ms",
+		 npruned, nstats, relationObjectId, INSTR_TIME_GET_MILLISEC(duration));
+
+#if PG_VERSION_NUM >= 180000
+	explain_stat_register_pruning(nstats, npruned,
+								  INSTR_TIME_GET_MILLISEC(duration));
+#endif
+}
+
+void
+statprune_init(void)
+{
+	DefineCustomBoolVariable(MODULE_NAME".prune_statistics",
+							 "Remove extended statistics, useless for the query, before its planning",
+							 NULL,
+							 &prune_statistics,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	prev_get_relation_info_hook = get_relation_info_hook;
+	get_relation_info_hook = statprune_get_relation_info;
+}
@@ -0,0 +1,11 @@
+#ifndef _STATPRUNE_H_
+#define _STATPRUNE_H_
+
+#include "postgres.h"
+
+#include "nodes/pathnodes.h"
+
+extern void statprune_init(void);
+extern Bitmapset *query_relation_attnums(PlannerInfo *root, Index varno);
+
+#endif /* _STATPRUNE_H_ */
@@ -0,0 +1,388 @@
+/*-------------------------------------------------------------------------
+ *
+ * statretire.c
+ *		Retirement of index-based statistics, unused by the planner.
+ *
+ * Statistics are generated on each multi-column index, and ANALYZE pays for
+ * them forever, even if no query can use them. Having the usage tracked, the
+ * background worker periodically looks through the index-based statistics of
+ * a database and retires ones the planner couldn't use during the configured
+ * period: either drops them or sets their statistics target to 0, so ANALYZE
+ * skips them. Only statistics, generated by the extension, are touched: they
+ * depend on an index and have the comment set on creation.
+ *
+ * A statistics object, unknown to the usage tracker, starts being watched at
+ * the moment the worker meets it. Hence, recently created statistics and ones
+ * with evicted counters get the whole period to prove their usefulness.
+ *
+ * Copyright (c) 2023-2025 Andrei Lepikhov
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ * IDENTIFICATION
+ *	  contrib/pg_index_stats/statretire.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "catalog/dependency.h"
+#include "catalog/objectaddress.h"
+#include "catalog/pg_statistic_ext.h"
+#include "commands/comment.h"
+#include "commands/dbcommands.h"
+#include "executor/spi.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "storage/lmgr.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/snapmgr.h"
+#include "utils/syscache.h"
+#include "utils/timestamp.h"
+
+#include "pg_index_stats.h"
+#include "rebuild.h"
+#include "statcost.h"
+#include "statretire.h"
+#include "statusage.h"
+
+/* Maximum interval between two checks of the unused statistics, in seconds */
+#define STATRETIRE_CHECK_INTERVAL	(3600)
+
+typedef enum
+{
+	RETIRE_DISABLE,		/* set statistics target to 0 */
+	RETIRE_DROP			/* drop the statistics */
+} RetireMode;
+
+static const struct config_enum_entry retire_mode_options[] = {
+	{"disable", RETIRE_DISABLE, false},
+	{"drop", RETIRE_DROP, false},
+	{NULL, 0, false}
+};
+
+static int retire_unused_after = -1;
+static int retire_mode = RETIRE_DISABLE;
+
+/* The launcher's time of the last check */
+static TimestampTz last_check = 0;
+
+bool
+statretire_enabled(void)
+{
+	return retire_unused_after > 0 && statusage_tracking();
+}
+
+/*
+ * Is it time to look for unused statistics? Called by the launcher: the period
+ * is long, so the check isn't needed at each worker run.
+ */
+bool
+statretire_due(void)
+{
+	TimestampTz	now;
+	int			interval;
+
+	if (!statretire_enabled())
+		return false;
+
+	now = GetCurrentTimestamp();
+	interval = Min(retire_unused_after,
+				   STATRETIRE_CHECK_INTERVAL / SECS_PER_MINUTE) * SECS_PER_MINUTE;
+	if (last_check != 0 &&
+		!TimestampDifferenceExceeds(last_check, now, interval * 1000))
+		return false;
+
+	last_check = now;
+	return true;
+}
+
+/*
+ * Statistics target of the statistics. Since PG17 it is NULL by default.
+ */
+static int
+statistics_target(HeapTuple htup)
+{
+#if PG_VERSION_NUM >= 170000
+	Datum	datum;
+	bool	isnull;
+
+	datum = SysCacheGetAttr(STATEXTOID, htup,
+							Anum_pg_statistic_ext_stxstattarget, &isnull);
+	return isnull ? -1 : DatumGetInt16(datum);
+#else
+	return ((Form_pg_statistic_ext) GETSTRUCT(htup))->stxstattarget;
+#endif
+}
+
+/*
+ * Is the statistics skipped by ANALYZE, having the statistics target 0? Such
+ * are retired statistics, and the user may set the target as well.
+ */
+bool
+statistics_retired(Oid statoid)
+{
+	HeapTuple	htup;
+	bool		result;
+
+	htup = SearchSysCache1(STATEXTOID, ObjectIdGetDatum(statoid));
+	if (!HeapTupleIsValid(htup))
+		return false;
+
+	result = (statistics_target(htup) == 0);
+	ReleaseSysCache(htup);
+	return result;
+}
+
+/*
+ * Is the statistics generated by the extension on an index and still
+ * analysed?
+ */
+static bool
+retirement_candidate(Oid statoid, char **qualname)
+{
+	HeapTuple				htup;
+	Form_pg_statistic_ext	stat;
+	char				   *comment;
+	bool					result;
+
+	if (!is_index_based_statistics(statoid))
+		return false;
+
+	/* A user might take the statistics over, changing the comment */
+	comment = GetComment(statoid, StatisticExtRelationId, 0);
+	if (comment == NULL || strcmp(comment, STAT_COMMENT_INDEX) != 0)
+		return false;
+
+	htup = SearchSysCache1(STATEXTOID, ObjectIdGetDatum(statoid));
+	if (!HeapTupleIsValid(htup))
+		return false;
+
+	stat = (Form_pg_statistic_ext) GETSTRUCT(htup);
+	result = (statistics_target(htup) != 0);
+	if (result)
+		*qualname = quote_qualified_identifier(
+									get_namespace_name(stat->stxnamespace),
+									NameStr(stat->stxname));
+	ReleaseSysCache(htup);
+
+	return result;
+}
+
+static void
+retire_statistics(Oid statoid, const char *qualname)
+{
+	if (retire_mode == RETIRE_DROP)
+	{
+		ObjectAddress	object;
+
+		ObjectAddressSet(object, StatisticExtRelationId, statoid);
+		performDeletion(&object, DROP_RESTRICT, PERFORM_DELETION_INTERNAL);
+	}
+	else
+	{
+		StringInfoData	query;
+
+		initStringInfo(&query);
+		appendStringInfo(&query, "ALTER STATISTICS %s SET STATISTICS 0",
+						 qualname);
+
+		SPI_connect();
+		if (SPI_execute(query.data, false, 0) != SPI_OK_UTILITY)
+			elog(ERROR, "SPI_execute failed: %s", query.data);
+		SPI_finish();
+		pfree(query.data);
+	}
+	CommandCounterIncrement();
+}
+
+/*
+ * Retire unused statistics of the relation.
+ * Caller should provide a transaction.
+ */
+static int
+retire_relation_statistics(Oid relid, TimestampTz threshold,
+						   double *reclaimed_ms)
+{
+	Relation	hrel;
+	List	   *autostats;
+	ListCell   *lc;
+	int			nretired = 0;
+
+	/* The same lock as DROP and ALTER STATISTICS take. Don't wait. */
+	if (!ConditionalLockRelationOid(relid, ShareUpdateExclusiveLock))
+		return 0;
+
+	hrel = try_relation_open(relid, NoLock);
+	if (hrel == NULL)
+		return 0;
+
+	autostats = fetch_index_based_statistics(relid, NULL);
+	foreach(lc, autostats)
+	{
+		StatExtEntry   *entry = (StatExtEntry *) lfirst(lc);
+		TimestampTz		last_used;
+		StatCost		cost;
+		char		   *qualname;
+
+		if (!retirement_candidate(entry->oid, &qualname))
+			continue;
+
+		last_used = statusage_stat_watch(MyDatabaseId, relid, entry->oid);
+		if (last_used >= threshold)
+			continue;
+
+		/* Estimate before the definition has gone */
+		estimate_statistics_cost(hrel, entry->columns, entry->exprs,
+								 entry->types, &cost);
+		retire_statistics(entry->oid, qualname);
+
+		ereport(LOG,
+				(errmsg(MODULE_NAME" worker: %s unused statistics %s on relation \"%s\"",
+						retire_mode == RETIRE_DROP ? "dropped" : "disabled",
+						qualname, RelationGetRelationName(hrel)),
+				 errdetail("Not used by the planner since %s, ANALYZE time reclaimed: %.1f ms.",
+						   timestamptz_to_str(last_used),
+						   cost.analyze_ms)));
+
+		*reclaimed_ms += cost.analyze_ms;
+		nretired++;
+	}
+
+	relation_close(hrel, NoLock);
+	return nretired;
+}
+
+/*
+ * Retire statistics on the relation in a separate transaction. An error is
+ * reported, but doesn't stop the worker.
+ */
+static int
+retire_relation_isolated(Oid relid, TimestampTz threshold,
+						 double *reclaimed_ms)
+{
+	MemoryContext	oldctx = CurrentMemoryContext;
+	volatile int	nretired = 0;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	PG_TRY();
+	{
+		nretired = retire_relation_statistics(relid, threshold, reclaimed_ms);
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+	}
+	PG_CATCH();
+	{
+		ErrorData  *edata;
+
+		MemoryContextSwitchTo(oldctx);
+		edata = CopyErrorData();
+		FlushErrorState();
+		AbortCurrentTransaction();
+
+		ereport(LOG,
+				(errmsg(MODULE_NAME" worker: could not retire statistics on relation %u",
+						relid),
+				 errdetail("%s", edata->message)));
+		FreeErrorData(edata);
+		nretired = 0;
+	}
+	PG_END_TRY();
+
+	MemoryContextSwitchTo(oldctx);
+	return nretired;
+}
+
+/*
+ * Retire statistics of the current database, unused for the configured
+ * period. Called by the worker outside of a transaction.
+ */
+void
+statretire_run(void)
+{
+	MemoryContext	oldctx = CurrentMemoryContext;
+	TimestampTz		threshold;
+	List		   *relids = NIL;
+	List		   *targets;
+	ListCell	   *lc;
+	char		   *dbname;
+	int				nretired = 0;
+	double			reclaimed_ms = 0.;
+
+	if (!statretire_enabled())
+		return;
+
+	threshold = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+						-(int64) retire_unused_after * SECS_PER_MINUTE * 1000);
+
+	/* Nothing can be said until the usage has been tracked for the period */
+	if (statusage_tracked_since() > threshold)
+		return;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	targets = collect_rebuild_targets(InvalidOid, InvalidOid);
+	MemoryContextSwitchTo(oldctx);
+	dbname = get_database_name(MyDatabaseId);
+	foreach(lc, targets)
+		relids = lappend_oid(relids, ((RebuildTarget *) lfirst(lc))->relid);
+
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	MemoryContextSwitchTo(oldctx);
+
+	foreach(lc, relids)
+	{
+		CHECK_FOR_INTERRUPTS();
+		nretired += retire_relation_isolated(lfirst_oid(lc), threshold,
+											 &reclaimed_ms);
+	}
+
+	if (nretired > 0)
+		elog(LOG, MODULE_NAME" worker: retired %d statistics in database \"%s\", ANALYZE time reclaimed: %.1f ms",
+			 nretired, dbname, reclaimed_ms);
+
+	list_free(relids);
+}
+
+void
+statretire_init(void)
+{
+	DefineCustomIntVariable(MODULE_NAME".retire_unused_after",
+							"Retire index-based statistics, unused by the planner for this period",
+							"-1 disables retirement",
+							&retire_unused_after,
+							-1,
+							-1,
+							INT_MAX,
+							PGC_SIGHUP,
+							GUC_UNIT_MIN,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomEnumVariable(MODULE_NAME".retire_mode",
+							 "How unused statistics are retired",
+							 "disable sets the statistics target to 0, drop removes the statistics",
+							 &retire_mode,
+							 RETIRE_DISABLE,
+							 retire_mode_options,
+							 PGC_SIGHUP,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+}
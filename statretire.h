@@ -0,0 +1,12 @@
+#ifndef _STATRETIRE_H_
+#define _STATRETIRE_H_
+
+#include "postgres.h"
+
+extern void statretire_init(void);
+extern bool statretire_enabled(void);
+extern bool statretire_due(void);
+extern void statretire_run(void);
+extern bool statistics_retired(Oid statoid);
+
+#endif /* _STATRETIRE_H_ */
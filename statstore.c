@@ -0,0 +1,841 @@
+/*-------------------------------------------------------------------------
+ *
+ * statstore.c
+ *		Storage of statistics kinds, managed by the extension.
+ *
+ * The core knows nothing about statistics invented here, so their data is
+ * kept in the pg_index_stats_data table of the extension, a row per index and
+ * kind. Values of the index key columns are stored in the binary form of their
+ * send functions: the types of the columns differ, and, unlike the text form,
+ * the binary one doesn't depend on DateStyle, extra_float_digits and other
+ * settings of the session. Types of the key columns are stored too, to detect
+ * a stale row of a dropped index, which OID has been reused.
+ *
+ * The planner reads the table directly and caches parsed statistics in the
+ * backend memory. Each change of the table invalidates the relcache entry of
+ * the table, which resets the cache in every backend.
+ *
+ * Routines, shared by the statistics kinds, live here as well: checks of the
+ * index to build statistics on, and evaluation of clauses on stored items.
+ *
+ * Copyright (c) 2023-2025 Andrei Lepikhov
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ * IDENTIFICATION
+ *	  contrib/pg_index_stats/statstore.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/genam.h"
+#include "access/htup_details.h"
+#include "access/table.h"
+#include "catalog/index.h"
+#include "catalog/pg_type.h"
+#include "commands/extension.h"
+#include "executor/executor.h"
+#include "executor/spi.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/pathnodes.h"
+#include "optimizer/optimizer.h"
+#include "utils/acl.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/syscache.h"
+#if PG_VERSION_NUM < 160000
+#include "catalog/indexing.h"
+#include "catalog/pg_extension.h"
+#endif
+
+#include "pg_index_stats.h"
+#include "rebuild.h"
+#include "statstore.h"
+
+PG_FUNCTION_INFO_V1(pg_index_stats_data_remove);
+
+/* Columns of the pg_index_stats_data table */
+#define Natts_statstore				7
+#define Anum_statstore_indexrelid	1
+#define Anum_statstore_kind			2
+#define Anum_statstore_keytypes		3
+#define Anum_statstore_nullfrac		4
+#define Anum_statstore_ndistinct	5
+#define Anum_statstore_stavalues	6
+#define Anum_statstore_stanumbers	7
+
+typedef struct StatStoreKey
+{
+	Oid			indexrelid;
+	char		kind;
+} StatStoreKey;
+
+typedef struct CompatibleClauseContext
+{
+	Index		varno;
+	Bitmapset  *allowed;		/* columns, having values in the items */
+	Bitmapset  *attnums;		/* columns, referenced by the clause */
+} CompatibleClauseContext;
+
+typedef struct StatStoreEntry
+{
+	StatStoreKey	key;
+	StoredStat	   *stat;		/* NULL, if there is no statistics */
+} StatStoreEntry;
+
+static MemoryContext statstore_ctx = NULL;
+static HTAB *statstore_htab = NULL;
+
+/* The table, the cache was loaded from */
+static Oid statstore_relid = InvalidOid;
+
+static void
+statstore_relcache_callback(Datum arg, Oid relid)
+{
+	if (statstore_htab == NULL)
+		return;
+
+	/*
+	 * Until the table is known, statistics can't be stored without our
+	 * notice, but the extension may be created.
+	 */
+	if (OidIsValid(relid) && OidIsValid(statstore_relid) &&
+		relid != statstore_relid)
+		return;
+
+	statstore_htab = NULL;
+	statstore_relid = InvalidOid;
+	MemoryContextReset(statstore_ctx);
+}
+
+#if PG_VERSION_NUM < 160000
+static Oid
+get_extension_schema(Oid ext_oid)
+{
+	Relation	rel;
+	SysScanDesc	scan;
+	HeapTuple	tuple;
+	ScanKeyData	key;
+	Oid			result = InvalidOid;
+
+	rel = table_open(ExtensionRelationId, AccessShareLock);
+	ScanKeyInit(&key,
+				Anum_pg_extension_oid,
+				BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(ext_oid));
+	scan = systable_beginscan(rel, ExtensionOidIndexId, true, NULL, 1, &key);
+	tuple = systable_getnext(scan);
+	if (HeapTupleIsValid(tuple))
+		result = ((Form_pg_extension) GETSTRUCT(tuple))->extnamespace;
+	systable_endscan(scan);
+	table_close(rel, AccessShareLock);
+
+	return result;
+}
+#endif
+
+/*
+ * The table of the extension. The extension is relocatable, so look into its
+ * current schema. Return InvalidOid, if the extension isn't installed.
+ */
+static Oid
+statstore_table(void)
+{
+	Oid		extoid = get_extension_oid(MODULE_NAME, true);
+
+	if (!OidIsValid(extoid))
+		return InvalidOid;
+
+	return get_relname_relid(STATSTORE_TABLE, get_extension_schema(extoid));
+}
+
+/*
+ * Parse the row of the table. Return NULL, if the index has been altered.
+ */
+static StoredStat *
+statstore_parse(Oid indexrelid, char kind, Datum *values, bool *nulls)
+{
+	StoredStat *stat;
+	ArrayType  *arr;
+	Datum	   *elems;
+	int			nelems;
+	int			i;
+	int			j;
+
+	stat = (StoredStat *) palloc0(sizeof(StoredStat));
+	stat->indexrelid = indexrelid;
+	stat->kind = kind;
+	stat->nullfrac = DatumGetFloat4(values[Anum_statstore_nullfrac - 1]);
+	stat->ndistinct = DatumGetFloat8(values[Anum_statstore_ndistinct - 1]);
+
+	arr = DatumGetArrayTypeP(values[Anum_statstore_keytypes - 1]);
+	deconstruct_array(arr, OIDOID, sizeof(Oid), true, TYPALIGN_INT,
+					  &elems, NULL, &nelems);
+	stat->ndims = nelems;
+	stat->typids = (Oid *) palloc(nelems * sizeof(Oid));
+	for (j = 0; j < nelems; j++)
+	{
+		stat->typids[j] = DatumGetObjectId(elems[j]);
+		if (get_atttype(indexrelid, j + 1) != stat->typids[j])
+			return NULL;
+	}
+
+	if (!nulls[Anum_statstore_stavalues - 1])
+	{
+		arr = DatumGetArrayTypeP(values[Anum_statstore_stavalues - 1]);
+		if (ARR_NDIM(arr) != 2 || ARR_DIMS(arr)[1] != stat->ndims)
+			return NULL;
+
+		deconstruct_array(arr, BYTEAOID, -1, false, TYPALIGN_INT,
+						  &elems, NULL, &nelems);
+		stat->nvalues = ARR_DIMS(arr)[0];
+		stat->values = (Datum *) palloc(nelems * sizeof(Datum));
+		for (j = 0; j < stat->ndims; j++)
+		{
+			Oid		typreceive;
+			Oid		typioparam;
+
+			getTypeBinaryInputInfo(stat->typids[j], &typreceive, &typioparam);
+			for (i = 0; i < stat->nvalues; i++)
+			{
+				int				n = i * stat->ndims + j;
+				bytea		   *data = DatumGetByteaPP(elems[n]);
+				StringInfoData	buf;
+
+				/* Receive functions expect the trailing null */
+				initStringInfo(&buf);
+				appendBinaryStringInfo(&buf, VARDATA_ANY(data),
+									   VARSIZE_ANY_EXHDR(data));
+				stat->values[n] = OidReceiveFunctionCall(typreceive, &buf,
+														 typioparam, -1);
+				if (buf.cursor != buf.len)
+					ereport(ERROR,
+							(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+							 errmsg("incorrect binary data format in \"%s\"",
+									STATSTORE_TABLE)));
+				pfree(buf.data);
+			}
+		}
+	}
+
+	if (!nulls[Anum_statstore_stanumbers - 1])
+	{
+		arr = DatumGetArrayTypeP(values[Anum_statstore_stanumbers - 1]);
+		deconstruct_array(arr, FLOAT8OID, sizeof(float8), FLOAT8PASSBYVAL,
+						  TYPALIGN_DOUBLE, &elems, NULL, &nelems);
+		stat->nnumbers = nelems;
+		stat->numbers = (double *) palloc(Max(nelems, 1) * sizeof(double));
+		for (i = 0; i < nelems; i++)
+			stat->numbers[i] = DatumGetFloat8(elems[i]);
+	}
+
+	return stat;
+}
+
+static StoredStat *
+statstore_load(Oid relid, Oid indexrelid, char kind)
+{
+	Relation	rel;
+	SysScanDesc	scan;
+	HeapTuple	tuple;
+	ScanKeyData	key[2];
+	StoredStat *stat = NULL;
+
+	rel = table_open(relid, AccessShareLock);
+	ScanKeyInit(&key[0],
+				Anum_statstore_indexrelid,
+				BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(indexrelid));
+	ScanKeyInit(&key[1],
+				Anum_statstore_kind,
+				BTEqualStrategyNumber, F_CHAREQ,
+				CharGetDatum(kind));
+
+	/* The table is small, each index has a row per kind */
+	scan = systable_beginscan(rel, InvalidOid, false, NULL, 2, key);
+	tuple = systable_getnext(scan);
+	if (HeapTupleIsValid(tuple) &&
+		RelationGetDescr(rel)->natts == Natts_statstore)
+	{
+		Datum	values[Natts_statstore];
+		bool	nulls[Natts_statstore];
+
+		heap_deform_tuple(tuple, RelationGetDescr(rel), values, nulls);
+		stat = statstore_parse(indexrelid, kind, values, nulls);
+	}
+	systable_endscan(scan);
+	table_close(rel, AccessShareLock);
+
+	return stat;
+}
+
+/*
+ * Get statistics of the kind on the index. Return NULL, if there is no one.
+ *
+ * Invalidation messages, processed while the table is opened, may reset the
+ * cache. So, the statistics are loaded into their own memory context, which
+ * is attached to the cache afterwards.
+ */
+StoredStat *
+statstore_fetch(Oid indexrelid, char kind)
+{
+	StatStoreKey	key;
+	StatStoreEntry *entry;
+	StoredStat	   *stat = NULL;
+	MemoryContext	loadctx = NULL;
+	Oid				relid;
+
+	memset(&key, 0, sizeof(StatStoreKey));
+	key.indexrelid = indexrelid;
+	key.kind = kind;
+
+	if (statstore_htab != NULL)
+	{
+		entry = (StatStoreEntry *) hash_search(statstore_htab, &key,
+											   HASH_FIND, NULL);
+		if (entry != NULL)
+			return entry->stat;
+	}
+
+	relid = statstore_table();
+	if (OidIsValid(relid))
+	{
+		MemoryContext	oldctx;
+
+		loadctx = AllocSetContextCreate(TopMemoryContext,
+										MODULE_NAME" - stored statistics entry",
+										ALLOCSET_SMALL_SIZES);
+		oldctx = MemoryContextSwitchTo(loadctx);
+		PG_TRY();
+		{
+			stat = statstore_load(relid, indexrelid, kind);
+		}
+		PG_CATCH();
+		{
+			MemoryContextSwitchTo(oldctx);
+			MemoryContextDelete(loadctx);
+			PG_RE_THROW();
+		}
+		PG_END_TRY();
+		MemoryContextSwitchTo(oldctx);
+	}
+
+	if (statstore_htab == NULL)
+	{
+		HASHCTL		info;
+
+		memset(&info, 0, sizeof(info));
+		info.keysize = sizeof(StatStoreKey);
+		info.entrysize = sizeof(StatStoreEntry);
+		info.hcxt = statstore_ctx;
+		statstore_htab = hash_create(MODULE_NAME" stored statistics", 64,
+									 &info,
+									 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+	statstore_relid = relid;
+
+	if (stat != NULL)
+		MemoryContextSetParent(loadctx, statstore_ctx);
+	else if (loadctx != NULL)
+		MemoryContextDelete(loadctx);
+
+	entry = (StatStoreEntry *) hash_search(statstore_htab, &key, HASH_ENTER,
+										   NULL);
+	entry->stat = stat;
+	return stat;
+}
+
+/*
+ * Replace the statistics of the kind on the index. Changes of the table are
+ * made on behalf of its owner: users, allowed to build statistics on their
+ * tables, aren't granted to change the table directly.
+ */
+void
+statstore_save(StoredStat *stat)
+{
+	Oid			relid = statstore_table();
+	Oid			argtypes[Natts_statstore] = {OIDOID, CHAROID, OIDARRAYOID,
+											 FLOAT4OID, FLOAT8OID,
+											 BYTEAARRAYOID, FLOAT8ARRAYOID};
+	Datum		values[Natts_statstore];
+	char		nulls[Natts_statstore];
+	Datum	   *elems;
+	Relation	rel;
+	char	   *qualname;
+	char	   *query;
+	Oid			save_userid;
+	int			save_sec_context;
+	int			i;
+	int			j;
+
+	if (!OidIsValid(relid))
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("extension \"%s\" is not installed", MODULE_NAME)));
+
+	memset(nulls, ' ', sizeof(nulls));
+	values[0] = ObjectIdGetDatum(stat->indexrelid);
+	values[1] = CharGetDatum(stat->kind);
+	values[3] = Float4GetDatum(stat->nullfrac);
+	values[4] = Float8GetDatum(stat->ndistinct);
+
+	elems = (Datum *) palloc(Max(stat->nvalues, 1) * stat->ndims *
+							 sizeof(Datum));
+	for (j = 0; j < stat->ndims; j++)
+		elems[j] = ObjectIdGetDatum(stat->typids[j]);
+	values[2] = PointerGetDatum(construct_array(elems, stat->ndims, OIDOID,
+												sizeof(Oid), true,
+												TYPALIGN_INT));
+
+	if (stat->nvalues > 0)
+	{
+		int		dims[2] = {stat->nvalues, stat->ndims};
+		int		lbs[2] = {1, 1};
+
+		for (j = 0; j < stat->ndims; j++)
+		{
+			Oid		typsend;
+			bool	typisvarlena;
+
+			getTypeBinaryOutputInfo(stat->typids[j], &typsend, &typisvarlena);
+			for (i = 0; i < stat->nvalues; i++)
+			{
+				int		n = i * stat->ndims + j;
+
+				elems[n] = PointerGetDatum(OidSendFunctionCall(typsend,
+														stat->values[n]));
+			}
+		}
+		values[5] = PointerGetDatum(construct_md_array(elems, NULL, 2, dims,
+													   lbs, BYTEAOID, -1,
+													   false, TYPALIGN_INT));
+	}
+	else
+		nulls[5] = 'n';
+
+	if (stat->nnumbers > 0)
+	{
+		Datum  *numbers = (Datum *) palloc(stat->nnumbers * sizeof(Datum));
+
+		for (i = 0; i < stat->nnumbers; i++)
+			numbers[i] = Float8GetDatum(stat->numbers[i]);
+		values[6] = PointerGetDatum(construct_array(numbers, stat->nnumbers,
+													FLOAT8OID, sizeof(float8),
+													FLOAT8PASSBYVAL,
+													TYPALIGN_DOUBLE));
+	}
+	else
+		nulls[6] = 'n';
+
+	rel = table_open(relid, RowExclusiveLock);
+	qualname = quote_qualified_identifier(
+						get_namespace_name(RelationGetNamespace(rel)),
+						RelationGetRelationName(rel));
+
+	GetUserIdAndSecContext(&save_userid, &save_sec_context);
+	SetUserIdAndSecContext(rel->rd_rel->relowner,
+						   save_sec_context | SECURITY_LOCAL_USERID_CHANGE);
+
+	SPI_connect();
+	query = psprintf("DELETE FROM %s WHERE indexrelid = $1 AND kind = $2",
+					 qualname);
+	if (SPI_execute_with_args(query, 2, argtypes, values, nulls, false,
+							  0) != SPI_OK_DELETE)
+		elog(ERROR, "SPI_execute_with_args failed: %s", query);
+	query = psprintf("INSERT INTO %s VALUES ($1, $2, $3, $4, $5, $6, $7)",
+					 qualname);
+	if (SPI_execute_with_args(query, Natts_statstore, argtypes, values, nulls,
+							  false, 0) != SPI_OK_INSERT)
+		elog(ERROR, "SPI_execute_with_args failed: %s", query);
+	SPI_finish();
+
+	SetUserIdAndSecContext(save_userid, save_sec_context);
+	table_close(rel, NoLock);
+
+	/* Let the planners see the new statistics */
+	CacheInvalidateRelcacheByRelid(relid);
+}
+
+/*
+ * Delete rows of the table, satisfying the condition with an optional
+ * parameter. Return the number of removed rows.
+ */
+static uint64
+statstore_delete(Oid relid, const char *cond, Oid argtype, Datum arg)
+{
+	Relation	rel;
+	char	   *query;
+	Oid			save_userid;
+	int			save_sec_context;
+	uint64		nremoved;
+
+	rel = table_open(relid, RowExclusiveLock);
+	query = psprintf("DELETE FROM %s d WHERE %s",
+					 quote_qualified_identifier(
+						get_namespace_name(RelationGetNamespace(rel)),
+						RelationGetRelationName(rel)),
+					 cond);
+
+	GetUserIdAndSecContext(&save_userid, &save_sec_context);
+	SetUserIdAndSecContext(rel->rd_rel->relowner,
+						   save_sec_context | SECURITY_LOCAL_USERID_CHANGE);
+
+	SPI_connect();
+	if (SPI_execute_with_args(query, OidIsValid(argtype) ? 1 : 0, &argtype,
+							  &arg, NULL, false, 0) != SPI_OK_DELETE)
+		elog(ERROR, "SPI_execute_with_args failed: %s", query);
+	nremoved = SPI_processed;
+	SPI_finish();
+
+	SetUserIdAndSecContext(save_userid, save_sec_context);
+	table_close(rel, NoLock);
+
+	if (nremoved > 0)
+		CacheInvalidateRelcacheByRelid(relid);
+
+	return nremoved;
+}
+
+/*
+ * Remove statistics of all kinds on the index. Without an index, remove
+ * statistics of dropped indexes.
+ * Return the number of removed rows.
+ */
+Datum
+pg_index_stats_data_remove(PG_FUNCTION_ARGS)
+{
+	Oid			relid = statstore_table();
+	uint64		nremoved;
+
+	if (!OidIsValid(relid))
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("extension \"%s\" is not installed", MODULE_NAME)));
+
+	if (!PG_ARGISNULL(0))
+	{
+		Oid		indexrelid = PG_GETARG_OID(0);
+		Oid		heaprelid = IndexGetRelation(indexrelid, true);
+
+		if (!OidIsValid(heaprelid))
+			ereport(ERROR,
+					(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+					 errmsg("\"%s\" is not an index", get_rel_name(indexrelid))));
+
+		/* The same permission, as for building */
+		(void) rebuild_permitted(heaprelid, true);
+
+		nremoved = statstore_delete(relid, "indexrelid = $1", OIDOID,
+									ObjectIdGetDatum(indexrelid));
+	}
+	else
+		nremoved = statstore_delete(relid,
+							"NOT EXISTS (SELECT 1 FROM pg_catalog.pg_class c "
+							"WHERE c.oid = d.indexrelid)",
+							InvalidOid, (Datum) 0);
+
+	PG_RETURN_INT32((int32) nremoved);
+}
+
+/*
+ * Remove statistics of the dropped indexes. Called after the utility command,
+ * so an index, which still exists, hasn't been dropped actually.
+ */
+void
+statstore_forget(List *indexes)
+{
+	Oid			relid = statstore_table();
+	Datum	   *elems;
+	int			nelems = 0;
+	ListCell   *lc;
+
+	if (!OidIsValid(relid))
+		return;
+
+	elems = (Datum *) palloc(list_length(indexes) * sizeof(Datum));
+	foreach(lc, indexes)
+	{
+		Oid		indexrelid = lfirst_oid(lc);
+
+		if (!SearchSysCacheExists1(RELOID, ObjectIdGetDatum(indexrelid)))
+			elems[nelems++] = ObjectIdGetDatum(indexrelid);
+	}
+
+	if (nelems > 0)
+		(void) statstore_delete(relid, "indexrelid = ANY ($1)", OIDARRAYOID,
+								PointerGetDatum(construct_array(elems, nelems,
+																OIDOID,
+																sizeof(Oid),
+																true,
+																TYPALIGN_INT)));
+	pfree(elems);
+}
+
+/*
+ * Open the index and its table to build statistics of the kind on the key
+ * columns of the index. The key columns have to be plain columns of the table,
+ * so the clauses on the table could be evaluated on stored keys. Checks,
+ * specific to the kind, are left to the caller.
+ */
+Relation
+statstore_open_index(Oid indexrelid, const char *kindname, Relation *hrel)
+{
+	Oid			heaprelid = IndexGetRelation(indexrelid, true);
+	Relation	irel;
+	int			j;
+
+	if (!OidIsValid(heaprelid))
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("\"%s\" is not an index", get_rel_name(indexrelid))));
+
+	(void) rebuild_permitted(heaprelid, true);
+
+	/* The same lock as ANALYZE takes */
+	*hrel = table_open(heaprelid, ShareUpdateExclusiveLock);
+	irel = index_open(indexrelid, AccessShareLock);
+
+	if ((*hrel)->rd_rel->relkind != RELKIND_RELATION &&
+		(*hrel)->rd_rel->relkind != RELKIND_MATVIEW)
+		ereport(ERROR,
+				(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				 errmsg("cannot build %s statistics on index \"%s\"",
+						kindname, RelationGetRelationName(irel)),
+				 errdetail("Only indexes of tables and materialized views are supported.")));
+
+	for (j = 0; j < IndexRelationGetNumberOfKeyAttributes(irel); j++)
+	{
+		AttrNumber	attnum = irel->rd_index->indkey.values[j];
+
+		if (attnum == 0 ||
+			TupleDescAttr(RelationGetDescr(*hrel), attnum - 1)->atttypid !=
+			TupleDescAttr(RelationGetDescr(irel), j)->atttypid)
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("cannot build %s statistics on index \"%s\"",
+							kindname, RelationGetRelationName(irel)),
+					 errdetail("Key column %d is an expression or has the type, differing from the column of the table.",
+							   j + 1)));
+	}
+
+	return irel;
+}
+
+/*
+ * Return true if the clause references something, except the allowed columns
+ * of the relation. Such a clause can't be evaluated on a stored item.
+ */
+static bool
+incompatible_clause_walker(Node *node, void *context)
+{
+	CompatibleClauseContext *cxt = (CompatibleClauseContext *) context;
+
+	if (node == NULL)
+		return false;
+
+	if (IsA(node, Var))
+	{
+		Var	   *var = (Var *) node;
+
+		if (var->varno != cxt->varno || var->varlevelsup != 0 ||
+			!bms_is_member(var->varattno, cxt->allowed))
+			return true;
+
+		cxt->attnums = bms_add_member(cxt->attnums, var->varattno);
+		return false;
+	}
+
+	if (IsA(node, Param) || IsA(node, SubLink) || IsA(node, SubPlan) ||
+		IsA(node, AlternativeSubPlan) || IsA(node, PlaceHolderVar) ||
+		IsA(node, CurrentOfExpr))
+		return true;
+
+	return expression_tree_walker(node, incompatible_clause_walker, context);
+}
+
+/*
+ * Must operators, evaluated on stored items of the relation, be leakproof?
+ * Items are values of the table, and a leaky operator may reveal them to the
+ * user, who can't see all of them: the table is behind the row level security,
+ * or the user has no privilege to read the columns, given by a view.
+ */
+bool
+statstore_need_leakproof(RelOptInfo *rel, RangeTblEntry *rte,
+						 Bitmapset *columns)
+{
+	Oid			userid;
+	int			attnum = -1;
+
+	if (rte->securityQuals != NIL)
+		return true;
+
+	userid = OidIsValid(rel->userid) ? rel->userid : GetUserId();
+
+	/* Table-level SELECT privilege is sufficient for all columns */
+	if (pg_class_aclcheck(rte->relid, userid, ACL_SELECT) == ACLCHECK_OK)
+		return false;
+
+	while ((attnum = bms_next_member(columns, attnum)) >= 0)
+	{
+		if (pg_attribute_aclcheck(rte->relid, attnum, userid,
+								  ACL_SELECT) != ACLCHECK_OK)
+			return true;
+	}
+	return false;
+}
+
+/* Binary-compatible relabeling doesn't change the value */
+static Node *
+strip_relabel(Node *node)
+{
+	while (node != NULL && IsA(node, RelabelType))
+		node = (Node *) ((RelabelType *) node)->arg;
+	return node;
+}
+
+static bool
+is_var_op_const(List *args, bool const_on_left)
+{
+	Node	   *left;
+	Node	   *right;
+
+	if (list_length(args) != 2)
+		return false;
+
+	left = strip_relabel(linitial(args));
+	right = strip_relabel(lsecond(args));
+	return (IsA(left, Var) && IsA(right, Const)) ||
+		(const_on_left && IsA(left, Const) && IsA(right, Var));
+}
+
+static bool
+operator_is_allowed(Oid opno, bool leakproof)
+{
+	return !leakproof || get_func_leakproof(get_opcode(opno));
+}
+
+/*
+ * Check that the clause may be evaluated on stored items, having values of the
+ * allowed columns only. Add columns, referenced by the clause, to the attnums.
+ *
+ * Only comparisons of a column with a constant are accepted: a (Var op Const),
+ * a Var IN (array) and a row comparison. Nothing else of the query is executed
+ * on the items, and with leakproof, the operators can't reveal them.
+ */
+bool
+statstore_clause_is_compatible(Node *clause, Index varno, Bitmapset *allowed,
+							   bool leakproof, Bitmapset **attnums)
+{
+	CompatibleClauseContext	cxt = {varno, allowed, NULL};
+
+	if (IsA(clause, OpExpr))
+	{
+		OpExpr	   *opexpr = (OpExpr *) clause;
+
+		if (!is_var_op_const(opexpr->args, true) ||
+			!operator_is_allowed(opexpr->opno, leakproof))
+			return false;
+	}
+	else if (IsA(clause, ScalarArrayOpExpr))
+	{
+		ScalarArrayOpExpr *saop = (ScalarArrayOpExpr *) clause;
+
+		if (!is_var_op_const(saop->args, false) ||
+			!operator_is_allowed(saop->opno, leakproof))
+			return false;
+	}
+	else if (IsA(clause, RowCompareExpr))
+	{
+		RowCompareExpr *rcexpr = (RowCompareExpr *) clause;
+		ListCell   *lc1;
+		ListCell   *lc2;
+		ListCell   *lc3;
+
+		forthree(lc1, rcexpr->opnos, lc2, rcexpr->largs, lc3, rcexpr->rargs)
+		{
+			if (!IsA(strip_relabel(lfirst(lc2)), Var) ||
+				!IsA(strip_relabel(lfirst(lc3)), Const) ||
+				!operator_is_allowed(lfirst_oid(lc1), leakproof))
+				return false;
+		}
+	}
+	else
+		return false;
+
+	if (contain_volatile_functions(clause) ||
+		incompatible_clause_walker(clause, (void *) &cxt) ||
+		cxt.attnums == NULL)
+		return false;
+
+	*attnums = bms_join(*attnums, cxt.attnums);
+	return true;
+}
+
+/*
+ * Evaluate the clauses on each of the items, having values of the columns
+ * attnums, and return the array of results. Values of an item are stored
+ * together, isnull may be NULL if there are no NULLs.
+ */
+bool *
+statstore_eval_clauses(List *clauses, TupleDesc tupdesc, int nitems,
+					   int natts, AttrNumber *attnums, Datum *values,
+					   bool *isnull)
+{
+	EState		   *estate = CreateExecutorState();
+	ExprContext	   *econtext = GetPerTupleExprContext(estate);
+	TupleTableSlot *slot = MakeSingleTupleTableSlot(tupdesc, &TTSOpsVirtual);
+	ExprState	   *qual;
+	List		   *exprs = NIL;
+	ListCell	   *lc;
+	bool		   *passed;
+	int				i;
+	int				j;
+
+	foreach(lc, clauses)
+		exprs = lappend(exprs, ((RestrictInfo *) lfirst(lc))->clause);
+
+	qual = ExecPrepareQual(exprs, estate);
+	econtext->ecxt_scantuple = slot;
+
+	passed = (bool *) palloc0(Max(nitems, 1) * sizeof(bool));
+	for (i = 0; i < nitems; i++)
+	{
+		ExecClearTuple(slot);
+		memset(slot->tts_isnull, true, tupdesc->natts * sizeof(bool));
+		for (j = 0; j < natts; j++)
+		{
+			slot->tts_values[attnums[j] - 1] = values[i * natts + j];
+			slot->tts_isnull[attnums[j] - 1] =
+									isnull != NULL && isnull[i * natts + j];
+		}
+		ExecStoreVirtualTuple(slot);
+
+		passed[i] = ExecQual(qual, econtext);
+		ResetExprContext(econtext);
+	}
+
+	ExecDropSingleTupleTableSlot(slot);
+	FreeExecutorState(estate);
+
+	return passed;
+}
+
+void
+statstore_init(void)
+{
+	statstore_ctx = AllocSetContextCreate(TopMemoryContext,
+										  MODULE_NAME" - stored statistics",
+										  ALLOCSET_DEFAULT_SIZES);
+	CacheRegisterRelcacheCallback(statstore_relcache_callback, (Datum) 0);
+}
@@ -0,0 +1,54 @@
+#ifndef _STATSTORE_H_
+#define _STATSTORE_H_
+
+#include "postgres.h"
+
+#include "access/tupdesc.h"
+#include "nodes/bitmapset.h"
+#include "nodes/pathnodes.h"
+#include "nodes/pg_list.h"
+#include "utils/relcache.h"
+
+#define STATSTORE_TABLE		"pg_index_stats_data"
+
+/* Kinds of statistics, managed by the extension */
+#define STATSTORE_KIND_KEY	'k'		/* MCV and histogram of the index key */
+#define STATSTORE_KIND_GRID	'g'		/* multi-dimensional histogram */
+
+/*
+ * Statistics on the key columns of an index. Values are stored as a flat array
+ * of nvalues x ndims elements, NULLs are never stored. For the grid, values
+ * are bounds of the buckets in each dimension, and numbers are frequencies of
+ * the cells, the last dimension changing first.
+ */
+typedef struct StoredStat
+{
+	Oid			indexrelid;
+	char		kind;
+	int			ndims;
+	Oid		   *typids;		/* types of the index key columns */
+	float4		nullfrac;
+	float8		ndistinct;
+	int			nvalues;
+	Datum	   *values;
+	int			nnumbers;
+	double	   *numbers;
+} StoredStat;
+
+extern void statstore_init(void);
+extern StoredStat *statstore_fetch(Oid indexrelid, char kind);
+extern void statstore_save(StoredStat *stat);
+extern void statstore_forget(List *indexes);
+
+extern Relation statstore_open_index(Oid indexrelid, const char *kindname,
+									 Relation *hrel);
+extern bool statstore_need_leakproof(RelOptInfo *rel, RangeTblEntry *rte,
+									 Bitmapset *columns);
+extern bool statstore_clause_is_compatible(Node *clause, Index varno,
+										   Bitmapset *allowed, bool leakproof,
+										   Bitmapset **attnums);
+extern bool *statstore_eval_clauses(List *clauses, TupleDesc tupdesc,
+									int nitems, int natts, AttrNumber *attnums,
+									Datum *values, bool *isnull);
+
+#endif /* _STATSTORE_H_ */
@@ -0,0 +1,895 @@
+/*-------------------------------------------------------------------------
+ *
+ * statusage.c
+ *		Cluster-wide counters of statistics usage by the planner.
+ *
+ * Counted are requests of the planner for the statistics of a column (of a
+ * table or of an index expression) and usable extended statistics objects:
+ * covering at least two columns, or an expression, referenced by clauses or
+ * grouping of the query. A backend accumulates the counters of a planning
+ * locally and adds them to the shared hash table at the end of the top-level
+ * planning with atomic operations, so the shared lock is held in the shared
+ * mode, unless a new entry appears. Each entry has the number of accesses,
+ * the number of planned queries and the time of the last use. The content
+ * survives restarts through a dump file.
+ *
+ * Copyright (c) 2023-2025 Andrei Lepikhov
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ * IDENTIFICATION
+ *	  contrib/pg_index_stats/statusage.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/sysattr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/plancat.h"
+#include "optimizer/planner.h"
+#include "pgstat.h"
+#include "port/atomics.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/selfuncs.h"
+#include "utils/timestamp.h"
+
+#include "pg_index_stats.h"
+#include "statprune.h"
+#include "statusage.h"
+
+PG_FUNCTION_INFO_V1(pg_index_stats_usage);
+PG_FUNCTION_INFO_V1(pg_index_stats_usage_reset);
+
+#define USAGE_TRANCHE	MODULE_NAME" usage"
+#define USAGE_DUMP_FILE	PGSTAT_STAT_PERMANENT_DIRECTORY "/" MODULE_NAME "_usage.stat"
+
+/* Magic number identifying the dump file format */
+static const uint32 USAGE_FILE_HEADER = 0x55534701;
+
+/*
+ * A column is identified by the relid and attnum, an extended statistics
+ * object - by the relid and statid.
+ */
+typedef struct UsageKey
+{
+	Oid			dbid;
+	Oid			relid;
+	Oid			statid;
+	AttrNumber	attnum;
+} UsageKey;
+
+typedef struct UsageEntry
+{
+	UsageKey			key;
+	pg_atomic_uint64	accesses;
+	pg_atomic_uint64	queries;
+	pg_atomic_uint64	last_used;	/* TimestampTz */
+} UsageEntry;
+
+/* Content of an entry in the dump file */
+typedef struct UsageRecord
+{
+	UsageKey	key;
+	uint64		accesses;
+	uint64		queries;
+	TimestampTz	last_used;
+} UsageRecord;
+
+typedef struct UsageState
+{
+	LWLock	   *lock;		/* protects the hash table structure */
+	int64		dropped;	/* number of evicted entries */
+	TimestampTz	dropped_last_used;	/* the latest use of an evicted entry */
+	TimestampTz	stats_reset;
+} UsageState;
+
+/* Counters of the current planning */
+typedef struct UsageLocalEntry
+{
+	UsageKey	key;
+	uint64		accesses;
+} UsageLocalEntry;
+
+static bool track_usage = true;
+static int max_usage_entries = 10000;
+static bool usage_save = true;
+
+static UsageState *usage = NULL;
+static HTAB *usage_htab = NULL;
+static HTAB *usage_local_htab = NULL;
+static int usage_plan_nesting = 0;
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static planner_hook_type prev_planner_hook = NULL;
+static get_relation_info_hook_type prev_get_relation_info_hook = NULL;
+static get_relation_stats_hook_type prev_get_relation_stats_hook = NULL;
+static get_index_stats_hook_type prev_get_index_stats_hook = NULL;
+
+static Size
+usage_memsize(void)
+{
+	Size		size;
+
+	size = MAXALIGN(sizeof(UsageState));
+	size = add_size(size, hash_estimate_size(max_usage_entries,
+											 sizeof(UsageEntry)));
+	return size;
+}
+
+#if PG_VERSION_NUM >= 150000
+static void
+usage_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(usage_memsize());
+	RequestNamedLWLockTranche(USAGE_TRANCHE, 1);
+}
+#endif
+
+/*
+ * Dump the counters into the file on the postmaster shutdown.
+ */
+static void
+usage_shmem_shutdown(int code, Datum arg)
+{
+	FILE			   *file;
+	HASH_SEQ_STATUS		hash_seq;
+	UsageEntry		   *entry;
+	int32				num_entries;
+
+	/* Don't try to dump during a crash */
+	if (code)
+		return;
+
+	if (usage == NULL)
+		return;
+
+	if (!usage_save)
+	{
+		/* Remove an outdated file, if any */
+		(void) unlink(USAGE_DUMP_FILE);
+		return;
+	}
+
+	file = AllocateFile(USAGE_DUMP_FILE ".tmp", PG_BINARY_W);
+	if (file == NULL)
+		goto error;
+
+	num_entries = hash_get_num_entries(usage_htab);
+	if (fwrite(&USAGE_FILE_HEADER, sizeof(uint32), 1, file) != 1 ||
+		fwrite(&usage->stats_reset, sizeof(TimestampTz), 1, file) != 1 ||
+		fwrite(&usage->dropped_last_used, sizeof(TimestampTz), 1, file) != 1 ||
+		fwrite(&num_entries, sizeof(int32), 1, file) != 1)
+		goto error;
+
+	hash_seq_init(&hash_seq, usage_htab);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+	{
+		UsageRecord	record;
+
+		record.key = entry->key;
+		record.accesses = pg_atomic_read_u64(&entry->accesses);
+		record.queries = pg_atomic_read_u64(&entry->queries);
+		record.last_used = (TimestampTz) pg_atomic_read_u64(&entry->last_used);
+
+		if (fwrite(&record, sizeof(UsageRecord), 1, file) != 1)
+		{
+			hash_seq_term(&hash_seq);
+			goto error;
+		}
+	}
+
+	if (FreeFile(file))
+	{
+		file = NULL;
+		goto error;
+	}
+
+	(void) durable_rename(USAGE_DUMP_FILE ".tmp", USAGE_DUMP_FILE, LOG);
+	return;
+
+error:
+	ereport(LOG,
+			(errcode_for_file_access(),
+			 errmsg("could not write file \"%s\": %m",
+					USAGE_DUMP_FILE ".tmp")));
+	if (file)
+		FreeFile(file);
+	(void) unlink(USAGE_DUMP_FILE ".tmp");
+}
+
+/*
+ * Load the counters, saved at the previous shutdown.
+ * Errors aren't critical here: in the worst case we lose the history.
+ */
+static void
+usage_load(void)
+{
+	FILE	   *file;
+	uint32		header;
+	TimestampTz	stats_reset;
+	TimestampTz	dropped_last_used;
+	int32		num_entries;
+	int			i;
+
+	file = AllocateFile(USAGE_DUMP_FILE, PG_BINARY_R);
+	if (file == NULL)
+	{
+		if (errno != ENOENT)
+			ereport(LOG,
+					(errcode_for_file_access(),
+					 errmsg("could not read file \"%s\": %m",
+							USAGE_DUMP_FILE)));
+		return;
+	}
+
+	if (fread(&header, sizeof(uint32), 1, file) != 1 ||
+		fread(&stats_reset, sizeof(TimestampTz), 1, file) != 1 ||
+		fread(&dropped_last_used, sizeof(TimestampTz), 1, file) != 1 ||
+		fread(&num_entries, sizeof(int32), 1, file) != 1)
+		goto read_error;
+
+	if (header != USAGE_FILE_HEADER)
+	{
+		ereport(LOG,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("ignoring invalid data in file \"%s\"",
+						USAGE_DUMP_FILE)));
+		goto cleanup;
+	}
+
+	usage->stats_reset = stats_reset;
+	usage->dropped_last_used = dropped_last_used;
+
+	for (i = 0; i < num_entries; i++)
+	{
+		UsageRecord	record;
+		UsageEntry *entry;
+		bool		found;
+
+		if (fread(&record, sizeof(UsageRecord), 1, file) != 1)
+			goto read_error;
+
+		/* The limit could be decreased since the previous start */
+		if (hash_get_num_entries(usage_htab) >= max_usage_entries)
+		{
+			usage->dropped_last_used = Max(usage->dropped_last_used,
+										   record.last_used);
+			continue;
+		}
+
+		entry = (UsageEntry *) hash_search(usage_htab, &record.key,
+										   HASH_ENTER, &found);
+		if (!found)
+		{
+			pg_atomic_init_u64(&entry->accesses, record.accesses);
+			pg_atomic_init_u64(&entry->queries, record.queries);
+			pg_atomic_init_u64(&entry->last_used, (uint64) record.last_used);
+		}
+	}
+	goto cleanup;
+
+read_error:
+	ereport(LOG,
+			(errcode_for_file_access(),
+			 errmsg("could not read file \"%s\": %m", USAGE_DUMP_FILE)));
+cleanup:
+	FreeFile(file);
+
+	/*
+	 * Remove the file to not load the same data once more after a crash.
+	 */
+	(void) unlink(USAGE_DUMP_FILE);
+}
+
+static void
+usage_shmem_startup(void)
+{
+	HASHCTL		info;
+	bool		found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	usage = NULL;
+	usage_htab = NULL;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	usage = ShmemInitStruct(MODULE_NAME" usage state",
+							sizeof(UsageState), &found);
+	if (!found)
+	{
+		usage->lock = &(GetNamedLWLockTranche(USAGE_TRANCHE))->lock;
+		usage->dropped = 0;
+		usage->dropped_last_used = 0;
+		usage->stats_reset = GetCurrentTimestamp();
+	}
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(UsageKey);
+	info.entrysize = sizeof(UsageEntry);
+	usage_htab = ShmemInitHash(MODULE_NAME" usage hash",
+							   max_usage_entries, max_usage_entries,
+							   &info, HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	/*
+	 * Only the postmaster dumps and loads the data. Backends just attach to
+	 * the shared structures.
+	 */
+	if (!IsUnderPostmaster)
+		on_shmem_exit(usage_shmem_shutdown, (Datum) 0);
+
+	if (found)
+		return;
+
+	usage_load();
+}
+
+bool
+statusage_enabled(void)
+{
+	return usage != NULL;
+}
+
+/*
+ * Is the usage being counted now? Absence of usage means nothing otherwise.
+ */
+bool
+statusage_tracking(void)
+{
+	return statusage_enabled() && track_usage;
+}
+
+/*
+ * Since that moment the usage is known. Before the first start with the
+ * library or after the reset nothing can be said.
+ */
+TimestampTz
+statusage_tracked_since(void)
+{
+	TimestampTz	result;
+
+	if (!statusage_enabled())
+		return 0;
+
+	LWLockAcquire(usage->lock, LW_SHARED);
+	result = usage->stats_reset;
+	LWLockRelease(usage->lock);
+
+	return result;
+}
+
+/* Share of the entries, evicted at once when the table is full */
+#define USAGE_EVICT_PERCENT	(5)
+
+static int
+usage_entry_cmp(const void *a, const void *b)
+{
+	uint64	la = pg_atomic_read_u64(&(*(UsageEntry *const *) a)->last_used);
+	uint64	lb = pg_atomic_read_u64(&(*(UsageEntry *const *) b)->last_used);
+
+	return (la > lb) - (la < lb);
+}
+
+/*
+ * Evict the least recently used entries to free space for new ones. A batch
+ * is evicted at once, as pg_stat_statements does, so the whole table isn't
+ * scanned for each new object. Caller must hold the lock exclusively.
+ */
+static void
+usage_evict(void)
+{
+	HASH_SEQ_STATUS		hash_seq;
+	UsageEntry		   *entry;
+	UsageEntry		  **entries;
+	long				nentries = hash_get_num_entries(usage_htab);
+	long				nvictims;
+	long				i = 0;
+
+	if (nentries == 0)
+		return;
+
+	entries = (UsageEntry **) palloc(nentries * sizeof(UsageEntry *));
+	hash_seq_init(&hash_seq, usage_htab);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+		entries[i++] = entry;
+
+	qsort(entries, i, sizeof(UsageEntry *), usage_entry_cmp);
+
+	nvictims = Max(1, i * USAGE_EVICT_PERCENT / 100);
+	nvictims = Min(nvictims, i);
+	for (i = 0; i < nvictims; i++)
+	{
+		TimestampTz	last_used;
+
+		last_used = (TimestampTz) pg_atomic_read_u64(&entries[i]->last_used);
+		(void) hash_search(usage_htab, &entries[i]->key, HASH_REMOVE, NULL);
+		usage->dropped++;
+		usage->dropped_last_used = Max(usage->dropped_last_used, last_used);
+	}
+
+	pfree(entries);
+}
+
+/*
+ * Find the entry or create a new one with zero counters, evicting the least
+ * recently used entry if there is no room. Caller must hold the lock
+ * exclusively.
+ */
+static UsageEntry *
+usage_enter(UsageKey *key, TimestampTz last_used)
+{
+	UsageEntry *entry;
+	bool		found;
+
+	entry = (UsageEntry *) hash_search(usage_htab, key, HASH_FIND, NULL);
+	if (entry != NULL)
+		return entry;
+
+	if (hash_get_num_entries(usage_htab) >= max_usage_entries)
+		usage_evict();
+
+	entry = (UsageEntry *) hash_search(usage_htab, key, HASH_ENTER, &found);
+	if (!found)
+	{
+		pg_atomic_init_u64(&entry->accesses, 0);
+		pg_atomic_init_u64(&entry->queries, 0);
+		pg_atomic_init_u64(&entry->last_used, (uint64) last_used);
+	}
+	return entry;
+}
+
+/*
+ * The last time the planner could use the extended statistics object.
+ *
+ * An object, unknown so far, is either created recently or its counters
+ * have been evicted. Anyway, it starts being watched now: an entry with zero
+ * counters is added, and the current time is returned. So, the object is
+ * considered unused only after a whole period of watching.
+ */
+TimestampTz
+statusage_stat_watch(Oid dbid, Oid relid, Oid statid)
+{
+	UsageKey	key;
+	UsageEntry *entry;
+	TimestampTz	result;
+
+	if (!statusage_enabled())
+		return 0;
+
+	memset(&key, 0, sizeof(UsageKey));
+	key.dbid = dbid;
+	key.relid = relid;
+	key.statid = statid;
+
+	LWLockAcquire(usage->lock, LW_SHARED);
+	entry = (UsageEntry *) hash_search(usage_htab, &key, HASH_FIND, NULL);
+	if (entry != NULL)
+	{
+		result = (TimestampTz) pg_atomic_read_u64(&entry->last_used);
+		LWLockRelease(usage->lock);
+		return result;
+	}
+	LWLockRelease(usage->lock);
+
+	result = GetCurrentTimestamp();
+	LWLockAcquire(usage->lock, LW_EXCLUSIVE);
+	entry = usage_enter(&key, result);
+	result = (TimestampTz) pg_atomic_read_u64(&entry->last_used);
+	LWLockRelease(usage->lock);
+
+	return result;
+}
+
+/*
+ * Databases, where the planner has worked since the start of tracking
+ */
+List *
+statusage_databases(void)
+{
+	HASH_SEQ_STATUS		hash_seq;
+	UsageEntry		   *entry;
+	List			   *result = NIL;
+
+	if (!statusage_enabled())
+		return NIL;
+
+	LWLockAcquire(usage->lock, LW_SHARED);
+	hash_seq_init(&hash_seq, usage_htab);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+		result = list_append_unique_oid(result, entry->key.dbid);
+	LWLockRelease(usage->lock);
+
+	return result;
+}
+
+/*
+ * Count an access to the statistics in the current planning
+ */
+static void
+usage_count(Oid relid, Oid statid, AttrNumber attnum)
+{
+	UsageKey			key;
+	UsageLocalEntry	   *local;
+	bool				found;
+
+	/* The re-planning by QDS isn't a use of the statistics */
+	if (!statusage_enabled() || !track_usage || qds_replanning())
+		return;
+
+	if (usage_local_htab == NULL)
+	{
+		HASHCTL		info;
+
+		memset(&info, 0, sizeof(info));
+		info.keysize = sizeof(UsageKey);
+		info.entrysize = sizeof(UsageLocalEntry);
+		info.hcxt = TopMemoryContext;
+		usage_local_htab = hash_create(MODULE_NAME" local usage hash", 64,
+									   &info,
+									   HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	memset(&key, 0, sizeof(UsageKey));
+	key.dbid = MyDatabaseId;
+	key.relid = relid;
+	key.statid = statid;
+	key.attnum = attnum;
+
+	local = (UsageLocalEntry *) hash_search(usage_local_htab, &key,
+											HASH_ENTER, &found);
+	if (!found)
+		local->accesses = 0;
+	local->accesses++;
+}
+
+/*
+ * Add the counters of the finished planning to the shared ones. Each entry,
+ * touched by the planning, counts one query.
+ */
+static void
+usage_flush(void)
+{
+	HASH_SEQ_STATUS		hash_seq;
+	UsageLocalEntry	   *local;
+	LWLockMode			mode = LW_SHARED;
+	TimestampTz			now;
+
+	if (usage_local_htab == NULL ||
+		hash_get_num_entries(usage_local_htab) == 0)
+		return;
+
+	now = GetCurrentTimestamp();
+
+	LWLockAcquire(usage->lock, mode);
+	hash_seq_init(&hash_seq, usage_local_htab);
+	while ((local = hash_seq_search(&hash_seq)) != NULL)
+	{
+		UsageEntry *entry;
+
+		entry = (UsageEntry *) hash_search(usage_htab, &local->key,
+										   HASH_FIND, NULL);
+		if (entry == NULL)
+		{
+			/* Need exclusive lock to add the new entry */
+			if (mode != LW_EXCLUSIVE)
+			{
+				LWLockRelease(usage->lock);
+				mode = LW_EXCLUSIVE;
+				LWLockAcquire(usage->lock, mode);
+			}
+
+			entry = usage_enter(&local->key, 0);
+		}
+
+		pg_atomic_fetch_add_u64(&entry->accesses, local->accesses);
+		pg_atomic_fetch_add_u64(&entry->queries, 1);
+		pg_atomic_write_u64(&entry->last_used, (uint64) now);
+
+		(void) hash_search(usage_local_htab, &local->key, HASH_REMOVE, NULL);
+	}
+	LWLockRelease(usage->lock);
+}
+
+/*
+ * Flush the counters at the end of the top-level planning. Counters of a
+ * failed planning are added to the next one.
+ */
+#if PG_VERSION_NUM >= 190000
+static PlannedStmt *
+usage_planner(Query *parse, const char *query_string, int cursorOptions,
+			  ParamListInfo boundParams, ExplainState *es)
+#else
+static PlannedStmt *
+usage_planner(Query *parse, const char *query_string, int cursorOptions,
+			  ParamListInfo boundParams)
+#endif
+{
+	PlannedStmt	   *result;
+
+	usage_plan_nesting++;
+	PG_TRY();
+	{
+#if PG_VERSION_NUM >= 190000
+		if (prev_planner_hook)
+			result = prev_planner_hook(parse, query_string, cursorOptions,
+									   boundParams, es);
+		else
+			result = standard_planner(parse, query_string, cursorOptions,
+									  boundParams, es);
+#else
+		if (prev_planner_hook)
+			result = prev_planner_hook(parse, query_string, cursorOptions,
+									   boundParams);
+		else
+			result = standard_planner(parse, query_string, cursorOptions,
+									  boundParams);
+#endif
+	}
+	PG_FINALLY();
+	{
+		usage_plan_nesting--;
+	}
+	PG_END_TRY();
+
+	if (usage_plan_nesting == 0 && statusage_enabled())
+		usage_flush();
+
+	return result;
+}
+
+/*
+ * Might the planner use the extended statistics, having the columns of the
+ * relation, referenced by the query?
+ */
+static bool
+statistics_usable(StatisticExtInfo *info, Index varno, Bitmapset *attnums)
+{
+	int			nmatched = bms_num_members(bms_intersect(info->keys, attnums));
+	ListCell   *lc;
+
+	foreach(lc, info->exprs)
+	{
+		Bitmapset  *varattnos = NULL;
+		int			member = -1;
+		bool		matched = true;
+
+		pull_varattnos((Node *) lfirst(lc), varno, &varattnos);
+		if (varattnos == NULL)
+			continue;
+
+		while ((member = bms_next_member(varattnos, member)) >= 0)
+		{
+			AttrNumber	attnum = member + FirstLowInvalidHeapAttributeNumber;
+
+			if (!bms_is_member(attnum, attnums))
+			{
+				matched = false;
+				break;
+			}
+		}
+
+		/* Statistics of a single expression is used as well */
+		if (matched)
+			return true;
+	}
+
+	return nmatched >= 2;
+}
+
+/*
+ * Count extended statistics, which might be used by the query. Pruned ones
+ * are not counted (see statprune.c).
+ */
+static void
+usage_get_relation_info(PlannerInfo *root, Oid relationObjectId,
+						bool inhparent, RelOptInfo *rel)
+{
+	Bitmapset  *attnums;
+	List	   *counted = NIL;
+	ListCell   *lc;
+
+	if (prev_get_relation_info_hook)
+		(*prev_get_relation_info_hook) (root, relationObjectId, inhparent, rel);
+
+	if (!statusage_enabled() || !track_usage || rel->statlist == NIL)
+		return;
+
+	attnums = query_relation_attnums(root, rel->relid);
+
+	/* Each kind of the statistics object has its own entry in the list */
+	foreach(lc, rel->statlist)
+	{
+		StatisticExtInfo *info = (StatisticExtInfo *) lfirst(lc);
+
+		if (list_member_oid(counted, info->statOid) ||
+			!statistics_usable(info, rel->relid, attnums))
+			continue;
+
+		usage_count(relationObjectId, info->statOid, InvalidAttrNumber);
+		counted = lappend_oid(counted, info->statOid);
+	}
+	list_free(counted);
+}
+
+static bool
+usage_relation_stats_hook(PlannerInfo *root, RangeTblEntry *rte,
+						  AttrNumber attnum, VariableStatData *vardata)
+{
+	if (rte->rtekind == RTE_RELATION)
+		usage_count(rte->relid, InvalidOid, attnum);
+
+	if (prev_get_relation_stats_hook)
+		return (*prev_get_relation_stats_hook) (root, rte, attnum, vardata);
+	return false;
+}
+
+static bool
+usage_index_stats_hook(PlannerInfo *root, Oid indexOid, AttrNumber indexattnum,
+					   VariableStatData *vardata)
+{
+	usage_count(indexOid, InvalidOid, indexattnum);
+
+	if (prev_get_index_stats_hook)
+		return (*prev_get_index_stats_hook) (root, indexOid, indexattnum,
+											 vardata);
+	return false;
+}
+
+#define PG_INDEX_STATS_USAGE_COLS	(7)
+
+/*
+ * Show the usage counters
+ */
+Datum
+pg_index_stats_usage(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo	   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	HASH_SEQ_STATUS		hash_seq;
+	UsageEntry		   *entry;
+
+	if (!statusage_enabled())
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg(MODULE_NAME" must be loaded via \"shared_preload_libraries\"")));
+
+	prepare_materialized_srf(fcinfo);
+
+	LWLockAcquire(usage->lock, LW_SHARED);
+	hash_seq_init(&hash_seq, usage_htab);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+	{
+		Datum		values[PG_INDEX_STATS_USAGE_COLS];
+		bool		nulls[PG_INDEX_STATS_USAGE_COLS];
+
+		memset(nulls, false, sizeof(nulls));
+
+		values[0] = ObjectIdGetDatum(entry->key.dbid);
+		values[1] = ObjectIdGetDatum(entry->key.relid);
+		if (OidIsValid(entry->key.statid))
+		{
+			nulls[2] = true;
+			values[3] = ObjectIdGetDatum(entry->key.statid);
+		}
+		else
+		{
+			values[2] = Int16GetDatum(entry->key.attnum);
+			nulls[3] = true;
+		}
+		values[4] = Int64GetDatum((int64) pg_atomic_read_u64(&entry->accesses));
+		values[5] = Int64GetDatum((int64) pg_atomic_read_u64(&entry->queries));
+		values[6] = TimestampTzGetDatum((TimestampTz)
+										pg_atomic_read_u64(&entry->last_used));
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+	}
+	LWLockRelease(usage->lock);
+
+	return (Datum) 0;
+}
+
+/*
+ * Remove all the counters
+ */
+Datum
+pg_index_stats_usage_reset(PG_FUNCTION_ARGS)
+{
+	HASH_SEQ_STATUS		hash_seq;
+	UsageEntry		   *entry;
+
+	if (!statusage_enabled())
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg(MODULE_NAME" must be loaded via \"shared_preload_libraries\"")));
+
+	LWLockAcquire(usage->lock, LW_EXCLUSIVE);
+	hash_seq_init(&hash_seq, usage_htab);
+	while ((entry = hash_seq_search(&hash_seq)) != NULL)
+		(void) hash_search(usage_htab, &entry->key, HASH_REMOVE, NULL);
+	usage->dropped = 0;
+	usage->dropped_last_used = 0;
+	usage->stats_reset = GetCurrentTimestamp();
+	LWLockRelease(usage->lock);
+
+	PG_RETURN_VOID();
+}
+
+void
+statusage_init(void)
+{
+	DefineCustomBoolVariable(MODULE_NAME".track_usage",
+							"Count usage of statistics by the planner",
+							"Works only if the library is loaded by the shared_preload_libraries",
+							&track_usage,
+							true,
+							PGC_SUSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable(MODULE_NAME".max_usage_entries",
+							"Sets the maximum number of entries of the usage counters",
+							NULL,
+							&max_usage_entries,
+							10000,
+							100,
+							INT_MAX / 2,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomBoolVariable(MODULE_NAME".usage_save",
+							"Save the usage counters across server shutdowns",
+							NULL,
+							&usage_save,
+							true,
+							PGC_SIGHUP,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = usage_shmem_request;
+#else
+	RequestAddinShmemSpace(usage_memsize());
+	RequestNamedLWLockTranche(USAGE_TRANCHE, 1);
+#endif
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = usage_shmem_startup;
+
+	prev_planner_hook = planner_hook;
+	planner_hook = usage_planner;
+	prev_get_relation_info_hook = get_relation_info_hook;
+	get_relation_info_hook = usage_get_relation_info;
+	prev_get_relation_stats_hook = get_relation_stats_hook;
+	get_relation_stats_hook = usage_relation_stats_hook;
+	prev_get_index_stats_hook = get_index_stats_hook;
+	get_index_stats_hook = usage_index_stats_hook;
+}
@@ -0,0 +1,16 @@
+#ifndef _STATUSAGE_H_
+#define _STATUSAGE_H_
+
+#include "postgres.h"
+
+#include "datatype/timestamp.h"
+#include "nodes/pg_list.h"
+
+extern void statusage_init(void);
+extern bool statusage_enabled(void);
+extern bool statusage_tracking(void);
+extern TimestampTz statusage_tracked_since(void);
+extern TimestampTz statusage_stat_watch(Oid dbid, Oid relid, Oid statid);
+extern List *statusage_databases(void);
+
+#endif /* _STATUSAGE_H_ */
@@ -0,0 +1,799 @@
+/*-------------------------------------------------------------------------
+ *
+ * statworker.c
+ *		Background worker, building extended statistics recommended by the
+ *		QDS candidates repository.
+ *
+ * A static launcher periodically looks into the candidates repository and
+ * starts a short-lived dynamic worker for each database having unprocessed
+ * candidates. The worker checks the load of the instance, and if it is low
+ * enough, builds a limited number of statistics, using the same duplicates
+ * reduction logic as the index-based generator. Hence, user queries never
+ * pay catalog-write latency for a recommendation.
+ *
+ * Also, the worker fills up statistics created automatically, either by the
+ * worker itself or after CREATE INDEX. Such relations are queued and
+ * processed in the next run, so all the statistics created on a table in the
+ * meantime are built with a single sample.
+ *
+ * Periodically, the worker retires index-based statistics unused by the
+ * planner, see statretire.c.
+ *
+ * Copyright (c) 2023-2025 Andrei Lepikhov
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license. See the LICENSE file for details.
+ *
+ * IDENTIFICATION
+ *	  contrib/pg_index_stats/statworker.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "commands/extension.h"
+#include "executor/spi.h"
+#include "miscadmin.h"
+#include "nodes/makefuncs.h"
+#include "pgstat.h"
+#include "port/atomics.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/interrupt.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lmgr.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "tcop/tcopprot.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/snapmgr.h"
+
+#include "extstat_analyze.h"
+#include "pg_index_stats.h"
+#include "qds_repository.h"
+#include "statretire.h"
+#include "statusage.h"
+#include "statworker.h"
+
+/* Maximum power of two the naptime is multiplied by under the high load */
+#define STATWORKER_MAX_BACKOFF	(5)
+
+/* Maximum number of relations waiting for the extended statistics build */
+#define ANALYZE_QUEUE_SIZE		(64)
+
+typedef struct AnalyzeQueueEntry
+{
+	Oid			dbid;
+	Oid			relid;
+} AnalyzeQueueEntry;
+
+typedef struct StatWorkerState
+{
+	/* Number of sequential cycles skipped because of the high load */
+	pg_atomic_uint32	backoff;
+
+	slock_t				mutex;	/* protects the queue */
+	int					nqueued;
+	AnalyzeQueueEntry	queue[ANALYZE_QUEUE_SIZE];
+} StatWorkerState;
+
+/* Decision made on a candidate */
+typedef enum
+{
+	CANDIDATE_CREATED,		/* new statistics has been built */
+	CANDIDATE_REJECTED,		/* no statistics needed or possible */
+	CANDIDATE_POSTPONED		/* can't decide right now */
+} CandidateDecision;
+
+static bool worker_enabled = false;
+static int worker_naptime = 60;
+static int worker_stats_limit = 5;
+static int worker_min_calls = 10;
+static int worker_max_active_backends = 8;
+static int worker_max_replication_lag = 10000;
+static bool analyze_new_stats = true;
+static int analyze_delay = 10;
+
+static StatWorkerState *statworker_state = NULL;
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+#if PG_VERSION_NUM >= 150000
+static void
+statworker_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(MAXALIGN(sizeof(StatWorkerState)));
+}
+#endif
+
+static void
+statworker_shmem_startup(void)
+{
+	bool	found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	statworker_state = ShmemInitStruct(MODULE_NAME" worker state",
+									   sizeof(StatWorkerState), &found);
+	if (!found)
+	{
+		pg_atomic_init_u32(&statworker_state->backoff, 0);
+		SpinLockInit(&statworker_state->mutex);
+		statworker_state->nqueued = 0;
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Queue the relation to build its new extended statistics in background.
+ * Nothing happens if the relation is already queued. If the transaction is
+ * rolled back, the worker just finds nothing to do.
+ */
+void
+statworker_schedule_analyze(Oid relid)
+{
+	int		i;
+	bool	queued = false;
+
+	if (statworker_state == NULL || !analyze_new_stats)
+		return;
+
+	SpinLockAcquire(&statworker_state->mutex);
+	for (i = 0; i < statworker_state->nqueued; i++)
+	{
+		if (statworker_state->queue[i].dbid == MyDatabaseId &&
+			statworker_state->queue[i].relid == relid)
+			break;
+	}
+	if (i < statworker_state->nqueued)
+		queued = true;
+	else if (statworker_state->nqueued < ANALYZE_QUEUE_SIZE)
+	{
+		statworker_state->queue[i].dbid = MyDatabaseId;
+		statworker_state->queue[i].relid = relid;
+		statworker_state->nqueued++;
+		queued = true;
+	}
+	SpinLockRelease(&statworker_state->mutex);
+
+	if (!queued)
+		ereport(LOG,
+				(errmsg(MODULE_NAME": analyze queue is full, statistics on relation \"%s\" stay empty",
+						get_rel_name(relid)),
+				 errhint("Run ANALYZE or pg_index_stats_analyze() on the relation.")));
+}
+
+/*
+ * Get the list of databases having queued relations.
+ */
+static List *
+analyze_queue_databases(void)
+{
+	Oid		dbids[ANALYZE_QUEUE_SIZE];
+	List   *result = NIL;
+	int		ndbids;
+	int		i;
+
+	SpinLockAcquire(&statworker_state->mutex);
+	ndbids = statworker_state->nqueued;
+	for (i = 0; i < ndbids; i++)
+		dbids[i] = statworker_state->queue[i].dbid;
+	SpinLockRelease(&statworker_state->mutex);
+
+	for (i = 0; i < ndbids; i++)
+		result = list_append_unique_oid(result, dbids[i]);
+	return result;
+}
+
+/*
+ * Remove all the relations of the database from the queue and return them.
+ */
+static List *
+analyze_queue_extract(Oid dbid)
+{
+	AnalyzeQueueEntry	relids[ANALYZE_QUEUE_SIZE];
+	List			   *result = NIL;
+	int					nrelids = 0;
+	int					i;
+	int					j = 0;
+
+	SpinLockAcquire(&statworker_state->mutex);
+	for (i = 0; i < statworker_state->nqueued; i++)
+	{
+		if (statworker_state->queue[i].dbid == dbid)
+			relids[nrelids++] = statworker_state->queue[i];
+		else
+			statworker_state->queue[j++] = statworker_state->queue[i];
+	}
+	statworker_state->nqueued = j;
+	SpinLockRelease(&statworker_state->mutex);
+
+	for (i = 0; i < nrelids; i++)
+		result = lappend_oid(result, relids[i].relid);
+	return result;
+}
+
+/*
+ * Launch a worker for each database having something to do and wait for its
+ * completion. Serve databases one by one to not overload the instance.
+ */
+static void
+statworker_launch_all(void)
+{
+	List	   *databases;
+	ListCell   *lc;
+	bool		retire = statretire_due();
+
+	databases = analyze_queue_databases();
+	if (worker_enabled)
+		databases = list_concat_unique_oid(databases,
+							qds_repository_pending_databases(worker_min_calls));
+
+	/*
+	 * Unused statistics are looked for in databases, where the planner has
+	 * worked. If nothing is planned, the statistics don't cost anything but
+	 * the ANALYZE time, which is not wasted on the idle database.
+	 */
+	if (retire)
+		databases = list_concat_unique_oid(databases, statusage_databases());
+
+	foreach(lc, databases)
+	{
+		Oid						dbid = lfirst_oid(lc);
+		BackgroundWorker		worker;
+		BackgroundWorkerHandle *handle;
+		pid_t					pid;
+
+		memset(&worker, 0, sizeof(worker));
+		worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
+						   BGWORKER_BACKEND_DATABASE_CONNECTION;
+		worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+		worker.bgw_restart_time = BGW_NEVER_RESTART;
+		snprintf(worker.bgw_library_name, sizeof(worker.bgw_library_name),
+				 MODULE_NAME);
+		snprintf(worker.bgw_function_name, sizeof(worker.bgw_function_name),
+				 "pg_index_stats_worker_main");
+		snprintf(worker.bgw_name, BGW_MAXLEN,
+				 MODULE_NAME" worker for database %u", dbid);
+		snprintf(worker.bgw_type, BGW_MAXLEN, MODULE_NAME" worker");
+		worker.bgw_main_arg = ObjectIdGetDatum(dbid);
+		worker.bgw_notify_pid = MyProcPid;
+		memcpy(worker.bgw_extra, &retire, sizeof(bool));
+
+		if (!RegisterDynamicBackgroundWorker(&worker, &handle))
+		{
+			elog(LOG, "could not register "MODULE_NAME" worker");
+			break;
+		}
+
+		if (WaitForBackgroundWorkerStartup(handle, &pid) != BGWH_STARTED)
+			continue;
+
+		if (WaitForBackgroundWorkerShutdown(handle) == BGWH_POSTMASTER_DIED)
+			proc_exit(1);
+
+		if (ShutdownRequestPending)
+			break;
+	}
+
+	list_free(databases);
+}
+
+void
+pg_index_stats_launcher_main(Datum main_arg)
+{
+	pqsignal(SIGHUP, SignalHandlerForConfigReload);
+	pqsignal(SIGTERM, SignalHandlerForShutdownRequest);
+	BackgroundWorkerUnblockSignals();
+
+	for (;;)
+	{
+		uint32	backoff;
+		long	timeout;
+
+		backoff = pg_atomic_read_u32(&statworker_state->backoff);
+		timeout = worker_naptime * 1000L *
+								(1L << Min(backoff, STATWORKER_MAX_BACKOFF));
+
+		(void) WaitLatch(MyLatch,
+						 WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+						 timeout, PG_WAIT_EXTENSION);
+		ResetLatch(MyLatch);
+		CHECK_FOR_INTERRUPTS();
+
+		if (ShutdownRequestPending)
+			break;
+
+		if (ConfigReloadPending)
+		{
+			ConfigReloadPending = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		statworker_launch_all();
+	}
+
+	proc_exit(0);
+}
+
+/*
+ * Check the instance load. Don't compete with the user workload at peak
+ * hours.
+ */
+static bool
+statworker_system_overloaded(void)
+{
+	bool	result = false;
+	bool	isnull;
+	Datum	value;
+
+	if (worker_max_active_backends < 0 && worker_max_replication_lag < 0)
+		return false;
+
+	SPI_connect();
+
+	if (worker_max_active_backends >= 0 &&
+		SPI_execute("SELECT count(*) FROM pg_stat_activity "
+					"WHERE state = 'active' AND backend_type = 'client backend'",
+					true, 1) == SPI_OK_SELECT && SPI_processed == 1)
+	{
+		value = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc,
+							  1, &isnull);
+		if (!isnull && DatumGetInt64(value) > worker_max_active_backends)
+		{
+			elog(DEBUG1, MODULE_NAME" worker: too many active backends: "INT64_FORMAT,
+				 DatumGetInt64(value));
+			result = true;
+		}
+	}
+
+	if (!result && worker_max_replication_lag >= 0 &&
+		SPI_execute("SELECT (COALESCE(max(EXTRACT(epoch FROM replay_lag)), 0) "
+					"* 1000)::float8 FROM pg_stat_replication",
+					true, 1) == SPI_OK_SELECT && SPI_processed == 1)
+	{
+		value = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc,
+							  1, &isnull);
+		if (!isnull && DatumGetFloat8(value) > worker_max_replication_lag)
+		{
+			elog(DEBUG1, MODULE_NAME" worker: replication lag is too high: %.0lf ms",
+				 DatumGetFloat8(value));
+			result = true;
+		}
+	}
+
+	SPI_finish();
+	return result;
+}
+
+/*
+ * Try to build statistics on the candidate's definition.
+ * Caller should provide a transaction.
+ */
+static CandidateDecision
+statworker_build_statistics(QdsCandidate *candidate)
+{
+	Relation			hrel;
+	TupleDesc			tupdesc;
+	List			   *exprlst = NIL;
+	List			   *exprs = NIL;
+	Bitmapset		   *atts_used = NULL;
+	ListCell		   *lc;
+	Oid					save_userid;
+	int					save_sec_context;
+	int					save_nestlevel;
+	int32				stat_types;
+	int					i;
+	CandidateDecision	result = CANDIDATE_REJECTED;
+
+	if ((stat_types = get_statistic_types()) == 0)
+		return CANDIDATE_POSTPONED;
+
+	/* Don't wait for the lock: DDL is going on, so come back later */
+	if (!ConditionalLockRelationOid(candidate->relid, ShareUpdateExclusiveLock))
+		return CANDIDATE_POSTPONED;
+
+	hrel = try_relation_open(candidate->relid, NoLock);
+	if (hrel == NULL)
+		/* The relation has gone */
+		return CANDIDATE_REJECTED;
+
+	if (hrel->rd_rel->relkind != RELKIND_RELATION)
+	{
+		relation_close(hrel, NoLock);
+		return CANDIDATE_REJECTED;
+	}
+
+	/*
+	 * Switch to the table owner's userid, as the index-based generator does.
+	 */
+	GetUserIdAndSecContext(&save_userid, &save_sec_context);
+	SetUserIdAndSecContext(hrel->rd_rel->relowner,
+						   save_sec_context | SECURITY_RESTRICTED_OPERATION);
+	save_nestlevel = NewGUCNestLevel();
+
+	tupdesc = RelationGetDescr(hrel);
+	for (i = 0; i < candidate->natts; i++)
+	{
+		AttrNumber			attnum = candidate->attnums[i];
+		Form_pg_attribute	attr;
+		StatsElem		   *selem;
+
+		if (attnum <= 0 || attnum > tupdesc->natts)
+			goto cleanup;
+
+		attr = TupleDescAttr(tupdesc, attnum - 1);
+		if (attr->attisdropped)
+			goto cleanup;
+
+		selem = makeNode(StatsElem);
+		selem->name = pstrdup(NameStr(attr->attname));
+		selem->expr = NULL;
+		atts_used = bms_add_member(atts_used, attnum);
+		exprlst = lappend(exprlst, selem);
+	}
+
+	if (candidate->exprs != NULL)
+		exprs = (List *) stringToNode(candidate->exprs);
+
+	foreach(lc, exprs)
+	{
+		StatsElem  *selem = makeNode(StatsElem);
+
+		selem->name = NULL;
+		selem->expr = (Node *) lfirst(lc);
+		exprlst = lappend(exprlst, selem);
+	}
+
+	if (pg_index_stats_create(hrel, exprlst, atts_used, stat_types,
+							  InvalidOid))
+		result = CANDIDATE_CREATED;
+
+cleanup:
+	AtEOXact_GUC(false, save_nestlevel);
+	SetUserIdAndSecContext(save_userid, save_sec_context);
+
+	/* The data of the statistics is built later, see statworker_analyze() */
+	if (result == CANDIDATE_CREATED)
+		elog(LOG, MODULE_NAME" worker: statistics created on relation \"%s\"",
+			 RelationGetRelationName(hrel));
+
+	relation_close(hrel, NoLock);
+	return result;
+}
+
+/*
+ * Process the candidate in a separate transaction. An error is reported, but
+ * doesn't stop the worker.
+ */
+static CandidateDecision
+statworker_process_candidate(QdsCandidate *candidate)
+{
+	MemoryContext				oldctx = CurrentMemoryContext;
+	volatile CandidateDecision	result = CANDIDATE_REJECTED;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	PG_TRY();
+	{
+		result = statworker_build_statistics(candidate);
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+	}
+	PG_CATCH();
+	{
+		ErrorData  *edata;
+
+		MemoryContextSwitchTo(oldctx);
+		edata = CopyErrorData();
+		FlushErrorState();
+		AbortCurrentTransaction();
+
+		ereport(LOG,
+				(errmsg(MODULE_NAME" worker: could not build statistics on relation %u",
+						candidate->relid),
+				 errdetail("%s", edata->message)));
+		FreeErrorData(edata);
+		result = CANDIDATE_REJECTED;
+	}
+	PG_END_TRY();
+
+	MemoryContextSwitchTo(oldctx);
+
+	/* Whatever the decision was, don't propose the candidate again */
+	if (result != CANDIDATE_POSTPONED)
+		qds_repository_set_processed(candidate);
+
+	return result;
+}
+
+/*
+ * Build data of empty statistics on the relation in a separate transaction.
+ */
+static void
+statworker_analyze(Oid relid)
+{
+	MemoryContext	oldctx = CurrentMemoryContext;
+	bool			postponed = false;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	PG_TRY();
+	{
+		Relation	rel;
+
+		/* The same lock as ANALYZE takes. Don't wait for the DDL. */
+		if (!ConditionalLockRelationOid(relid, ShareUpdateExclusiveLock))
+			postponed = true;
+		else if ((rel = try_relation_open(relid, NoLock)) != NULL)
+		{
+			if (rel->rd_rel->relkind == RELKIND_RELATION &&
+				extstat_analyze_relation(rel, analyze_delay))
+				elog(LOG, MODULE_NAME" worker: extended statistics built on relation \"%s\"",
+					 RelationGetRelationName(rel));
+			relation_close(rel, NoLock);
+		}
+
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+	}
+	PG_CATCH();
+	{
+		ErrorData  *edata;
+
+		MemoryContextSwitchTo(oldctx);
+		edata = CopyErrorData();
+		FlushErrorState();
+		AbortCurrentTransaction();
+
+		ereport(LOG,
+				(errmsg(MODULE_NAME" worker: could not build extended statistics on relation %u",
+						relid),
+				 errdetail("%s", edata->message)));
+		FreeErrorData(edata);
+	}
+	PG_END_TRY();
+
+	MemoryContextSwitchTo(oldctx);
+
+	if (postponed)
+		statworker_schedule_analyze(relid);
+}
+
+void
+pg_index_stats_worker_main(Datum main_arg)
+{
+	Oid				dbid = DatumGetObjectId(main_arg);
+	MemoryContext	worker_ctx;
+	List		   *candidates;
+	List		   *relids;
+	ListCell	   *lc;
+	bool			proceed = true;
+	bool			build_candidates = worker_enabled;
+	bool			retire;
+	int				created = 0;
+
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	memcpy(&retire, MyBgworkerEntry->bgw_extra, sizeof(bool));
+
+	BackgroundWorkerInitializeConnectionByOid(dbid, InvalidOid, 0);
+	pgstat_report_appname(MODULE_NAME" worker");
+
+	worker_ctx = AllocSetContextCreate(TopMemoryContext,
+									   MODULE_NAME" worker context",
+									   ALLOCSET_DEFAULT_SIZES);
+	MemoryContextSwitchTo(worker_ctx);
+
+	/* Check the prerequisites */
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	/*
+	 * Recommendations are applied only in databases where the extension is
+	 * installed. Index-based statistics may be created without it.
+	 */
+	if (!OidIsValid(get_extension_oid(MODULE_NAME, true)))
+		build_candidates = false;
+
+	if (statworker_system_overloaded())
+	{
+		pg_atomic_fetch_add_u32(&statworker_state->backoff, 1);
+		proceed = false;
+	}
+	else
+		pg_atomic_write_u32(&statworker_state->backoff, 0);
+
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	MemoryContextSwitchTo(worker_ctx);
+
+	if (!proceed)
+		proc_exit(0);
+
+	candidates = build_candidates ?
+		qds_repository_fetch_pending(dbid, worker_min_calls, -1) : NIL;
+	foreach(lc, candidates)
+	{
+		QdsCandidate   *candidate = (QdsCandidate *) lfirst(lc);
+
+		CHECK_FOR_INTERRUPTS();
+
+		/* Per-database rate limit */
+		if (created >= worker_stats_limit)
+			break;
+
+		if (statworker_process_candidate(candidate) == CANDIDATE_CREATED)
+			created++;
+	}
+
+	/*
+	 * Now, build the data of statistics created since the previous run,
+	 * including the ones created just now.
+	 */
+	relids = analyze_queue_extract(dbid);
+	foreach(lc, relids)
+	{
+		CHECK_FOR_INTERRUPTS();
+		statworker_analyze(lfirst_oid(lc));
+	}
+
+	/* At last, get rid of statistics nobody needs */
+	if (retire)
+		statretire_run();
+
+	proc_exit(0);
+}
+
+void
+statworker_init(void)
+{
+	BackgroundWorker	worker;
+
+	DefineCustomBoolVariable(MODULE_NAME".worker",
+							"Build recommended extended statistics in background",
+							NULL,
+							&worker_enabled,
+							false,
+							PGC_SIGHUP,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable(MODULE_NAME".worker_naptime",
+							"Sleep time between background worker runs",
+							NULL,
+							&worker_naptime,
+							60,
+							1,
+							INT_MAX / 1000,
+							PGC_SIGHUP,
+							GUC_UNIT_S,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable(MODULE_NAME".worker_stats_limit",
+							"Maximum number of statistics built in a database per worker run",
+							NULL,
+							&worker_stats_limit,
+							5,
+							0,
+							INT_MAX,
+							PGC_SIGHUP,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable(MODULE_NAME".worker_min_calls",
+							"Minimum number of hits the candidate needs to be built",
+							NULL,
+							&worker_min_calls,
+							10,
+							1,
+							INT_MAX,
+							PGC_SIGHUP,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable(MODULE_NAME".worker_max_active_backends",
+							"Skip the worker run if there are more active client backends",
+							"-1 disables this check",
+							&worker_max_active_backends,
+							8,
+							-1,
+							INT_MAX,
+							PGC_SIGHUP,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable(MODULE_NAME".worker_max_replication_lag",
+							"Skip the worker run if a replica lags more",
+							"-1 disables this check",
+							&worker_max_replication_lag,
+							10000,
+							-1,
+							INT_MAX,
+							PGC_SIGHUP,
+							GUC_UNIT_MS,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomBoolVariable(MODULE_NAME".analyze_new_stats",
+							"Build data of automatically created statistics in background",
+							"Only columns, involved in extended statistics, are sampled",
+							&analyze_new_stats,
+							true,
+							PGC_SIGHUP,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable(MODULE_NAME".analyze_delay",
+							"Pause between fetching batches of sample rows",
+							"0 disables throttling",
+							&analyze_delay,
+							10,
+							0,
+							INT_MAX,
+							PGC_SIGHUP,
+							GUC_UNIT_MS,
+							NULL,
+							NULL,
+							NULL);
+
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = statworker_shmem_request;
+#else
+	RequestAddinShmemSpace(MAXALIGN(sizeof(StatWorkerState)));
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = statworker_shmem_startup;
+
+	memset(&worker, 0, sizeof(worker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	worker.bgw_restart_time = 60;
+	snprintf(worker.bgw_library_name, sizeof(worker.bgw_library_name),
+			 MODULE_NAME);
+	snprintf(worker.bgw_function_name, sizeof(worker.bgw_function_name),
+			 "pg_index_stats_launcher_main");
+	snprintf(worker.bgw_name, BGW_MAXLEN, MODULE_NAME" launcher");
+	snprintf(worker.bgw_type, BGW_MAXLEN, MODULE_NAME" launcher");
+	worker.bgw_main_arg = (Datum) 0;
+	worker.bgw_notify_pid = 0;
+	RegisterBackgroundWorker(&worker);
+}
@@ -0,0 +1,14 @@
+#ifndef _STATWORKER_H_
+#define _STATWORKER_H_
+
+#include "postgres.h"
+
+#include "fmgr.h"
+
+extern void statworker_init(void);
+extern void statworker_schedule_analyze(Oid relid);
+
+extern PGDLLEXPORT void pg_index_stats_launcher_main(Datum main_arg);
+extern PGDLLEXPORT void pg_index_stats_worker_main(Datum main_arg);
+
+#endif /* _STATWORKER_H_ */